@@ -92,6 +92,7 @@
 #include "globals.h"
 #include "route.h"
 #include "dprint.h"
+#include "log_ring.h"
 #include "cfg_pp.h"
 #include "sr_module.h"
 #include "modparam.h"
@@ -321,6 +322,8 @@ extern int cfg_parse_only_routes;
 %token SYSLOG_FORMAT
 %token LOG_JSON_BUF_SIZE
 %token LOG_MSG_BUF_SIZE
+%token LOG_ASYNC_BUF_SIZE
+%token LOG_ASYNC_FILE
 %token LOGFACILITY
 %token SYSLOG_FACILITY
 %token LOGNAME
@@ -342,10 +345,12 @@ extern int cfg_parse_only_routes;
 %token DNS_USE_SEARCH
 %token MAX_WHILE_LOOPS
 %token UDP_WORKERS
+%token UDP_WORKERS_CPU_AFFINITY
 %token CHECK_VIA
 %token SHM_HASH_SPLIT_PERCENTAGE
 %token SHM_SECONDARY_HASH_SIZE
 %token MEM_WARMING_ENABLED
+%token SHM_CACHE_SIZE
 %token MEM_WARMING_PATTERN_FILE
 %token MEM_WARMING_PERCENTAGE
 %token RPM_MEM_FILE
@@ -386,6 +391,7 @@ extern int cfg_parse_only_routes;
 %token TCP_KEEPINTERVAL
 %token TCP_MAX_MSG_TIME
 %token TCP_PARALLEL_READ_ON_WORKERS
+%token TCP_ACCEPT_ON_WORKERS
 %token ADVERTISED_ADDRESS
 %token ADVERTISED_PORT
 %token DISABLE_CORE
@@ -401,6 +407,7 @@ extern int cfg_parse_only_routes;
 %token DB_DEFAULT_URL
 %token DB_MAX_ASYNC_CONNECTIONS
 %token DISABLE_503_TRANSLATION
+%token MSG_SCATTER_BUILD
 %token SYNC_TOKEN
 %token ASYNC_TOKEN
 %token LAUNCH_TOKEN
@@ -1085,6 +1092,12 @@ assign_stm: LOGLEVEL EQUAL snumber { IFOR();
 			}
 			}
 		| LOG_MSG_BUF_SIZE EQUAL error { yyerror("number expected"); }
+		| LOG_ASYNC_BUF_SIZE EQUAL NUMBER { IFOR();
+			log_async_buf_size = $3;
+			}
+		| LOG_ASYNC_BUF_SIZE EQUAL error { yyerror("number expected"); }
+		| LOG_ASYNC_FILE EQUAL STRING { IFOR(); log_async_file = $3; }
+		| LOG_ASYNC_FILE EQUAL error { yyerror("string value expected"); }
 		| LOGFACILITY EQUAL ID { IFOR();
 			warn("'log_facility' is deprecated, use 'syslog_facility' instead");
 			if ( (i_tmp=str2facility($3))==-1)
@@ -1132,6 +1145,11 @@ assign_stm: LOGLEVEL EQUAL snumber { IFOR();
 				udp_auto_scaling_profile=$5;
 		}
 		| UDP_WORKERS EQUAL error { yyerror("number expected"); }
+		| UDP_WORKERS_CPU_AFFINITY EQUAL NUMBER { IFOR();
+				udp_workers_cpu_affinity=$3;
+		}
+		| UDP_WORKERS_CPU_AFFINITY EQUAL error {
+				yyerror("number expected"); }
 		| TIMER_WORKERS EQUAL NUMBER { IFOR();
 				timer_workers_no=$3;
 		}
@@ -1189,6 +1207,10 @@ assign_stm: LOGLEVEL EQUAL snumber { IFOR();
 				"for HP_MALLOC\n");
 			#endif
 			}
+		| SHM_CACHE_SIZE EQUAL NUMBER { IFOR();
+			shm_cache_size = $3;
+			}
+		| SHM_CACHE_SIZE EQUAL error { yyerror("number expected"); }
 		| MEM_WARMING_PATTERN_FILE EQUAL STRING { IFOR();
 			#ifdef HP_MALLOC
 			mem_warming_pattern_file = $3;
@@ -1365,6 +1387,12 @@ assign_stm: LOGLEVEL EQUAL snumber { IFOR();
 		| TCP_PARALLEL_READ_ON_WORKERS EQUAL error {
 			yyerror("boolean value expected");
 		}
+		| TCP_ACCEPT_ON_WORKERS EQUAL NUMBER { IFOR();
+				tcp_accept_on_workers=!!$3;
+		}
+		| TCP_ACCEPT_ON_WORKERS EQUAL error {
+			yyerror("boolean value expected");
+		}
 		| TCP_KEEPCOUNT EQUAL NUMBER 		{ IFOR();
 			#ifndef HAVE_TCP_KEEPCNT
 				warn("cannot be enabled TCP_KEEPCOUNT (no OS support)");
@@ -1626,6 +1654,11 @@ assign_stm: LOGLEVEL EQUAL snumber { IFOR();
 		| DISABLE_503_TRANSLATION EQUAL error {
 				yyerror("integer value expected");
 				}
+		| MSG_SCATTER_BUILD EQUAL NUMBER { IFOR();
+				msg_scatter_build=$3; }
+		| MSG_SCATTER_BUILD EQUAL error {
+				yyerror("integer value expected");
+				}
 		| AUTO_SCALING_PROFILE EQUAL auto_scale_profile_def {}
 		| AUTO_SCALING_PROFILE EQUAL error {
 				yyerror("bad auto-scaling profile definition");
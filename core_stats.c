@@ -41,6 +41,7 @@
 #include <signal.h>
 #include "socket_info.h"
 #include "ipc.h"
+#include "log_ring.h"
 
 
 #ifdef STATISTICS
@@ -60,24 +61,27 @@ stat_var* slow_msgs;
 
 
 const stat_export_t core_stats[] = {
-	{"rcv_requests" ,         0,  &rcv_reqs              },
-	{"rcv_replies" ,          0,  &rcv_rpls              },
-	{"fwd_requests" ,         0,  &fwd_reqs              },
-	{"fwd_replies" ,          0,  &fwd_rpls              },
-	{"drop_requests" ,        0,  &drp_reqs              },
-	{"drop_replies" ,         0,  &drp_rpls              },
-	{"err_requests" ,         0,  &err_reqs              },
-	{"err_replies" ,          0,  &err_rpls              },
-	{"bad_URIs_rcvd",         0,  &bad_URIs              },
-	{"bad_msg_hdr",           0,  &bad_msg_hdr           },
-	{"slow_messages" ,        0,  &slow_msgs             },
-	{"timestamp",  STAT_IS_FUNC, (stat_var**)get_ticks   },
+	{"rcv_requests" ,        STAT_SHARDED, &rcv_reqs             },
+	{"rcv_replies" ,         STAT_SHARDED, &rcv_rpls             },
+	{"fwd_requests" ,        STAT_SHARDED, &fwd_reqs             },
+	{"fwd_replies" ,         STAT_SHARDED, &fwd_rpls             },
+	{"drop_requests" ,       STAT_SHARDED, &drp_reqs             },
+	{"drop_replies" ,        STAT_SHARDED, &drp_rpls             },
+	{"err_requests" ,        STAT_SHARDED, &err_reqs             },
+	{"err_replies" ,         STAT_SHARDED, &err_rpls             },
+	{"bad_URIs_rcvd" ,       0,            &bad_URIs             },
+	{"bad_msg_hdr" ,         0,            &bad_msg_hdr          },
+	{"slow_messages" ,       0,            &slow_msgs            },
+	{"timestamp" ,           STAT_IS_FUNC, (stat_var**)get_ticks },
 	{0,0,0}
 };
 
 
 
 /*************************** NET statistics *********************************/
+stat_var* udp_rcv_batches;
+stat_var* udp_rcv_batch_dgrams;
+stat_var* udp_rcv_batch_full;
 
 static unsigned long net_get_wb_udp(unsigned short foo)
 {
@@ -98,6 +102,31 @@ const stat_export_t net_stats[] = {
 	{"waiting_udp" ,    STAT_IS_FUNC,  (stat_var**)net_get_wb_udp    },
 	{"waiting_tcp" ,    STAT_IS_FUNC,  (stat_var**)net_get_wb_tcp    },
 	{"waiting_tls" ,    STAT_IS_FUNC,  (stat_var**)net_get_wb_tls    },
+	{"udp_rcv_batches" ,        0,     &udp_rcv_batches              },
+	{"udp_rcv_batch_dgrams" ,   0,     &udp_rcv_batch_dgrams         },
+	{"udp_rcv_batch_full" ,     0,     &udp_rcv_batch_full           },
+	{0,0,0}
+};
+
+
+
+/*************************** LOG statistics *********************************/
+stat_var* log_async_dropped[LOG_RING_LEVELS];
+
+static unsigned long log_get_async_buf_used(unsigned short foo)
+{
+	return log_ring_used();
+}
+
+const stat_export_t log_stats[] = {
+	{"async_dropped_alert" ,    0,     &log_async_dropped[0]         },
+	{"async_dropped_crit" ,     0,     &log_async_dropped[1]         },
+	{"async_dropped_err" ,      0,     &log_async_dropped[2]         },
+	{"async_dropped_warn" ,     0,     &log_async_dropped[3]         },
+	{"async_dropped_notice" ,   0,     &log_async_dropped[4]         },
+	{"async_dropped_info" ,     0,     &log_async_dropped[5]         },
+	{"async_dropped_dbg" ,      0,     &log_async_dropped[6]         },
+	{"async_buf_used" ,  STAT_IS_FUNC, (stat_var**)log_get_async_buf_used},
 	{0,0,0}
 };
 
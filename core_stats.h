@@ -36,10 +36,12 @@
 
 #include "mem/mem.h"
 #include "statistics.h"
+#include "log_ring.h"
 
 #ifdef STATISTICS
 extern stat_export_t core_stats[];
 extern stat_export_t net_stats[];
+extern stat_export_t log_stats[];
 
 /*! \brief received requests */
 extern stat_var* rcv_reqs;
@@ -74,6 +76,18 @@ extern stat_var* bad_msg_hdr;
 /*! \brief SIP message processing which exceeded 'threshold' duration */
 extern stat_var* slow_msgs;
 
+/*! \brief UDP batched reads (recvmmsg calls returning data) */
+extern stat_var* udp_rcv_batches;
+
+/*! \brief datagrams received via batched reads */
+extern stat_var* udp_rcv_batch_dgrams;
+
+/*! \brief batched reads which filled up the whole batch */
+extern stat_var* udp_rcv_batch_full;
+
+/*! \brief log lines dropped on a full async logging ring, per level */
+extern stat_var* log_async_dropped[LOG_RING_LEVELS];
+
 #ifdef PKG_MALLOC
 int init_pkg_stats(int no_procs);
 #endif
@@ -27,6 +27,7 @@
 
 #include "dprint.h"
 #include "log_interface.h"
+#include "log_ring.h"
 #include "globals.h"
 #include "pt.h"
 
@@ -455,6 +456,21 @@ static int log_print_json(str *buf, enum log_json_format json_fmt, char *time,
 	return len;
 }
 
+/* formats a plain text line, to be queued in the async logging ring */
+static inline int log_vsnprintf(char *buf, int size, char *format, va_list ap)
+{
+	int len;
+
+	len = vsnprintf(buf, size, format, ap);
+	if (len >= size) {
+		/* keep the line terminated, as the writer does not add it */
+		len = size;
+		buf[len - 1] = '\n';
+	}
+
+	return len;
+}
+
 static void stderr_dprint(int log_level, int facility, const char *module, const char *func,
 	char *format, va_list ap)
 {
@@ -479,8 +495,18 @@ static void stderr_dprint(int log_level, int facility, const char *module, const
 			return;
 		}
 
+		if (log_ring_on()) {
+			log_json_buf[len] = '\n';
+			log_ring_push(LOG_RING_STDERR, 0, log_level, log_json_buf, len + 1);
+			return;
+		}
+
 		fprintf(stderr, "%.*s\n", len, log_json_buf);
 		fflush(stderr);
+	} else if (log_ring_on()) {
+		len = log_vsnprintf(log_msg_buf, log_msg_buf_size, format, ap);
+		if (len > 0)
+			log_ring_push(LOG_RING_STDERR, 0, log_level, log_msg_buf, len);
 	} else {
 		vfprintf(stderr,format,ap);
 		fflush(stderr);
@@ -536,12 +562,27 @@ static void syslog_dprint(int log_level, int facility, const char *module, const
 			return;
 		}
 
+		if (log_ring_on()) {
+			log_json_buf[len] = '\n';
+			log_ring_push(LOG_RING_SYSLOG, level|facility, log_level,
+				log_json_buf, len + 1);
+			return;
+		}
+
 		syslog(level|facility, "%.*s\n", len, log_json_buf);
 	} else {
 		/* skip the time and pid arguments from va_list */
 		va_arg(ap, char *);
 	    va_arg(ap, int);
 
+		if (log_ring_on()) {
+			len = log_vsnprintf(log_msg_buf, log_msg_buf_size, format, ap);
+			if (len > 0)
+				log_ring_push(LOG_RING_SYSLOG, level|facility, log_level,
+					log_msg_buf, len);
+			return;
+		}
+
 		vsyslog(level|facility, format, ap);
 	}
 }
@@ -47,6 +47,8 @@
  *      otherwise the core's ./test/ suite)
  *   - print the unit test summary
  *   - exit with 0 on success, non-zero otherwise
+ *
+ * "-T script:<file>" benchmarks the -f script instead (see test/script_bench.h)
  */
 int testing_framework;
 char *testing_module = "core";
@@ -61,6 +63,8 @@ unsigned int maxbuffer = MAX_RECV_BUFFER_SIZE; /* maximum buffer size we do
 int udp_workers_no = UDP_WORKERS_NO;
 /* the global UDP auto scaling profile */
 char *udp_auto_scaling_profile = NULL;
+/* pin each UDP worker to a CPU */
+int udp_workers_cpu_affinity = 0;
 /* if the auto-scaling engine is enabled or not - this is autodetected */
 int auto_scaling_enabled = 0;
 /* auto-scaling sampling and checking time cycle is 1 sec by default */
@@ -51,6 +51,7 @@ extern int auto_aliases;
 extern unsigned int maxbuffer;
 extern int udp_workers_no;
 extern char *udp_auto_scaling_profile;
+extern int udp_workers_cpu_affinity;
 extern enum poll_types io_poll_method;
 extern int auto_scaling_enabled;
 extern int auto_scaling_cycle;
@@ -74,6 +75,7 @@ extern int tcp_no_new_conn;
 extern int tcp_no_new_conn_bflag;
 extern int tcp_no_new_conn_rplflag;
 extern int tcp_parallel_read_on_workers;
+extern int tcp_accept_on_workers;
 extern struct tcp_conn_profile tcp_con_df_profile;
 
 extern int no_daemon_mode;
@@ -151,6 +153,7 @@ extern char *db_default_url;
 extern int db_max_async_connections;
 
 extern int disable_503_translation;
+extern int msg_scatter_build;
 
 extern int enable_asserts;
 extern int abort_on_assert;
@@ -112,6 +112,9 @@ Options:\n\
     -A address   Set the globally advertised addres\n"
 #ifdef UNIT_TESTS
 "    -T           Fork, run unit tests and exit.\n"
+"    -T script:file[:loops]\n"
+"                 Fork, replay the SIP messages of the file through the\n"
+"                  script, report the time per message and exit.\n"
 #endif
 ;
 
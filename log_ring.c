@@ -0,0 +1,444 @@
+/*
+ * Asynchronous logging via a shared memory ring buffer
+ *
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef __OS_linux
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "dprint.h"
+#include "globals.h"
+#include "pt.h"
+#include "daemonize.h"
+#include "core_stats.h"
+#include "mem/mem.h"
+#include "mem/shm_mem.h"
+#include "log_ring.h"
+
+/* all the records (and thus the pads) are multiple of this */
+#define LOG_RING_ALIGN    32
+#define LOG_RING_MIN_SIZE (64 * 1024)
+/* writer's sleep when the ring is empty - woken up earlier by the producers,
+ * where futexes are available */
+#define LOG_RING_IDLE_MS  100
+/* how often the log file is checked for being rotated */
+#define LOG_RING_REOPEN_MS 1000
+/* how much stderr output is gathered in a single write */
+#define LOG_RING_BATCH    (64 * 1024)
+
+struct log_rec {
+	/* set, once the record is complete, to its position in the ring + 1;
+	 * a late producer, whose record was skipped meanwhile, can never make
+	 * a later record at the same offset look ready */
+	volatile unsigned long seq;
+	unsigned int size;   /* of the whole record, header included */
+	int len;             /* of the text */
+	short dest;
+	short level;
+	int prio;            /* syslog priority */
+	char text[0];
+};
+
+#define log_rec_size(_len) \
+	((sizeof(struct log_rec) + (_len) + LOG_RING_ALIGN - 1) & \
+		~((unsigned long)LOG_RING_ALIGN - 1))
+
+int log_async_buf_size = 0;
+char *log_async_file = NULL;
+
+struct log_ring *log_ring;
+int log_ring_writer;
+
+/* where the stderr records go, in the draining process */
+static int log_ring_fd = -1;
+static struct stat log_ring_fd_st;
+
+
+static inline long log_ring_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+
+static inline void log_ring_drop(int level)
+{
+#ifdef STATISTICS
+	stat_var *s = log_async_dropped[log_ring_level_idx(level)];
+
+	if (s)
+		update_stat(s, 1);
+#endif
+}
+
+
+int init_log_ring(void)
+{
+	unsigned long size;
+
+	if (log_async_buf_size <= 0 || config_check)
+		return 0;
+
+	for (size = LOG_RING_MIN_SIZE; size < log_async_buf_size; size <<= 1) ;
+
+	log_ring = shm_malloc(sizeof *log_ring + size);
+	if (!log_ring) {
+		LM_ERR("no more shm memory for a %lu bytes log buffer\n", size);
+		return -1;
+	}
+	memset(log_ring, 0, sizeof *log_ring + size);
+
+	log_ring->size = size;
+	log_ring->buf = (char *)(log_ring + 1);
+
+	/* the plain text lines get formatted here, before being queued */
+	if (init_log_msg_buf(0) < 0) {
+		shm_free(log_ring);
+		log_ring = NULL;
+		return -1;
+	}
+
+	LM_DBG("using a %lu bytes ring buffer for async logging\n", size);
+	return 0;
+}
+
+
+int log_ring_count_processes(void)
+{
+	return (log_async_buf_size > 0 && !config_check) ? 1 : 0;
+}
+
+
+int log_ring_push(int dest, int prio, int level, const char *s, int len)
+{
+	unsigned long head, pos, pad, need;
+	struct log_rec *rec;
+
+	need = log_rec_size(len);
+	if (need > log_ring->size) {
+		log_ring_drop(level);
+		return -1;
+	}
+
+	do {
+		head = log_ring->head;
+		pos = head & (log_ring->size - 1);
+
+		/* a record never wraps - the end of the ring is padded instead */
+		pad = (pos + need > log_ring->size) ? log_ring->size - pos : 0;
+
+		if (head + pad + need - log_ring->tail > log_ring->size) {
+			log_ring_drop(level);
+			return -1;
+		}
+	} while (__sync_val_compare_and_swap(&log_ring->head, head,
+		head + pad + need) != head);
+
+	if (pad) {
+		rec = (struct log_rec *)(log_ring->buf + pos);
+		rec->size = pad;
+		rec->dest = LOG_RING_PAD;
+		__sync_synchronize();
+		rec->seq = head + 1;
+		pos = 0;
+	}
+
+	rec = (struct log_rec *)(log_ring->buf + pos);
+	rec->size = need;
+	rec->level = level;
+	rec->dest = dest;
+	rec->prio = prio;
+	rec->len = len;
+	memcpy(rec->text, s, len);
+
+	/* publish the record only once it is complete */
+	__sync_synchronize();
+	rec->seq = head + pad + 1;
+
+	/* the writer went to sleep - paired with the barrier in
+	 * log_ring_wait() */
+	__sync_synchronize();
+	if (log_ring->sleeping &&
+	        __sync_bool_compare_and_swap(&log_ring->sleeping, 1, 0)) {
+#ifdef __OS_linux
+		syscall(SYS_futex, &log_ring->sleeping, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+	}
+
+	return 0;
+}
+
+
+unsigned long log_ring_used(void)
+{
+	return log_ring ? log_ring->head - log_ring->tail : 0;
+}
+
+
+/* the file is reopened once moved away (e.g. rotated), as checked at most
+ * every LOG_RING_REOPEN_MS */
+static int log_ring_open_file(void)
+{
+	static long last_check;
+	struct stat st;
+	long now;
+	int fd;
+
+	if (!log_async_file)
+		return log_ring_fd < 0 ? (log_ring_fd = STDERR_FILENO) : 0;
+
+	now = log_ring_now_ms();
+	if (log_ring_fd >= 0 && now - last_check < LOG_RING_REOPEN_MS)
+		return 0;
+	last_check = now;
+
+	if (log_ring_fd >= 0 && stat(log_async_file, &st) == 0 &&
+	        st.st_ino == log_ring_fd_st.st_ino &&
+	        st.st_dev == log_ring_fd_st.st_dev)
+		return 0;
+
+	fd = open(log_async_file, O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0640);
+	if (fd < 0 || fstat(fd, &log_ring_fd_st) < 0) {
+		if (fd >= 0)
+			close(fd);
+		/* keep writing to the old one, if any */
+		if (log_ring_fd < 0)
+			log_ring_fd = STDERR_FILENO;
+		return -1;
+	}
+
+	if (log_ring_fd >= 0 && log_ring_fd != STDERR_FILENO)
+		close(log_ring_fd);
+	log_ring_fd = fd;
+
+	return 0;
+}
+
+
+static void log_ring_write(const char *s, int len)
+{
+	int n;
+
+	while (len > 0) {
+		n = write(log_ring_fd, s, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		s += n;
+		len -= n;
+	}
+}
+
+
+static inline void log_ring_flush_stderr(char *batch, int *len)
+{
+	if (*len == 0)
+		return;
+
+	log_ring_write(batch, *len);
+	*len = 0;
+}
+
+
+/* any offset may be a record header again, on the next turn */
+static inline void log_ring_clear(unsigned long tail, unsigned long size)
+{
+	unsigned long pos = tail & (log_ring->size - 1);
+
+	if (pos + size > log_ring->size) {
+		memset(log_ring->buf, 0, pos + size - log_ring->size);
+		size = log_ring->size - pos;
+	}
+	memset(log_ring->buf + pos, 0, size);
+}
+
+
+/* the record at @tail is still incomplete - its producer died or got
+ * stuck while writing it, if so for more than LOG_RING_STUCK_MS */
+static int log_ring_stuck(unsigned long tail)
+{
+	static unsigned long stuck_seq;
+	static long stuck_since;
+	long now = log_ring_now_ms();
+
+	if (stuck_seq != tail + 1) {
+		stuck_seq = tail + 1;
+		stuck_since = now;
+		return 0;
+	}
+
+	return now - stuck_since >= LOG_RING_STUCK_MS;
+}
+
+
+int log_ring_drain(int abandon)
+{
+	static char batch[LOG_RING_BATCH];
+	struct log_rec *rec;
+	unsigned long head, tail, size;
+	int n = 0, blen = 0;
+
+	log_ring_open_file();
+
+	for (tail = log_ring->tail; tail != (head = log_ring->head); tail += size) {
+		rec = (struct log_rec *)(log_ring->buf + (tail & (log_ring->size - 1)));
+
+		if (rec->seq != tail + 1) {
+			if (!abandon && !log_ring_stuck(tail))
+				break;
+
+			/* skipped; if not even sized, along with all the records
+			 * reserved after it (accounted as one line, of unknown level) */
+			size = rec->size;
+			if (!size || size & (LOG_RING_ALIGN - 1) || size > head - tail) {
+				size = head - tail;
+				log_ring_drop(L_DBG);
+			} else if (rec->dest != LOG_RING_PAD) {
+				log_ring_drop(rec->level);
+			}
+
+			log_ring_clear(tail, size);
+			__sync_synchronize();
+			log_ring->tail = tail + size;
+			n++;
+			continue;
+		} else if (rec->dest == LOG_RING_STDERR) {
+			if (blen + rec->len > LOG_RING_BATCH)
+				log_ring_flush_stderr(batch, &blen);
+			if (rec->len > LOG_RING_BATCH) {
+				log_ring_write(rec->text, rec->len);
+			} else {
+				memcpy(batch + blen, rec->text, rec->len);
+				blen += rec->len;
+			}
+		} else if (rec->dest == LOG_RING_SYSLOG) {
+			syslog(rec->prio, "%.*s", rec->len, rec->text);
+		}
+
+		size = rec->size;
+		log_ring_clear(tail, size);
+		__sync_synchronize();
+		log_ring->tail = tail + size;
+		n++;
+	}
+
+	log_ring_flush_stderr(batch, &blen);
+
+	return n;
+}
+
+
+/* sleeps until a record is published or for at most LOG_RING_IDLE_MS, so
+ * that a stuck record or a moved log file are still noticed */
+static void log_ring_wait(void)
+{
+	struct log_rec *rec;
+	unsigned long tail;
+#ifdef __OS_linux
+	struct timespec ts = {0, LOG_RING_IDLE_MS * 1000000L};
+#endif
+
+	log_ring->sleeping = 1;
+	__sync_synchronize();
+
+	/* a record published meanwhile, while the flag was still unset */
+	tail = log_ring->tail;
+	rec = (struct log_rec *)(log_ring->buf + (tail & (log_ring->size - 1)));
+	if (tail == log_ring->head || rec->seq != tail + 1) {
+#ifdef __OS_linux
+		syscall(SYS_futex, &log_ring->sleeping, FUTEX_WAIT, 1, &ts, NULL, 0);
+#else
+		usleep(LOG_RING_IDLE_MS * 1000);
+#endif
+	}
+
+	log_ring->sleeping = 0;
+}
+
+
+static void run_log_writer(void)
+{
+	for (;;) {
+		if (log_ring_drain(0) == 0)
+			log_ring_wait();
+	}
+}
+
+
+int start_log_writer(void)
+{
+	const struct internal_fork_params ifp_lw = {
+		.proc_desc = "log writer",
+		.flags = OSS_PROC_NO_IPC|OSS_PROC_NO_LOAD,
+		.type = TYPE_NONE,
+	};
+	int id;
+
+	if (!log_ring)
+		return 0;
+
+	if ((id = internal_fork(&ifp_lw)) < 0) {
+		LM_CRIT("cannot fork the log writer process\n");
+		return -1;
+	} else if (id == 0) {
+		/* new process */
+		clean_write_pipeend();
+
+		log_ring_writer = 1;
+		run_log_writer();
+		exit(-1);
+	}
+
+	log_ring->active = 1;
+
+	return 0;
+}
+
+
+void destroy_log_ring(void)
+{
+	if (!log_ring)
+		return;
+
+	log_ring->active = 0;
+	/* all the producers are gone by now */
+	log_ring_drain(1);
+
+	if (log_ring_fd >= 0 && log_ring_fd != STDERR_FILENO)
+		close(log_ring_fd);
+	log_ring_fd = -1;
+
+	shm_free(log_ring);
+	log_ring = NULL;
+}
@@ -0,0 +1,118 @@
+/*
+ * Asynchronous logging via a shared memory ring buffer
+ *
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * When enabled (the "log_async_buf_size" core parameter), the stderror and
+ * syslog consumers no longer write from the logging process: the formatted
+ * (plain text or JSON) line is copied into a shm ring buffer and the call
+ * returns. A dedicated "log writer" process drains the ring, in batches, to
+ * the standard error and to syslog.
+ *
+ * The ring is a multi-producer, single-consumer byte queue, with no locks:
+ * the producers reserve their records by advancing the head with a CAS,
+ * then copy the line and mark the record as ready. The writer consumes the
+ * ready records, in reservation order, zeroes them and advances the tail.
+ * When the ring is full, the line is dropped (never blocking the worker)
+ * and accounted in the "log:async_dropped_*" per-level statistics.
+ *
+ * The writer sleeps on a futex while the ring is empty, woken up by the
+ * producers. A record reserved, but still not complete after
+ * LOG_RING_STUCK_MS (its producer died or got stuck), is skipped as
+ * dropped, so it cannot block the ones after it. If "log_async_file" is
+ * set, the stderr lines are appended to this file instead.
+ */
+
+#ifndef _LOG_RING_H
+#define _LOG_RING_H
+
+#include "dprint.h"
+
+/* destination of a record */
+#define LOG_RING_STDERR  1
+#define LOG_RING_SYSLOG  2
+#define LOG_RING_PAD     3
+
+/* number of distinct levels, for the drop statistics (L_ALERT .. L_DBG) */
+#define LOG_RING_LEVELS  7
+
+/* how long an incomplete record may block the ones after it */
+#define LOG_RING_STUCK_MS  1000
+
+struct log_ring {
+	volatile unsigned long head;  /* next byte to be reserved */
+	char _pad0[64 - sizeof(unsigned long)];
+	volatile unsigned long tail;  /* next byte to be consumed */
+	char _pad1[64 - sizeof(unsigned long)];
+	volatile int active;          /* set once the writer is running */
+	volatile int sleeping;        /* the writer waits for records (futex) */
+	unsigned long size;           /* power of 2 */
+	char *buf;
+};
+
+/* size of the shm ring, 0 if disabled */
+extern int log_async_buf_size;
+/* file to write the stderr lines to, instead of the standard error */
+extern char *log_async_file;
+
+extern struct log_ring *log_ring;
+/* set in the log writer process, which must write directly */
+extern int log_ring_writer;
+
+#define log_ring_on() \
+	(log_ring && log_ring->active && !log_ring_writer)
+
+/* allocates the ring; to be called after the config file was parsed */
+int init_log_ring(void);
+
+/* number of processes needed by the async logging (0 or 1) */
+int log_ring_count_processes(void);
+
+/* forks the log writer process and routes the logs through the ring */
+int start_log_writer(void);
+
+/* to be called by the attendant, once all the other processes exited:
+ * writes the leftovers and switches back to the direct logging */
+void destroy_log_ring(void);
+
+/* queues an already formatted line; returns 0 on success, -1 if dropped */
+int log_ring_push(int dest, int prio, int level, const char *s, int len);
+
+/* writes all the ready records, in order, skipping the ones stuck for too
+ * long - or all the incomplete ones, if @abandon is set (no producers are
+ * left); returns the number of consumed records */
+int log_ring_drain(int abandon);
+
+/* bytes currently queued in the ring */
+unsigned long log_ring_used(void);
+
+static inline int log_ring_level_idx(int level)
+{
+	if (level < L_ALERT)
+		return 0;
+	if (level > L_DBG)
+		return LOG_RING_LEVELS - 1;
+
+	/* L_ALERT..L_ERR are -3..-1, L_WARN..L_DBG are 1..4 */
+	return level < 0 ? level - L_ALERT : level + 2;
+}
+
+#endif
@@ -133,6 +133,7 @@
 #include "statistics.h"
 #include "status_report.h"
 #include "core_stats.h"
+#include "log_ring.h"
 #include "pvar.h"
 #include "signals.h"
 #include "shutdown.h"
@@ -147,6 +148,7 @@
 #include "net/trans.h"
 
 #include "test/unit_tests.h"
+#include "test/script_bench.h"
 #include "lib/dbg/profiling.h"
 
 #include "ssl_tweaks.h"
@@ -260,6 +262,12 @@ static int main_loop(void)
 	chd_rank=0;
 	register_fork_handler(&profiling_handler);
 
+	/* first of all, so all the other processes get to log through it */
+	if (start_log_writer()!=0) {
+		LM_CRIT("cannot start the log writer process\n");
+		goto error;
+	}
+
 	if (start_module_procs()!=0) {
 		LM_ERR("failed to fork module processes\n");
 		goto error;
@@ -628,7 +636,11 @@ int main(int argc, char** argv)
 					LM_INFO("running in testing framework mode, for '%s'\n", optarg);
 					testing_framework = 1;
 					testing_module = optarg;
-					if (strcmp(testing_module, "core")) {
+					if (!strncmp(optarg, "script:", 7)) {
+						/* the -f script is benchmarked, over the messages */
+						testing_module = "script";
+						script_bench_file = optarg + 7;
+					} else if (strcmp(testing_module, "core")) {
 						cfg_file = malloc(100);
 						snprintf(cfg_file, 100, "modules/%s/test/opensips.cfg",
 						         testing_module);
@@ -724,6 +736,11 @@ try_again:
 		goto error;
 	}
 
+	if (init_log_ring() < 0) {
+		LM_ERR("Failed to initialize the async logging buffer\n");
+		goto error;
+	}
+
 	if (config_check>1 && check_rls()!=0) {
 		LM_ERR("bad function call in config file\n");
 		return ret;
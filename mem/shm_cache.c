@@ -0,0 +1,241 @@
+/*
+ * Per-process cache of shared memory blocks
+ *
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "shm_mem.h"
+#include "shm_cache.h"
+
+int shm_cache_size = 0;
+__thread int shm_cache_enabled = 0;
+
+struct shm_magazine shm_magazines[SHM_CACHE_CLASSES];
+
+#ifdef STATISTICS
+stat_var *shm_cached_size;
+#define shm_cache_update_stat(_n) \
+	do { \
+		if (shm_cached_size) \
+			update_stat(shm_cached_size, (_n)); \
+	} while (0)
+#else
+#define shm_cache_update_stat(_n) do { (void)(_n); } while (0)
+#endif
+
+#ifdef DBG_MALLOC
+#define SHM_CACHE_MALLOC(_size) \
+	SHM_MALLOC(shm_block, (_size), __FILE__, __FUNCTION__, __LINE__)
+#define SHM_CACHE_FREE(_p) \
+	SHM_FREE(shm_block, (_p), __FILE__, __FUNCTION__, __LINE__)
+#else
+#define SHM_CACHE_MALLOC(_size) SHM_MALLOC(shm_block, (_size))
+#define SHM_CACHE_FREE(_p)      SHM_FREE(shm_block, (_p))
+#endif
+
+
+static void shm_cache_exit(void)
+{
+	shm_cache_flush_all();
+	/* the frees of the other exit handlers go straight to the allocator */
+	shm_cache_enabled = 0;
+}
+
+
+void shm_cache_init(void)
+{
+	static int atfork_registered, atexit_registered;
+
+	if (shm_cache_size <= 0)
+		return;
+
+	/* HP_MALLOC already spreads its locking over the size buckets */
+#if defined INLINE_ALLOC && defined HP_MALLOC
+	LM_INFO("shm cache disabled, as the HP_MALLOC allocator is used\n");
+	return;
+#elif defined HP_MALLOC
+	if (mem_allocator_shm == MM_HP_MALLOC ||
+	        mem_allocator_shm == MM_HP_MALLOC_DBG) {
+		LM_INFO("shm cache disabled, as the %s allocator is used\n",
+		        mm_str(mem_allocator_shm));
+		return;
+	}
+#endif
+
+#if defined DBG_MALLOC && !defined INLINE_ALLOC
+	if (mem_allocator_shm == MM_F_MALLOC_DBG ||
+	        mem_allocator_shm == MM_Q_MALLOC_DBG) {
+		LM_INFO("shm cache disabled, as the %s allocator is used\n",
+		        mm_str(mem_allocator_shm));
+		return;
+	}
+#endif
+
+	if (shm_cache_size < 2) {
+		shm_cache_size = 2;
+	} else if (shm_cache_size > SHM_CACHE_MAX_BLOCKS) {
+		LM_WARN("shm_cache_size too big, capping it to %d\n",
+		        SHM_CACHE_MAX_BLOCKS);
+		shm_cache_size = SHM_CACHE_MAX_BLOCKS;
+	}
+
+	/* whoever forks - not only internal_fork() - the child must not
+	 * hand out the blocks cached by its parent */
+	if (!atfork_registered) {
+		if (pthread_atfork(NULL, NULL, shm_cache_reset_child) != 0) {
+			LM_ERR("failed to register the fork handler, shm cache "
+			       "disabled\n");
+			return;
+		}
+		atfork_registered = 1;
+	}
+
+	/* inherited by the children, so each of them flushes its own cache */
+	if (!atexit_registered) {
+		if (atexit(shm_cache_exit) != 0) {
+			LM_ERR("failed to register the exit handler, shm cache "
+			       "disabled\n");
+			return;
+		}
+		atexit_registered = 1;
+	}
+
+	memset(shm_magazines, 0, sizeof shm_magazines);
+	shm_cache_enabled = 1;
+
+	LM_DBG("caching up to %d shm blocks of %lu-%lu bytes per process\n",
+	       shm_cache_size, SHM_CACHE_MIN_SIZE, SHM_CACHE_MAX_SIZE);
+}
+
+
+void shm_cache_reset_child(void)
+{
+	int c;
+
+	/* the inherited blocks are still owned (and cached) by the parent */
+	for (c = 0; c < SHM_CACHE_CLASSES; c++)
+		shm_magazines[c].count = 0;
+}
+
+
+/* gives back the blocks of the other magazines, hoping to make room for
+ * a refill; must be called under the global memory lock */
+static unsigned long shm_cache_drain_unsafe(int skip)
+{
+	unsigned long freed = 0;
+	struct shm_magazine *mag;
+	int c;
+
+	for (c = 0; c < SHM_CACHE_CLASSES; c++) {
+		if (c == skip)
+			continue;
+
+		mag = &shm_magazines[c];
+		while (mag->count) {
+			freed += shm_frag_size(mag->blocks[--mag->count]);
+			SHM_CACHE_FREE(mag->blocks[mag->count]);
+		}
+	}
+
+	return freed;
+}
+
+
+int shm_cache_refill(int c)
+{
+	struct shm_magazine *mag = &shm_magazines[c];
+	unsigned long size = shm_cache_class_size(c);
+	long cached = 0;
+	int batch, drained = 0;
+	void *p;
+
+	batch = shm_cache_size / 2;
+
+	shm_lock();
+
+	while (mag->count < batch) {
+		p = SHM_CACHE_MALLOC(size);
+		if (!p && mag->count == 0 && !drained) {
+			/* not even a single block - our own cache may be the culprit */
+			cached -= shm_cache_drain_unsafe(c);
+			drained = 1;
+			p = SHM_CACHE_MALLOC(size);
+		}
+		if (!p)
+			break;
+
+		mag->blocks[mag->count++] = p;
+		cached += shm_frag_size(p);
+	}
+
+	shm_threshold_check();
+
+	shm_unlock();
+
+	shm_cache_update_stat(cached);
+
+	return mag->count;
+}
+
+
+void shm_cache_flush(int c)
+{
+	struct shm_magazine *mag = &shm_magazines[c];
+	unsigned long freed = 0;
+	unsigned int keep;
+
+	keep = mag->count / 2;
+
+	shm_lock();
+
+	while (mag->count > keep) {
+		freed += shm_frag_size(mag->blocks[--mag->count]);
+		SHM_CACHE_FREE(mag->blocks[mag->count]);
+	}
+
+	shm_threshold_check();
+
+	shm_unlock();
+
+	shm_cache_update_stat(-(long)freed);
+}
+
+
+void shm_cache_flush_all(void)
+{
+	unsigned long freed;
+
+	if (!shm_cache_enabled)
+		return;
+
+	shm_lock();
+	freed = shm_cache_drain_unsafe(-1);
+	shm_unlock();
+
+	shm_cache_update_stat(-(long)freed);
+}
+
+
+void shm_cache_destroy(void)
+{
+	shm_cache_enabled = 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * Per-process cache of shared memory blocks
+ *
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Each process keeps a "magazine" of free blocks for every size class
+ * (powers of two, from SHM_CACHE_MIN_SIZE up to SHM_CACHE_MAX_SIZE), in
+ * front of the global shm allocator. A shm_malloc() served from the
+ * magazine does not touch the global memory lock at all. Empty magazines
+ * are refilled and full ones are flushed by half, with a single acquire of
+ * the global lock for the whole batch.
+ *
+ * The cached blocks are regular fragments, still allocated from the point
+ * of view of the global allocator, so a block may be freed by any process:
+ * it simply lands in the magazine of the freeing process, sorted by its
+ * real fragment size.
+ *
+ * The magazines of a forked child are emptied by a pthread_atfork() handler,
+ * so it applies to any fork(), not only to the internal_fork() ones. The
+ * blocks are given back by an atexit() handler, so on any exit() of a
+ * process; a process leaving through _exit() should call
+ * shm_cache_flush_all() first, or they stay allocated.
+ *
+ * The magazines are not locked, so the cache is only used by the thread
+ * which initialized it (and by the processes it forks), never by the other
+ * threads of the process (async logging, module threads).
+ *
+ * The cache is turned off with the *_DBG allocators, so the fragments keep
+ * the exact allocation/free locations used by the memory debugging dumps,
+ * and with HP_MALLOC, which has its own per-bucket locking.
+ */
+
+#ifndef shm_cache_h
+#define shm_cache_h
+
+#define SHM_CACHE_MIN_SHIFT   5
+#define SHM_CACHE_CLASSES     8
+#define SHM_CACHE_MIN_SIZE    (1UL << SHM_CACHE_MIN_SHIFT)
+#define SHM_CACHE_MAX_SIZE    (SHM_CACHE_MIN_SIZE << (SHM_CACHE_CLASSES-1))
+/* upper limit for the "shm_cache_size" core parameter */
+#define SHM_CACHE_MAX_BLOCKS  256
+
+#define shm_cache_class_size(_c) (SHM_CACHE_MIN_SIZE << (_c))
+
+struct shm_magazine {
+	unsigned int count;
+	void *blocks[SHM_CACHE_MAX_BLOCKS];
+};
+
+/* blocks per size class, per process; 0 disables the cache */
+extern int shm_cache_size;
+/* set at startup, once the shm allocator is known; per thread, so it is
+ * only set in the thread calling shm_cache_init() */
+extern __thread int shm_cache_enabled;
+
+extern struct shm_magazine shm_magazines[SHM_CACHE_CLASSES];
+
+#ifdef STATISTICS
+extern stat_var *shm_cached_size;
+#endif
+
+/* enables the cache, if configured; to be called after the config file was
+ * parsed and the statistics were registered */
+void shm_cache_init(void);
+
+/* drops (without freeing) the blocks inherited from the parent process;
+ * runs in any child process, right after fork */
+void shm_cache_reset_child(void);
+
+/* returns the blocks of all the magazines to the global allocator */
+void shm_cache_flush_all(void);
+
+/* turns the cache off for good, without giving back the blocks; to be
+ * called when the shm pool is destroyed */
+void shm_cache_destroy(void);
+
+/* both must be called without holding the global memory lock */
+int shm_cache_refill(int c);
+void shm_cache_flush(int c);
+
+
+/* class to allocate from: the smallest one fitting "size" */
+static inline int shm_cache_alloc_class(unsigned long size)
+{
+	if (size <= SHM_CACHE_MIN_SIZE)
+		return 0;
+
+	return (int)(sizeof(long)*8 - __builtin_clzl(size - 1)) - SHM_CACHE_MIN_SHIFT;
+}
+
+/* class to cache into: the largest one the fragment may serve */
+static inline int shm_cache_free_class(unsigned long size)
+{
+	return (int)(sizeof(long)*8 - 1 - __builtin_clzl(size)) - SHM_CACHE_MIN_SHIFT;
+}
+
+/* returns a cached block fitting "size" or NULL if the caller must go
+ * through the global allocator */
+static inline void *shm_cache_get(unsigned long size)
+{
+	struct shm_magazine *mag;
+	int c;
+
+	if (!shm_cache_enabled || size > SHM_CACHE_MAX_SIZE)
+		return NULL;
+
+	c = shm_cache_alloc_class(size);
+	mag = &shm_magazines[c];
+
+	if (mag->count == 0 && shm_cache_refill(c) == 0)
+		return NULL;
+
+	return mag->blocks[--mag->count];
+}
+
+/* returns 0 if the block was cached, -1 if the caller must free it */
+static inline int shm_cache_put(void *p)
+{
+	struct shm_magazine *mag;
+	unsigned long size;
+
+	if (!shm_cache_enabled || !p)
+		return -1;
+
+	size = shm_frag_size(p);
+	/* do not keep the large fragments around, they would be wasted when
+	 * reused for the upper class */
+	if (size < SHM_CACHE_MIN_SIZE || size >= 2 * SHM_CACHE_MAX_SIZE)
+		return -1;
+
+	mag = &shm_magazines[shm_cache_free_class(size)];
+
+	if (mag->count == shm_cache_size)
+		shm_cache_flush(mag - shm_magazines);
+
+	mag->blocks[mag->count++] = p;
+
+	return 0;
+}
+
+#endif
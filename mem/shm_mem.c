@@ -87,6 +87,7 @@ stat_export_t shm_stats[] = {
 	{"real_used_size" , STAT_IS_FUNC,    (stat_var**)shm_get_rused },
 	{"fragments" ,      STAT_IS_FUNC,    (stat_var**)shm_get_frags },
 #endif
+	{"cached_size" ,    STAT_NO_RESET,               &shm_cached_size },
 	{0,0,0}
 };
 #endif
@@ -831,6 +832,8 @@ mi_response_t *mi_shm_check(const mi_params_t *params,
 
 int init_shm_post_yyparse(void)
 {
+	shm_cache_init();
+
 #ifdef HP_MALLOC
 	if (mem_allocator_shm == MM_HP_MALLOC ||
 	    mem_allocator_shm == MM_HP_MALLOC_DBG) {
@@ -942,7 +945,12 @@ void shm_mem_destroy(void)
 
 #ifdef HP_MALLOC
 	int j;
+#endif
 
+	/* the pool is going away, along with the cached blocks */
+	shm_cache_destroy();
+
+#ifdef HP_MALLOC
 	if (mem_allocator_shm == MM_HP_MALLOC ||
 	    mem_allocator_shm == MM_HP_MALLOC_DBG)
 		hp_update_shm_pattern_file();
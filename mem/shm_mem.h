@@ -231,6 +231,7 @@ int shm_dbg_mem_init(void);
  * must be called after the statistics engine is initialized
  *	- updates the atomic shm statistics with proper values
  *	- performs memory warming with HP_MALLOC
+ *	- enables the per-process cache of shm blocks
  */
 int init_shm_post_yyparse(void);
 void *shm_getmem(int, void *, unsigned long);   /* allocates the memory (mmap or sysv shmap) */
@@ -318,6 +319,7 @@ inline static void shm_threshold_check(void)
 #endif
 
 #include "shm_mem_dbg.h"
+#include "shm_cache.h"
 
 #ifdef DBG_MALLOC
 
@@ -398,12 +400,15 @@ inline static void* _shm_malloc(unsigned long size,
 {
 	void *p;
 
-	shm_lock();
+	p = shm_cache_get(size);
+	if (!p) {
+		shm_lock();
 
-	p = SHM_MALLOC(shm_block, size, file, function, line);
-	shm_threshold_check();
+		p = SHM_MALLOC(shm_block, size, file, function, line);
+		shm_threshold_check();
 
-	shm_unlock();
+		shm_unlock();
+	}
 
 	DBG_SHM_ALLOC(SH_SHM_MALLOC);
 
@@ -531,8 +536,6 @@ inline static void _shm_free(void *ptr,
 {
 	int size = -1;
 
-	shm_lock();
-
 	#ifdef SHM_EXTRA_STATS
 		if (shm_stats_get_index(ptr) !=  VAR_STAT(MOD_NAME)) {
 				update_module_stats(-shm_frag_size(ptr), -(shm_frag_size(ptr) + shm_frag_overhead), -1, shm_stats_get_index(ptr));
@@ -547,10 +550,15 @@ inline static void _shm_free(void *ptr,
 	if (ptr)
 		size = shm_frag_size(ptr);
 
-	SHM_FREE(shm_block, ptr, file, function, line);
-	shm_threshold_check();
+	if (shm_cache_put(ptr) != 0) {
+		shm_lock();
+
+		SHM_FREE(shm_block, ptr, file, function, line);
+		shm_threshold_check();
+
+		shm_unlock();
+	}
 
-	shm_unlock();
 	DBG_SHM_FREE(file, function, line, size);
 }
 
@@ -637,12 +645,15 @@ inline static void* shm_malloc(unsigned long size)
 {
 	void *p;
 
-	shm_lock();
+	p = shm_cache_get(size);
+	if (!p) {
+		shm_lock();
 
-	p = SHM_MALLOC(shm_block, size);
-	shm_threshold_check();
+		p = SHM_MALLOC(shm_block, size);
+		shm_threshold_check();
 
-	shm_unlock();
+		shm_unlock();
+	}
 
 #ifdef SHM_EXTRA_STATS
 	if (p) {
@@ -761,8 +772,6 @@ inline static void* shm_realloc_unsafe(void *ptr, unsigned long size)
 #define shm_free_func shm_free
 inline static void shm_free(void *_p)
 {
-	shm_lock();
-
 	#ifdef SHM_EXTRA_STATS
 		if (shm_stats_get_index(_p) !=  VAR_STAT(MOD_NAME)) {
 				update_module_stats(-shm_frag_size(_p), -(shm_frag_size(_p) + shm_frag_overhead), -1, shm_stats_get_index(_p));
@@ -774,6 +783,11 @@ inline static void shm_free(void *_p)
 		}
 	#endif
 
+	if (shm_cache_put(_p) == 0)
+		return;
+
+	shm_lock();
+
 	SHM_FREE(shm_block, _p);
 	shm_threshold_check();
 
@@ -18,6 +18,10 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,USA
  */
 
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <tap.h>
 
 #include "../../str.h"
@@ -308,6 +312,106 @@ static inline void test_shm_malloc(void)
 	ok(reallocs == aligned_reallocs,   "check shm_realloc() alignment");
 }
 
+/* the other threads go straight to the allocator */
+static void *shm_cache_thread(void *p)
+{
+	void *q;
+	long reused;
+
+	q = shm_malloc(100);
+	reused = (q == p || shm_cache_enabled);
+	shm_free(q);
+
+	return (void *)reused;
+}
+
+void test_shm_cache(void)
+{
+	void *p, *q, *blocks[4 * TEST_SHM_CACHE_SIZE];
+	int i, status, size = shm_cache_size;
+	unsigned int count;
+	long cached;
+	pthread_t th;
+	pid_t pid;
+
+	shm_cache_size = TEST_SHM_CACHE_SIZE;
+	shm_cache_init();
+	if (!shm_cache_enabled) {
+		diag("shm cache not available with the %s allocator",
+		     mm_str(mem_allocator_shm));
+		shm_cache_size = size;
+		return;
+	}
+
+	p = shm_malloc(100);
+	ok(p && shm_frag_size(p) >= 100, "shm cache: malloc from the cache");
+	ok(get_stat_val(get_stat(_str("cached_size"))) > 0,
+	   "shm cache: refilled in batch");
+
+	shm_free(p);
+	q = shm_malloc(120);
+	ok(q == p, "shm cache: freed block is reused");
+	shm_free(q);
+
+	for (i = 0; i < 4 * TEST_SHM_CACHE_SIZE; i++)
+		blocks[i] = shm_malloc(SHM_CACHE_MIN_SIZE);
+	for (i = 0; i < 4 * TEST_SHM_CACHE_SIZE; i++)
+		shm_free(blocks[i]);
+	ok(shm_magazines[0].count <= TEST_SHM_CACHE_SIZE,
+	   "shm cache: magazine flushed when full");
+
+	p = shm_malloc(2 * SHM_CACHE_MAX_SIZE);
+	shm_free(p);
+	for (i = 0; i < SHM_CACHE_CLASSES; i++)
+		if (shm_magazines[i].count && shm_magazines[i].blocks[
+		        shm_magazines[i].count - 1] == p)
+			break;
+	ok(i == SHM_CACHE_CLASSES, "shm cache: large blocks are not cached");
+
+	p = shm_malloc(100);
+	shm_free(p);
+
+	count = shm_magazines[shm_cache_alloc_class(100)].count;
+	ok(pthread_create(&th, NULL, shm_cache_thread, p) == 0 &&
+	   pthread_join(th, &q) == 0 && q == NULL &&
+	   shm_magazines[shm_cache_alloc_class(100)].count == count,
+	   "shm cache: not used by the other threads");
+
+	/* a child leaving through exit() gives its blocks back */
+	cached = get_stat_val(get_stat(_str("cached_size")));
+	fflush(stdout);
+	fflush(stderr);
+	if ((pid = fork()) == 0) {
+		shm_free(shm_malloc(200));
+		exit(0);
+	}
+	ok(pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+	   get_stat_val(get_stat(_str("cached_size"))) == cached,
+	   "shm cache: flushed on exit");
+
+	/* a raw fork(), not through internal_fork() */
+	if ((pid = fork()) == 0) {
+		for (i = 0, status = 0; i < SHM_CACHE_CLASSES; i++)
+			if (shm_magazines[i].count)
+				status = 1;
+		q = shm_malloc(100);
+		if (q == p)
+			status = 1;
+		shm_free(q);
+		shm_cache_flush_all();
+		_exit(status);
+	}
+	ok(pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+	   WEXITSTATUS(status) == 0, "shm cache: forked child starts empty");
+
+	shm_cache_flush_all();
+	ok(get_stat_val(get_stat(_str("cached_size"))) == 0,
+	   "shm cache: all blocks given back");
+
+	shm_cache_enabled = 0;
+	shm_cache_size = size;
+}
+
 void test_malloc(void)
 {
 	test_pkg_malloc();
@@ -24,9 +24,15 @@
 /* attendant + 7 more */
 #define TEST_MALLOC_PROCS  8
 
+/* magazine size used while testing the per-process shm cache */
+#define TEST_SHM_CACHE_SIZE  8
+
 /* stress-test the PKG and/or SHM allocator implementations */
 void init_malloc_tests(void);
 
 void test_malloc(void);
 
+/* check the per-process cache in front of the SHM allocator */
+void test_shm_cache(void);
+
 #endif /* __TEST_MALLOC_H__ */
@@ -975,6 +975,11 @@ static const mi_export_t mi_core_cmds[] = {
 		{EMPTY_MI_RECIPE}
 		}
 	},
+	{ "tcp_write_stats", "async write queue stats of each TCP profile", 0, 0, {
+		{mi_tcp_write_stats, {0}},
+		{EMPTY_MI_RECIPE}
+		}
+	},
 	{ "mem_pkg_dump", "forces a status dump of the pkg memory (per process)", 0, 0, {
 		{w_mem_pkg_dump_1, {"pid", 0}},
 		{w_mem_pkg_dump_2, {"pid", "log_level", 0}},
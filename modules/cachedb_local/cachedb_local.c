@@ -56,6 +56,7 @@ static void destroy(void);
 
 int cache_clean_period = 600;
 int local_exec_threshold = 0;
+int lcache_lockless_reads = 0;
 
 lcache_col_t* lcache_collection = NULL;
 url_lst_t* url_list=NULL;
@@ -80,6 +81,10 @@ mi_response_t *mi_cache_fetch_chunk_1(const mi_params_t *params,
 								struct mi_handler *async_hdl);
 mi_response_t *mi_cache_fetch_chunk_2(const mi_params_t *params,
 								struct mi_handler *async_hdl);
+mi_response_t *mi_cache_htable_stats(const mi_params_t *params,
+								struct mi_handler *async_hdl);
+mi_response_t *mi_cache_htable_stats_1(const mi_params_t *params,
+								struct mi_handler *async_hdl);
 void localcache_clean(unsigned int ticks,void *param);
 static int parse_collections(unsigned int type, void *val);
 static int store_urls(unsigned int type, void *val);
@@ -87,6 +92,7 @@ static int store_urls(unsigned int type, void *val);
 static const param_export_t params[]={
 	{ "cache_clean_period", INT_PARAM, &cache_clean_period },
 	{ "exec_threshold",     INT_PARAM, &local_exec_threshold },
+	{ "lockless_reads",     INT_PARAM, &lcache_lockless_reads },
 	{ "cache_collections",  STR_PARAM|USE_FUNC_PARAM, (void *)parse_collections },
 	{ "cachedb_url",        STR_PARAM|USE_FUNC_PARAM, (void *)store_urls },
 	{ "cluster_id",INT_PARAM, &cluster_id },
@@ -114,6 +120,11 @@ static const mi_export_t mi_cmds[] = {
 		{mi_cache_fetch_chunk_2, {"glob", "collection", 0}},
 		{EMPTY_MI_RECIPE}}
 	},
+	{ "cache_htable_stats", 0, 0, 0, {
+		{mi_cache_htable_stats, {0}},
+		{mi_cache_htable_stats_1, {"collection", 0}},
+		{EMPTY_MI_RECIPE}}
+	},
 	{EMPTY_MI_EXPORT}
 };
 
@@ -157,32 +168,29 @@ static char *pat_buff = NULL;
 static int pat_buff_size = 0;
 
 
-static int remove_chunk_f(struct sip_msg* msg, str* col_s, str* pat)
+/* matches the key of the entry against the glob in pat_buff
+ * returns 1 if matching, 0 if not, -1 on error */
+static int match_chunk_entry(lcache_entry_t *me)
 {
-	int i;
-	lcache_entry_t* me1, *me2;
-	struct timeval start;
-
-	lcache_col_t* col;
-	lcache_t* cache_htable;
-
-	if ( !col_s ) {
-		/* use default collection; default collection is always first in list */
-		col = lcache_collection;
-	} else {
-		for ( col=lcache_collection; col; col=col->next ) {
-			if ( !str_strcmp( &col->col_name, col_s) )
-				break;
-		}
-
-		if ( !col ) {
-			LM_ERR("collection <%.*s> not defined!\n", col_s->len, col_s->s);
+	if (me->attr.len + 1 > key_buff_size) {
+		key_buff = pkg_realloc(key_buff,me->attr.len+1);
+		if (key_buff == NULL) {
+			LM_ERR("No more pkg mem\n");
+			key_buff_size = 0;
 			return -1;
 		}
+
+		key_buff_size = me->attr.len + 1;
 	}
 
-	cache_htable = col->col_htable->htable;
+	memcpy(key_buff,me->attr.s,me->attr.len);
+	key_buff[me->attr.len] = 0;
 
+	return fnmatch(pat_buff,key_buff,0) == 0 ? 1 : 0;
+}
+
+static int set_chunk_glob(str *pat)
+{
 	if (pat->len+1 > pat_buff_size) {
 		pat_buff = pkg_realloc(pat_buff,pat->len+1);
 		if (pat_buff == NULL) {
@@ -197,58 +205,61 @@ static int remove_chunk_f(struct sip_msg* msg, str* col_s, str* pat)
 	memcpy(pat_buff,pat->s,pat->len);
 	pat_buff[pat->len] = 0;
 
-	LM_DBG("trying to remove chunk with pattern [%s]\n",pat_buff);
-	start_expire_timer(start,local_exec_threshold);
+	return 0;
+}
 
-	for(i = 0; i< col->col_htable->size; i++) {
-		lock_get(&cache_htable[i].lock);
-		me1 = cache_htable[i].entries;
-		me2 = NULL;
-
-		while(me1) {
-			if (me1->attr.len + 1 > key_buff_size) {
-				key_buff = pkg_realloc(key_buff,me1->attr.len+1);
-				if (key_buff == NULL) {
-					LM_ERR("No more pkg mem\n");
-					key_buff_size = 0;
-					lock_release(&cache_htable[i].lock);
-					_stop_expire_timer(start,local_exec_threshold,
-						"cachedb_local remove_chunk",pat->s,pat->len,0,
-						cdb_slow_queries, cdb_total_queries);
-					return -1;
-				}
+static int remove_chunk_entry(lcache_col_t *col, lcache_entry_t *me,
+		void *param)
+{
+	int rc;
 
-				key_buff_size = me1->attr.len + 1;
-			}
+	rc = match_chunk_entry(me);
+	if (rc == 1)
+		LM_DBG("[%.*s] matches glob [%.*s] - removing\n",
+				me->attr.len, me->attr.s,pat_buff_size,pat_buff);
 
-			memcpy(key_buff,me1->attr.s,me1->attr.len);
-			key_buff[me1->attr.len] = 0;
-
-			if(fnmatch(pat_buff,key_buff,0) == 0) {
-				LM_DBG("[%.*s] matches glob [%.*s] - removing from bucket %d\n",
-						me1->attr.len, me1->attr.s,pat_buff_size,pat_buff,i);
-
-				if(me2) {
-					me2->next = me1->next;
-					func_free(col->free, me1);
-					me1 = me2->next;
-				} else{
-					cache_htable[i].entries = me1->next;
-					func_free(col->free, me1);
-					me1 = cache_htable[i].entries;
-				}
-			} else {
-				me2 = me1;
-				me1 = me1->next;
-			}
-		}
-		lock_release(&cache_htable[i].lock);
+	return rc;
+}
+
+static lcache_col_t *get_collection(str *col_s)
+{
+	lcache_col_t* col;
+
+	if ( !col_s ) {
+		/* use default collection; default collection is always first in list */
+		return lcache_collection;
 	}
 
+	for ( col=lcache_collection; col; col=col->next ) {
+		if ( !str_strcmp( &col->col_name, col_s) )
+			return col;
+	}
+
+	LM_ERR("collection <%.*s> not defined!\n", col_s->len, col_s->s);
+	return NULL;
+}
+
+static int remove_chunk_f(struct sip_msg* msg, str* col_s, str* pat)
+{
+	struct timeval start;
+	lcache_col_t* col;
+	int rc;
+
+	if ( !(col = get_collection(col_s)) )
+		return -1;
+
+	if (set_chunk_glob(pat) < 0)
+		return -1;
+
+	LM_DBG("trying to remove chunk with pattern [%s]\n",pat_buff);
+	start_expire_timer(start,local_exec_threshold);
+
+	rc = lcache_htable_walk(col, remove_chunk_entry, NULL);
+
 	_stop_expire_timer(start,local_exec_threshold,
 		"cachedb_local remove_chunk",pat->s,pat->len,0,
 		cdb_slow_queries, cdb_total_queries);
-	return 1;
+	return rc < 0 ? -1 : 1;
 }
 
 mi_response_t *mi_cache_remove_chunk(const mi_params_t *params, str *collection)
@@ -281,50 +292,51 @@ mi_response_t *mi_cache_remove_chunk_2(const mi_params_t *params,
 	return mi_cache_remove_chunk(params, &col);
 }
 
+static int fetch_chunk_entry(lcache_col_t *col, lcache_entry_t *me,
+		void *param)
+{
+	mi_item_t *keys_arr = (mi_item_t *)param, *key_obj;
+	int rc;
+
+	rc = match_chunk_entry(me);
+	if (rc != 1)
+		return rc;
+
+	LM_DBG("[%.*s] matches glob [%.*s] - returning\n",
+			me->attr.len, me->attr.s,pat_buff_size,pat_buff);
+	if ((key_obj = add_mi_object(keys_arr, MI_SSTR("key"))) < 0) {
+		LM_ERR("Failed to add object \n");
+		return -1;
+	}
+	if (add_mi_string(key_obj,MI_SSTR("name"),me->attr.s,me->attr.len) < 0) {
+		LM_ERR("Failed to add key name \n");
+		return -1;
+	}
+	if (add_mi_string(key_obj,MI_SSTR("value"),me->value.s,me->value.len) < 0) {
+		LM_ERR("Failed to add key value \n");
+		return -1;
+	}
+
+	return 0;
+}
+
 mi_response_t *mi_cache_fetch_chunk(const mi_params_t *params, str *collection)
 {
 	str glob;
 	mi_response_t *resp;
-	mi_item_t *resp_obj, *keys_arr, *key_obj;
+	mi_item_t *resp_obj, *keys_arr;
 	lcache_col_t* col;
-	lcache_t* cache_htable;
-	lcache_entry_t* me1;
 	struct timeval start;
-	int i;
+	int rc;
 
 	if (get_mi_string_param(params, "glob", &glob.s, &glob.len) < 0)
 		return init_mi_param_error();
 
-	if ( !collection ) {
-		/* use default collection; default collection is always first in list */
-		col = lcache_collection;
-	} else {
-		for ( col=lcache_collection; col; col=col->next ) {
-			if ( !str_strcmp( &col->col_name, collection) )
-				break;
-		}
-
-		if ( !col ) {
-			LM_ERR("collection <%.*s> not defined!\n", collection->len, collection->s);
-			return init_mi_param_error();
-		}
-	}
-
-	cache_htable = col->col_htable->htable;
-
-	if (glob.len+1 > pat_buff_size) {
-		pat_buff = pkg_realloc(pat_buff,glob.len+1);
-		if (pat_buff == NULL) {
-			LM_ERR("No more pkg mem\n");
-			pat_buff_size = 0;
-			return init_mi_error( 400, MI_SSTR("Internal Error"));
-		}
-
-		pat_buff_size = glob.len +1;
-	}
+	if ( !(col = get_collection(collection)) )
+		return init_mi_param_error();
 
-	memcpy(pat_buff,glob.s,glob.len);
-	pat_buff[glob.len] = 0;
+	if (set_chunk_glob(&glob) < 0)
+		return init_mi_error( 400, MI_SSTR("Internal Error"));
 
 	resp = init_mi_result_object(&resp_obj);
 	if (resp==NULL) {
@@ -334,65 +346,25 @@ mi_response_t *mi_cache_fetch_chunk(const mi_params_t *params, str *collection)
 
 	if((keys_arr = add_mi_array(resp_obj, MI_SSTR("keys"))) < 0) {
 		LM_ERR("Failed to init client rates reply object \n");
+		free_mi_response(resp);
 		return init_mi_error( 400, MI_SSTR("Internal Error"));
 	}
 
 	LM_DBG("trying to fetch entire chunk with pattern [%s]\n",pat_buff);
 	start_expire_timer(start,local_exec_threshold);
 
-	for(i = 0; i< col->size; i++) {
-		lock_get(&cache_htable[i].lock);
-		me1 = cache_htable[i].entries;
-
-		while(me1) {
-			if (me1->attr.len + 1 > key_buff_size) {
-				key_buff = pkg_realloc(key_buff,me1->attr.len+1);
-				if (key_buff == NULL) {
-					LM_ERR("No more pkg mem\n");
-					key_buff_size = 0;
-					goto err_release;
-				}
-				key_buff_size = me1->attr.len + 1;
-			}
-
-			memcpy(key_buff,me1->attr.s,me1->attr.len);
-			key_buff[me1->attr.len] = 0;
-
-			if(fnmatch(pat_buff,key_buff,0) == 0) {
-				LM_DBG("[%.*s] matches glob [%.*s] - returning %d\n",
-						me1->attr.len, me1->attr.s,pat_buff_size,pat_buff,i);
-				if ((key_obj = add_mi_object(keys_arr, MI_SSTR("key"))) < 0) {
-					LM_ERR("Failed to add object \n");
-					goto err_release;
-				}
-				if (add_mi_string(key_obj,MI_SSTR("name"),me1->attr.s,me1->attr.len) < 0) {
-					LM_ERR("Failed to add key name \n");
-					goto err_release;
-				}
-				if (add_mi_string(key_obj,MI_SSTR("value"),me1->value.s,me1->value.len) < 0) {
-					LM_ERR("Failed to add key value \n");
-					goto err_release;
-				}
-			}
-
-			me1 = me1->next;
-		}
-
-		lock_release(&cache_htable[i].lock);
-	}
+	rc = lcache_htable_walk(col, fetch_chunk_entry, keys_arr);
 
 	_stop_expire_timer(start,local_exec_threshold,
 		"cachedb_local fetch_chunk",glob.s,glob.len,0,
 		cdb_slow_queries, cdb_total_queries);
 
+	if (rc < 0) {
+		free_mi_response(resp);
+		return init_mi_error( 400, MI_SSTR("Internal Error"));
+	}
 
 	return resp;
-err_release:
-	lock_release(&cache_htable[i].lock);
-	_stop_expire_timer(start,local_exec_threshold,
-		"cachedb_local fetch_chunk",glob.s,glob.len,0,
-		cdb_slow_queries, cdb_total_queries);
-	return init_mi_error( 400, MI_SSTR("Internal Error"));
 }
 
 mi_response_t *mi_cache_fetch_chunk_1(const mi_params_t *params,
@@ -412,6 +384,99 @@ mi_response_t *mi_cache_fetch_chunk_2(const mi_params_t *params,
 	return mi_cache_fetch_chunk(params, &col);
 }
 
+static int mi_add_htable_stats(mi_item_t *cols_arr, lcache_col_t *col)
+{
+	static const char *depth_names[LCACHE_DEPTH_RANGES] =
+		{"0", "1", "2", "3", "4-7", "8+"};
+	struct lcache_htable_stats st;
+	mi_item_t *col_obj, *depths_obj;
+	int i;
+
+	lcache_htable_get_stats(col, &st);
+
+	if (!(col_obj = add_mi_object(cols_arr, NULL, 0)))
+		return -1;
+
+	if (add_mi_string(col_obj, MI_SSTR("name"),
+			col->col_name.s, col->col_name.len) < 0)
+		return -1;
+	if (add_mi_number(col_obj, MI_SSTR("buckets"), st.size) < 0)
+		return -1;
+	if (add_mi_number(col_obj, MI_SSTR("entries"), st.entries) < 0)
+		return -1;
+	if (add_mi_number(col_obj, MI_SSTR("expiring"), st.expiring) < 0)
+		return -1;
+	if (add_mi_number(col_obj, MI_SSTR("used_buckets"), st.used_buckets) < 0)
+		return -1;
+	if (add_mi_number(col_obj, MI_SSTR("max_depth"), st.max_depth) < 0)
+		return -1;
+	if (add_mi_number(col_obj, MI_SSTR("avg_depth"), st.used_buckets ?
+			(double)st.entries / st.used_buckets : 0) < 0)
+		return -1;
+
+	if (!(depths_obj = add_mi_object(col_obj, MI_SSTR("depths"))))
+		return -1;
+	for (i = 0; i < LCACHE_DEPTH_RANGES; i++)
+		if (add_mi_number(depths_obj, (char *)depth_names[i],
+				strlen(depth_names[i]), st.depths[i]) < 0)
+			return -1;
+
+	if (st.old_size && (add_mi_number(col_obj, MI_SSTR("rehashing_from"),
+			st.old_size) < 0 || add_mi_number(col_obj, MI_SSTR("rehashed"),
+			st.rehashed) < 0))
+		return -1;
+
+	return 0;
+}
+
+static mi_response_t *mi_cache_get_htable_stats(str *collection)
+{
+	mi_response_t *resp;
+	mi_item_t *resp_obj, *cols_arr;
+	lcache_col_t* col;
+
+	if (collection && !(col = get_collection(collection)))
+		return init_mi_error(404, MI_SSTR("Collection not found"));
+
+	resp = init_mi_result_object(&resp_obj);
+	if (!resp)
+		return NULL;
+
+	if (!(cols_arr = add_mi_array(resp_obj, MI_SSTR("collections"))))
+		goto error;
+
+	if (collection) {
+		if (mi_add_htable_stats(cols_arr, col) < 0)
+			goto error;
+	} else {
+		for (col = lcache_collection; col; col = col->next)
+			if (mi_add_htable_stats(cols_arr, col) < 0)
+				goto error;
+	}
+
+	return resp;
+error:
+	free_mi_response(resp);
+	return NULL;
+}
+
+mi_response_t *mi_cache_htable_stats(const mi_params_t *params,
+								struct mi_handler *async_hdl)
+{
+	return mi_cache_get_htable_stats(NULL);
+}
+
+mi_response_t *mi_cache_htable_stats_1(const mi_params_t *params,
+								struct mi_handler *async_hdl)
+{
+	str col;
+
+	if (get_mi_string_param(params, "collection", &col.s, &col.len) < 0)
+		return init_mi_param_error();
+
+	return mi_cache_get_htable_stats(&col);
+}
+
 lcache_con* lcache_new_connection(struct cachedb_id* id)
 {
 	lcache_con *con;
@@ -503,24 +568,6 @@ lcache_rpm_cache_t *add_head_rpm_cache(str *col_name)
 	return c;
 }
 
-void fix_rpm_cache_entries(lcache_htable_t *col_htable)
-{
-	lcache_entry_t *me;
-	int i;
-
-	for(i = 0; i < col_htable->size; i++) {
-		me = col_htable->htable[i].entries;
-		while (me) {
-			if (me->expires > 0)
-				me->expires = get_ticks() + me->ttl;
-
-			me->synced = 0;
-
-			me = me->next;
-		}
-	}
-}
-
 void clean_rpm_cache_old(void)
 {
 	lcache_col_t *it = NULL;
@@ -702,7 +749,7 @@ static int mod_init(void)
 
 				col_it->col_htable = rpm_cache->col_htable;
 
-				if (rpm_cache->col_htable->size != col_it->size) {
+				if (rpm_cache->col_htable->stripes_no != col_it->size) {
 					LM_WARN("Defined size [%d] for collection <%.*s> is different "
 						"than the old rpm cached size - cleaning old data\n",
 						col_it->size, col_it->col_name.len, col_it->col_name.s);
@@ -720,7 +767,7 @@ static int mod_init(void)
 					continue;
 				}
 
-				fix_rpm_cache_entries(col_it->col_htable);
+				lcache_htable_restore(col_it->col_htable, col_it->free);
 			} else {
 				if (lcache_htable_init(col_it) < 0) {
 					LM_ERR("failed to initialize htable for collection <%.*s>!\n",
@@ -743,9 +790,10 @@ static int mod_init(void)
 		}
 	}
 
-	/* register timer to delete the expired entries */
+	/* register timer to delete the expired entries (each cache_clean_period)
+	 * and to maintain the hash tables (each second) */
 	register_timer("localcache-expire",localcache_clean, 0,
-		cache_clean_period, TIMER_FLAG_DELAY_ON_DELAY);
+		1, TIMER_FLAG_DELAY_ON_DELAY);
 
 	/* register clusterer module */
 	if (cluster_id) {
@@ -795,74 +843,29 @@ static int child_init(int rank)
 static void destroy(void)
 {
 	lcache_col_t* it;
-	lcache_entry_t *me;
-	int i;
 
-	for ( it=lcache_collection; it; it=it->next) {
-		if (!it->rpm_cache) {
+	/* the restart persistent ones are kept as they are */
+	for ( it=lcache_collection; it; it=it->next)
+		if (!it->rpm_cache)
 			lcache_htable_destroy(it->col_htable, it->free);
-		} else {
-			for(i = 0; i< it->col_htable->size; i++) {
-				me = it->col_htable->htable[i].entries;
-				while (me) {
-					if (me->expires > 0)
-						me->ttl = me->expires - get_ticks();
-
-					me = me->next;
-				}
-			}
-		}
-	}
 }
 
 void localcache_clean(unsigned int ticks,void *param)
 {
-	int i;
-	lcache_entry_t* me1, *me2;
+	static unsigned int last_clean;
 	lcache_col_t* it;
-	lcache_t* cache_htable;
+	int expire;
 
-	for ( it=lcache_collection; it; it=it->next ) {
-		LM_DBG("start\n");
-		cache_htable = it->col_htable->htable;
-
-		for(i = 0; i< it->col_htable->size; i++)
-		{
-			lock_get(&cache_htable[i].lock);
-			me1 = cache_htable[i].entries;
-			me2 = NULL;
-
-			while(me1)
-			{
-				if((me1->expires > 0) && (me1->expires < get_ticks()))
-				{
-					LM_DBG("deleted entry attr= [%.*s]\n",
-							me1->attr.len, me1->attr.s);
-
-					if(me2)
-					{
-						me2->next = me1->next;
-						func_free(it->free, me1);
-						me1 = me2->next;
-					}
-					else
-					{
-						cache_htable[i].entries = me1->next;
-						func_free(it->free, me1);
-						me1 = cache_htable[i].entries;
-					}
-				}
-				else
-				{
-					if (me1->expires > 0 && it->rpm_cache)
-						me1->ttl = me1->expires - get_ticks();
+	expire = (ticks - last_clean >= cache_clean_period);
+	if (expire)
+		last_clean = ticks;
 
-					me2 = me1;
-					me1 = me1->next;
-				}
-			}
+	for ( it=lcache_collection; it; it=it->next ) {
+		lcache_htable_maintain(it);
 
-			lock_release(&cache_htable[i].lock);
+		if (expire) {
+			LM_DBG("start\n");
+			lcache_htable_expire(it);
 		}
 	}
 }
@@ -36,6 +36,8 @@
 
 extern int cache_htable_size;
 extern int local_exec_threshold;
+/* lookups without locking (see lcache_read_lockless()) */
+extern int lcache_lockless_reads;
 
 typedef struct {
 	struct cachedb_id *id;
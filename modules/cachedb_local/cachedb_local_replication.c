@@ -174,13 +174,32 @@ error:
         bin_free_packet(&packet);
 }
 
+static int sync_entry(lcache_col_t *col, lcache_entry_t *data, void *param)
+{
+        int node_id = *(int *)param;
+        bin_packet_t *sync_packet;
+
+        if (data->expires != 0 && data->expires <= get_ticks())
+                return 0;
+
+        sync_packet = clusterer_api.sync_chunk_start(&cache_repl_cap,
+                                        cluster_id, node_id, BIN_VERSION);
+        if (!sync_packet) {
+                LM_ERR("Can not create sync packet!\n");
+                return -1;
+        }
+        bin_push_str(sync_packet, &col->col_name);
+        bin_push_str(sync_packet, &data->attr);
+        bin_push_str(sync_packet, &data->value);
+        bin_push_int(sync_packet, data->expires ?
+                data->expires - get_ticks() : 0);
+
+        return 0;
+}
+
 int receive_sync_request(int node_id)
 {
-        int i;
         lcache_col_t *col;
-        lcache_entry_t *data;
-        bin_packet_t *sync_packet;
-        lcache_t* cache_htable;
 
         for ( col=lcache_collection; col; col=col->next ) {
                 LM_DBG("Found collection %.*s\n", col->col_name.len, col->col_name.s);
@@ -188,41 +207,22 @@ int receive_sync_request(int node_id)
                 if (!col->replicated)
                         continue;
 
-                cache_htable = col->col_htable->htable;
-
-                for (i =0; i < col->col_htable->size; i++) {
-                        lock_get(&cache_htable[i].lock);
-                        data = cache_htable[i].entries;
-                        while(data) {
-                                if (data->expires == 0 || data->expires > get_ticks()) {
-                                        sync_packet = clusterer_api.sync_chunk_start(&cache_repl_cap,
-                                                                        cluster_id, node_id, BIN_VERSION);
-                                        if (!sync_packet) {
-                                                LM_ERR("Can not create sync packet!\n");
-												lock_release(&cache_htable[i].lock);
-                                                return -1;
-                                        }
-                                        bin_push_str(sync_packet, &col->col_name);
-                                        bin_push_str(sync_packet, &data->attr);
-                                        bin_push_str(sync_packet, &data->value);
-                                        bin_push_int(sync_packet, data->expires ?
-                                                data->expires - get_ticks() : 0);
-                                }
-                                data = data->next;
-                        }
-                        lock_release(&cache_htable[i].lock);
-                }
+                if (lcache_htable_walk(col, sync_entry, &node_id) < 0)
+                        return -1;
         }
 
         return 0;
 }
 
+/* drops the restart persistent entries not received during the sync */
+static int drop_unsynced(lcache_col_t *col, lcache_entry_t *entry, void *param)
+{
+        return entry->synced ? 0 : 1;
+}
+
 void receive_cluster_event(enum clusterer_event ev, int node_id)
 {
         lcache_col_t *col;
-        lcache_t* cache_htable;
-        lcache_entry_t *entry, *prev, *tmp;
-        int i;
 
 	if (ev == SYNC_REQ_RCV && receive_sync_request(node_id) < 0)
 		LM_ERR("Failed to send sync data to node: %d\n", node_id);
@@ -231,33 +231,7 @@ void receive_cluster_event(enum clusterer_event ev, int node_id)
                         if (!col->replicated || !col->rpm_cache)
                                 continue;
 
-                        cache_htable = col->col_htable->htable;
-
-                        for (i = 0; i < col->col_htable->size; i++) {
-                                lock_get(&cache_htable[i].lock);
-
-                                prev = NULL;
-                                entry = cache_htable[i].entries;
-
-                                while (entry) {
-                                        if (!entry->synced) {
-                                                if (prev)
-                                                        prev->next = entry->next;
-                                                else
-                                                        cache_htable[i].entries = entry->next;
-
-                                                tmp = entry;
-                                                entry = entry->next;
-
-                                                func_free(col->free, tmp);
-                                        } else {
-                                                prev = entry;
-                                                entry = entry->next;
-                                        }
-                                }
-
-                                lock_release(&cache_htable[i].lock);
-                        }
+                        lcache_htable_walk(col, drop_unsynced, NULL);
                 }
         }
 }
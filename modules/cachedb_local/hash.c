@@ -26,6 +26,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "../../dprint.h"
 #include "../../ut.h"
@@ -36,75 +37,470 @@
 #include "cachedb_local_replication.h"
 #include "hash.h"
 
-void lcache_htable_remove_safe(osips_free_f free_f, str attr, lcache_entry_t** it);
+/* max average bucket depth, before doubling the buckets */
+#define LCACHE_MAX_LOAD      2
+#define LCACHE_MAX_SIZE      (1 << 24)
+/* old buckets moved by each insert, while rehashing */
+#define LCACHE_REHASH_STEP   4
+/* lockless attempts of a read, before falling back to locking */
+#define LCACHE_READ_TRIES    4
+
+/* both the bucket and the stripe are picked by the low bits of the hash;
+ * core_hash() is additive, so keys like "user123" and "user132" collide
+ * on all the 32 bits - use FNV-1a, with a final mix of the bits */
+static inline unsigned int lcache_hash(str *attr)
+{
+	unsigned int h = 2166136261u;
+	int i;
+
+	for (i = 0; i < attr->len; i++) {
+		h ^= (unsigned char)attr->s[i];
+		h *= 16777619;
+	}
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+#define lcache_retired(_b, _size) ((struct lcache_retired *)((_b) + (_size)))
+
+#define lcache_stripe(_t, _h) (&(_t)->stripes[(_h) & ((_t)->stripes_no - 1)])
+
+/* the stripe changes are seen by the lockless readers through its seq */
+#define lcache_wr_start(_st) \
+	do { \
+		if (lcache_lockless_reads) { \
+			(_st)->seq++; \
+			__sync_synchronize(); \
+		} \
+	} while (0)
+
+#define lcache_wr_end(_st) \
+	do { \
+		if (lcache_lockless_reads) { \
+			__sync_synchronize(); \
+			(_st)->seq++; \
+		} \
+	} while (0)
+
+
+static lcache_t *lcache_alloc_buckets(lcache_col_t *col, int size)
+{
+	lcache_t *buckets;
+
+	buckets = func_malloc(col->malloc,
+		size * sizeof *buckets + sizeof(struct lcache_retired));
+	if (buckets)
+		memset(buckets, 0, size * sizeof *buckets);
+
+	return buckets;
+}
+
+static void lcache_free_retired(struct lcache_retired **list, int aged_only,
+		osips_free_f free_f)
+{
+	struct lcache_retired *r;
+
+	while ((r = *list)) {
+		if (aged_only && !r->aged++) {
+			list = &r->next;
+			continue;
+		}
+
+		*list = r->next;
+		func_free(free_f, r->buckets);
+	}
+}
 
 int lcache_htable_init(struct lcache_col *col)
 {
+	lcache_htable_t *t;
 	int i = 0, j;
 
-	col->col_htable = func_malloc(col->malloc, sizeof *col->col_htable);
-	if (!col->col_htable) {
+	t = func_malloc(col->malloc, sizeof *t);
+	if (!t) {
 		LM_ERR("no more shm memory\n");
 		return -1;
 	}
-	memset(col->col_htable, 0, sizeof *col->col_htable);
+	memset(t, 0, sizeof *t);
 
-	col->col_htable->size = col->size;
+	t->size = t->stripes_no = col->size;
 
-	col->col_htable->htable = func_malloc(col->malloc, col->col_htable->size *
-		sizeof(lcache_t));
-	if(col->col_htable->htable == NULL)
-	{
+	t->htable = lcache_alloc_buckets(col, t->size);
+	t->stripes = func_malloc(col->malloc, t->stripes_no * sizeof *t->stripes);
+	if (!t->htable || !t->stripes) {
 		LM_ERR("no more shared memory\n");
-		func_free(col->free, col->col_htable);
-		return -1;
+		goto error_free;
 	}
-	memset(col->col_htable->htable, 0, col->col_htable->size * sizeof(lcache_t));
+	memset(t->stripes, 0, t->stripes_no * sizeof *t->stripes);
 
-	for(i= 0; i< col->col_htable->size; i++)
-	{
-		if(lock_init(&col->col_htable->htable[i].lock)== 0)
-		{
+	if (!lock_init(&t->rehash_lock)) {
+		LM_ERR("failed to initialize the rehash lock\n");
+		goto error_free;
+	}
+
+	for (i = 0; i < t->stripes_no; i++) {
+		if (lock_init(&t->stripes[i].lock) == 0) {
 			LM_ERR("failed to initialize lock [%d]\n", i);
 			goto error;
 		}
+		atomic_init(&t->stripes[i].readers[0], 0);
+		atomic_init(&t->stripes[i].readers[1], 0);
 	}
 
+	atomic_init(&t->count, 0);
+	t->ticks_epoch = (long)time(NULL) - get_ticks();
+
+	col->col_htable = t;
 	return 0;
 
 error:
-	for(j = 0; j< i; j++)
-	{
-		lock_destroy(&col->col_htable->htable[j].lock);
-	}
-	func_free(col->free, col->col_htable->htable);
-	func_free(col->free, col->col_htable);
+	for (j = 0; j < i; j++)
+		lock_destroy(&t->stripes[j].lock);
+	lock_destroy(&t->rehash_lock);
+error_free:
+	if (t->stripes)
+		func_free(col->free, t->stripes);
+	if (t->htable)
+		func_free(col->free, t->htable);
+	func_free(col->free, t);
 	return -1;
 }
 
+static void lcache_free_list(lcache_entry_t *e, int limbo, osips_free_f free_f)
+{
+	lcache_entry_t *next;
+
+	for (; e; e = next) {
+		next = limbo ? e->limbo_next : e->next;
+		func_free(free_f, e);
+	}
+}
+
 void lcache_htable_destroy(lcache_htable_t *htable, osips_free_f free_f)
 {
+	lcache_stripe_t *st;
 	int i;
-	lcache_entry_t* me1, *me2;
 
 	if(!htable || !htable->htable)
 		return;
 
-	for(i = 0; i< htable->size; i++)
-	{
-		lock_destroy(&htable->htable[i].lock);
-		me1 = htable->htable[i].entries;
-		while(me1)
-		{
-			me2 = me1->next;
-			func_free(free_f, me1);
-			me1 = me2;
-		}
-	}
+	for (i = 0; i < htable->size; i++)
+		lcache_free_list(htable->htable[i].entries, 0, free_f);
 	func_free(free_f, htable->htable);
+
+	if (htable->old) {
+		for (i = 0; i < htable->old_size; i++)
+			lcache_free_list(htable->old[i].entries, 0, free_f);
+		func_free(free_f, htable->old);
+	}
+	lcache_free_retired(&htable->retired, 0, free_f);
+
+	for (i = 0; i < htable->stripes_no; i++) {
+		st = &htable->stripes[i];
+		lock_destroy(&st->lock);
+		lcache_free_list(st->limbo, 1, free_f);
+		lcache_free_list(st->limbo_old, 1, free_f);
+		if (st->heap)
+			func_free(free_f, st->heap);
+	}
+	lock_destroy(&htable->rehash_lock);
+
+	func_free(free_f, htable->stripes);
 	func_free(free_f, htable);
 }
 
+
+/* expiry index */
+
+static inline void lcache_heap_set(lcache_stripe_t *st, int i,
+		lcache_entry_t *e)
+{
+	st->heap[i] = e;
+	e->heap_idx = i;
+}
+
+static void lcache_heap_fix(lcache_stripe_t *st, int i)
+{
+	lcache_entry_t *e = st->heap[i];
+	int c;
+
+	/* up */
+	while (i > 0 && st->heap[(i - 1) / 2]->expires > e->expires) {
+		lcache_heap_set(st, i, st->heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+
+	/* down */
+	while ((c = 2 * i + 1) < st->heap_used) {
+		if (c + 1 < st->heap_used &&
+		        st->heap[c + 1]->expires < st->heap[c]->expires)
+			c++;
+		if (st->heap[c]->expires >= e->expires)
+			break;
+		lcache_heap_set(st, i, st->heap[c]);
+		i = c;
+	}
+
+	lcache_heap_set(st, i, e);
+}
+
+static int lcache_heap_reserve(lcache_col_t *col, lcache_stripe_t *st)
+{
+	lcache_entry_t **heap;
+	int size;
+
+	if (st->heap_used < st->heap_size)
+		return 0;
+
+	size = st->heap_size ? 2 * st->heap_size : 16;
+	heap = func_realloc(col->realloc, st->heap, size * sizeof *heap);
+	if (!heap) {
+		LM_ERR("no more memory for the expiry index\n");
+		return -1;
+	}
+
+	st->heap = heap;
+	st->heap_size = size;
+	return 0;
+}
+
+/* the room must have been reserved with lcache_heap_reserve() */
+static inline void lcache_heap_push(lcache_stripe_t *st, lcache_entry_t *e)
+{
+	lcache_heap_set(st, st->heap_used++, e);
+	lcache_heap_fix(st, e->heap_idx);
+}
+
+static inline void lcache_heap_remove(lcache_stripe_t *st, lcache_entry_t *e)
+{
+	int i = e->heap_idx;
+
+	if (i < 0)
+		return;
+
+	e->heap_idx = -1;
+	if (i != --st->heap_used) {
+		lcache_heap_set(st, i, st->heap[st->heap_used]);
+		lcache_heap_fix(st, i);
+	}
+}
+
+
+/* buckets */
+
+static inline lcache_entry_t **lcache_find_in(lcache_entry_t **pp,
+		str *attr, unsigned int hash)
+{
+	lcache_entry_t *e;
+
+	for (; (e = *pp); pp = &e->next)
+		if (e->hash == hash && e->attr.len == attr->len &&
+		        memcmp(e->attr.s, attr->s, attr->len) == 0)
+			return pp;
+
+	return NULL;
+}
+
+/* the link to the entry, in the current or (if not moved yet) in the old
+ * bucket array; to be called with the stripe of @hash locked */
+static lcache_entry_t **lcache_find(lcache_htable_t *t, str *attr,
+		unsigned int hash)
+{
+	lcache_entry_t **pp;
+
+	pp = lcache_find_in(&t->htable[hash & (t->size - 1)].entries, attr, hash);
+	if (!pp && t->old)
+		pp = lcache_find_in(&t->old[hash & (t->old_size - 1)].entries,
+			attr, hash);
+
+	return pp;
+}
+
+/* the link to the given entry */
+static lcache_entry_t **lcache_find_entry(lcache_htable_t *t,
+		lcache_entry_t *e)
+{
+	lcache_entry_t **pp;
+
+	for (pp = &t->htable[e->hash & (t->size - 1)].entries; *pp;
+	        pp = &(*pp)->next)
+		if (*pp == e)
+			return pp;
+
+	if (t->old)
+		for (pp = &t->old[e->hash & (t->old_size - 1)].entries; *pp;
+		        pp = &(*pp)->next)
+			if (*pp == e)
+				return pp;
+
+	return NULL;
+}
+
+static inline void lcache_free_entry(lcache_col_t *col, lcache_stripe_t *st,
+		lcache_entry_t *e)
+{
+	if (lcache_lockless_reads) {
+		/* freed by the timer, once no reader may look at it anymore */
+		e->limbo_next = st->limbo;
+		st->limbo = e;
+	} else {
+		func_free(col->free, e);
+	}
+}
+
+/* to be called with the stripe locked, between wr_start and wr_end */
+static void lcache_unlink(lcache_col_t *col, lcache_stripe_t *st,
+		lcache_entry_t **pp)
+{
+	lcache_entry_t *e = *pp;
+
+	*pp = e->next;
+	lcache_heap_remove(st, e);
+	atomic_fetch_add(&col->col_htable->count, -1);
+
+	lcache_free_entry(col, st, e);
+}
+
+
+/* rehashing */
+
+static void lcache_lock_all(lcache_htable_t *t)
+{
+	int i;
+
+	for (i = 0; i < t->stripes_no; i++) {
+		lock_get(&t->stripes[i].lock);
+		lcache_wr_start(&t->stripes[i]);
+	}
+}
+
+static void lcache_unlock_all(lcache_htable_t *t)
+{
+	int i;
+
+	for (i = t->stripes_no - 1; i >= 0; i--) {
+		lcache_wr_end(&t->stripes[i]);
+		lock_release(&t->stripes[i].lock);
+	}
+}
+
+/* to be called with the rehash lock */
+static void lcache_rehash_end(lcache_col_t *col)
+{
+	lcache_htable_t *t = col->col_htable;
+	struct lcache_retired *r;
+	lcache_t *old;
+
+	lcache_lock_all(t);
+	old = t->old;
+	/* the old_size is kept, for the readers which still see the array */
+	t->old = NULL;
+	lcache_unlock_all(t);
+
+	if (lcache_lockless_reads) {
+		r = lcache_retired(old, t->old_size);
+		r->buckets = old;
+		r->aged = 0;
+		r->next = t->retired;
+		t->retired = r;
+	} else
+		func_free(col->free, old);
+
+	LM_DBG("collection <%.*s> rehashed to %d buckets\n",
+		col->col_name.len, col->col_name.s, t->size);
+}
+
+/* moves up to @steps old buckets into the current array */
+static void lcache_rehash(lcache_col_t *col, int steps)
+{
+	lcache_htable_t *t = col->col_htable;
+	lcache_stripe_t *st;
+	lcache_entry_t *e, **pp;
+	int b;
+
+	for (; steps > 0; steps--) {
+		lock_get(&t->rehash_lock);
+		if (!t->old || t->rehash_idx == t->old_size) {
+			lock_release(&t->rehash_lock);
+			return;
+		}
+		b = t->rehash_idx++;
+		lock_release(&t->rehash_lock);
+
+		st = lcache_stripe(t, b);
+		lock_get(&st->lock);
+		lcache_wr_start(st);
+
+		while ((e = t->old[b].entries)) {
+			t->old[b].entries = e->next;
+			pp = &t->htable[e->hash & (t->size - 1)].entries;
+			e->next = *pp;
+			*pp = e;
+		}
+
+		lcache_wr_end(st);
+		lock_release(&st->lock);
+
+		lock_get(&t->rehash_lock);
+		if (++t->rehash_done == t->old_size)
+			lcache_rehash_end(col);
+		lock_release(&t->rehash_lock);
+	}
+}
+
+/* starts doubling the buckets, if loaded enough */
+static void lcache_grow(lcache_col_t *col)
+{
+	lcache_htable_t *t = col->col_htable;
+	lcache_t *buckets;
+	int size;
+
+	if (atomic_load(&t->count) <= (unsigned long)t->size * LCACHE_MAX_LOAD ||
+	        t->old || t->size >= LCACHE_MAX_SIZE)
+		return;
+
+	lock_get(&t->rehash_lock);
+
+	if (t->old) {
+		lock_release(&t->rehash_lock);
+		return;
+	}
+
+	size = 2 * t->size;
+	buckets = lcache_alloc_buckets(col, size);
+	if (!buckets) {
+		LM_ERR("no more memory to grow collection <%.*s> to %d buckets\n",
+			col->col_name.len, col->col_name.s, size);
+		lock_release(&t->rehash_lock);
+		return;
+	}
+	lcache_lock_all(t);
+
+	/* the lockless readers load the sizes before the arrays, so they
+	 * never index an array beyond its size */
+	t->old_size = t->size;
+	__sync_synchronize();
+	t->old = t->htable;
+	t->htable = buckets;
+	__sync_synchronize();
+	t->size = size;
+	t->rehash_idx = t->rehash_done = 0;
+
+	lcache_unlock_all(t);
+
+	lock_release(&t->rehash_lock);
+
+	LM_DBG("growing collection <%.*s> to %d buckets\n",
+		col->col_name.len, col->col_name.s, size);
+}
+
+
 int lcache_htable_insert(cachedb_con *con,str* attr, str* value, int expires)
 {
 	lcache_col_t *cache_col;
@@ -122,13 +518,11 @@ int lcache_htable_insert(cachedb_con *con,str* attr, str* value, int expires)
 int _lcache_htable_insert(lcache_col_t *cache_col, str* attr, str* value,
 	int expires, int isrepl)
 {
-	lcache_entry_t* me, *it;
-	int hash_code;
+	lcache_entry_t* me, **pp, **bucket;
+	lcache_htable_t *t = cache_col->col_htable;
+	lcache_stripe_t *st;
 	int size;
 	struct timeval start;
-	lcache_t* cache_htable;
-
-	cache_htable = cache_col->col_htable->htable;
 
 	size= sizeof(lcache_entry_t) + attr->len + value->len;
 
@@ -157,18 +551,40 @@ int _lcache_htable_insert(lcache_col_t *cache_col, str* attr, str* value,
 	if (isrepl)
 		me->synced = 1;
 
-	hash_code= core_hash( attr, NULL, cache_col->col_htable->size);
-	lock_get(&cache_htable[hash_code].lock);
+	me->hash = lcache_hash(attr);
+	me->heap_idx = -1;
 
-	it = cache_htable[hash_code].entries;
+	st = lcache_stripe(t, me->hash);
+	lock_get(&st->lock);
+
+	if (expires != 0 && lcache_heap_reserve(cache_col, st) < 0) {
+		lock_release(&st->lock);
+		func_free(cache_col->free, me);
+		_stop_expire_timer(start,local_exec_threshold,
+			"cachedb_local insert",attr->s,attr->len,0,
+			cdb_slow_queries, cdb_total_queries);
+		return -1;
+	}
+
+	lcache_wr_start(st);
 
 	/* if a previous record for the same attr delete it */
-	lcache_htable_remove_safe(cache_col->free, *attr, &it);
+	if ((pp = lcache_find(t, attr, me->hash)))
+		lcache_unlink(cache_col, st, pp);
+
+	bucket = &t->htable[me->hash & (t->size - 1)].entries;
+	me->next = *bucket;
+	*bucket = me;
+	if (expires != 0)
+		lcache_heap_push(st, me);
+	atomic_fetch_add(&t->count, 1);
 
-	me->next = it;
-	cache_htable[hash_code].entries = me;
+	lcache_wr_end(st);
+	lock_release(&st->lock);
 
-	lock_release(&cache_htable[hash_code].lock);
+	lcache_grow(cache_col);
+	if (t->old)
+		lcache_rehash(cache_col, LCACHE_REHASH_STEP);
 
 	_stop_expire_timer(start,local_exec_threshold,
 		"cachedb_local insert",attr->s,attr->len,0,
@@ -181,31 +597,6 @@ int _lcache_htable_insert(lcache_col_t *cache_col, str* attr, str* value,
 	return 1;
 }
 
-void lcache_htable_remove_safe(osips_free_f free_f, str attr, lcache_entry_t** it_p)
-{
-	lcache_entry_t* me = NULL, *it= *it_p;
-
-	while(it)
-	{
-		if(it->attr.len == attr.len &&
-				(strncmp(it->attr.s, attr.s, attr.len) == 0))
-		{
-
-			if(me)
-				me->next = it->next;
-			else
-				*it_p = it->next;
-
-			func_free(free_f, it);
-
-			return;
-		}
-		me = it;
-		it = it->next;
-	}
-	LM_DBG("entry not found\n");
-}
-
 int lcache_htable_remove(cachedb_con *con,str* attr)
 {
 	lcache_col_t *cache_col;
@@ -222,21 +613,27 @@ int lcache_htable_remove(cachedb_con *con,str* attr)
 
 int _lcache_htable_remove(lcache_col_t *cache_col, str* attr, int isrepl)
 {
-	int hash_code;
+	unsigned int hash;
 	struct timeval start;
-	lcache_t* cache_htable;
-
-	cache_htable = cache_col->col_htable->htable;
-
+	lcache_htable_t *t = cache_col->col_htable;
+	lcache_stripe_t *st;
+	lcache_entry_t **pp;
 
 	start_expire_timer(start,local_exec_threshold);
 
-	hash_code= core_hash( attr, NULL, cache_col->col_htable->size);
-	lock_get(&cache_htable[hash_code].lock);
+	hash = lcache_hash(attr);
+	st = lcache_stripe(t, hash);
+	lock_get(&st->lock);
 
-	lcache_htable_remove_safe(cache_col->free, *attr, &cache_htable[hash_code].entries);
+	if ((pp = lcache_find(t, attr, hash))) {
+		lcache_wr_start(st);
+		lcache_unlink(cache_col, st, pp);
+		lcache_wr_end(st);
+	} else {
+		LM_DBG("entry not found\n");
+	}
 
-	lock_release(&cache_htable[hash_code].lock);
+	lock_release(&st->lock);
 
 	_stop_expire_timer(start,local_exec_threshold,
 		"cachedb_local remove",attr->s,attr->len,0,
@@ -250,16 +647,16 @@ int _lcache_htable_remove(lcache_col_t *cache_col, str* attr, int isrepl)
 
 int lcache_htable_add(cachedb_con *con,str *attr,int val,int expires,int *new_val)
 {
-	int hash_code;
-	lcache_entry_t *it=NULL,*it_prev=NULL;
+	unsigned int hash;
+	lcache_entry_t *it, *me, **pp;
 	int old_value;
 	char *new_value;
 	int new_len;
 	str ins_val;
 	struct timeval start;
-	int ttl;
 
-	lcache_t* cache_htable;
+	lcache_htable_t *t;
+	lcache_stripe_t *st;
 	lcache_col_t* cache_col;
 
 	cache_col = ((lcache_con*)con->data)->col;
@@ -269,83 +666,97 @@ int lcache_htable_add(cachedb_con *con,str *attr,int val,int expires,int *new_va
 		return -1;
 	}
 
-	cache_htable = cache_col->col_htable->htable;
+	t = cache_col->col_htable;
 
 	start_expire_timer(start,local_exec_threshold);
 
-	hash_code = core_hash(attr, NULL,cache_col->col_htable->size);
-	lock_get(&cache_htable[hash_code].lock);
-
-	it = cache_htable[hash_code].entries;
-	while (it) {
-		if (it->attr.len == attr->len &&
-				memcmp(it->attr.s,attr->s,attr->len) == 0) {
-			if (it->expires !=0 && it->expires < get_ticks()) {
-				/* found an expired entry  -> delete it */
-				if(it_prev)
-					it_prev->next = it->next;
-				else
-					cache_htable[hash_code].entries = it->next;
-
-				func_free(cache_col->free, it);
-				lock_release(&cache_htable[hash_code].lock);
-
-				ins_val.s = sint2str(val,&ins_val.len);
-				if (lcache_htable_insert(con,attr,&ins_val,expires) < 0) {
-					LM_ERR("failed to insert value\n");
+	hash = lcache_hash(attr);
+	st = lcache_stripe(t, hash);
+	lock_get(&st->lock);
+
+	pp = lcache_find(t, attr, hash);
+	if (pp) {
+		it = *pp;
+		if (it->expires !=0 && it->expires < get_ticks()) {
+			/* found an expired entry  -> delete it */
+			lcache_wr_start(st);
+			lcache_unlink(cache_col, st, pp);
+			lcache_wr_end(st);
+		} else {
+			/* found our valid entry */
+			if (str2sint(&it->value,&old_value) < 0) {
+				LM_ERR("not an integer\n");
+				lock_release(&st->lock);
+				_stop_expire_timer(start,local_exec_threshold,
+					"cachedb_local add",attr->s,attr->len,0,
+					cdb_slow_queries, cdb_total_queries);
+				return -1;
+			}
+
+			old_value+=val;
+			new_value = sint2str(old_value,&new_len);
+
+			if (!lcache_lockless_reads) {
+				/* all the readers hold the lock, update it in place */
+				me = func_realloc(cache_col->realloc, it,
+					sizeof(lcache_entry_t) + attr->len + new_len);
+				if (me == NULL) {
+					LM_ERR("failed to realloc struct\n");
+					lock_release(&st->lock);
 					_stop_expire_timer(start,local_exec_threshold,
 						"cachedb_local add",attr->s,attr->len,0,
 						cdb_slow_queries, cdb_total_queries);
 					return -1;
 				}
+				if (me != it) {
+					*pp = me;
+					if (me->heap_idx >= 0)
+						lcache_heap_set(st, me->heap_idx, me);
+				}
+				me->attr.s = (char*)(me + 1);
+				me->value.s = (char *)(me + 1) + attr->len;
+				memcpy(me->value.s,new_value,new_len);
+				me->value.len = new_len;
 
+				lock_release(&st->lock);
 				if (new_val)
-					*new_val = val;
-
+					*new_val = old_value;
 				_stop_expire_timer(start,local_exec_threshold,
 					"cachedb_local add",attr->s,attr->len,0,
 					cdb_slow_queries, cdb_total_queries);
 				return 0;
 			}
 
-			/* found our valid entry */
-			if (str2sint(&it->value,&old_value) < 0) {
-				LM_ERR("not an integer\n");
-				lock_release(&cache_htable[hash_code].lock);
+			/* a lockless reader may still be looking at the entry, so a
+			 * new one replaces it */
+			me = func_malloc(cache_col->malloc,
+				sizeof(lcache_entry_t) + attr->len + new_len);
+			if (me == NULL) {
+				LM_ERR("failed to alloc struct\n");
+				lock_release(&st->lock);
 				_stop_expire_timer(start,local_exec_threshold,
 					"cachedb_local add",attr->s,attr->len,0,
 					cdb_slow_queries, cdb_total_queries);
 				return -1;
 			}
 
-			old_value+=val;
-			expires = it->expires;
-			ttl = it->ttl;
-			new_value = sint2str(old_value,&new_len);
-			it = func_realloc(cache_col->realloc,
-				it, sizeof(lcache_entry_t) + attr->len +new_len);
-			if (it == NULL) {
-				LM_ERR("failed to realloc struct\n");
-				lock_release(&cache_htable[hash_code].lock);
-				_stop_expire_timer(start,local_exec_threshold,
-					"cachedb_local add",attr->s,attr->len,0,
-					cdb_slow_queries, cdb_total_queries);
-				return -1;
+			*me = *it;
+			me->attr.s = (char*)(me + 1);
+			memcpy(me->attr.s, attr->s, attr->len);
+			me->value.s = (char *)(me + 1) + attr->len;
+			memcpy(me->value.s,new_value,new_len);
+			me->value.len = new_len;
+
+			lcache_wr_start(st);
+			if (it->heap_idx >= 0) {
+				lcache_heap_set(st, it->heap_idx, me);
+				it->heap_idx = -1;
 			}
+			*pp = me;
+			lcache_free_entry(cache_col, st, it);
+			lcache_wr_end(st);
 
-			if (it_prev)
-				it_prev->next = it;
-			else
-				cache_htable[hash_code].entries = it;
-
-			it->attr.s = (char*)(it + 1);
-			it->value.s =(char *)(it + 1) + attr->len;
-			it->expires = expires;
-			it->ttl = ttl;
-
-			memcpy(it->value.s,new_value,new_len);
-			it->value.len = new_len;
-			lock_release(&cache_htable[hash_code].lock);
+			lock_release(&st->lock);
 			if (new_val)
 				*new_val = old_value;
 			_stop_expire_timer(start,local_exec_threshold,
@@ -353,12 +764,9 @@ int lcache_htable_add(cachedb_con *con,str *attr,int val,int expires,int *new_va
 				cdb_slow_queries, cdb_total_queries);
 			return 0;
 		}
-
-		it_prev = it;
-		it = it->next;
 	}
 
-	lock_release(&cache_htable[hash_code].lock);
+	lock_release(&st->lock);
 
 	/* not found */
 	ins_val.s = sint2str(val,&ins_val.len);
@@ -383,6 +791,157 @@ int lcache_htable_sub(cachedb_con *con,str *attr,int val,int expires,int *new_va
 	return lcache_htable_add(con,attr,-val,expires,new_val);
 }
 
+/* gets the value (a pkg copy, in @res) or the counter (in @cnt) of an entry
+ *	return :
+ *		1  - if found
+ *		-2 - if not found
+ *		-3 - if not a counter
+ *		-1 - if error
+ */
+static inline int lcache_get(lcache_entry_t *it, str *res, int *cnt)
+{
+	char *value;
+
+	if (res) {
+		value = (char*)pkg_malloc(it->value.len);
+		if(value == NULL) {
+			LM_ERR("no more memory\n");
+			return -1;
+		}
+		memcpy(value, it->value.s, it->value.len);
+		res->len = it->value.len;
+		res->s = value;
+	} else if (str2sint(&it->value, cnt) != 0) {
+		LM_ERR("Not a counter key\n");
+		return -3;
+	}
+
+	return 1;
+}
+
+/* registers a lockless reader of the stripe, in the current read epoch;
+ * returns the counter to be released with lcache_read_end() */
+static inline atomic_t *lcache_read_start(lcache_htable_t *t,
+		lcache_stripe_t *st)
+{
+	unsigned int epoch;
+	atomic_t *readers;
+
+	for (;;) {
+		epoch = t->read_epoch;
+		readers = &st->readers[epoch & 1];
+		atomic_fetch_add(readers, 1);
+		__sync_synchronize();
+
+		/* else it may have been counted after its epoch was checked */
+		if (t->read_epoch == epoch)
+			return readers;
+
+		atomic_fetch_add(readers, -1);
+	}
+}
+
+static inline void lcache_read_end(atomic_t *readers)
+{
+	__sync_synchronize();
+	atomic_fetch_add(readers, -1);
+}
+
+/* lookup without locking: the stripe's seq tells if the entry was
+ * changed meanwhile, while the removed entries are only freed once the
+ * readers which could still see them are gone (see lcache_reclaim());
+ * returns 0 if the result is not reliable */
+static int lcache_read_lockless(lcache_htable_t *t, str *attr,
+		unsigned int hash, str *res, int *cnt, int *ret)
+{
+	lcache_stripe_t *st = lcache_stripe(t, hash);
+	lcache_entry_t *it;
+	lcache_t *buckets;
+	atomic_t *readers;
+	unsigned int seq;
+	int size, tries;
+
+	readers = lcache_read_start(t, st);
+
+	for (tries = 0; tries < LCACHE_READ_TRIES; tries++) {
+		seq = st->seq;
+		if (seq & 1)
+			continue;
+		__sync_synchronize();
+
+		size = t->size;
+		__sync_synchronize();
+		buckets = t->htable;
+
+		for (it = buckets[hash & (size - 1)].entries; it; it = it->next)
+			if (it->hash == hash && it->attr.len == attr->len &&
+			        memcmp(it->attr.s, attr->s, attr->len) == 0)
+				break;
+
+		if (!it && (buckets = t->old)) {
+			__sync_synchronize();
+			size = t->old_size;
+			for (it = buckets[hash & (size - 1)].entries; it; it = it->next)
+				if (it->hash == hash && it->attr.len == attr->len &&
+				        memcmp(it->attr.s, attr->s, attr->len) == 0)
+					break;
+		}
+
+		/* the expired ones are left to the timer */
+		if (!it || (it->expires != 0 && it->expires < get_ticks()))
+			*ret = -2;
+		else
+			*ret = lcache_get(it, res, cnt);
+
+		__sync_synchronize();
+		if (st->seq == seq) {
+			lcache_read_end(readers);
+			return 1;
+		}
+
+		if (*ret == 1 && res)
+			pkg_free(res->s);
+	}
+
+	lcache_read_end(readers);
+	return 0;
+}
+
+static int lcache_read(lcache_col_t *cache_col, str *attr, str *res, int *cnt)
+{
+	lcache_htable_t *t = cache_col->col_htable;
+	lcache_stripe_t *st;
+	lcache_entry_t **pp;
+	unsigned int hash;
+	int ret;
+
+	hash = lcache_hash(attr);
+
+	if (lcache_lockless_reads &&
+	        lcache_read_lockless(t, attr, hash, res, cnt, &ret))
+		return ret;
+
+	st = lcache_stripe(t, hash);
+	lock_get(&st->lock);
+
+	pp = lcache_find(t, attr, hash);
+	if (!pp) {
+		ret = -2;
+	} else if ((*pp)->expires != 0 && (*pp)->expires < get_ticks()) {
+		/* found an expired entry  -> delete it */
+		lcache_wr_start(st);
+		lcache_unlink(cache_col, st, pp);
+		lcache_wr_end(st);
+		ret = -2;
+	} else {
+		ret = lcache_get(*pp, res, cnt);
+	}
+
+	lock_release(&st->lock);
+
+	return ret;
+}
+
 /*
  *	return :
  *		1  - if found
@@ -391,13 +950,9 @@ int lcache_htable_sub(cachedb_con *con,str *attr,int val,int expires,int *new_va
  * */
 int lcache_htable_fetch(cachedb_con *con,str* attr, str* res)
 {
-	int hash_code;
-	lcache_entry_t* it = NULL, *it_aux = NULL;
-	char* value;
 	struct timeval start;
-
-	lcache_t* cache_htable;
 	lcache_col_t* cache_col;
+	int ret;
 
 	cache_col = ((lcache_con*)con->data)->col;
 
@@ -407,76 +962,21 @@ int lcache_htable_fetch(cachedb_con *con,str* attr, str* res)
 		return -1;
 	}
 
-	cache_htable = cache_col->col_htable->htable;
-
 	start_expire_timer(start,local_exec_threshold);
 
-	hash_code= core_hash( attr, NULL, cache_col->col_htable->size);
-	lock_get(&cache_htable[hash_code].lock);
-
-	it = cache_htable[hash_code].entries;
+	ret = lcache_read(cache_col, attr, res, NULL);
 
-	while(it)
-	{
-		if(it->attr.len == attr->len &&
-				(strncmp(it->attr.s, attr->s, attr->len) == 0))
-		{
-			if( it->expires != 0 && it->expires < get_ticks())
-			{
-				/* found an expired entry  -> delete it */
-				if(it_aux)
-					it_aux->next = it->next;
-				else
-					cache_htable[hash_code].entries = it->next;
-
-				func_free(cache_col->free, it);
-
-				lock_release(&cache_htable[hash_code].lock);
-				_stop_expire_timer(start,local_exec_threshold,
-					"cachedb_local fetch",attr->s,attr->len,0,
-					cdb_slow_queries, cdb_total_queries);
-				return -2;
-			}
-			value = (char*)pkg_malloc(it->value.len);
-			if(value == NULL)
-			{
-				LM_ERR("no more memory\n");
-				lock_release(&cache_htable[hash_code].lock);
-				_stop_expire_timer(start,local_exec_threshold,
-					"cachedb_local fetch",attr->s,attr->len,0,
-					cdb_slow_queries, cdb_total_queries);
-				return -1;
-			}
-			memcpy(value, it->value.s, it->value.len);
-			res->len = it->value.len;
-			res->s = value;
-			lock_release(&cache_htable[hash_code].lock);
-			_stop_expire_timer(start,local_exec_threshold,
-				"cachedb_local fetch",attr->s,attr->len,0,
-				cdb_slow_queries, cdb_total_queries);
-			return 1;
-		}
-
-		it_aux = it;
-		it = it->next;
-	}
-
-	lock_release(&cache_htable[hash_code].lock);
 	_stop_expire_timer(start,local_exec_threshold,
 		"cachedb_local fetch",attr->s,attr->len,0,
 		cdb_slow_queries, cdb_total_queries);
-	return -2;
+	return ret;
 }
 
 int lcache_htable_fetch_counter(cachedb_con* con,str* attr,int *val)
 {
-	int hash_code;
-	lcache_entry_t* it = NULL, *it_aux = NULL;
-	int ret;
 	struct timeval start;
-
-	lcache_t* cache_htable;
 	lcache_col_t* cache_col;
+	int ret, cnt;
 
 	cache_col = ((lcache_con*)con->data)->col;
 	if ( !cache_col ) {
@@ -485,71 +985,90 @@ int lcache_htable_fetch_counter(cachedb_con* con,str* attr,int *val)
 		return -1;
 	}
 
-	cache_htable = cache_col->col_htable->htable;
-
 	start_expire_timer(start,local_exec_threshold);
 
-	hash_code= core_hash( attr, NULL, cache_col->col_htable->size);
-	lock_get(&cache_htable[hash_code].lock);
+	ret = lcache_read(cache_col, attr, NULL, &cnt);
+	if (ret == 1 && val)
+		*val = cnt;
 
-	it = cache_htable[hash_code].entries;
+	_stop_expire_timer(start,local_exec_threshold,
+		"cachedb_local fetch_counter",attr->s,attr->len,0,
+		cdb_slow_queries, cdb_total_queries);
+	return ret;
+}
 
-	while(it)
-	{
-		if(it->attr.len == attr->len &&
-				(strncmp(it->attr.s, attr->s, attr->len) == 0))
-		{
-			if( it->expires != 0 && it->expires < get_ticks())
-			{
-				/* found an expired entry  -> delete it */
-				if(it_aux)
-					it_aux->next = it->next;
-				else
-					cache_htable[hash_code].entries = it->next;
-
-				func_free(cache_col->free, it);
-
-				lock_release(&cache_htable[hash_code].lock);
-				_stop_expire_timer(start,local_exec_threshold,
-					"cachedb_local fetch_counter",attr->s,attr->len,0,
-					cdb_slow_queries, cdb_total_queries);
-				return -2;
-			}
-			if (str2sint(&it->value,&ret) != 0) {
-				LM_ERR("Not a counter key\n");
-				lock_release(&cache_htable[hash_code].lock);
-				_stop_expire_timer(start,local_exec_threshold,
-					"cachedb_local fetch_counter",attr->s,attr->len,0,
-					cdb_slow_queries, cdb_total_queries);
-				return -3;
+
+static int lcache_walk_buckets(lcache_col_t *col, lcache_stripe_t *st,
+		int s, lcache_t *buckets, int size, lcache_walk_f f, void *param)
+{
+	lcache_entry_t **pp;
+	int b, rc;
+
+	for (b = s; b < size; b += col->col_htable->stripes_no) {
+		pp = &buckets[b].entries;
+		while (*pp) {
+			rc = f(col, *pp, param);
+			if (rc < 0)
+				return -1;
+
+			if (rc == 1) {
+				lcache_wr_start(st);
+				lcache_unlink(col, st, pp);
+				lcache_wr_end(st);
+			} else {
+				pp = &(*pp)->next;
 			}
-			if (val)
-				*val = ret;
-			lock_release(&cache_htable[hash_code].lock);
-			_stop_expire_timer(start,local_exec_threshold,
-				"cachedb_local fetch_counter",attr->s,attr->len,0,
-				cdb_slow_queries, cdb_total_queries);
-			return 1;
 		}
+	}
 
-		it_aux = it;
-		it = it->next;
+	return 0;
+}
+
+int lcache_htable_walk(lcache_col_t *col, lcache_walk_f f, void *param)
+{
+	lcache_htable_t *t = col->col_htable;
+	lcache_stripe_t *st;
+	int s, rc;
+
+	/* the bucket arrays may only change while all the stripes are held */
+	for (s = 0; s < t->stripes_no; s++) {
+		st = &t->stripes[s];
+		lock_get(&st->lock);
+
+		rc = lcache_walk_buckets(col, st, s, t->htable, t->size, f, param);
+		if (rc == 0 && t->old)
+			rc = lcache_walk_buckets(col, st, s, t->old, t->old_size,
+				f, param);
+
+		lock_release(&st->lock);
+
+		if (rc < 0)
+			return -1;
 	}
 
-	lock_release(&cache_htable[hash_code].lock);
-	_stop_expire_timer(start,local_exec_threshold,
-		"cachedb_local fetch_counter",attr->s,attr->len,0,
-		cdb_slow_queries, cdb_total_queries);
-	return -2;
+	return 0;
+}
+
+struct lcache_iter_param {
+	int (*kv_func)(const str *_k, const str *_v);
+	int n;
+};
+
+static int lcache_iter_key(lcache_col_t *col, lcache_entry_t *e, void *param)
+{
+	struct lcache_iter_param *p = (struct lcache_iter_param *)param;
+
+	if (p->kv_func(&e->attr, &e->value) == 0)
+		p->n++;
+
+	return 0;
 }
 
 int lcache_htable_iter_keys(cachedb_con *con,
                             int (*kv_func)(const str *_k, const str *_v))
 {
-	lcache_t* cache_htable;
 	lcache_col_t* cache_col;
-	lcache_entry_t* it;
-	int i, n = 0;
+	struct lcache_iter_param p;
 
 	cache_col = ((lcache_con *)con->data)->col;
 	if (!cache_col) {
@@ -558,18 +1077,200 @@ int lcache_htable_iter_keys(cachedb_con *con,
 		return -1;
 	}
 
-	cache_htable = cache_col->col_htable->htable;
+	p.kv_func = kv_func;
+	p.n = 0;
+	lcache_htable_walk(cache_col, lcache_iter_key, &p);
+
+	/* number of successfully processed keys */
+	return p.n;
+}
+
+
+void lcache_htable_expire(lcache_col_t *col)
+{
+	lcache_htable_t *t = col->col_htable;
+	lcache_stripe_t *st;
+	lcache_entry_t *e, **pp;
+	unsigned int now = get_ticks();
+	int s;
+
+	for (s = 0; s < t->stripes_no; s++) {
+		st = &t->stripes[s];
+		lock_get(&st->lock);
+
+		if (st->heap_used && st->heap[0]->expires < now) {
+			lcache_wr_start(st);
+
+			while (st->heap_used && (e = st->heap[0])->expires < now) {
+				LM_DBG("deleted entry attr= [%.*s]\n",
+						e->attr.len, e->attr.s);
+
+				pp = lcache_find_entry(t, e);
+				if (!pp) {
+					LM_BUG("indexed entry not found in its bucket\n");
+					lcache_heap_remove(st, e);
+					continue;
+				}
+				lcache_unlink(col, st, pp);
+			}
+
+			lcache_wr_end(st);
+		}
+
+		lock_release(&st->lock);
+	}
+}
+
 
-	for (i = 0; i < cache_col->size; i++) {
-		lock_get(&cache_htable[i].lock);
+/*
+ * Frees what was removed before the last change of the read epoch, if all
+ * the lockless readers of that epoch are gone, and moves to a new epoch.
+ * A reader of the current epoch registered (and checked the epoch) before
+ * the change, so it may still look at anything removed since the previous
+ * change, but not at anything removed before it.
+ */
+static void lcache_reclaim(lcache_col_t *col)
+{
+	lcache_htable_t *t = col->col_htable;
+	lcache_stripe_t *st;
+	lcache_entry_t *limbo;
+	unsigned int prev;
+	int s;
+
+	lock_get(&t->rehash_lock);
+
+	prev = (t->read_epoch + 1) & 1;
+	__sync_synchronize();
+	for (s = 0; s < t->stripes_no; s++)
+		if (atomic_load(&t->stripes[s].readers[prev])) {
+			/* retry on the next run */
+			lock_release(&t->rehash_lock);
+			return;
+		}
 
-		for (it = cache_htable[i].entries; it; it = it->next)
-			if (kv_func(&it->attr, &it->value) == 0)
-				n++;
+	for (s = 0; s < t->stripes_no; s++) {
+		st = &t->stripes[s];
+		lock_get(&st->lock);
+		limbo = st->limbo_old;
+		st->limbo_old = st->limbo;
+		st->limbo = NULL;
+		lock_release(&st->lock);
 
-		lock_release(&cache_htable[i].lock);
+		lcache_free_list(limbo, 1, col->free);
 	}
 
-	/* number of successfully processed keys */
-	return n;
+	lcache_free_retired(&t->retired, 1, col->free);
+
+	__sync_synchronize();
+	t->read_epoch++;
+
+	lock_release(&t->rehash_lock);
+}
+
+void lcache_htable_maintain(lcache_col_t *col)
+{
+	lcache_htable_t *t = col->col_htable;
+
+	t->ticks_epoch = (long)time(NULL) - get_ticks();
+
+	if (t->old)
+		lcache_rehash(col, t->old_size);
+
+	if (lcache_lockless_reads)
+		lcache_reclaim(col);
+}
+
+
+void lcache_htable_get_stats(lcache_col_t *col,
+		struct lcache_htable_stats *stats)
+{
+	lcache_htable_t *t = col->col_htable;
+	lcache_stripe_t *st;
+	lcache_entry_t *e;
+	lcache_t *buckets;
+	int s, b, d, r, size, a;
+
+	memset(stats, 0, sizeof *stats);
+
+	for (s = 0; s < t->stripes_no; s++) {
+		st = &t->stripes[s];
+		lock_get(&st->lock);
+
+		if (s == 0) {
+			stats->size = t->size;
+			if (t->old) {
+				stats->old_size = t->old_size;
+				stats->rehashed = t->rehash_done;
+			}
+		}
+		stats->expiring += st->heap_used;
+
+		for (a = 0; a < 2; a++) {
+			buckets = a ? t->old : t->htable;
+			size = a ? t->old_size : t->size;
+			if (!buckets)
+				break;
+
+			for (b = s; b < size; b += t->stripes_no) {
+				for (d = 0, e = buckets[b].entries; e; e = e->next)
+					d++;
+
+				/* the already moved old buckets are left out */
+				if (a && !d)
+					continue;
+
+				stats->entries += d;
+				if (d) {
+					stats->used_buckets++;
+					if (d > stats->max_depth)
+						stats->max_depth = d;
+				}
+
+				r = d < 4 ? d : (d < 8 ? 4 : 5);
+				stats->depths[r]++;
+			}
+		}
+
+		lock_release(&st->lock);
+	}
+}
+
+
+void lcache_htable_restore(lcache_htable_t *t, osips_free_f free_f)
+{
+	lcache_stripe_t *st;
+	lcache_entry_t *e;
+	long now = time(NULL), left;
+	int s, i;
+
+	for (s = 0; s < t->stripes_no; s++) {
+		st = &t->stripes[s];
+		st->seq = 0;
+		atomic_init(&st->readers[0], 0);
+		atomic_init(&st->readers[1], 0);
+
+		lcache_free_list(st->limbo, 1, free_f);
+		lcache_free_list(st->limbo_old, 1, free_f);
+		st->limbo = st->limbo_old = NULL;
+
+		/* same shift for all the expiry times, so the heaps hold */
+		for (i = 0; i < st->heap_used; i++) {
+			e = st->heap[i];
+			left = t->ticks_epoch + e->expires - now;
+			e->expires = get_ticks() + (left > 0 ? left : 0);
+		}
+	}
+
+	for (i = 0; i < t->size; i++)
+		for (e = t->htable[i].entries; e; e = e->next)
+			e->synced = 0;
+	if (t->old)
+		for (i = 0; i < t->old_size; i++)
+			for (e = t->old[i].entries; e; e = e->next)
+				e->synced = 0;
+
+	lcache_free_retired(&t->retired, 0, free_f);
+	t->read_epoch = 0;
+
+	t->ticks_epoch = now - get_ticks();
 }
@@ -29,6 +29,7 @@
 #define _MEMCACHE_HASH_
 
 #include "../../str.h"
+#include "../../atomic.h"
 #include "../../lock_ops.h"
 #include "../../cachedb/cachedb.h"
 
@@ -39,23 +40,95 @@ typedef struct lcache_entry
 	unsigned int expires;
 	unsigned int ttl;
 	int synced;
+	unsigned int hash;       /* of the attr, see lcache_hash() */
+	int heap_idx;            /* position in the expiry index, -1 if none */
 	struct lcache_entry* next;
+	struct lcache_entry* limbo_next;
 }lcache_entry_t;
 
 
 typedef struct lcache
 {
 	lcache_entry_t* entries;
-	gen_lock_t lock;
 }lcache_t;
 
+/*
+ * The buckets are guarded by a fixed set of locks (the initial size of the
+ * collection): bucket b belongs to the stripe (b & (stripes_no - 1)), in
+ * all the bucket arrays, so rehashing a bucket never crosses stripes.
+ */
+typedef struct lcache_stripe {
+	gen_lock_t lock;
+	/* odd while the stripe is being changed (for the lockless readers) */
+	volatile unsigned int seq;
+	/* expiry index of the stripe's entries: a min-heap by "expires" */
+	lcache_entry_t **heap;
+	int heap_used;
+	int heap_size;
+	/* lockless readers of the stripe, by the parity of the read epoch */
+	atomic_t readers[2];
+	/* removed entries, which lockless readers may still be looking at:
+	 * since the last epoch change and before it */
+	lcache_entry_t *limbo;
+	lcache_entry_t *limbo_old;
+} lcache_stripe_t;
+
+/* kept right after the buckets of each array, used once it is retired */
+struct lcache_retired {
+	lcache_t *buckets;
+	struct lcache_retired *next;
+	int aged;
+};
+
+/*
+ * Once loaded more than LCACHE_MAX_LOAD entries per bucket, a collection
+ * doubles its bucket array; the entries of the previous ("old") array are
+ * moved a few buckets at a time, by the writers and by the timer, while the
+ * lookups search both arrays.
+ */
 typedef struct lcache_htable {
-	lcache_t *htable;
-	int size;
+	lcache_t * volatile htable;
+	volatile int size;
+	lcache_t * volatile old;     /* being rehashed into htable, if any */
+	volatile int old_size;
+	int rehash_idx;              /* next old bucket to be moved */
+	int rehash_done;             /* moved old buckets */
+	/* previous arrays, freed once no lockless reader may see them */
+	struct lcache_retired *retired;
+	/* the lockless readers register under its parity; it only moves on
+	 * once all the readers of the previous epoch are gone */
+	volatile unsigned int read_epoch;
+
+	lcache_stripe_t *stripes;
+	int stripes_no;
+	gen_lock_t rehash_lock;
+
+	atomic_t count;
+	/* time() at tick 0, for the restart persistency */
+	long ticks_epoch;
 } lcache_htable_t;
 
+/* bucket depths: 0, 1, 2, 3, 4-7, 8+ */
+#define LCACHE_DEPTH_RANGES 6
+
+struct lcache_htable_stats {
+	int size;
+	int old_size;                /* if rehashing, else 0 */
+	int rehashed;                /* old buckets already moved */
+	unsigned long entries;
+	unsigned long expiring;      /* entries in the expiry index */
+	unsigned long used_buckets;
+	int max_depth;
+	unsigned long depths[LCACHE_DEPTH_RANGES];
+};
+
 struct lcache_col;
 
+/* callback of lcache_htable_walk(), run with the entry's stripe locked;
+ * returns 0 to go on, 1 to have the entry removed, -1 to stop the walk */
+typedef int (*lcache_walk_f)(struct lcache_col *col, lcache_entry_t *e,
+		void *param);
+
 int lcache_htable_init(struct lcache_col *col);
 void lcache_htable_destroy(lcache_htable_t *htable, osips_free_f free_f);
 int lcache_htable_insert(cachedb_con *con,str* attr, str* value, int expires);
@@ -66,4 +139,16 @@ int lcache_htable_sub(cachedb_con *con,str *attr,int val,int expires,int *new_va
 int lcache_htable_fetch_counter(cachedb_con* con,str* attr,int *val);
 int lcache_htable_iter_keys(cachedb_con *con, int (*kv_func)(const str *, const str *));
 
+/* runs @f over all the entries of the collection; returns -1 if stopped */
+int lcache_htable_walk(struct lcache_col *col, lcache_walk_f f, void *param);
+/* removes the expired entries, in O(expired) */
+void lcache_htable_expire(struct lcache_col *col);
+/* completes the rehashing and frees the removed entries and bucket arrays
+ * no longer seen by any lockless reader */
+void lcache_htable_maintain(struct lcache_col *col);
+void lcache_htable_get_stats(struct lcache_col *col,
+		struct lcache_htable_stats *stats);
+/* to be run on the restart persistent data, at startup */
+void lcache_htable_restore(lcache_htable_t *htable, osips_free_f free_f);
+
 #endif
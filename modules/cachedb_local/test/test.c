@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <tap.h>
+
+#include "../../../dprint.h"
+#include "../../../mem/shm_mem.h"
+
+#include "../cachedb_local.h"
+#include "../hash.h"
+
+/* a few buckets, so the collection grows a few times */
+#define LC_SIZE        4
+#define LC_KEYS        4000
+#define LC_WRITERS     3
+#define LC_READERS     4
+#define LC_OPS         200000
+
+static lcache_col_t lc_col;
+static lcache_con lc_con;
+static cachedb_con lc_cdb_con;
+
+
+static int lc_init(int size)
+{
+	memset(&lc_col, 0, sizeof lc_col);
+	lc_col.col_name = str_init("test");
+	lc_col.size = size;
+	lc_col.malloc = shm_malloc_func;
+	lc_col.realloc = shm_realloc_func;
+	lc_col.free = shm_free_func;
+
+	lc_con.col = &lc_col;
+	lc_cdb_con.data = &lc_con;
+
+	return lcache_htable_init(&lc_col);
+}
+
+static inline void lc_key(int i, str *key, char *buf)
+{
+	key->s = buf;
+	key->len = sprintf(buf, "key%d", i);
+}
+
+/* each key only ever holds its own value, so any other one is corrupted */
+static inline void lc_val(int i, str *val, char *buf)
+{
+	val->s = buf;
+	val->len = sprintf(buf, "value of key%d", i);
+}
+
+/* returns 1 if the key holds the expected value, 0 if missing, -1 if bad */
+static int lc_check(int i)
+{
+	char kbuf[16], vbuf[32];
+	str key, val, res;
+	int rc;
+
+	lc_key(i, &key, kbuf);
+	lc_val(i, &val, vbuf);
+
+	rc = lcache_htable_fetch(&lc_cdb_con, &key, &res);
+	if (rc == -2)
+		return 0;
+	if (rc != 1)
+		return -1;
+
+	rc = (res.len == val.len && !memcmp(res.s, val.s, val.len)) ? 1 : -1;
+	pkg_free(res.s);
+
+	return rc;
+}
+
+static int lc_limbo_empty(lcache_htable_t *t)
+{
+	int s;
+
+	for (s = 0; s < t->stripes_no; s++)
+		if (t->stripes[s].limbo || t->stripes[s].limbo_old)
+			return 0;
+
+	return 1;
+}
+
+/* each entry of the expiry index knows its own slot */
+static int lc_heap_ok(lcache_htable_t *t)
+{
+	int s, i;
+
+	for (s = 0; s < t->stripes_no; s++)
+		for (i = 0; i < t->stripes[s].heap_used; i++)
+			if (t->stripes[s].heap[i]->heap_idx != i)
+				return 0;
+
+	return 1;
+}
+
+
+static void test_grow(void)
+{
+	char kbuf[16], vbuf[32];
+	struct lcache_htable_stats stats;
+	lcache_htable_t *t;
+	str key, val;
+	int i, bad, missing, seen_old = 0, cnt;
+
+	if (lc_init(LC_SIZE) < 0) {
+		ok(0, "init the collection");
+		return;
+	}
+	t = lc_col.col_htable;
+
+	for (i = 0, bad = 0; i < LC_KEYS; i++) {
+		lc_key(i, &key, kbuf);
+		lc_val(i, &val, vbuf);
+		if (_lcache_htable_insert(&lc_col, &key, &val, 0, 0) != 1)
+			bad++;
+
+		/* the keys stay visible while the old buckets are moved */
+		if (t->old) {
+			seen_old = 1;
+			if (lc_check(i / 2) != 1 || lc_check(i) != 1)
+				bad++;
+		}
+	}
+	ok(bad == 0, "insert and fetch while rehashing (%d errors)", bad);
+	ok(seen_old, "the old buckets were searched while rehashing");
+
+	lcache_htable_maintain(&lc_col);
+	lcache_htable_get_stats(&lc_col, &stats);
+	ok(!t->old && stats.size >= LC_KEYS / 2 && stats.entries == LC_KEYS &&
+		atomic_load(&t->count) == LC_KEYS,
+		"grown to %d buckets, %lu entries", stats.size, stats.entries);
+
+	for (i = 0, bad = 0; i < LC_KEYS; i++)
+		if (lc_check(i) != 1)
+			bad++;
+	ok(bad == 0, "all the keys found after the grow (%d missing)", bad);
+
+	for (i = 0; i < LC_KEYS; i += 2) {
+		lc_key(i, &key, kbuf);
+		_lcache_htable_remove(&lc_col, &key, 0);
+	}
+	for (i = 0, bad = missing = 0; i < LC_KEYS; i++) {
+		switch (lc_check(i)) {
+		case 0:
+			missing += i % 2 == 0;
+			bad += i % 2 != 0;
+			break;
+		case 1:
+			bad += i % 2 == 0;
+			break;
+		default:
+			bad++;
+		}
+	}
+	ok(bad == 0 && missing == LC_KEYS / 2, "remove every other key");
+
+	key = str_init("counter");
+	ok(lcache_htable_add(&lc_cdb_con, &key, 5, 60, &cnt) == 0 && cnt == 5 &&
+		lcache_htable_add(&lc_cdb_con, &key, 3, 0, &cnt) == 0 && cnt == 8 &&
+		lcache_htable_sub(&lc_cdb_con, &key, 10, 0, &cnt) == 0 && cnt == -2 &&
+		lcache_htable_fetch_counter(&lc_cdb_con, &key, &cnt) == 1 && cnt == -2 &&
+		lc_heap_ok(t), "add/sub a counter");
+
+	lcache_htable_destroy(t, lc_col.free);
+}
+
+
+static void test_reclaim(void)
+{
+	char kbuf[16], vbuf[32];
+	lcache_htable_t *t;
+	atomic_t *readers;
+	str key, val;
+	int i, cnt;
+
+	lcache_lockless_reads = 1;
+
+	if (lc_init(LC_SIZE) < 0) {
+		ok(0, "init the collection");
+		return;
+	}
+	t = lc_col.col_htable;
+
+	for (i = 0; i < 64; i++) {
+		lc_key(i, &key, kbuf);
+		lc_val(i, &val, vbuf);
+		_lcache_htable_insert(&lc_col, &key, &val, 0, 0);
+	}
+	lcache_htable_maintain(&lc_col);
+	lcache_htable_maintain(&lc_col);
+	ok(t->size > LC_SIZE && !t->old && !t->retired && lc_limbo_empty(t),
+		"grown, the old buckets freed");
+
+	/* with lockless readers, a counter update replaces the entry */
+	key = str_init("counter");
+	ok(lcache_htable_add(&lc_cdb_con, &key, 5, 0, &cnt) == 0 &&
+		lcache_htable_add(&lc_cdb_con, &key, 3, 0, &cnt) == 0 && cnt == 8 &&
+		!lc_limbo_empty(t), "add to a counter, the old entry kept");
+
+	/* a reader of the current epoch, still in the middle of a lookup */
+	readers = &t->stripes[0].readers[t->read_epoch & 1];
+	atomic_fetch_add(readers, 1);
+
+	for (i = 0; i < 64; i++) {
+		lc_key(i, &key, kbuf);
+		_lcache_htable_remove(&lc_col, &key, 0);
+	}
+
+	for (i = 0; i < 4; i++)
+		lcache_htable_maintain(&lc_col);
+	ok(!lc_limbo_empty(t), "removed entries kept for an older reader");
+
+	atomic_fetch_add(readers, -1);
+	lcache_htable_maintain(&lc_col);
+	lcache_htable_maintain(&lc_col);
+	ok(lc_limbo_empty(t), "removed entries freed once the reader is gone");
+
+	lcache_htable_destroy(t, lc_col.free);
+	lcache_lockless_reads = 0;
+}
+
+
+static void lc_writer(unsigned int seed)
+{
+	char kbuf[16], vbuf[32];
+	str key, val;
+	int i, k;
+
+	for (i = 0; i < LC_OPS; i++) {
+		k = rand_r(&seed) % LC_KEYS;
+		lc_key(k, &key, kbuf);
+		if (rand_r(&seed) % 3) {
+			lc_val(k, &val, vbuf);
+			_lcache_htable_insert(&lc_col, &key, &val, 0, 0);
+		} else {
+			_lcache_htable_remove(&lc_col, &key, 0);
+		}
+	}
+}
+
+static int lc_reader(unsigned int seed)
+{
+	int i, bad = 0;
+
+	for (i = 0; i < LC_OPS; i++)
+		if (lc_check(rand_r(&seed) % LC_KEYS) < 0)
+			bad++;
+
+	return bad;
+}
+
+/* while the writers and the readers are running, it keeps rehashing the
+ * collection and freeing the removed entries */
+static void lc_maintainer(volatile int *stop)
+{
+	while (!*stop) {
+		lcache_htable_maintain(&lc_col);
+		usleep(1000);
+	}
+}
+
+static void test_concurrent(int lockless)
+{
+	pid_t pids[LC_WRITERS + LC_READERS], mpid, pid;
+	int i, status, failed = 0;
+	struct lcache_htable_stats stats;
+	volatile int *stop;
+
+	lcache_lockless_reads = lockless;
+
+	stop = shm_malloc(sizeof *stop);
+	if (!stop || lc_init(LC_SIZE) < 0) {
+		ok(0, "init the collection");
+		return;
+	}
+	*stop = 0;
+
+	if ((mpid = fork()) == 0) {
+		lc_maintainer(stop);
+		shm_cache_flush_all();
+		_exit(0);
+	}
+
+	for (i = 0; i < LC_WRITERS + LC_READERS; i++) {
+		if ((pid = fork()) == 0) {
+			if (i < LC_WRITERS) {
+				lc_writer(i + 1);
+				status = 0;
+			} else {
+				status = lc_reader(i + 1) ? 1 : 0;
+			}
+			shm_cache_flush_all();
+			_exit(status);
+		}
+		pids[i] = pid;
+	}
+
+	for (i = 0; i < LC_WRITERS + LC_READERS; i++)
+		if (pids[i] < 0 || waitpid(pids[i], &status, 0) != pids[i] ||
+		        !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed++;
+
+	*stop = 1;
+	if (mpid < 0 || waitpid(mpid, &status, 0) != mpid || !WIFEXITED(status))
+		failed++;
+
+	ok(failed == 0, "concurrent get/set/remove across grows (lockless: %d, "
+		"%d failed workers)", lockless, failed);
+
+	lcache_htable_maintain(&lc_col);
+	lcache_htable_maintain(&lc_col);
+	lcache_htable_get_stats(&lc_col, &stats);
+	ok(stats.size > LC_SIZE && stats.entries == atomic_load(
+		&lc_col.col_htable->count) && lc_limbo_empty(lc_col.col_htable) &&
+		!lc_col.col_htable->retired, "consistent after the workers, with "
+		"%lu entries in %d buckets", stats.entries, stats.size);
+
+	lcache_htable_destroy(lc_col.col_htable, lc_col.free);
+	shm_free((void *)stop);
+	lcache_lockless_reads = 0;
+}
+
+
+void mod_tests(void)
+{
+	test_grow();
+	test_reclaim();
+	test_concurrent(0);
+	test_concurrent(1);
+}
@@ -70,6 +70,7 @@ static char* profiles_wv_s = NULL;
 static char* profiles_nv_s = NULL;
 
 int dlg_bulk_del_no = 1; /* delete one by one */
+int dlg_db_load_workers = 1; /* processes loading the dialogs at startup */
 int seq_match_mode = SEQ_MATCH_FALLBACK;
 int options_ping_interval = 30;      /* seconds */
 int reinvite_ping_interval = 300;    /* seconds */
@@ -332,6 +333,7 @@ static const param_export_t mod_params[]={
 	{ "profiles_no_value",     STR_PARAM, &profiles_nv_s            },
 	{ "db_flush_vals_profiles",INT_PARAM, &db_flush_vp              },
 	{ "timer_bulk_del_no",     INT_PARAM, &dlg_bulk_del_no          },
+	{ "db_load_workers",       INT_PARAM, &dlg_db_load_workers      },
 	{ "race_condition_timeout",INT_PARAM, &race_condition_timeout	},
 	/* distributed profiles stuff */
 	{ "cachedb_url",           	 STR_PARAM, &cdb_url.s              },
@@ -352,17 +354,19 @@ static const param_export_t mod_params[]={
 
 
 static const stat_export_t mod_stats[] = {
-	{"active_dialogs" ,     STAT_NO_RESET,  &active_dlgs       },
-	{"early_dialogs",       STAT_NO_RESET,  &early_dlgs        },
-	{"processed_dialogs" ,  0,              &processed_dlgs    },
-	{"expired_dialogs" ,    0,              &expired_dlgs      },
-	{"failed_dialogs",      0,              &failed_dlgs       },
+	{"active_dialogs" ,     STAT_NO_RESET|STAT_SHARDED, &active_dlgs },
+	{"early_dialogs",       STAT_NO_RESET|STAT_SHARDED, &early_dlgs  },
+	{"processed_dialogs" ,  STAT_SHARDED,   &processed_dlgs    },
+	{"expired_dialogs" ,    STAT_SHARDED,   &expired_dlgs      },
+	{"failed_dialogs",      STAT_SHARDED,   &failed_dlgs       },
 	{"create_sent",         0,              &create_sent       },
 	{"update_sent",         0,              &update_sent       },
 	{"delete_sent",         0,              &delete_sent       },
 	{"create_recv",         0,              &create_recv       },
 	{"update_recv",         0,              &update_recv       },
 	{"delete_recv",         0,              &delete_recv       },
+	{"timer_lag",           STAT_IS_FUNC,
+		(stat_var**)get_dlg_timer_lag },
 	{0,0,0}
 };
 
@@ -21,7 +21,10 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 
 #include "../../dprint.h"
 #include "../../ut.h"
@@ -31,6 +34,7 @@
 #include "../../str.h"
 #include "../../socket_info.h"
 #include "../../pt.h"
+#include "../../mem/shm_mem.h"
 #include "dlg_hash.h"
 #include "dlg_db_handler.h"
 #include "dlg_cb.h"
@@ -75,6 +79,7 @@ static db_func_t dialog_dbf;
 extern int active_dlgs_cnt;
 extern int early_dlgs_cnt;
 extern int dlg_bulk_del_no;
+extern int dlg_db_load_workers;
 
 static inline void set_final_update_cols(db_val_t *, struct dlg_cell *, int);
 
@@ -149,7 +154,24 @@ static inline void set_final_update_cols(db_val_t *, struct dlg_cell *, int);
 	} while(0)
 
 
-static int load_dialog_info_from_db(int dlg_hash_size);
+/* how often the progress of the dialogs load is logged */
+#define DLG_LOAD_REPORT_MS  5000
+/* how often the loading processes are checked on */
+#define DLG_LOAD_POLL_US    100000
+
+/* counters of a loading process, shared with the parent */
+struct dlg_load_stats {
+	volatile unsigned long rows;
+	int active;
+	int early;
+	volatile int done;  /* 1 if loaded ok, -1 if failed */
+	char report;        /* if the progress is reported by the loader itself */
+};
+
+static struct timeval dlg_load_start, dlg_load_last;
+
+static int load_dialog_info_from_db(db_key_t *keys, db_op_t *ops,
+		db_val_t *vals, int n, struct dlg_load_stats *ls);
 
 
 int dlg_connect_db(const str *db_url)
@@ -191,6 +213,191 @@ static int remove_all_dialogs_from_db(void)
 }
 
 
+static inline unsigned long dlg_load_ms(struct timeval *from,
+		struct timeval *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000 +
+		(to->tv_usec - from->tv_usec) / 1000;
+}
+
+
+/* logs the rows loaded so far by the @n loaders and their rate - only
+ * every DLG_LOAD_REPORT_MS, unless the load is @done */
+static void dlg_load_report(struct dlg_load_stats *ls, int n, int done)
+{
+	struct timeval now;
+	unsigned long rows, ms;
+	int i;
+
+	gettimeofday(&now, NULL);
+	if (!done && dlg_load_ms(&dlg_load_last, &now) < DLG_LOAD_REPORT_MS)
+		return;
+	dlg_load_last = now;
+
+	for (i = 0, rows = 0; i < n; i++)
+		rows += ls[i].rows;
+	ms = dlg_load_ms(&dlg_load_start, &now);
+
+	if (done)
+		LM_INFO("loaded %lu dialog rows from DB in %lu.%03lus, %lu rows/s"
+			" (%d loaders)\n", rows, ms / 1000, ms % 1000,
+			ms ? rows * 1000 / ms : rows, n);
+	else
+		LM_INFO("loading dialogs from DB: %lu rows so far, %lu rows/s\n",
+			rows, ms ? rows * 1000 / ms : rows);
+}
+
+
+/* runs in a forked loader: loads the dialogs of the hash entries of
+ * partition @part (out of @parts), over its own DB connection */
+static int load_dialogs_part(const str *db_url, int dlg_hash_size,
+		int part, int parts, struct dlg_load_stats *ls)
+{
+	db_key_t keys[2] = {&dlg_id_column, &dlg_id_column};
+	db_op_t ops[2] = {OP_GEQ, OP_LT};
+	db_val_t vals[2];
+	unsigned long long lo, hi;
+	int active = active_dlgs_cnt, early = early_dlgs_cnt;
+	int ret;
+
+	/* the connection of the parent is not to be shared */
+	if ((dialog_db_handle = dialog_dbf.init(db_url)) == 0) {
+		LM_ERR("dialog loader %d failed to connect to the database\n", part);
+		return -1;
+	}
+
+	/* the dlg_id starts with the hash entry */
+	lo = (unsigned long long)part * dlg_hash_size / parts;
+	hi = (unsigned long long)(part + 1) * dlg_hash_size / parts;
+
+	memset(vals, 0, sizeof vals);
+	VAL_TYPE(vals) = VAL_TYPE(vals + 1) = DB_BIGINT;
+	VAL_BIGINT(vals) = lo << 32;
+	VAL_BIGINT(vals + 1) = hi << 32;
+
+	/* the last partition also gets any out of range dlg_id */
+	ret = load_dialog_info_from_db(keys, ops, vals,
+		part == parts - 1 ? 1 : 2, ls);
+
+	ls->active = active_dlgs_cnt - active;
+	ls->early = early_dlgs_cnt - early;
+
+	dialog_dbf.close(dialog_db_handle);
+	dialog_db_handle = 0;
+
+	return ret;
+}
+
+
+/* forks @workers processes loading disjoint ranges of hash entries in
+ * parallel; the parent only waits for them and reports the progress, with
+ * its DB connection closed meanwhile.
+ * As this runs from mod_init, before the modules depending on dialog got
+ * to register their DLGCB_LOADED callbacks, the loaders leave no state
+ * behind in their private memory - but for the counters below */
+static int load_dialogs_parallel(const str *db_url, int dlg_hash_size,
+		int workers)
+{
+	struct dlg_load_stats *ls;
+	pid_t *pids, pid;
+	int i, n, running, status, ret = 0;
+
+	ls = shm_malloc(workers * sizeof *ls);
+	pids = pkg_malloc(workers * sizeof *pids);
+	if (!ls || !pids) {
+		LM_ERR("no more memory for %d dialog loaders\n", workers);
+		if (ls) shm_free(ls);
+		if (pids) pkg_free(pids);
+		return -1;
+	}
+	memset(ls, 0, workers * sizeof *ls);
+
+	/* the DB connections are pooled by URL, so the loaders would all get
+	 * the one inherited from us, unless it is closed first */
+	dialog_dbf.close(dialog_db_handle);
+	dialog_db_handle = 0;
+
+	for (n = 0; n < workers; n++) {
+		pids[n] = fork();
+		if (pids[n] < 0) {
+			LM_ERR("failed to fork dialog loader %d: %s\n", n,
+				strerror(errno));
+			ret = -1;
+			break;
+		} else if (pids[n] == 0) {
+			ls[n].done = load_dialogs_part(db_url, dlg_hash_size, n, workers,
+				&ls[n]) == 0 ? 1 : -1;
+			/* not going through the regular process exit */
+			shm_cache_flush_all();
+			_exit(0);
+		}
+	}
+
+	for (running = n; running; ) {
+		usleep(DLG_LOAD_POLL_US);
+
+		for (i = 0; i < n; i++) {
+			if (pids[i] == 0)
+				continue;
+
+			pid = waitpid(pids[i], &status, WNOHANG);
+			if (pid == 0 || (pid < 0 && errno == EINTR))
+				continue;
+
+			pids[i] = 0;
+			running--;
+			if (ls[i].done != 1) {
+				LM_ERR("dialog loader %d failed\n", i);
+				ret = -1;
+			}
+		}
+
+		dlg_load_report(ls, n, 0);
+	}
+
+	for (i = 0; i < n; i++) {
+		active_dlgs_cnt += ls[i].active;
+		early_dlgs_cnt += ls[i].early;
+	}
+
+	if (ret == 0)
+		dlg_load_report(ls, n, 1);
+
+	if (dlg_connect_db(db_url) != 0) {
+		LM_ERR("unable to reconnect to the database\n");
+		ret = -1;
+	}
+
+	shm_free(ls);
+	pkg_free(pids);
+	return ret;
+}
+
+
+static int load_dialogs(const str *db_url, int dlg_hash_size)
+{
+	struct dlg_load_stats ls;
+	int workers = dlg_db_load_workers;
+
+	gettimeofday(&dlg_load_start, NULL);
+	dlg_load_last = dlg_load_start;
+
+	if (workers > dlg_hash_size)
+		workers = dlg_hash_size;
+	if (workers > 1)
+		return load_dialogs_parallel(db_url, dlg_hash_size, workers);
+
+	memset(&ls, 0, sizeof ls);
+	ls.report = 1;
+
+	if (load_dialog_info_from_db(0, 0, 0, 0, &ls) != 0)
+		return -1;
+
+	dlg_load_report(&ls, 1, 1);
+	return 0;
+}
+
+
 int init_dlg_db(const str *db_url, int dlg_hash_size , int db_update_period)
 {
 	/* Find a database module */
@@ -219,7 +426,7 @@ int init_dlg_db(const str *db_url, int dlg_hash_size , int db_update_period)
 		}
 	}
 
-	if( (load_dialog_info_from_db(dlg_hash_size) ) !=0 ){
+	if( (load_dialogs(db_url, dlg_hash_size) ) !=0 ){
 		LM_ERR("unable to load the dialog data\n");
 		return -1;
 	}
@@ -247,7 +454,8 @@ void destroy_dlg_db(void)
 
 
 
-static int select_entire_dialog_table(db_res_t ** res, int *no_rows)
+static int select_dialog_table(db_key_t *keys, db_op_t *ops, db_val_t *vals,
+		int n, db_res_t ** res, int *no_rows)
 {
 	db_key_t query_cols[DIALOG_TABLE_TOTAL_COL_NO] = {
 			&dlg_id_column,		&call_id_column,	&from_uri_column,
@@ -265,9 +473,9 @@ static int select_entire_dialog_table(db_res_t ** res, int *no_rows)
 		return -1;
 	}
 
-	/* select the whole tabel and all the columns */
+	/* select all the columns, of the whole table unless filtered */
 	if (DB_CAPABILITY(dialog_dbf, DB_CAP_FETCH)) {
-		if(dialog_dbf.query(dialog_db_handle,0,0,0,query_cols, 0,
+		if(dialog_dbf.query(dialog_db_handle,keys,ops,vals,query_cols, n,
 		DIALOG_TABLE_TOTAL_COL_NO, 0, 0) < 0) {
 			LM_ERR("Error while querying (fetch) database\n");
 			return -1;
@@ -282,7 +490,7 @@ static int select_entire_dialog_table(db_res_t ** res, int *no_rows)
 			return -1;
 		}
 	} else {
-		if(dialog_dbf.query(dialog_db_handle,0,0,0,query_cols, 0,
+		if(dialog_dbf.query(dialog_db_handle,keys,ops,vals,query_cols, n,
 		DIALOG_TABLE_TOTAL_COL_NO, 0, res) < 0) {
 			LM_ERR("Error while querying database\n");
 			return -1;
@@ -560,7 +768,8 @@ int remove_ended_dlgs_from_db(void)
 	return 0;
 }
 
-static int load_dialog_info_from_db(int dlg_hash_size)
+static int load_dialog_info_from_db(db_key_t *keys, db_op_t *ops,
+		db_val_t *vals, int n, struct dlg_load_stats *ls)
 {
 	db_res_t * res;
 	db_val_t * values;
@@ -580,7 +789,7 @@ static int load_dialog_info_from_db(int dlg_hash_size)
 	str_const flag_list;
 
 	res = 0;
-	if((nr_rows = select_entire_dialog_table(&res,&no_rows)) < 0)
+	if((nr_rows = select_dialog_table(keys, ops, vals, n, &res,&no_rows)) < 0)
 		goto error;
 
 	nr_rows = RES_ROW_N(res);
@@ -837,6 +1046,10 @@ static int load_dialog_info_from_db(int dlg_hash_size)
 			next_dialog:;
 		}
 
+		ls->rows += nr_rows;
+		if (ls->report)
+			dlg_load_report(ls, 1, 0);
+
 		/* any more data to be fetched ?*/
 		if (DB_CAPABILITY(dialog_dbf, DB_CAP_FETCH)) {
 			if (dialog_dbf.fetch_result( dialog_db_handle, &res,no_rows) < 0) {
@@ -1884,7 +2097,7 @@ static int sync_dlg_db_mem(void)
 	str_const flag_list;
 
 	res = 0;
-	if((nr_rows = select_entire_dialog_table(&res,&no_rows)) < 0)
+	if((nr_rows = select_dialog_table(0, 0, 0, 0, &res,&no_rows)) < 0)
 		goto error;
 
 	nr_rows = RES_ROW_N(res);
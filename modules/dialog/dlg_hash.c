@@ -1335,6 +1335,9 @@ void next_state_dlg(struct dlg_cell *dlg, int event, int dir, int *old_state,
 	}
 	*new_state = dlg->state;
 
+	if (*old_state != DLG_STATE_DELETED && *new_state == DLG_STATE_DELETED)
+		dlg_ping_deleted(dlg);
+
 	dlg_unlock( d_table, d_entry);
 
 	if (*old_state != *new_state)
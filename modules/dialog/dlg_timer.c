@@ -50,6 +50,8 @@ extern int options_ping_interval;
 
 static int _init_gen_dlg_timer(struct dlg_timer **timer)
 {
+	int i;
+
 	*timer = (struct dlg_timer*)shm_malloc(sizeof(struct dlg_timer));
 	if (*timer==0) {
 		LM_ERR("no more shm mem\n");
@@ -57,7 +59,11 @@ static int _init_gen_dlg_timer(struct dlg_timer **timer)
 	}
 	memset( *timer, 0, sizeof(struct dlg_timer) );
 
-	(*timer)->first.next = (*timer)->first.prev = &((*timer)->first);
+	for (i = 0; i < DLG_TW_SIZE; i++) {
+		(*timer)->near[i].next = (*timer)->near[i].prev = &(*timer)->near[i];
+		(*timer)->far[i].next = (*timer)->far[i].prev = &(*timer)->far[i];
+	}
+	(*timer)->now = get_ticks();
 
 	(*timer)->lock = lock_alloc();
 	if ((*timer)->lock==0) {
@@ -116,17 +122,17 @@ void debug_detached_timer_list(struct dlg_tl *detached)
 }
 
 /* assumed to be always called under timer lock */
-void debug_gen_timer_list( struct dlg_timer *timer )
+void debug_gen_timer_list( struct dlg_tl *head )
 {
 	static int visited;
 
 	struct dlg_tl *start,*finish;
 
 	visited++;
-	start = finish = &(timer->first);
+	start = finish = head;
 	LM_DBG("testing forward loop with visited = %d\n",visited);
 
-	/* check the main list is circular in both directions from start to end,
+	/* check the slot list is circular in both directions from start to end,
 	 * with no loops in the middle */
 	while (start) {
 		start->visited=visited;
@@ -142,7 +148,7 @@ void debug_gen_timer_list( struct dlg_timer *timer )
 	}
 
 	visited++;
-	start = &(timer->first);
+	start = head;
 
 	LM_DBG("testing backward loop with visited = %d\n",visited);
 
@@ -164,7 +170,7 @@ void debug_gen_timer_list( struct dlg_timer *timer )
 
 int init_dlg_ping_timer(void)
 {
-	ping_timer = (struct dlg_ping_timer*)shm_malloc(sizeof(struct dlg_timer));
+	ping_timer = (struct dlg_ping_timer*)shm_malloc(sizeof(struct dlg_ping_timer));
 	if (ping_timer==0) {
 		LM_ERR("no more shm mem\n");
 		return -1;
@@ -194,7 +200,8 @@ error0:
 
 int init_dlg_reinvite_ping_timer(void)
 {
-	reinvite_ping_timer = (struct dlg_reinvite_ping_timer*)shm_malloc(sizeof(struct dlg_timer));
+	reinvite_ping_timer = (struct dlg_reinvite_ping_timer*)shm_malloc(
+		sizeof(struct dlg_reinvite_ping_timer));
 	if (reinvite_ping_timer==0) {
 		LM_ERR("no more shm mem\n");
 		return -1;
@@ -258,27 +265,40 @@ void destroy_dlg_del_timer(void)
 }
 
 
+/* returns the head of the wheel slot for a timer expiring at tick @t */
+static inline struct dlg_tl *dlg_tw_slot(struct dlg_timer *timer,
+		unsigned int t)
+{
+	unsigned int n = timer->now + 1;
+
+	/* already due - goes into the very next tick to be expired */
+	if ((int)(t - n) < 0)
+		t = n;
+
+	if ((t >> DLG_TW_BITS) == (n >> DLG_TW_BITS))
+		return &timer->near[t & DLG_TW_MASK];
+
+	return &timer->far[(t >> DLG_TW_BITS) & DLG_TW_MASK];
+}
+
 static inline void insert_gen_timer_unsafe(struct dlg_timer *timer, struct dlg_tl *tl)
 {
-	struct dlg_tl* ptr;
+	struct dlg_tl* head;
+
+	head = dlg_tw_slot(timer, tl->timeout);
 
 #ifdef EXTRA_DEBUG
-	debug_gen_timer_list( timer );
+	debug_gen_timer_list( head );
 #endif
 
-	for(ptr = timer->first.prev; ptr != &(timer->first) ; ptr = ptr->prev) {
-		if ( ptr->timeout <= tl->timeout )
-			break;
-	}
-
 	LM_DBG("inserting %p for %d\n", tl,tl->timeout);
-	tl->prev = ptr;
-	tl->next = ptr->next;
+	tl->prev = head->prev;
+	tl->next = head;
 	tl->prev->next = tl;
-	tl->next->prev = tl;
+	head->prev = tl;
 
 #ifdef EXTRA_DEBUG
-	debug_gen_timer_list( timer );
+	debug_gen_timer_list( head );
 #endif
 }
 
@@ -467,15 +487,14 @@ int insert_reinvite_ping_timer(struct dlg_cell* dlg)
 static inline void remove_dlg_timer_unsafe(struct dlg_tl *tl)
 {
 #ifdef EXTRA_DEBUG
-	debug_gen_timer_list( d_timer );
+	if (tl->prev->next != tl || tl->next->prev != tl) {
+		LM_ERR("Detected something wrong with timer entry %p\n", tl);
+		abort();
+	}
 #endif
 
 	tl->prev->next = tl->next;
 	tl->next->prev = tl->prev;
-
-#ifdef EXTRA_DEBUG
-	debug_gen_timer_list( d_timer );
-#endif
 }
 
 
@@ -579,52 +598,74 @@ int update_dlg_timer( struct dlg_tl *tl, int timeout )
 	return ret;
 }
 
+/* moves the entries of a window slot into the slots of the current window
+ * (or back into the same slot, if a further round is due) */
+static inline void _cascade_gen_timer(struct dlg_timer *timer,
+		struct dlg_tl *head)
+{
+	struct dlg_tl *tl, *next;
+
+	if (head->next == head)
+		return;
+
+	tl = head->next;
+	head->prev->next = NULL;
+	head->next = head->prev = head;
+
+	for (; tl; tl = next) {
+		next = tl->next;
+		insert_gen_timer_unsafe(timer, tl);
+	}
+}
+
 static inline struct dlg_tl* _get_gen_expired_dlgs(struct dlg_timer *timer, unsigned int time)
 {
-	struct dlg_tl *tl , *end, *ret;
+	struct dlg_tl *tl, *head, *ret, *last;
+	unsigned int k, lag = 0;
 
 	lock_get( timer->lock);
 
-	if (timer->first.next==&(timer->first)
-	|| timer->first.next->timeout > time ) {
-		lock_release( timer->lock);
-		return FAKE_DIALOG_TL;
-	}
+	ret = last = FAKE_DIALOG_TL;
+
+	while ((int)(time - timer->now) > 0) {
+		k = timer->now + 1;
+
+		/* entering a new window - bring its timers into the slots */
+		if ((k & DLG_TW_MASK) == 0)
+			_cascade_gen_timer(timer,
+				&timer->far[(k >> DLG_TW_BITS) & DLG_TW_MASK]);
+
+		timer->now = k;
+
+		head = &timer->near[k & DLG_TW_MASK];
+		if (head->next == head)
+			continue;
 
 #ifdef EXTRA_DEBUG
-	debug_gen_timer_list( timer );
+		debug_gen_timer_list( head );
 #endif
 
-	end = &timer->first;
-	tl = timer->first.next;
-	LM_DBG("start with tl=%p tl->prev=%p tl->next=%p (%d) at %d "
-		"and end with end=%p end->prev=%p end->next=%p\n",
-		tl,tl->prev,tl->next,tl->timeout,time,
-		end,end->prev,end->next);
-	while( tl!=end && tl->timeout <= time) {
-		LM_DBG("getting tl=%p tl->prev=%p tl->next=%p with %d\n",
-			tl,tl->prev,tl->next,tl->timeout);
-		tl->prev = 0;
-		tl->timeout = 0;
-		tl=tl->next;
-	}
-	LM_DBG("end with tl=%p tl->prev=%p tl->next=%p and "
-		"timer->first.next->prev=%p\n",
-		tl,tl->prev,tl->next,timer->first.next->prev);
+		/* the whole slot is due */
+		for (tl = head->next; tl != head; tl = tl->next) {
+			LM_DBG("getting tl=%p tl->prev=%p tl->next=%p with %d\n",
+				tl,tl->prev,tl->next,tl->timeout);
+			if (time - tl->timeout > lag)
+				lag = time - tl->timeout;
+			tl->prev = 0;
+			tl->timeout = 0;
+		}
 
-	if (tl==end && timer->first.next->prev) {
-		LM_DBG("no dialog to return\n");
-		ret = FAKE_DIALOG_TL;
-	} else {
-		ret = timer->first.next;
-		tl->prev->next = FAKE_DIALOG_TL;
-		timer->first.next = tl;
-		tl->prev = &timer->first;
+		if (ret == FAKE_DIALOG_TL)
+			ret = head->next;
+		else
+			last->next = head->next;
+		last = head->prev;
+		last->next = FAKE_DIALOG_TL;
+
+		head->next = head->prev = head;
 	}
 
-#ifdef EXTRA_DEBUG
-	debug_gen_timer_list( timer );
-#endif
+	timer->lag = lag;
 
 	lock_release( timer->lock);
 
@@ -664,83 +705,109 @@ void dlg_timer_routine(unsigned int ticks , void * attr)
 	}
 }
 
-/* removes expired dlgs from main ping_timer list
- * and links them back into a new list */
-void get_timeout_dlgs(struct dlg_ping_list **expired,
-		struct dlg_ping_list **to_be_deleted,int reinvite)
+/* detaches the node of a terminated dialog (linked into @to_be_deleted) or
+ * of a dialog whose pinging failed on any leg (linked into @expired);
+ * returns 1 if the node was detached, 0 otherwise */
+static inline int detach_done_ping_node_unsafe(struct dlg_ping_list *it,
+		struct dlg_ping_list **expired, struct dlg_ping_list **to_be_deleted,
+		int reinvite)
 {
-	struct dlg_ping_list *exp = NULL,*del=NULL,*it=NULL,*next=NULL;
-	struct dlg_cell *current;
+	struct dlg_cell *current = it->dlg;
+	struct dlg_ping_list **list;
+
+	if (current->state == DLG_STATE_DELETED) {
+		/* the dialog has terminated - we remove it as well
+		 * since we also have a ref */
+		list = to_be_deleted;
+	} else if ((reinvite &&
+	        ((current->flags & DLG_FLAG_REINVITE_PING_CALLER
+	            && current->legs[DLG_CALLER_LEG].reinvite_confirmed == DLG_PING_FAIL)
+	        || (current->flags & DLG_FLAG_REINVITE_PING_CALLEE
+	            && current->legs[callee_idx(current)].reinvite_confirmed == DLG_PING_FAIL)))
+
+	    || (!reinvite &&
+	        ((current->flags & DLG_FLAG_PING_CALLER
+	            && current->legs[DLG_CALLER_LEG].reply_received == DLG_PING_FAIL)
+	        || (current->flags & DLG_FLAG_PING_CALLEE
+	            && current->legs[callee_idx(current)].reply_received == DLG_PING_FAIL)))) {
+		/* if pinging failed on any leg: detach the timer and end the dialog */
+		list = expired;
+	} else {
+		return 0;
+	}
+
+	detach_ping_node_unsafe(it,reinvite);
 
 	if (reinvite)
-		lock_get(reinvite_ping_timer->lock);
+		current->reinvite_pl = 0;
 	else
-		lock_get(ping_timer->lock);
+		current->pl = 0;
 
-	for (it=reinvite?reinvite_ping_timer->first:ping_timer->first;it;it=next) {
-		/* FIXME - optimisation needed here : only iterate on the nodes that we need to
-		eg. where pinging is in progress */
+	it->next = *list;
+	*list = it;
 
-		current = it->dlg;
-		next = it->next;
+	return 1;
+}
 
-		if (current->state == DLG_STATE_DELETED) {
-			/* the dialog has terminated - we remove it as well
-			 * since we also have a ref */
-			detach_ping_node_unsafe(it,reinvite);
-			if (reinvite)
-				it->dlg->reinvite_pl = 0;
-			else
-				it->dlg->pl = 0;
-
-			if (del == NULL)
-				del = it;
-			else {
-				it->next = del;
-				del = it;
-			}
+/* removes the terminated and the failed dlgs from the ping list and links
+ * them into the given lists; only the dlgs due for a ping are checked,
+ * unless some ping failed or some pinged dlg got deleted meanwhile - then
+ * the whole list is */
+static void get_timeout_dlgs(struct dlg_ping_list **expired,
+		struct dlg_ping_list **to_be_deleted,int reinvite)
+{
+	struct dlg_ping_list *it=NULL,*next=NULL;
+	unsigned int now = get_ticks();
+	volatile int *sweep;
+	int all;
 
-			continue;
-		}
+	*expired = *to_be_deleted = NULL;
 
-		/* if pinging failed on any leg: detach the timer and end the dialog */
-		if ((reinvite &&
-		        ((current->flags & DLG_FLAG_REINVITE_PING_CALLER
-		            && current->legs[DLG_CALLER_LEG].reinvite_confirmed == DLG_PING_FAIL)
-		        || (current->flags & DLG_FLAG_REINVITE_PING_CALLEE
-		            && current->legs[callee_idx(current)].reinvite_confirmed == DLG_PING_FAIL)))
-
-		    || (!reinvite &&
-		        ((current->flags & DLG_FLAG_PING_CALLER
-		            && current->legs[DLG_CALLER_LEG].reply_received == DLG_PING_FAIL)
-		        || (current->flags & DLG_FLAG_PING_CALLEE
-		            && current->legs[callee_idx(current)].reply_received == DLG_PING_FAIL)))) {
-
-			detach_ping_node_unsafe(it,reinvite);
-
-			if (reinvite)
-				it->dlg->reinvite_pl = 0;
-			else
-				it->dlg->pl = 0;
-
-			if (exp == NULL)
-				exp = it;
-			else {
-				it->next = exp;
-				exp = it;
-			}
+	if (reinvite) {
+		lock_get(reinvite_ping_timer->lock);
+		sweep = &reinvite_ping_timer->sweep;
+	} else {
+		lock_get(ping_timer->lock);
+		sweep = &ping_timer->sweep;
+	}
 
-			continue;
-		}
+	/* the flag is raised without the lock, so read and clear it at once */
+	all = __sync_lock_test_and_set(sweep, 0);
+
+	for (it=reinvite?reinvite_ping_timer->first:ping_timer->first;it;it=next) {
+		if (!all && it->timeout > now)
+			break;
+
+		next = it->next;
+		detach_done_ping_node_unsafe(it, expired, to_be_deleted, reinvite);
 	}
 
 	if (reinvite)
 		lock_release(reinvite_ping_timer->lock);
 	else
 		lock_release(ping_timer->lock);
+}
+
+/* no lock here, as the reply may be processed while sending the ping,
+ * under the ping list lock; the full barrier publishes the leg's ping
+ * status (or the dialog's state) before the flag */
+static inline void dlg_ping_sweep(int reinvite)
+{
+	if (reinvite)
+		__sync_fetch_and_or(&reinvite_ping_timer->sweep, 1);
+	else
+		__sync_fetch_and_or(&ping_timer->sweep, 1);
+}
 
-	*to_be_deleted = del;
-	*expired = exp;
+/* called once the dialog turned DELETED, so its ping nodes (and the refs
+ * they hold) are released by the next run of the ping routines, not only
+ * when they are due for a ping */
+void dlg_ping_deleted(struct dlg_cell *dlg)
+{
+	if (dlg->pl)
+		dlg_ping_sweep(0);
+	if (dlg->reinvite_pl)
+		dlg_ping_sweep(1);
 }
 
 int dlg_handle_seq_reply(struct dlg_cell *dlg, struct sip_msg* rpl,
@@ -760,6 +827,7 @@ int dlg_handle_seq_reply(struct dlg_cell *dlg, struct sip_msg* rpl,
 		        "ci: [%.*s]\n", leg == DLG_CALLER_LEG ? "caller" : "callee",
 		        dlg->callid.len, dlg->callid.s);
 		*ping_status = DLG_PING_FAIL;
+		dlg_ping_sweep(is_reinvite_rpl);
 		return -1;
 	}
 
@@ -772,6 +840,7 @@ int dlg_handle_seq_reply(struct dlg_cell *dlg, struct sip_msg* rpl,
 		        dlg->callid.len, dlg->callid.s);
 
 		*ping_status = DLG_PING_FAIL;
+		dlg_ping_sweep(is_reinvite_rpl);
 		return -1;
 	}
 
@@ -951,6 +1020,9 @@ void dlg_options_routine(unsigned int ticks , void * attr)
 		next=it->next;
 
 		if (dialog_repl_cluster && get_shtag_state(dlg) == SHTAG_STATE_BACKUP) {
+			/* not ours to ping - look at it again one interval later */
+			detach_ping_node_unsafe(it,0);
+			unsafe_insert_ping_timer(it,options_ping_interval);
 			it = next;
 			continue;
 		}
@@ -1058,6 +1130,9 @@ void dlg_reinvite_routine(unsigned int ticks , void * attr)
 		next=it->next;
 
 		if (dialog_repl_cluster && get_shtag_state(dlg) == SHTAG_STATE_BACKUP) {
+			/* not ours to ping - look at it again one interval later */
+			detach_ping_node_unsafe(it,1);
+			unsafe_insert_reinvite_ping_timer(it,reinvite_ping_interval);
 			it = next;
 			continue;
 		}
@@ -1125,3 +1200,9 @@ void dlg_reinvite_routine(unsigned int ticks , void * attr)
 	lock_release(reinvite_ping_timer->lock);
 	tcp_no_new_conn = 0;
 }
+
+
+unsigned long get_dlg_timer_lag(unsigned short foo)
+{
+	return d_timer ? d_timer->lag : 0;
+}
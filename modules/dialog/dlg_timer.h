@@ -38,9 +38,24 @@ struct dlg_tl
 };
 
 
+/* the dialog timers are kept in a timing wheel: the slots of the current
+ * window of DLG_TW_SIZE ticks (one tick each), followed by the slots of the
+ * windows ahead (DLG_TW_SIZE ticks each), which are cascaded into the
+ * first ones as the wheel turns; the timers further than DLG_TW_SIZE
+ * windows ahead simply stay in their slot for another round */
+#define DLG_TW_BITS  10
+#define DLG_TW_SIZE  (1<<DLG_TW_BITS)
+#define DLG_TW_MASK  (DLG_TW_SIZE-1)
+
 struct  dlg_timer
 {
-	struct dlg_tl   first;
+	/* the last tick already expired */
+	unsigned int    now;
+	/* max lag (in ticks) of the timers expired by the last run */
+	unsigned int    lag;
+	/* heads of the circular slot lists */
+	struct dlg_tl   near[DLG_TW_SIZE];
+	struct dlg_tl   far[DLG_TW_SIZE];
 	gen_lock_t      *lock;
 };
 
@@ -56,6 +71,10 @@ struct dlg_ping_timer
 {
 	struct dlg_ping_list *first;
 	struct dlg_ping_list *last;
+	/* set when a ping failed or a pinged dialog got deleted, so the next
+	 * run looks for such dialogs all over the list, not only among the
+	 * ones due for a ping */
+	volatile int sweep;
 	gen_lock_t *lock;
 };
 
@@ -63,6 +82,10 @@ struct dlg_reinvite_ping_timer
 {
 	struct dlg_ping_list *first;
 	struct dlg_ping_list *last;
+	/* set when a ping failed or a pinged dialog got deleted, so the next
+	 * run looks for such dialogs all over the list, not only among the
+	 * ones due for a ping */
+	volatile int sweep;
 	gen_lock_t *lock;
 };
 
@@ -96,6 +119,8 @@ int remove_dlg_timer(struct dlg_tl *tl);
 
 int remove_ping_timer(struct dlg_cell *dlg);
 
+void dlg_ping_deleted(struct dlg_cell *dlg);
+
 int update_dlg_timer( struct dlg_tl *tl, int timeout );
 
 void dlg_timer_routine(unsigned int ticks , void * attr);
@@ -104,4 +129,6 @@ void dlg_options_routine(unsigned int ticks , void * attr);
 
 void dlg_reinvite_routine(unsigned int ticks , void * attr);
 
+unsigned long get_dlg_timer_lag(unsigned short foo);
+
 #endif
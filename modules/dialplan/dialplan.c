@@ -41,6 +41,7 @@
 #include "../../status_report.h"
 #include "dialplan.h"
 #include "dp_db.h"
+#include "dp_matcher.h"
 
 
 
@@ -70,6 +71,10 @@ static mi_response_t *mi_show_partition(const mi_params_t *params,
 								struct mi_handler *async_hdl);
 static mi_response_t *mi_show_partition_1(const mi_params_t *params,
 								struct mi_handler *async_hdl);
+static mi_response_t *mi_show_matchers(const mi_params_t *params,
+								struct mi_handler *async_hdl);
+static mi_response_t *mi_show_matchers_1(const mi_params_t *params,
+								struct mi_handler *async_hdl);
 
 
 static int dp_translate_f(struct sip_msg *m, int* dpid, str *in_str,
@@ -86,6 +91,10 @@ static str database_url = {NULL, 0};
 
 void *dp_srg = NULL;
 
+/* one lookup out of dp_lookup_sampling is timed, 0 disables it */
+int dp_lookup_sampling = 100;
+stat_var *dp_lookup_hist[DP_LOOKUP_HIST_SIZE];
+
 
 static const param_export_t mod_params[]={
 	{ "partition",		STR_PARAM|USE_FUNC_PARAM,
@@ -102,9 +111,19 @@ static const param_export_t mod_params[]={
 	{ "attrs_col",		STR_PARAM,	&attrs_column.s },
 	{ "timerec_col",        STR_PARAM,      &timerec_column.s },
 	{ "disabled_col",	STR_PARAM,	&disabled_column.s},
+	{ "lookup_sampling",	INT_PARAM,	&dp_lookup_sampling},
 	{0,0,0}
 };
 
+static const stat_export_t mod_stats[] = {
+	{"lookups_under_10us",  0, &dp_lookup_hist[0]},
+	{"lookups_under_100us", 0, &dp_lookup_hist[1]},
+	{"lookups_under_1ms",   0, &dp_lookup_hist[2]},
+	{"lookups_under_10ms",  0, &dp_lookup_hist[3]},
+	{"lookups_over_10ms",   0, &dp_lookup_hist[4]},
+	{0, 0, 0}
+};
+
 static const mi_export_t mi_cmds[] = {
 	{ "dp_reload", 0, 0, NULL, {
 		{mi_reload_rules, {0}},
@@ -121,6 +140,11 @@ static const mi_export_t mi_cmds[] = {
 		{mi_show_partition_1, {"partition", 0}},
 		{EMPTY_MI_RECIPE}}
 	},
+	{ "dp_show_matchers", 0, 0, NULL, {
+		{mi_show_matchers, {0}},
+		{mi_show_matchers_1, {"partition", 0}},
+		{EMPTY_MI_RECIPE}}
+	},
 	{EMPTY_MI_EXPORT}
 };
 
@@ -159,7 +183,7 @@ struct module_exports exports= {
 	cmds,            /* exported functions */
 	0,               /* exported async functions */
 	mod_params,     /* param exports */
-	0,				/* exported statistics */
+	mod_stats,		/* exported statistics */
 	mi_cmds,		/* exported MI functions */
 	0,				/* exported pseudo-variables */
 	0,			 	/* exported transformations */
@@ -361,6 +385,11 @@ static int mod_init(void)
 	timerec_column.len      = strlen(timerec_column.s);
 	disabled_column.len 	= strlen(disabled_column.s);
 
+	if (dp_lookup_sampling < 0) {
+		LM_WARN("negative lookup_sampling, disabling the lookup timing\n");
+		dp_lookup_sampling = 0;
+	}
+
 	if (!dp_df_head && str_match(&dp_df_part, const_str(DEFAULT_PARTITION)) &&
 	        default_dp_db_url.s) {
 		dp_head_insert(DP_TYPE_URL, &default_dp_db_url, &dp_df_part);
@@ -725,6 +754,114 @@ error:
 	return 0;
 }
 
+static int mi_add_matchers(mi_item_t *to, dp_connection_list_t *el)
+{
+	mi_item_t *ids_arr, *id_item;
+	dpl_matcher_t *m;
+	dpl_id_p idp;
+
+	ids_arr = add_mi_array(to, MI_SSTR("Dpids"));
+	if (!ids_arr)
+		return -1;
+
+	lock_start_read( el->ref_lock );
+
+	for (idp = el->hash[el->crt_index]; idp; idp = idp->next) {
+		id_item = add_mi_object(ids_arr, NULL, 0);
+		if (!id_item)
+			goto error;
+
+		m = idp->matcher;
+
+		if (add_mi_number(id_item, MI_SSTR("dpid"), idp->dp_id) < 0 ||
+		add_mi_number(id_item, MI_SSTR("regex_rules"),
+			m ? m->rules_no : 0) < 0 ||
+		add_mi_number(id_item, MI_SSTR("sequential_rules"),
+			m ? m->nodes[0].rules_no : 0) < 0 ||
+		add_mi_number(id_item, MI_SSTR("trie_nodes"),
+			m ? m->nodes_no : 0) < 0 ||
+		add_mi_number(id_item, MI_SSTR("build_us"), idp->build_us) < 0)
+			goto error;
+	}
+
+	lock_stop_read( el->ref_lock );
+
+	return 0;
+
+error:
+	lock_stop_read( el->ref_lock );
+	return -1;
+}
+
+static mi_response_t *mi_show_matchers(const mi_params_t *params,
+								struct mi_handler *async_hdl)
+{
+	mi_response_t *resp;
+	mi_item_t *resp_obj;
+	mi_item_t *parts_arr, *part_item;
+	dp_connection_list_t *el;
+
+	resp = init_mi_result_object(&resp_obj);
+	if (!resp)
+		return 0;
+
+	parts_arr = add_mi_array(resp_obj, MI_SSTR("Partitions"));
+	if (!parts_arr)
+		goto error;
+
+	for (el = dp_get_connections(); el; el = el->next) {
+		part_item = add_mi_object(parts_arr, NULL, 0);
+		if (!part_item)
+			goto error;
+
+		if (add_mi_string(part_item, MI_SSTR("name"),
+			el->partition.s, el->partition.len) < 0)
+			goto error;
+
+		if (mi_add_matchers(part_item, el) < 0)
+			goto error;
+	}
+
+	return resp;
+
+error:
+	free_mi_response(resp);
+	return 0;
+}
+
+static mi_response_t *mi_show_matchers_1(const mi_params_t *params,
+								struct mi_handler *async_hdl)
+{
+	mi_response_t *resp;
+	mi_item_t *resp_obj;
+	dp_connection_list_t *el;
+	str part;
+
+	if (get_mi_string_param(params, "partition", &part.s, &part.len) < 0)
+		return init_mi_param_error();
+
+	el = dp_get_connection(&part);
+	if (!el)
+		return init_mi_error(404, MI_SSTR("Partition Not Found"));
+
+	resp = init_mi_result_object(&resp_obj);
+	if (!resp)
+		return 0;
+
+	if (add_mi_string(resp_obj, MI_SSTR("Partition"),
+		el->partition.s, el->partition.len) < 0)
+		goto error;
+
+	if (mi_add_matchers(resp_obj, el) < 0)
+		goto error;
+
+	return resp;
+
+error:
+	free_mi_response(resp);
+	return 0;
+}
+
 static mi_response_t *mi_reload_rules(const mi_params_t *params,
 								struct mi_handler *async_hdl)
 {
@@ -28,6 +28,7 @@
 #include "../../parser/msg_parser.h"
 #include "../../rw_locking.h"
 #include "../../time_rec.h"
+#include "../../statistics.h"
 
 #include "../../db/db.h"
 #include "../../re.h"
@@ -41,6 +42,10 @@
 #define DP_CASE_INSENSITIVE		1
 #define DP_INDEX_HASH_SIZE		16
 
+/* buckets of the lookup latency histogram: below 10us, 100us, 1ms, 10ms
+ * and above */
+#define DP_LOOKUP_HIST_SIZE		5
+
 typedef struct dpl_node{
 	int dpid;
 	int table_id; /*choose between matching regexp/strings with same priority*/
@@ -65,10 +70,14 @@ typedef struct dpl_index{
 
 }dpl_index_t, *dpl_index_p;
 
+struct dpl_matcher;
+
 /*For every DPID*/
 typedef struct dpl_id{
 	int dp_id;
 	dpl_index_t* rule_hash;/*fast access :string rules are hashed*/
+	struct dpl_matcher *matcher; /*compiled regex rules, if any*/
+	unsigned int build_us;
 	struct dpl_id * next;
 }dpl_id_t,*dpl_id_p;
 
@@ -138,4 +147,7 @@ void wrap_pcre_free( pcre*);
 extern rw_lock_t *ref_lock;
 extern str dp_df_part;
 
+extern int dp_lookup_sampling;
+extern stat_var *dp_lookup_hist[DP_LOOKUP_HIST_SIZE];
+
 #endif
@@ -31,6 +31,7 @@
 #include "../../status_report.h"
 
 #include "dp_db.h"
+#include "dp_matcher.h"
 
 dp_head_p dp_hlist;
 dp_head_p dp_df_head;
@@ -259,8 +260,11 @@ int dp_load_db(dp_connection_list_p dp_conn, int initial)
 	db_val_t cond_val[1];
 
 	dpl_node_t *rule;
+	dpl_id_p crt_idp;
 	int no_rows = 10;
 	int loaded_rl=0, discarded_rl=0;
+	int built_no=0;
+	unsigned int built_us=0;
 
 
 	lock_start_write( dp_conn->ref_lock );
@@ -372,7 +376,20 @@ int dp_load_db(dp_connection_list_p dp_conn, int initial)
 
 
 end:
-
+	/* compile the regex rules of each dpid */
+	for (crt_idp = dp_conn->hash[dp_conn->next_index]; crt_idp;
+	crt_idp = crt_idp->next) {
+		if (dp_build_matcher(crt_idp) != 0) {
+			LM_WARN("failed to build the matcher for dpid %d in partition "
+				"<%.*s>, using sequential matching\n", crt_idp->dp_id,
+				dp_conn->partition.len, dp_conn->partition.s);
+			continue;
+		}
+		if (crt_idp->matcher) {
+			built_us += crt_idp->build_us;
+			built_no++;
+		}
+	}
 
 	/*update data*/
 	lock_start_write( dp_conn->ref_lock );
@@ -392,6 +409,9 @@ end:
 		CHAR_INT("DB data loading successfully completed"), 0);
 	sr_add_report_fmt( dp_srg, STR2CI(dp_conn->partition), 0,
 		"%d rules loaded (%d discarded)", loaded_rl, discarded_rl);
+	if (built_no)
+		sr_add_report_fmt( dp_srg, STR2CI(dp_conn->partition), 0,
+			"regex matchers built for %d dpids in %u us", built_no, built_us);
 	sr_set_status( dp_srg, STR2CI(dp_conn->partition), SR_STATUS_READY,
 		CHAR_INT("data available"), 0);
 
@@ -715,6 +735,7 @@ void destroy_hash(dpl_id_t **rules_hash)
 		}
 		*rules_hash = crt_idp->next;
 
+		dp_destroy_matcher(crt_idp);
 		shm_free(crt_idp);
 		crt_idp = NULL;
 	}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <ctype.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../../dprint.h"
+#include "../../ut.h"
+#include "../../mem/mem.h"
+#include "../../mem/shm_mem.h"
+#include "dp_matcher.h"
+
+/* only the match/no match outcome is used from here */
+#define DP_MATCHER_OVECTOR  (10 * 3)
+
+static int ovector[DP_MATCHER_OVECTOR];
+
+
+int dp_literal_prefix(str *exp, int flags, char *buf)
+{
+	char *p, *end;
+	int len = 0, last;
+	char c;
+
+	/* an alternation, even nested, may escape the leading anchor */
+	if (exp->len < 2 || exp->s[0] != '^' || memchr(exp->s, '|', exp->len))
+		return 0;
+
+	end = exp->s + exp->len;
+	for (p = exp->s + 1; p < end && len < DP_MATCHER_MAX_PREFIX; ) {
+		last = len;
+		c = *p;
+
+		if (c == '\\') {
+			/* classes, back references, \Q..\E quoting, etc. */
+			if (p + 1 == end || isalnum((unsigned char)p[1]))
+				break;
+			c = p[1];
+			p += 2;
+		} else if (c == '\0' || strchr("^$.[]()?*+{}", c)) {
+			break;
+		} else {
+			p++;
+		}
+
+		if ((flags & DP_CASE_INSENSITIVE) && isalpha((unsigned char)c))
+			break;
+
+		buf[len++] = c;
+
+		if (p < end) {
+			/* an optional literal is not required from the input */
+			if (*p == '?' || *p == '*' || *p == '{') {
+				len = last;
+				break;
+			}
+			if (*p == '+')
+				break;
+		}
+	}
+
+	return len;
+}
+
+
+static int dp_trie_child(dpl_trie_node_t **nodes, unsigned int *nodes_no,
+								unsigned int *size, unsigned int parent, char c)
+{
+	dpl_trie_node_t *n;
+	unsigned int i;
+
+	for (i = (*nodes)[parent].child; i; i = (*nodes)[i].sibling)
+		if ((*nodes)[i].c == (unsigned char)c)
+			return i;
+
+	if (*nodes_no == *size) {
+		n = pkg_realloc(*nodes, 2 * *size * sizeof *n);
+		if (!n) {
+			LM_ERR("no more pkg memory\n");
+			return -1;
+		}
+		*nodes = n;
+		*size *= 2;
+	}
+
+	i = (*nodes_no)++;
+	n = &(*nodes)[i];
+	memset(n, 0, sizeof *n);
+	n->c = (unsigned char)c;
+	n->sibling = (*nodes)[parent].child;
+	(*nodes)[parent].child = i;
+
+	return i;
+}
+
+
+int dp_build_matcher(dpl_id_p idp)
+{
+	dpl_index_p regexes = &idp->rule_hash[DP_INDEX_HASH_SIZE];
+	dpl_trie_node_t *nodes = NULL;
+	unsigned int nodes_no = 1, size = 16;
+	unsigned int *node_of = NULL;
+	unsigned int n, i, off;
+	dpl_matcher_t *m;
+	dpl_node_p rule;
+	char prefix[DP_MATCHER_MAX_PREFIX];
+	struct timeval begin;
+	int len, j, node;
+
+	gettimeofday(&begin, NULL);
+
+	for (n = 0, rule = regexes->first_rule; rule; rule = rule->next)
+		n++;
+
+	/* nothing to compile for the string-only dpids */
+	if (n == 0)
+		return 0;
+
+	nodes = pkg_malloc(size * sizeof *nodes);
+	node_of = pkg_malloc(n * sizeof *node_of);
+	if (!nodes || !node_of) {
+		LM_ERR("no more pkg memory\n");
+		goto error;
+	}
+	memset(nodes, 0, sizeof *nodes);
+
+	for (i = 0, rule = regexes->first_rule; rule; rule = rule->next, i++) {
+		len = dp_literal_prefix(&rule->match_exp, rule->match_flags, prefix);
+
+		for (j = 0, node = 0; j < len; j++) {
+			node = dp_trie_child(&nodes, &nodes_no, &size, node, prefix[j]);
+			if (node < 0)
+				goto error;
+		}
+
+		node_of[i] = node;
+		nodes[node].rules_no++;
+
+		LM_DBG("dpid %d: rule %.*s indexed on prefix '%.*s'\n", idp->dp_id,
+			rule->match_exp.len, rule->match_exp.s, len, prefix);
+	}
+
+	m = shm_malloc(sizeof *m + n * sizeof *m->rules +
+		nodes_no * sizeof *m->nodes + n * sizeof *m->cands);
+	if (!m) {
+		LM_ERR("no more shm memory\n");
+		goto error;
+	}
+
+	m->rules = (dpl_node_t **)(m + 1);
+	m->rules_no = n;
+	m->nodes = (dpl_trie_node_t *)(m->rules + n);
+	m->nodes_no = nodes_no;
+	m->cands = (unsigned int *)(m->nodes + nodes_no);
+
+	/* lay out the candidates of each node, keeping the rule order */
+	for (i = 0, off = 0; i < nodes_no; i++) {
+		nodes[i].rules = off;
+		off += nodes[i].rules_no;
+		nodes[i].rules_no = 0;
+	}
+
+	for (i = 0, rule = regexes->first_rule; rule; rule = rule->next, i++) {
+		m->rules[i] = rule;
+		node = node_of[i];
+		m->cands[nodes[node].rules + nodes[node].rules_no++] = i;
+	}
+
+	memcpy(m->nodes, nodes, nodes_no * sizeof *nodes);
+
+	pkg_free(nodes);
+	pkg_free(node_of);
+
+	idp->matcher = m;
+	idp->build_us = get_time_diff(&begin);
+
+	LM_DBG("dpid %d: %u regex rules (%u not indexed), %u trie nodes, "
+		"built in %u us\n", idp->dp_id, n, m->nodes[0].rules_no, nodes_no,
+		idp->build_us);
+
+	return 0;
+
+error:
+	if (nodes)
+		pkg_free(nodes);
+	if (node_of)
+		pkg_free(node_of);
+	return -1;
+}
+
+
+void dp_destroy_matcher(dpl_id_p idp)
+{
+	if (idp->matcher) {
+		shm_free(idp->matcher);
+		idp->matcher = NULL;
+	}
+}
+
+
+dpl_node_t *dp_matcher_lookup(dpl_matcher_t *m, str *input)
+{
+	/* (pos, end) of the candidate lists on the input's path */
+	unsigned int pos[DP_MATCHER_MAX_PREFIX + 1], end[DP_MATCHER_MAX_PREFIX + 1];
+	unsigned int node, best;
+	dpl_node_p rule;
+	int i, k = 0, min;
+
+	if (m->nodes[0].rules_no) {
+		pos[k] = m->nodes[0].rules;
+		end[k++] = m->nodes[0].rules + m->nodes[0].rules_no;
+	}
+
+	node = m->nodes[0].child;
+	for (i = 0; i < input->len && i < DP_MATCHER_MAX_PREFIX && node; i++) {
+		for ( ; node; node = m->nodes[node].sibling)
+			if (m->nodes[node].c == (unsigned char)input->s[i])
+				break;
+		if (!node)
+			break;
+
+		if (m->nodes[node].rules_no) {
+			pos[k] = m->nodes[node].rules;
+			end[k++] = m->nodes[node].rules + m->nodes[node].rules_no;
+		}
+
+		node = m->nodes[node].child;
+	}
+
+	/* merge the lists, so the rules get tried in their loading order */
+	while (k > 0) {
+		for (i = 1, min = 0; i < k; i++)
+			if (m->cands[pos[i]] < m->cands[pos[min]])
+				min = i;
+
+		best = m->cands[pos[min]];
+		if (++pos[min] == end[min]) {
+			k--;
+			pos[min] = pos[k];
+			end[min] = end[k];
+		}
+
+		rule = m->rules[best];
+
+		if (rule->parsed_timerec &&
+		        tmrec_expr_check(rule->parsed_timerec) < 0) {
+			LM_DBG("Time rule doesn't match: skip next!\n");
+			continue;
+		}
+
+		if (test_match(*input, rule->match_comp, ovector,
+		        DP_MATCHER_OVECTOR) >= 0)
+			return rule;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Compiled matcher for the regex rules of a dialplan id.
+ *
+ * At (re)load time, the literal prefix each regex requires from its input
+ * (e.g. "0049" for "^0049[1-9]") is extracted and the rules are hung on a
+ * trie of these prefixes. A lookup walks the trie once, along the input,
+ * and only runs the regexes of the rules found on its path, in their
+ * original order - so the first match is also the highest priority one.
+ *
+ * Rules without an usable prefix (not anchored, alternations, caseless
+ * letters, etc.) are kept on the root of the trie and are always tried,
+ * exactly like the sequential matching does.
+ */
+
+#ifndef _DP_MATCHER_H
+#define _DP_MATCHER_H
+
+#include "dialplan.h"
+
+/* longest literal prefix indexed for a rule */
+#define DP_MATCHER_MAX_PREFIX  32
+
+typedef struct dpl_trie_node {
+	unsigned int child;     /* first child, 0 if none */
+	unsigned int sibling;   /* next node on the same level, 0 if none */
+	unsigned int rules;     /* first candidate of the node, in "cands" */
+	unsigned int rules_no;
+	unsigned char c;
+} dpl_trie_node_t;
+
+typedef struct dpl_matcher {
+	/* all the regex rules, in matching order */
+	dpl_node_t **rules;
+	unsigned int rules_no;
+	/* indexes in "rules", grouped per trie node and sorted */
+	unsigned int *cands;
+	/* nodes[0] is the root, holding the rules without a prefix */
+	dpl_trie_node_t *nodes;
+	unsigned int nodes_no;
+} dpl_matcher_t;
+
+/* extracts (in @buf, of DP_MATCHER_MAX_PREFIX) the literal string any input
+ * matching the regex must start with; returns its length, 0 if there is no
+ * such (safely detectable) prefix */
+int dp_literal_prefix(str *exp, int flags, char *buf);
+
+/* builds the matcher of a dpid, once all its rules were loaded; on failure,
+ * the dpid is left with the sequential matching */
+int dp_build_matcher(dpl_id_p idp);
+
+void dp_destroy_matcher(dpl_id_p idp);
+
+/* returns the first regex rule matching the input, or NULL */
+dpl_node_t *dp_matcher_lookup(dpl_matcher_t *m, str *input);
+
+#endif
@@ -22,9 +22,12 @@
  *  2007-08-01 initial version (ancuta onofrei)
  */
 
+#include <time.h>
+
 #include "../../re.h"
 #include "../../time_rec.h"
 #include "dialplan.h"
+#include "dp_matcher.h"
 
 #define MAX_REPLACE_WITH	10
 
@@ -276,16 +279,42 @@ error:
 
 #define DP_MAX_ATTRS_LEN	256
 static char dp_attrs_buf[DP_MAX_ATTRS_LEN+1];
+/* accounts a sampled lookup, started at @begin, into the latency histogram */
+static void dp_account_lookup(struct timespec *begin)
+{
+	struct timespec end;
+	long ns, limit;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (end.tv_sec - begin->tv_sec) * 1000000000L +
+		(end.tv_nsec - begin->tv_nsec);
+
+	for (i = 0, limit = 10000; i < DP_LOOKUP_HIST_SIZE - 1 && ns >= limit;
+	        i++, limit *= 10)
+		;
+
+	update_stat(dp_lookup_hist[i], 1);
+}
+
 int translate(struct sip_msg *msg, str input, str * output, dpl_id_p idp, str * attrs) {
 
+	static unsigned int lookups;
 	dpl_node_p rulep, rrulep;
 	int string_res = -1, regexp_res = -1, bucket;
+	struct timespec begin;
+	int sampled;
 
 	if(!input.s || !input.len) {
 		LM_ERR("invalid input string\n");
 		return -1;
 	}
 
+	/* only the sampled lookups read the clock and touch the shared stats */
+	sampled = dp_lookup_sampling && ++lookups % dp_lookup_sampling == 0;
+	if (sampled)
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+
 	bucket = core_case_hash(&input, NULL, DP_INDEX_HASH_SIZE);
 
 	/* try to match the input in the corresponding string bucket */
@@ -321,29 +350,38 @@ int translate(struct sip_msg *msg, str input, str * output, dpl_id_p idp, str *
 		}
 	}
 
-	/* try to match the input in the regexp bucket */
-	for (rrulep = idp->rule_hash[DP_INDEX_HASH_SIZE].first_rule; rrulep; rrulep=rrulep->next) {
-
-		// Check for Time Period if Set
-		if(rrulep->parsed_timerec) {
-			LM_DBG("Timerec exists for rule checking: %.*s\n", rrulep->timerec.len, rrulep->timerec.s);
-			// Doesn't matches time period continue with next rule
-			if(tmrec_expr_check(rrulep->parsed_timerec) < 0) {
-				LM_DBG("Time rule doesn't match: skip next!\n");
-				continue;
+	/* try to match the input against the regexps, via the compiled
+	 * matcher if available */
+	if (idp->matcher) {
+		rrulep = dp_matcher_lookup(idp->matcher, &input);
+		regexp_res = rrulep ? 0 : -1;
+	} else {
+		for (rrulep = idp->rule_hash[DP_INDEX_HASH_SIZE].first_rule; rrulep; rrulep=rrulep->next) {
+
+			// Check for Time Period if Set
+			if(rrulep->parsed_timerec) {
+				LM_DBG("Timerec exists for rule checking: %.*s\n", rrulep->timerec.len, rrulep->timerec.s);
+				// Doesn't matches time period continue with next rule
+				if(tmrec_expr_check(rrulep->parsed_timerec) < 0) {
+					LM_DBG("Time rule doesn't match: skip next!\n");
+					continue;
+				}
 			}
-		}
 
-		regexp_res = (test_match(input, rrulep->match_comp, matches, MAX_MATCHES)
-					>= 0 ? 0 : -1);
+			regexp_res = (test_match(input, rrulep->match_comp, matches, MAX_MATCHES)
+						>= 0 ? 0 : -1);
 
-		LM_DBG("Regex operator testing. Got result: %d\n", regexp_res);
+			LM_DBG("Regex operator testing. Got result: %d\n", regexp_res);
 
-		if (regexp_res == 0) {
-			break;
+			if (regexp_res == 0) {
+				break;
+			}
 		}
 	}
 
+	if (sampled)
+		dp_account_lookup(&begin);
+
 	if (string_res != 0 && regexp_res != 0) {
 		LM_DBG("No matching rule for input %.*s\n", input.len, input.s);
 		return -1;
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <tap.h>
+
+#include "../../../dprint.h"
+#include "../../../mem/shm_mem.h"
+
+#include "../dialplan.h"
+#include "../dp_matcher.h"
+
+#define DP_RAND_INPUTS  20000
+
+static struct {
+	char *exp;
+	int flags;
+	char *prefix;
+} prefix_cases[] = {
+	{"^0049[1-9]", 0, "0049"},
+	{"^0049", 0, "0049"},
+	{"^0049$", 0, "0049"},
+	{"^12.", 0, "12"},
+	{"^1[2]", 0, "1"},
+	{"^1(2)", 0, "1"},
+	/* an optional or repeated last literal */
+	{"^004?9", 0, "00"},
+	{"^00*", 0, "0"},
+	{"^1{2}", 0, ""},
+	{"^1+2", 0, "1"},
+	/* escapes */
+	{"^\\+49", 0, "+49"},
+	{"^\\.\\*1", 0, ".*1"},
+	{"^1\\d", 0, "1"},
+	{"^\\Q12\\E", 0, ""},
+	{"^1\\", 0, "1"},
+	/* alternations, anywhere */
+	{"^00|^11", 0, ""},
+	{"^0(0|1)", 0, ""},
+	/* not anchored */
+	{"0049", 0, ""},
+	{"^", 0, ""},
+	/* caseless letters */
+	{"^abc", DP_CASE_INSENSITIVE, ""},
+	{"^12a", DP_CASE_INSENSITIVE, "12"},
+	{"^abc", 0, "abc"},
+	{"^0123456789012345678901234567890123456789", 0,
+		"01234567890123456789012345678901"},
+};
+
+/* the rules of a dpid, in their matching order */
+static struct {
+	char *exp;
+	int flags;
+} rule_cases[] = {
+	{"^0049[1-9]", 0},
+	{"^00491", 0},
+	{"^\\+49(.*)$", 0},
+	{"^0040|^0041", 0},
+	{"^(00|\\+)33", 0},
+	{"^1?800", 0},
+	{"^1800[0-9]+$", 0},
+	{"^abc", DP_CASE_INSENSITIVE},
+	{"^ABD", 0},
+	{"555$", 0},
+	{"^0{2}44", 0},
+	{"^0*1", 0},
+	{"^\\d{3}$", 0},
+	{"^[+]44", 0},
+	{"^9\\.1", 0},
+	{"^4+9", 0},
+	{"^0049", 0},
+};
+
+static char *inputs[] = {
+	"00491234", "0049", "00490", "+4930", "+49", "00401", "00412", "0033",
+	"+33", "800", "1800", "18001", "1800x", "abc", "ABC", "abD", "ABD",
+	"12555", "0044", "00044", "001", "1", "123", "+44", "9.1", "9x1", "449",
+	"49", "0", "x",
+};
+
+#define RULES_NO  (sizeof rule_cases / sizeof *rule_cases)
+
+
+static void test_literal_prefix(void)
+{
+	char buf[DP_MATCHER_MAX_PREFIX];
+	str exp;
+	int i, len;
+
+	for (i = 0; i < sizeof prefix_cases / sizeof *prefix_cases; i++) {
+		exp.s = prefix_cases[i].exp;
+		exp.len = strlen(exp.s);
+
+		len = dp_literal_prefix(&exp, prefix_cases[i].flags, buf);
+		ok(len == strlen(prefix_cases[i].prefix) &&
+			!memcmp(buf, prefix_cases[i].prefix, len),
+			"dp-prefix '%s' -> '%.*s'", exp.s, len, buf);
+	}
+}
+
+
+/* the first rule to match, as by the sequential scan */
+static dpl_node_t *seq_lookup(dpl_node_t *rules, str *input)
+{
+	int ovector[30];
+
+	for ( ; rules; rules = rules->next)
+		if (test_match(*input, rules->match_comp, ovector, 30) >= 0)
+			return rules;
+
+	return NULL;
+}
+
+static void test_matcher(void)
+{
+	dpl_index_t index[DP_INDEX_HASH_SIZE + 1];
+	dpl_node_t rules[RULES_NO], **last;
+	dpl_id_t idp;
+	char buf[8];
+	str input;
+	int i, j, bad;
+
+	memset(index, 0, sizeof index);
+	memset(rules, 0, sizeof rules);
+	memset(&idp, 0, sizeof idp);
+	idp.rule_hash = index;
+
+	for (i = 0, last = &index[DP_INDEX_HASH_SIZE].first_rule; i < RULES_NO;
+	        i++, last = &(*last)->next) {
+		rules[i].match_exp.s = rule_cases[i].exp;
+		rules[i].match_exp.len = strlen(rule_cases[i].exp);
+		rules[i].match_flags = rule_cases[i].flags;
+		rules[i].matchop = REGEX_OP;
+		rules[i].match_comp = wrap_pcre_compile(rule_cases[i].exp,
+			rule_cases[i].flags);
+		if (!rules[i].match_comp) {
+			ok(0, "dp-matcher-compile %s", rule_cases[i].exp);
+			goto out;
+		}
+		*last = &rules[i];
+	}
+
+	if (!ok(dp_build_matcher(&idp) == 0 && idp.matcher, "dp-matcher-build"))
+		goto out;
+
+	ok(idp.matcher->rules_no == RULES_NO &&
+		/* the alternation, the group, the caseless, the unanchored one,
+		 * the class and the ones with a leading optional literal */
+		idp.matcher->nodes[0].rules_no == 9, "dp-matcher-root-rules");
+
+	for (i = 0; i < sizeof inputs / sizeof *inputs; i++) {
+		input.s = inputs[i];
+		input.len = strlen(inputs[i]);
+		ok(dp_matcher_lookup(idp.matcher, &input) ==
+			seq_lookup(index[DP_INDEX_HASH_SIZE].first_rule, &input),
+			"dp-matcher-same '%s'", inputs[i]);
+	}
+
+	/* random inputs over the alphabet of the rules */
+	for (i = 0, bad = 0; i < DP_RAND_INPUTS; i++) {
+		input.len = 1 + rand() % (sizeof buf - 1);
+		for (j = 0; j < input.len; j++)
+			buf[j] = "0123459+8.abdABD"[rand() % 16];
+		input.s = buf;
+
+		if (dp_matcher_lookup(idp.matcher, &input) !=
+		        seq_lookup(index[DP_INDEX_HASH_SIZE].first_rule, &input)) {
+			LM_ERR("different match for '%.*s'\n", input.len, input.s);
+			bad++;
+		}
+	}
+	ok(bad == 0, "dp-matcher-same-random");
+
+out:
+	dp_destroy_matcher(&idp);
+	for (i = 0; i < RULES_NO; i++)
+		if (rules[i].match_comp)
+			wrap_pcre_free(rules[i].match_comp);
+}
+
+
+void mod_tests(void)
+{
+	test_literal_prefix();
+	test_matcher();
+}
@@ -155,6 +155,10 @@ static void ds_destroy_data_set( ds_data_t *d)
 		shm_free(sp_curr);
 	}
 
+	/* the IP index, with all its nodes */
+	if (d->ip_hash)
+		shm_free(d->ip_hash);
+
 	/* free the data holder */
 	shm_free(d);
 }
@@ -511,6 +515,64 @@ err1:
 }
 
 
+static inline unsigned int ds_ip_hash(struct ip_addr *ip, unsigned int size)
+{
+	str key = {(char *)ip->u.addr, ip->len};
+
+	return core_hash(&key, NULL, size);
+}
+
+
+/* index all the IPs of all the destinations, for a fast ds_is_in_list();
+ * to be called once the destinations are compacted by reindex_dests() */
+static int ds_index_ips( ds_data_t *d_data)
+{
+	ds_set_p sp;
+	ds_ip_node_t *nodes;
+	unsigned int size, n, h;
+	int i, j, k;
+
+	for( n=0,sp=d_data->sets ; sp ; sp=sp->next )
+		for( j=0 ; j<sp->nr ; j++ )
+			n += sp->dlist[j].ips_cnt;
+
+	if (n==0)
+		return 0;
+
+	for( size=16 ; size<n ; size<<=1 );
+
+	d_data->ip_hash = shm_malloc( size*sizeof(ds_ip_node_t*) +
+		n*sizeof(ds_ip_node_t) );
+	if (d_data->ip_hash==NULL) {
+		LM_ERR("no more shm memory for the IP index\n");
+		return -1;
+	}
+	memset( d_data->ip_hash, 0, size*sizeof(ds_ip_node_t*));
+	d_data->ip_hash_size = size;
+	nodes = (ds_ip_node_t*)(d_data->ip_hash + size);
+
+	/* lay out the nodes in the order of the linear scan... */
+	for( n=0,sp=d_data->sets ; sp ; sp=sp->next )
+		for( j=0 ; j<sp->nr ; j++ )
+			for( k=0 ; k<sp->dlist[j].ips_cnt ; k++,n++ ) {
+				nodes[n].ip = &sp->dlist[j].ips[k];
+				nodes[n].port = sp->dlist[j].ports[k];
+				nodes[n].set = sp;
+				nodes[n].dst = &sp->dlist[j];
+			}
+
+	/* ...and keep it inside each bucket, so the first match is the same */
+	for( i=n-1 ; i>=0 ; i-- ) {
+		h = ds_ip_hash( nodes[i].ip, size);
+		nodes[i].next = d_data->ip_hash[h];
+		d_data->ip_hash[h] = &nodes[i];
+	}
+
+	LM_DBG("indexed %u IPs in %u buckets\n", n, size);
+	return 0;
+}
+
+
 /* variables used to generate the pvar name */
 static enum ds_pattern_type ds_pattern_one  = DS_PATTERN_NONE;
 static enum ds_pattern_type ds_pattern_two  = DS_PATTERN_NONE;
@@ -1011,7 +1073,7 @@ void ds_flusher_routine(unsigned int ticks, void* param)
 static ds_data_t* ds_load_data(ds_partition_t *partition)
 {
 	ds_data_t *d_data;
-	int i, id, nr_rows, cnt, nr_cols = 9;
+	int i, id, cnt, nr_cols = 9, no_rows = 10;
 	int state;
 	int weight;
 	int prio;
@@ -1054,105 +1116,132 @@ static ds_data_t* ds_load_data(ds_partition_t *partition)
 	sr_add_report( ds_srg, STR2CI(partition->name),
 		CHAR_INT("starting DB data loading"), 0 /*is_public*/);
 
-	/*select the whole table and all the columns*/
-	if(partition->dbf.query(*partition->db_handle,0,0,0,query_cols,0,nr_cols,
-	0,&res) < 0) {
-		LM_ERR("error while querying database\n");
-		goto error;
+	/* select the whole table and all the columns; if possible, the rows
+	 * are fetched in chunks, so a large table is never entirely held in
+	 * pkg memory */
+	if (DB_CAPABILITY(partition->dbf, DB_CAP_FETCH)) {
+		if(partition->dbf.query(*partition->db_handle,0,0,0,query_cols,0,
+		nr_cols,0,0) < 0) {
+			LM_ERR("error while querying database\n");
+			goto error;
+		}
+		no_rows = estimate_available_rows( 4+64+32+4+128+4+64+4+4, nr_cols);
+		if (no_rows==0) no_rows = 10;
+		if(partition->dbf.fetch_result(*partition->db_handle,&res,no_rows)<0){
+			LM_ERR("error while fetching rows\n");
+			goto error;
+		}
+	} else {
+		if(partition->dbf.query(*partition->db_handle,0,0,0,query_cols,0,
+		nr_cols,0,&res) < 0) {
+			LM_ERR("error while querying database\n");
+			goto error;
+		}
 	}
 
 	cnt = 0;
 
-	nr_rows = RES_ROW_N(res);
-	rows = RES_ROWS(res);
-	if(nr_rows == 0) {
+	if(RES_ROW_N(res) == 0) {
 		LM_WARN("no dispatching data in the db -- empty destination set\n");
 		goto load_done;
 	}
 
-	for(i=0; i<nr_rows; i++) {
+	do {
+		ds_count_loaded_rows(RES_ROW_N(res));
+		rows = RES_ROWS(res);
+		for(i=0; i<RES_ROW_N(res); i++) {
 
-		values = ROW_VALUES(rows+i);
+			values = ROW_VALUES(rows+i);
 
-		/* id */
-		if (VAL_NULL(values)) {
-			LM_ERR("ds ID column cannot be NULL -> skipping\n");
-			discarded_dst++;
-			continue;
-		}
-		id = VAL_INT(values);
-
-		/* uri */
-		get_str_from_dbval( "URI", values+1,
-			1/*not_null*/, 1/*not_empty*/, uri, error2);
-
-		/* sock */
-		get_str_from_dbval( "SOCKET", values+2,
-			0/*not_null*/, 0/*not_empty*/, attrs, error2);
-		if ( attrs.len ) {
-			sock = parse_sock_info(&attrs);
-			if (sock == NULL) {
-				LM_ERR("socket <%.*s> is not local to opensips (we must "
-					"listen on it) -> ignoring it\n", attrs.len, attrs.s);
+			/* id */
+			if (VAL_NULL(values)) {
+				LM_ERR("ds ID column cannot be NULL -> skipping\n");
+				discarded_dst++;
+				continue;
+			}
+			id = VAL_INT(values);
+
+			/* uri */
+			get_str_from_dbval( "URI", values+1,
+				1/*not_null*/, 1/*not_empty*/, uri, error2);
+
+			/* sock */
+			get_str_from_dbval( "SOCKET", values+2,
+				0/*not_null*/, 0/*not_empty*/, attrs, error2);
+			if ( attrs.len ) {
+				sock = parse_sock_info(&attrs);
+				if (sock == NULL) {
+					LM_ERR("socket <%.*s> is not local to opensips (we must "
+						"listen on it) -> ignoring it\n", attrs.len, attrs.s);
+				}
+			} else {
+				sock = NULL;
 			}
-		} else {
-			sock = NULL;
-		}
 
-		weight = 1;
+			weight = 1;
 
-		/* weight */
-		if (values[3].type == DB_INT) {
-			weight = VAL_INT(values+3);
-			memset(&weight_st, 0, sizeof weight_st);
-		} else {
-			/* dynamic weight, given as a communication socket string */
-			get_str_from_dbval("WEIGHT", values+3,
-			                   0/*not_null*/, 0/*not_empty*/, weight_st, error2);
-			if (!is_fs_url(&weight_st)) {
-				if (str2int(&weight_st, (unsigned int *)&weight) < 0)
-					goto error;
+			/* weight */
+			if (values[3].type == DB_INT) {
+				weight = VAL_INT(values+3);
 				memset(&weight_st, 0, sizeof weight_st);
+			} else {
+				/* dynamic weight, given as a communication socket string */
+				get_str_from_dbval("WEIGHT", values+3,
+				                   0/*not_null*/, 0/*not_empty*/, weight_st, error2);
+				if (!is_fs_url(&weight_st)) {
+					if (str2int(&weight_st, (unsigned int *)&weight) < 0)
+						goto error;
+					memset(&weight_st, 0, sizeof weight_st);
+				}
 			}
-		}
 
-		/* attrs */
-		get_str_from_dbval( "ATTRIBUTES", values+4,
-			0/*not_null*/, 0/*not_empty*/, attrs, error2);
+			/* attrs */
+			get_str_from_dbval( "ATTRIBUTES", values+4,
+				0/*not_null*/, 0/*not_empty*/, attrs, error2);
 
-		/* priority */
-		if (VAL_NULL(values+5))
-			prio = 0;
-		else
-			prio = VAL_INT(values+5);
+			/* priority */
+			if (VAL_NULL(values+5))
+				prio = 0;
+			else
+				prio = VAL_INT(values+5);
 
-		/* priority */
-		if (VAL_NULL(values+7))
-			probe_mode = 0;
-		else
-			probe_mode = VAL_INT(values+7);
+			/* priority */
+			if (VAL_NULL(values+7))
+				probe_mode = 0;
+			else
+				probe_mode = VAL_INT(values+7);
 
-		/* state */
-		if (!partition->persistent_state || VAL_NULL(values+8))
-			/* active state */
-			state = 0;
-		else
-			state = VAL_INT(values+8);
+			/* state */
+			if (!partition->persistent_state || VAL_NULL(values+8))
+				/* active state */
+				state = 0;
+			else
+				state = VAL_INT(values+8);
 
-		get_str_from_dbval( "DESCRIPTION", values+6,
-			0/*not_null*/, 0/*not_empty*/, description, error2);
+			get_str_from_dbval( "DESCRIPTION", values+6,
+				0/*not_null*/, 0/*not_empty*/, description, error2);
 
-		if (add_dest2list(id, uri, sock, &weight_st, state, weight, prio,
-				probe_mode, attrs, description, d_data)
-		!= 0) {
-			LM_WARN("failed to add destination <%.*s> in group %d\n",
-				uri.len,uri.s,id);
-			discarded_dst++;
-			continue;
-		} else {
-			cnt++;
+			if (add_dest2list(id, uri, sock, &weight_st, state, weight, prio,
+					probe_mode, attrs, description, d_data)
+			!= 0) {
+				LM_WARN("failed to add destination <%.*s> in group %d\n",
+					uri.len,uri.s,id);
+				discarded_dst++;
+				continue;
+			} else {
+				cnt++;
+			}
 		}
-	}
+
+		if (!DB_CAPABILITY(partition->dbf, DB_CAP_FETCH))
+			break;
+		if(partition->dbf.fetch_result(*partition->db_handle,&res,no_rows)<0){
+			LM_ERR("error while fetching rows\n");
+			if (res)
+				goto error2;
+			goto error;
+		}
+	} while(RES_ROW_N(res)>0);
 
 	if (cnt==0) {
 		LM_WARN("No record loaded from db, running on empty sets\n");
@@ -1161,6 +1250,9 @@ static ds_data_t* ds_load_data(ds_partition_t *partition)
 			LM_ERR("error on reindex\n");
 			goto error2;
 		}
+		/* not fatal, ds_is_in_list() falls back to scanning the sets */
+		if (ds_index_ips( d_data )!=0)
+			LM_WARN("running without the IP index\n");
 	}
 
 load_done:
@@ -1188,6 +1280,7 @@ int ds_reload_db(ds_partition_t *partition, int initial, int is_inherit_state)
 {
 	ds_data_t *old_data;
 	ds_data_t *new_data;
+	struct timeval start;
 
 	if (initial)
 		sr_set_status( ds_srg, STR2CI(partition->name),
@@ -1196,9 +1289,14 @@ int ds_reload_db(ds_partition_t *partition, int initial, int is_inherit_state)
 		sr_set_status( ds_srg, STR2CI(partition->name),
 			SR_STATUS_RELOADING_DATA, CHAR_INT("data re-loading"), 0);
 
+	gettimeofday(&start, NULL);
+	if (__sync_fetch_and_add(&ds_rld_stats->ongoing, 1) == 0)
+		ds_rld_stats->rows = 0;
+
 	new_data = ds_load_data(partition);
 	if (new_data==NULL) {
 		LM_ERR("failed to load the new data, dropping the reload\n");
+		__sync_fetch_and_sub(&ds_rld_stats->ongoing, 1);
 		if (initial)
 			sr_set_status( ds_srg, STR2CI(partition->name), SR_STATUS_NO_DATA,
 				CHAR_INT("no data loaded"), 0);
@@ -1208,8 +1306,27 @@ int ds_reload_db(ds_partition_t *partition, int initial, int is_inherit_state)
 		return -1;
 	}
 
+	/* copy the state of the destinations from the old set (for the
+	 * matching ids) before the new set gets visible - as a reader, so
+	 * the routing is not held back by the merge */
+	if (is_inherit_state) {
+		lock_start_read( partition->lock );
+		old_data = *partition->data;
+		if (old_data)
+			ds_inherit_state( old_data, new_data);
+		lock_stop_read( partition->lock );
+	} else {
+		old_data = NULL;
+	}
+
+	/* waiting for the write access is the grace period of the old data:
+	 * once granted, no reader may still use it */
 	lock_start_write( partition->lock );
 
+	/* a concurrent reload swapped the data in the meantime */
+	if (is_inherit_state && *partition->data != old_data && *partition->data)
+		ds_inherit_state( *partition->data, new_data);
+
 	/* no more activ readers -> do the swapping */
 	old_data = *partition->data;
 	*partition->data = new_data;
@@ -1217,19 +1334,16 @@ int ds_reload_db(ds_partition_t *partition, int initial, int is_inherit_state)
 	lock_stop_write( partition->lock );
 
 	/* destroy old data */
-	if (old_data) {
-		/* copy the state of the destinations from the old set
-		 * (for the matching ids) */
-		if (is_inherit_state) {
-			ds_inherit_state( old_data, new_data);
-		}
-		
+	if (old_data)
 		ds_destroy_data_set( old_data );
-	}
 
 	/* update the Black Lists with the new gateways */
 	populate_ds_bls( new_data->sets, partition->name);
 
+	ds_rld_stats->last_ms = get_time_diff(&start) / 1000;
+	__sync_fetch_and_sub(&ds_rld_stats->ongoing, 1);
+	if_update_stat(ds_reloads_stat, ds_reloads_stat, 1);
+
 	sr_set_status( ds_srg, STR2CI(partition->name), SR_STATUS_READY,
 		CHAR_INT("data available"), 0);
 
@@ -2391,17 +2505,63 @@ int ds_set_state(int group, str *address, int state, int type,
 }
 
 
+/* checks the filters of ds_is_in_list() against a destination matching the
+ * IP and port; returns 1 if the destination is accepted, 0 if filtered out
+ * and -1 on error */
+static inline int ds_is_in_list_dst(struct sip_msg *_m, ds_set_p list,
+		ds_dest_p dst, int set, ds_partition_t *partition, int active_only,
+		char *pattern)
+{
+	pv_value_t val;
+	int_str avp_val;
+
+	if (active_only && !dst_is_active(*dst) )
+		return 0;
+	/* matching pattern - already null terminated :D */
+	if (pattern) {
+		if (!dst->attrs.s)
+			return 0;
+		if (fnmatch(pattern, dst->attrs.s, FNM_PERIOD) != 0)
+			return 0;
+	}
+	if(set==-1 && ds_setid_pvname.s!=0) {
+		memset(&val, 0, sizeof(pv_value_t));
+		val.flags = PV_VAL_INT|PV_TYPE_INT;
+		val.ri = list->id;
+		if(pv_set_value(_m, &ds_setid_pv, (int)EQ_T, &val)<0) {
+			LM_ERR("setting PV failed\n");
+			return -1;
+		}
+	}
+	if (partition->attrs_avp_name>= 0) {
+		avp_val.s = dst->attrs;
+		if(add_avp(AVP_VAL_STR|partition->attrs_avp_type,
+					partition->attrs_avp_name,avp_val)!=0)
+			return -1;
+	}
+
+	if (partition->script_attrs_avp_name>= 0) {
+		avp_val.s = dst->script_attrs;
+		if(add_avp(AVP_VAL_STR|partition->script_attrs_avp_type,
+					partition->script_attrs_avp_name,avp_val)!=0)
+			return -1;
+	}
+
+	return 1;
+}
+
+
 /* Checks, if the request (sip_msg *_m) comes from a host in a set
  * (set-id or -1 for all sets)
  */
 int ds_is_in_list(struct sip_msg *_m, str *_ip, int port, int set,
                   ds_partition_t *partition, int active_only, str *pattern_s)
 {
-	pv_value_t val;
+	ds_data_t *data;
 	ds_set_p list;
+	ds_ip_node_t *node;
 	struct ip_addr *ip;
-	int_str avp_val;
-	int j,k;
+	int j,k,rc = 0;
 	char *pattern = NULL;
 
 	if (!(ip = str2ip(_ip)) && !(ip = str2ip6(_ip))) {
@@ -2419,68 +2579,54 @@ int ds_is_in_list(struct sip_msg *_m, str *_ip, int port, int set,
 		pattern[pattern_s->len] = '\0';
 	}
 
-	memset(&val, 0, sizeof(pv_value_t));
-	val.flags = PV_VAL_INT|PV_TYPE_INT;
-
 	/* access ds data under reader's lock */
 	lock_start_read( partition->lock );
 
-	for(list = (*partition->data)->sets ; list!= NULL; list= list->next) {
+	data = *partition->data;
+
+	if (data->ip_hash) {
+		/* the bucket keeps the order of the sets/destinations/IPs */
+		for (node = data->ip_hash[ds_ip_hash(ip, data->ip_hash_size)];
+		node && rc==0 ; node = node->next) {
+			if ( ((set == -1) || (set == node->set->id)) &&
+			(node->port==0 || port==0 || port==node->port) &&
+			ip_addr_cmp( ip, node->ip) )
+				rc = ds_is_in_list_dst(_m, node->set, node->dst, set,
+					partition, active_only, pattern);
+		}
+		goto done;
+	}
+
+	for(list = data->sets ; list!= NULL && rc==0; list= list->next) {
 		if ((set == -1) || (set == list->id)) {
 			/* interate through all elements/destinations in the list */
-			for(j=0; j<list->nr; j++) {
+			for(j=0; j<list->nr && rc==0; j++) {
 				/* interate through all IPs of each destination */
-				for(k=0 ; k<list->dlist[j].ips_cnt ; k++ ) {
+				for(k=0 ; k<list->dlist[j].ips_cnt && rc==0; k++ ) {
 					if ( (list->dlist[j].ports[k]==0 || port==0
 					|| port==list->dlist[j].ports[k]) &&
 					ip_addr_cmp( ip, &list->dlist[j].ips[k]) ) {
 						/* matching destination */
-						if (active_only && !dst_is_active(list->dlist[j]) )
-							continue;
-						/* matching pattern - already null terminated :D */
-						if (pattern) {
-							if (!list->dlist[j].attrs.s)
-								continue;
-							if (fnmatch(pattern, list->dlist[j].attrs.s, FNM_PERIOD) != 0)
-								continue;
-						}
-						if(set==-1 && ds_setid_pvname.s!=0) {
-							val.ri = list->id;
-							if(pv_set_value(_m, &ds_setid_pv,
-									(int)EQ_T, &val)<0)
-							{
-								LM_ERR("setting PV failed\n");
-								goto error;
-							}
-						}
-						if (partition->attrs_avp_name>= 0) {
-							avp_val.s = list->dlist[j].attrs;
-							if(add_avp(AVP_VAL_STR|partition->attrs_avp_type,
-										partition->attrs_avp_name,avp_val)!=0)
-								goto error;
-						}
-
-						if (partition->script_attrs_avp_name>= 0) {
-							avp_val.s = list->dlist[j].script_attrs;
-							if(add_avp(AVP_VAL_STR|partition->script_attrs_avp_type,
-										partition->script_attrs_avp_name,avp_val)!=0)
-								goto error;
-						}
-
-						lock_stop_read( partition->lock );
-						if (pattern)
-							pkg_free(pattern);
-						return 1;
+						rc = ds_is_in_list_dst(_m, list, &list->dlist[j], set,
+							partition, active_only, pattern);
 					}
 				}
 			}
 		}
 	}
 
-error:
+done:
 	lock_stop_read( partition->lock );
 	if (pattern)
 		pkg_free(pattern);
+
+	if (rc==1) {
+		update_stat(ds_lookup_hits, 1);
+		return 1;
+	}
+
+	if (rc==0)
+		update_stat(ds_lookup_misses, 1);
 	return -1;
 }
 
@@ -32,6 +32,7 @@
 #include "../../db/db.h"
 #include "../../rw_locking.h"
 #include "../../status_report.h"
+#include "../../statistics.h"
 
 #define DS_HASH_USER_ONLY	1  /* use only the uri user part for hashing */
 #define DS_FAILOVER_ON		2  /* store the other dest in avps */
@@ -97,10 +98,24 @@ typedef struct _ds_set
 	struct _ds_set *next;
 } ds_set_t, *ds_set_p;
 
+/* entry of the IP index, pointing to one IP of one destination */
+typedef struct _ds_ip_node
+{
+	struct ip_addr *ip;
+	unsigned short port;
+	ds_set_p set;
+	ds_dest_p dst;
+	struct _ds_ip_node *next;
+} ds_ip_node_t;
+
 typedef struct _ds_data
 {
 	ds_set_t *sets;
 	unsigned int sets_no;
+	/* hash of all the destination IPs, each bucket keeping the order of the
+	 * sets/destinations/IPs lists; NULL if not built */
+	ds_ip_node_t **ip_hash;
+	unsigned int ip_hash_size;
 } ds_data_t;
 
 typedef struct _ds_pvar_param
@@ -212,6 +227,25 @@ extern int max_freeswitch_weight;
 
 extern void *ds_srg;
 
+extern stat_var *ds_lookup_hits;
+extern stat_var *ds_lookup_misses;
+extern stat_var *ds_reloads_stat;
+
+/* progress of the data (re)loading, kept in shm */
+struct ds_reload_stats {
+	int ongoing;             /* partitions being (re)loaded right now */
+	unsigned long rows;      /* DB rows loaded by them, so far */
+	unsigned long last_ms;   /* duration of the last completed reload */
+};
+
+extern struct ds_reload_stats *ds_rld_stats;
+
+#define ds_count_loaded_rows(_n) \
+	do { \
+		if (ds_rld_stats) \
+			__sync_fetch_and_add(&ds_rld_stats->rows, (_n)); \
+	} while (0)
+
 int init_ds_db(ds_partition_t *partition);
 int ds_connect_db(ds_partition_t *partition);
 void ds_disconnect_db(ds_partition_t *partition);
@@ -38,6 +38,7 @@
 #include "../../mem/mem.h"
 #include "../../mod_fix.h"
 #include "../../db/db.h"
+#include "../../ipc.h"
 
 #include "../freeswitch/fs_api.h"
 
@@ -80,6 +81,13 @@ int ds_persistent_state = 1;
 static int ds_persistent_state_enable = 0;
 int_list_t *ds_probing_list = NULL;
 
+/* run the MI triggered reloads in the "DS reloader" process */
+static int ds_bg_reload = 0;
+/* process_no of the reloader, -1 until it is up */
+static int *ds_reloader_pno;
+
+struct ds_reload_stats *ds_rld_stats;
+
 /* db partiton info */
 
 typedef struct _ds_db_head
@@ -330,6 +338,7 @@ static const param_export_t params[]={
 	{"cluster_id",            INT_PARAM, &ds_cluster_id },
 	{"cluster_sharing_tag",   STR_PARAM, &ds_cluster_shtag },
 	{"cluster_probing_mode",  STR_PARAM, &ds_cluster_prob_mode_s},
+	{"reload_in_background",  INT_PARAM, &ds_bg_reload},
 
 	{0,0,0}
 };
@@ -362,7 +371,7 @@ static const mi_export_t mi_cmds[] = {
 		{w_ds_mi_list_1, {"full", "partition", 0}},
 		{EMPTY_MI_RECIPE}}
 	},
-	{ "ds_reload", 0, 0, mi_child_init, {
+	{ "ds_reload", 0, MI_ASYNC_RPL_FLAG, mi_child_init, {
 		{ds_mi_reload, {0}},
 		{ds_mi_reload, {"inherit_state", 0}},
 		{ds_mi_reload_1, {"partition", 0}},
@@ -391,6 +400,43 @@ static const dep_export_t deps = {
 };
 
 /** module exports */
+stat_var *ds_lookup_hits;
+stat_var *ds_lookup_misses;
+stat_var *ds_reloads_stat;
+
+static unsigned long ds_get_reload_ongoing(void *unused)
+{
+	return ds_rld_stats ? ds_rld_stats->ongoing : 0;
+}
+
+static unsigned long ds_get_reload_rows(void *unused)
+{
+	return ds_rld_stats ? ds_rld_stats->rows : 0;
+}
+
+static unsigned long ds_get_reload_duration(void *unused)
+{
+	return ds_rld_stats ? ds_rld_stats->last_ms : 0;
+}
+
+static const stat_export_t mod_stats[] = {
+	{"is_in_list_hits" ,    STAT_SHARDED,   &ds_lookup_hits    },
+	{"is_in_list_misses" ,  STAT_SHARDED,   &ds_lookup_misses  },
+	{"reloads" ,            0,              &ds_reloads_stat   },
+	{"reload_ongoing" ,     STAT_IS_FUNC, (stat_var**)ds_get_reload_ongoing },
+	{"reload_rows" ,        STAT_IS_FUNC, (stat_var**)ds_get_reload_rows    },
+	{"reload_duration_ms" , STAT_IS_FUNC, (stat_var**)ds_get_reload_duration},
+	{0,0,0}
+};
+
+static void ds_reloader_proc(int rank);
+
+static proc_export_t ds_procs[] = {
+	{"DS reloader", 0, 0, ds_reloader_proc, 0,
+		PROC_FLAG_INITCHILD|PROC_FLAG_HAS_IPC},
+	{0,0,0,0,0,0}
+};
+
 struct module_exports exports= {
 	"dispatcher",
 	MOD_TYPE_DEFAULT,/* class of this module */
@@ -401,11 +447,11 @@ struct module_exports exports= {
 	cmds,
 	0,
 	params,
-	0,          /* exported statistics */
+	mod_stats,  /* exported statistics */
 	mi_cmds,    /* exported MI functions */
 	0,          /* exported pseudo-variables */
 	0,			/* exported transformations */
-	0,          /* extra processes */
+	ds_procs,   /* extra processes */
 	0,          /* module pre-initialization function */
 	mod_init,   /* module initialization function */
 	(response_function) 0,
@@ -947,6 +993,18 @@ static int mod_init(void)
 		return E_UNSPEC;
 	}
 
+	ds_rld_stats = shm_malloc(sizeof *ds_rld_stats);
+	ds_reloader_pno = shm_malloc(sizeof *ds_reloader_pno);
+	if (!ds_rld_stats || !ds_reloader_pno) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	memset(ds_rld_stats, 0, sizeof *ds_rld_stats);
+	*ds_reloader_pno = -1;
+
+	/* the reloader process is forked only if needed */
+	ds_procs[0].no = ds_bg_reload ? 1 : 0;
+
 	/* Creating partitions from head */
 	ds_db_head_t *head_it = ds_db_heads;
 	while (head_it){
@@ -1434,17 +1492,18 @@ mi_response_t *w_ds_mi_list_1(const mi_params_t *params,
 	return ds_mi_list(params, full);
 }
 
-mi_response_t *ds_mi_reload(const mi_params_t *params,
-								struct mi_handler *async_hdl)
+/* reloads the given partition, or all of them if NULL */
+static mi_response_t *ds_reload(ds_partition_t *partition,
+												int is_inherit_state)
 {
 	ds_partition_t *part_it;
-	int is_inherit_state = get_mi_bool_like_param(params, "inherit_state", 1);
-
-	LM_DBG("is_inherit_state is: %d \n", is_inherit_state);
 
-	for (part_it = partitions; part_it; part_it = part_it->next)
+	for (part_it = partitions; part_it; part_it = part_it->next) {
+		if (partition && part_it != partition)
+			continue;
 		if (ds_reload_db(part_it, 0, is_inherit_state)<0)
 			return init_mi_error(500, MI_SSTR(MI_ERR_RELOAD));
+	}
 
 	if (ds_cluster_id && ds_cluster_sync() < 0)
 		return init_mi_error(500, MI_SSTR(MI_ERR_RELOAD_SYNC));
@@ -1452,10 +1511,86 @@ mi_response_t *ds_mi_reload(const mi_params_t *params,
 	return init_mi_result_ok();
 }
 
+
+struct ds_reload_job {
+	struct mi_handler *async_hdl;
+	ds_partition_t *partition;  /* NULL for all the partitions */
+	int inherit_state;
+};
+
+static void ds_reloader_proc(int rank)
+{
+	if (mi_child_init() != 0) {
+		LM_ERR("failed to connect to the DB, no reloading possible\n");
+		return;
+	}
+
+	*ds_reloader_pno = process_no;
+
+	/* nothing else to do but to run the reload jobs, one by one */
+	for ( ;; )
+		ipc_handle_job(IPC_FD_READ_SELF);
+}
+
+static void rpc_ds_reload_job(int sender, void *param)
+{
+	struct ds_reload_job *job = (struct ds_reload_job *)param;
+
+	LM_DBG("running the reload requested by process %d\n", sender);
+
+	job->async_hdl->handler_f(ds_reload(job->partition, job->inherit_state),
+		job->async_hdl, 1);
+	shm_free(job);
+}
+
+/* hands the reload over to the reloader process, which replies once done;
+ * returns NULL if the reload is to be done right away, by the caller */
+static mi_response_t *ds_reload_in_bg(ds_partition_t *partition,
+		int is_inherit_state, struct mi_handler *async_hdl)
+{
+	struct ds_reload_job *job;
+
+	if (!ds_bg_reload || !async_hdl || *ds_reloader_pno < 0)
+		return NULL;
+
+	job = shm_malloc(sizeof *job);
+	if (!job) {
+		LM_ERR("no more shm memory\n");
+		return init_mi_error(500, MI_SSTR(MI_ERR_RELOAD));
+	}
+	job->async_hdl = async_hdl;
+	job->partition = partition;
+	job->inherit_state = is_inherit_state;
+
+	if (ipc_send_rpc(*ds_reloader_pno, rpc_ds_reload_job, job) < 0) {
+		LM_ERR("failed to send the reload job\n");
+		shm_free(job);
+		return init_mi_error(500, MI_SSTR(MI_ERR_RELOAD));
+	}
+
+	return MI_ASYNC_RPL;
+}
+
+mi_response_t *ds_mi_reload(const mi_params_t *params,
+								struct mi_handler *async_hdl)
+{
+	mi_response_t *resp;
+	int is_inherit_state = get_mi_bool_like_param(params, "inherit_state", 1);
+
+	LM_DBG("is_inherit_state is: %d \n", is_inherit_state);
+
+	resp = ds_reload_in_bg(NULL, is_inherit_state, async_hdl);
+	if (resp)
+		return resp;
+
+	return ds_reload(NULL, is_inherit_state);
+}
+
 mi_response_t *ds_mi_reload_1(const mi_params_t *params,
 								struct mi_handler *async_hdl)
 {
 	ds_partition_t *partition;
+	mi_response_t *resp;
 	str partname;
 	int is_inherit_state = get_mi_bool_like_param(params, "inherit_state", 1);
 
@@ -1468,13 +1603,12 @@ mi_response_t *ds_mi_reload_1(const mi_params_t *params,
 
 	if (partition == NULL)
 		return init_mi_error(500, MI_SSTR(MI_UNK_PARTITION));
-	if (ds_reload_db(partition, 0, is_inherit_state) < 0)
-		return init_mi_error(500, MI_SSTR(MI_ERR_RELOAD));
-	
-	if (ds_cluster_id && ds_cluster_sync() < 0)
-		return init_mi_error(500, MI_SSTR(MI_ERR_RELOAD_SYNC));
 
-	return init_mi_result_ok();
+	resp = ds_reload_in_bg(partition, is_inherit_state, async_hdl);
+	if (resp)
+		return resp;
+
+	return ds_reload(partition, is_inherit_state);
 }
 
 static int w_ds_is_in_list(struct sip_msg *msg, str *ip, int *port,
@@ -68,13 +68,14 @@ static inline void * get_qr_rule_handle(rt_info_t *rule) {
 
 
 /* Warning this function assumes the lock is already taken */
-rt_info_t* find_rule_by_prefix_unsafe(ptree_t *pt, ptree_node_t *noprefix,
-		str prefix, unsigned int grp_id, unsigned int *matched_len)
+rt_info_t* find_rule_by_prefix_unsafe(ptree_t *pt, ptrie_t *ptrie,
+		ptree_node_t *noprefix, str prefix, unsigned int grp_id,
+		unsigned int *matched_len)
 {
 	int rule_idx = 0;
 	rt_info_t *rt_info;
 
-	rt_info = get_prefix(pt, &prefix, grp_id,matched_len, &rule_idx);
+	rt_info = dr_get_prefix(pt, ptrie, &prefix, grp_id,matched_len, &rule_idx);
 
 	if (rt_info==NULL) {
 		*matched_len = 0;
@@ -111,8 +112,8 @@ static rt_info_t *match_number (dr_head_p partition, unsigned int grp_id,
 		const str *number, unsigned int *matched_len)
 {
 
-	return find_rule_by_prefix_unsafe(partition->pt, &(partition->noprefix),
-			*number, grp_id, matched_len);
+	return find_rule_by_prefix_unsafe(partition->pt, NULL,
+			&(partition->noprefix), *number, grp_id, matched_len);
 }
 
 static dr_head_p create_dr_head(void)
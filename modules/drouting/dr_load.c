@@ -391,6 +391,7 @@ rt_data_t* dr_load_routing_info(struct head_db *part,
 			RES_ROW_N(res), drd_table->len,drd_table->s);
 
 	do {
+		dr_count_loaded_rows(RES_ROW_N(res));
 		for(i=0; i < RES_ROW_N(res); i++) {
 			row = RES_ROWS(res) + i;
 			/* DB ID column */
@@ -546,6 +547,7 @@ rt_data_t* dr_load_routing_info(struct head_db *part,
 		LM_DBG("%d records found in %.*s\n",
 				RES_ROW_N(res), drc_table->len,drc_table->s);
 		do {
+			dr_count_loaded_rows(RES_ROW_N(res));
 			for(i=0; i < RES_ROW_N(res); i++) {
 				row = RES_ROWS(res) + i;
 				/* DB ID column */
@@ -666,6 +668,7 @@ rt_data_t* dr_load_routing_info(struct head_db *part,
 
 		n = 0;
 		do {
+			dr_count_loaded_rows(RES_ROW_N(res));
 			for(i=0; i < RES_ROW_N(res); i++) {
 				row = RES_ROWS(res) + i;
 				/* RULE_ID column */
@@ -801,6 +804,19 @@ rt_data_t* dr_load_routing_info(struct head_db *part,
 			loaded_rl, discarded_rl,
 			 part->partition.len, part->partition.s);
 
+	/* the lookups go through the compiled trie, from now on */
+	if ((rdata->ptrie = compile_prefix_tree(rdata->pt, part->malloc))) {
+		del_tree_nodes(rdata->pt, part->free);
+		rdata->pt = NULL;
+
+		LM_INFO("compiled %u prefixes into a %lu bytes trie in %lu us, "
+			"partition '%.*s'\n", rdata->ptrie->infos_no, rdata->ptrie->size,
+			rdata->ptrie->build_us, part->partition.len, part->partition.s);
+	} else {
+		LM_WARN("failed to compile the prefixes of partition '%.*s', "
+			"using the prefix tree\n", part->partition.len, part->partition.s);
+	}
+
 	/* do the reporting */
 	sr_add_report( dr_srg, STR2CI(part->partition),
 		CHAR_INT("DB data loading successfully completed"), 0 /*is_public*/);
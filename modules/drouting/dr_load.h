@@ -35,4 +35,19 @@ void dr_update_head_cache(struct head_db *head);
 rt_data_t* dr_load_routing_info(struct head_db *current_partition,
 		int persistent_state, str *rules_tables, int rules_no, MD5_CTX *hash_ctx);
 
+/* progress of the data (re)loading, kept in shm */
+struct dr_reload_stats {
+	int ongoing;             /* partitions being (re)loaded right now */
+	unsigned long rows;      /* DB rows loaded by them, so far */
+	unsigned long last_ms;   /* duration of the last completed reload */
+};
+
+extern struct dr_reload_stats *dr_rld_stats;
+
+#define dr_count_loaded_rows(_n) \
+	do { \
+		if (dr_rld_stats) \
+			__sync_fetch_and_add(&dr_rld_stats->rows, (_n)); \
+	} while (0)
+
 #endif
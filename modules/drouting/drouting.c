@@ -67,6 +67,11 @@
 #define MI_HASH_S "Hash"
 #define MI_HASH_LEN (strlen(MI_HASH_S))
 
+#define MI_PREFIXES_S "Prefixes"
+#define MI_TRIE_NODES_S "Trie nodes"
+#define MI_TRIE_MEMORY_S "Trie memory"
+#define MI_TRIE_BUILD_S "Trie build time (us)"
+
 #define MI_DEFAULT_PROBING_STATE	1
 #define MI_PROBING_DISABLED_S "Gateways probing disabled from script"
 
@@ -91,6 +96,14 @@ struct custom_rule_table *custom_rule_tables;
 /* reload controll parametere */
 static int no_concurrent_reload = 0;
 
+/* run the MI triggered reloads in the "DR reloader" process */
+static int dr_bg_reload = 0;
+/* process_no of the reloader, -1 until it is up */
+static int *dr_reloader_pno;
+
+struct dr_reload_stats *dr_rld_stats;
+static stat_var *dr_reloads_stat;
+
 /* generate drouting data md5 & attach that to reload status & status reports */
 static int generate_data_md5 = 0;
 
@@ -513,6 +526,31 @@ static const param_export_t params[] = {
 	{"extra_id_chars",     STR_PARAM, &extra_id_chars.s       },
 	{"gw_socket_filter_mode", STR_PARAM, &gw_sock_filter_s    },
 	{"generate_data_checksum", INT_PARAM, &generate_data_md5       },
+	{"reload_in_background", INT_PARAM, &dr_bg_reload          },
+	{0, 0, 0}
+};
+
+
+static unsigned long dr_get_reload_ongoing(void *unused)
+{
+	return dr_rld_stats ? dr_rld_stats->ongoing : 0;
+}
+
+static unsigned long dr_get_reload_rows(void *unused)
+{
+	return dr_rld_stats ? dr_rld_stats->rows : 0;
+}
+
+static unsigned long dr_get_reload_duration(void *unused)
+{
+	return dr_rld_stats ? dr_rld_stats->last_ms : 0;
+}
+
+static const stat_export_t mod_stats[] = {
+	{"reloads",            0,            &dr_reloads_stat                  },
+	{"reload_ongoing",     STAT_IS_FUNC, (stat_var**)dr_get_reload_ongoing },
+	{"reload_rows",        STAT_IS_FUNC, (stat_var**)dr_get_reload_rows    },
+	{"reload_duration_ms", STAT_IS_FUNC, (stat_var**)dr_get_reload_duration},
 	{0, 0, 0}
 };
 
@@ -540,7 +578,7 @@ static const param_export_t params[] = {
 "value is 0. With no parameter, returns current probing status"
 
 static const mi_export_t mi_cmds[] = {
-	{ "dr_reload", HLP1, 0, 0, {
+	{ "dr_reload", HLP1, MI_ASYNC_RPL_FLAG, 0, {
 		{dr_reload_cmd, {0}},
 		{dr_reload_cmd, {"inherit_state", 0}},
 		{dr_reload_cmd_1, {"partition_name", 0}},
@@ -605,6 +643,14 @@ static const dep_export_t deps = {
 	},
 };
 
+static void dr_reloader_proc(int rank);
+
+static proc_export_t dr_procs[] = {
+	{"DR reloader", 0, 0, dr_reloader_proc, 0,
+		PROC_FLAG_INITCHILD|PROC_FLAG_HAS_IPC},
+	{0,0,0,0,0,0}
+};
+
 struct module_exports exports = {
 	"drouting",
 	MOD_TYPE_DEFAULT,/* class of this module */
@@ -615,11 +661,11 @@ struct module_exports exports = {
 	cmds,            /* Exported functions */
 	0,               /* Exported async functions */
 	params,          /* Exported parameters */
-	0,               /* exported statistics */
+	mod_stats,       /* exported statistics */
 	mi_cmds,         /* exported MI functions */
 	0,               /* exported pseudo-variables */
 	0,			 	 /* exported transformations */
-	0,               /* additional processes */
+	dr_procs,        /* additional processes */
 	0,               /* Module pre-initialization function */
 	dr_init,         /* Module initialization function */
 	(response_function) 0,
@@ -1160,6 +1206,47 @@ static inline int uses_rule_table_query(const struct head_db *dbh, str *query)
 	return 0;
 }
 
+/* copy the state of gw/cr from the old data into the new one */
+static void dr_inherit_state(rt_data_t *old_data, rt_data_t *new_data)
+{
+	pgw_t *gw, *old_gw;
+	pcr_t *cr, *old_cr;
+	void **dest;
+	map_iterator_t it;
+
+	/* interate new gws and search them into old data */
+	for (map_first(new_data->pgw_tree, &it);
+			iterator_is_valid(&it); iterator_next(&it)) {
+		dest = iterator_val(&it);
+		if(dest==NULL)
+			break;
+
+		gw=(pgw_t *)*dest;
+
+		old_gw = get_gw_by_id( old_data->pgw_tree, &gw->id);
+		if (old_gw) {
+			gw->flags &= ~DR_DST_STAT_MASK;
+			gw->flags |= old_gw->flags&DR_DST_STAT_MASK;
+		}
+	}
+	/* interate new crs and search them into old data */
+	for (map_first(new_data->carriers_tree, &it);
+			iterator_is_valid(&it); iterator_next(&it)) {
+		dest = iterator_val(&it);
+		if(dest==NULL)
+			break;
+
+		cr=(pcr_t *)*dest;
+
+		old_cr = get_carrier_by_id( old_data->carriers_tree, &cr->id);
+		if (old_cr) {
+			cr->flags &= ~DR_CR_FLAG_IS_OFF;
+			cr->flags |= old_cr->flags&DR_CR_FLAG_IS_OFF;
+		}
+	}
+}
+
+
 /*
  * if none is successfully loaded return
  * -1, else return 0
@@ -1173,17 +1260,13 @@ static inline int dr_reload_data_head(struct head_db *hd,
 	db_func_t *dr_dbf = &hd->db_funcs;
 	rt_data_t *new_data;
 	rt_data_t *old_data;
-	pgw_t *gw, *old_gw;
-	pcr_t *cr, *old_cr;
 	time_t rawtime;
 	struct dr_prepare_part_params pp;
 	int ret = -1;
 	MD5_CTX Md5Ctx, *ctxp=NULL;
 	HASH bin_md5;
 	char hash_report_data[64];
-
-	void **dest;
-	map_iterator_t it;
+	struct timeval start;
 
 	db_res_t* res = NULL;
 	db_row_t *row = NULL;
@@ -1209,6 +1292,10 @@ static inline int dr_reload_data_head(struct head_db *hd,
 		goto success;
 	}
 
+	gettimeofday(&start, NULL);
+	if (__sync_fetch_and_add(&dr_rld_stats->ongoing, 1) == 0)
+		dr_rld_stats->rows = 0;
+
 	pp.part_name = *part_name;
 	run_dr_cbs(DRCB_RLD_PREPARE_PART, &pp);
 
@@ -1238,7 +1325,7 @@ static inline int dr_reload_data_head(struct head_db *hd,
 
 		if (dr_dbf->raw_query(db_hdl, &rule_table_query, &res) < 0) {
 			LM_ERR("Failed to run raw query to fetch rules tables\n");
-			return -1;
+			goto error;
 		}
 
 		if (RES_ROW_N(res) == 0) {
@@ -1298,10 +1385,31 @@ static inline int dr_reload_data_head(struct head_db *hd,
 		pkg_free(rules_tables);
 	}
 
+	/* copy the state of gw/cr from old data, before the new data gets
+	 * visible, so the routing never runs with the default states; this is
+	 * done as a reader, so the routing is not held back by it */
+	if (is_inherit_state) {
+		lock_start_read( hd->ref_lock );
+		old_data = hd->rdata;
+		if (old_data)
+			dr_inherit_state(old_data, new_data);
+		lock_stop_read( hd->ref_lock );
+	} else {
+		old_data = NULL;
+	}
+
+	/* waiting for the write access is the grace period of the old data:
+	 * once granted, no reader may still use it; only the swapping is done
+	 * under it, the rest happens after */
 	lock_start_write( hd->ref_lock );
 
-	/* no more activ readers -> do the swapping */
+	/* a concurrent reload swapped the data in the meantime */
+	if (is_inherit_state && hd->rdata != old_data && hd->rdata)
+		dr_inherit_state(hd->rdata, new_data);
+
 	old_data = hd->rdata;
+
+	/* no more activ readers -> do the swapping */
 	hd->rdata = new_data;
 	/* update the time of the last reload for the current partition */
 	time(&rawtime);
@@ -1319,49 +1427,16 @@ static inline int dr_reload_data_head(struct head_db *hd,
 	lock_stop_write( (hd->ref_lock) );
 
 	/* destroy old data */
-	if (old_data) {
-		if (is_inherit_state) {
-			/* copy the state of gw/cr from old data */
-			/* interate new gws and search them into old data */
-			for (map_first(new_data->pgw_tree, &it);
-					iterator_is_valid(&it); iterator_next(&it)) {
-				dest = iterator_val(&it);
-				if(dest==NULL)
-					break;
-
-				gw=(pgw_t *)*dest;
-
-				old_gw = get_gw_by_id( old_data->pgw_tree, &gw->id);
-				if (old_gw) {
-					gw->flags &= ~DR_DST_STAT_MASK;
-					gw->flags |= old_gw->flags&DR_DST_STAT_MASK;
-				}
-			}
-			/* interate new crs and search them into old data */
-			for (map_first(new_data->carriers_tree, &it);
-					iterator_is_valid(&it); iterator_next(&it)) {
-				dest = iterator_val(&it);
-				if(dest==NULL)
-					break;
-
-				cr=(pcr_t *)*dest;
-
-
-				old_cr = get_carrier_by_id( old_data->carriers_tree, &cr->id);
-				if (old_cr) {
-					cr->flags &= ~DR_CR_FLAG_IS_OFF;
-					cr->flags |= old_cr->flags&DR_CR_FLAG_IS_OFF;
-				}
-			}
-		}
-
-		/* free old data */
+	if (old_data)
 		free_rt_data(old_data, hd->free);
-	}
 
 	/* generate new blacklist from the routing info */
 	populate_dr_bls(hd->rdata->pgw_tree);
 
+	dr_rld_stats->last_ms = get_time_diff(&start) / 1000;
+	__sync_fetch_and_sub(&dr_rld_stats->ongoing, 1);
+	if_update_stat(dr_reloads_stat, dr_reloads_stat, 1);
+
 success:
 	if (generate_data_md5) {
 		sprintf(hash_report_data,"data available %s",hd->md5);
@@ -1382,6 +1457,7 @@ multi_err2:
 multi_err1:
 	dr_dbf->free_result(db_hdl, res);
 error:
+	__sync_fetch_and_sub(&dr_rld_stats->ongoing, 1);
 	if (initial)
 		sr_set_status( dr_srg, STR2CI(hd->partition), SR_STATUS_NO_DATA,
 			CHAR_INT("no data loaded"), 0);
@@ -1766,6 +1842,18 @@ static int dr_init(void)
 	}
 	*n_partitions = 0;
 
+	dr_rld_stats = shm_malloc(sizeof *dr_rld_stats);
+	dr_reloader_pno = shm_malloc(sizeof *dr_reloader_pno);
+	if (!dr_rld_stats || !dr_reloader_pno) {
+		LM_ERR("oom\n");
+		return -1;
+	}
+	memset(dr_rld_stats, 0, sizeof *dr_rld_stats);
+	*dr_reloader_pno = -1;
+
+	/* the reloader process is forked only if needed */
+	dr_procs[0].no = dr_bg_reload ? 1 : 0;
+
 	drd_table.len = strlen(drd_table.s);
 	drg_table.len = strlen(drg_table.s);
 	drr_table.len = strlen(drr_table.s);
@@ -2386,13 +2474,8 @@ static mi_response_t *mi_dr_get_partition(const mi_params_t *params,
 	return NULL;
 }
 
-mi_response_t *dr_reload_cmd(const mi_params_t *params,
-								struct mi_handler *async_hdl)
+static mi_response_t *dr_reload_all(int is_inherit_state)
 {
-	int is_inherit_state = get_mi_bool_like_param(params, "inherit_state", 1);
-
-	LM_INFO("dr_reload MI command received!\n");
-
 	if (dr_reload_data(0, is_inherit_state) != 0) {
 		LM_CRIT("failed to load routing data\n");
 		return init_mi_error(500, MI_SSTR("Failed to reload"));
@@ -2404,19 +2487,9 @@ mi_response_t *dr_reload_cmd(const mi_params_t *params,
 	return init_mi_result_ok();
 }
 
-mi_response_t *dr_reload_cmd_1(const mi_params_t *params,
-								struct mi_handler *async_hdl)
+static mi_response_t *dr_reload_part(struct head_db *part,
+											int is_inherit_state)
 {
-	struct head_db *part;
-	mi_response_t *resp;
-	int is_inherit_state = get_mi_bool_like_param(params, "inherit_state", 1);
-
-	LM_INFO("dr_reload MI command received!\n");
-
-	resp = mi_dr_get_partition(params, &part);
-	if (resp)
-		return resp;
-
 	switch (dr_reload_data_head(part, &part->partition, 0, is_inherit_state)) {
 		case 0:
 			/* all good, fallback to reloading */
@@ -2443,6 +2516,101 @@ mi_response_t *dr_reload_cmd_1(const mi_params_t *params,
 }
 
 
+struct dr_reload_job {
+	struct mi_handler *async_hdl;
+	struct head_db *part;  /* NULL for all the partitions */
+	int inherit_state;
+};
+
+static void dr_reloader_proc(int rank)
+{
+	*dr_reloader_pno = process_no;
+
+	/* nothing else to do but to run the reload jobs, one by one */
+	for ( ;; )
+		ipc_handle_job(IPC_FD_READ_SELF);
+}
+
+static void rpc_dr_reload_job(int sender, void *param)
+{
+	struct dr_reload_job *job = (struct dr_reload_job *)param;
+	mi_response_t *resp;
+
+	LM_DBG("running the reload requested by process %d\n", sender);
+
+	if (job->part)
+		resp = dr_reload_part(job->part, job->inherit_state);
+	else
+		resp = dr_reload_all(job->inherit_state);
+
+	job->async_hdl->handler_f(resp, job->async_hdl, 1);
+	shm_free(job);
+}
+
+/* hands the reload over to the reloader process, which replies once done;
+ * returns NULL if the reload is to be done right away, by the caller */
+static mi_response_t *dr_reload_in_bg(struct head_db *part,
+		int is_inherit_state, struct mi_handler *async_hdl)
+{
+	struct dr_reload_job *job;
+
+	if (!dr_bg_reload || !async_hdl || *dr_reloader_pno < 0)
+		return NULL;
+
+	job = shm_malloc(sizeof *job);
+	if (!job) {
+		LM_ERR("no more shm memory\n");
+		return init_mi_error(500, MI_SSTR("Internal error"));
+	}
+	job->async_hdl = async_hdl;
+	job->part = part;
+	job->inherit_state = is_inherit_state;
+
+	if (ipc_send_rpc(*dr_reloader_pno, rpc_dr_reload_job, job) < 0) {
+		LM_ERR("failed to send the reload job\n");
+		shm_free(job);
+		return init_mi_error(500, MI_SSTR("Failed to reload"));
+	}
+
+	return MI_ASYNC_RPL;
+}
+
+mi_response_t *dr_reload_cmd(const mi_params_t *params,
+								struct mi_handler *async_hdl)
+{
+	mi_response_t *resp;
+	int is_inherit_state = get_mi_bool_like_param(params, "inherit_state", 1);
+
+	LM_INFO("dr_reload MI command received!\n");
+
+	resp = dr_reload_in_bg(NULL, is_inherit_state, async_hdl);
+	if (resp)
+		return resp;
+
+	return dr_reload_all(is_inherit_state);
+}
+
+mi_response_t *dr_reload_cmd_1(const mi_params_t *params,
+								struct mi_handler *async_hdl)
+{
+	struct head_db *part;
+	mi_response_t *resp;
+	int is_inherit_state = get_mi_bool_like_param(params, "inherit_state", 1);
+
+	LM_INFO("dr_reload MI command received!\n");
+
+	resp = mi_dr_get_partition(params, &part);
+	if (resp)
+		return resp;
+
+	resp = dr_reload_in_bg(part, is_inherit_state, async_hdl);
+	if (resp)
+		return resp;
+
+	return dr_reload_part(part, is_inherit_state);
+}
+
+
 static inline int get_group_id(struct sip_uri *uri, struct head_db *
 		current_partition)
 {
@@ -3401,7 +3569,8 @@ search_again:
 	}
 
 	/* search a prefix */
-	rt_info = get_prefix(current_partition->rdata->pt, &username,
+	rt_info = dr_get_prefix(current_partition->rdata->pt,
+			current_partition->rdata->ptrie, &username,
 			(unsigned int)grp,&prefix_len, &rule_idx);
 
 	if (flags & DR_PARAM_STRICT_LEN) {
@@ -4522,7 +4691,7 @@ static int dr_match(struct sip_msg* msg, int *grp, long flags, str *number,
 
 	lock_start_read( part->ref_lock );
 
-	rule = find_rule_by_prefix_unsafe(part->rdata->pt,
+	rule = find_rule_by_prefix_unsafe(part->rdata->pt, part->rdata->ptrie,
 			&part->rdata->noprefix, *number, *grp, &matched_len);
 	if (rule == NULL){
 		goto failure;
@@ -5260,7 +5429,8 @@ mi_response_t *mi_dr_number_routing(const mi_params_t *params,
 	lock_start_read( partition->ref_lock );
 
 	route = find_rule_by_prefix_unsafe(partition->rdata->pt,
-			&partition->rdata->noprefix, number, grp_id, &matched_len);
+			partition->rdata->ptrie, &partition->rdata->noprefix, number,
+			grp_id, &matched_len);
 	if (route == NULL){
 		lock_stop_read( partition->ref_lock );
 		return init_mi_result_string(MI_SSTR("No match"));
@@ -5373,6 +5543,7 @@ static int mi_dr_print_rld_status(mi_item_t *part_item, struct head_db * partiti
 							int with_name)
 {
 	char ch_time[26];
+	ptrie_t *t;
 
 	lock_start_read(partition->ref_lock);
 
@@ -5392,6 +5563,17 @@ static int mi_dr_print_rld_status(mi_item_t *part_item, struct head_db * partiti
 	if (generate_data_md5 && add_mi_string(part_item,MI_SSTR(MI_HASH_S),partition->md5,strlen(partition->md5)) < 0)
 		goto error;
 
+	if (partition->rdata && (t = partition->rdata->ptrie)) {
+		if (add_mi_number(part_item, MI_SSTR(MI_PREFIXES_S), t->infos_no) < 0)
+			goto error;
+		if (add_mi_number(part_item, MI_SSTR(MI_TRIE_NODES_S), t->nodes_no) < 0)
+			goto error;
+		if (add_mi_number(part_item, MI_SSTR(MI_TRIE_MEMORY_S), t->size) < 0)
+			goto error;
+		if (add_mi_number(part_item, MI_SSTR(MI_TRIE_BUILD_S), t->build_us) < 0)
+			goto error;
+	}
+
 	lock_stop_read(partition->ref_lock);
 
 	return 0;
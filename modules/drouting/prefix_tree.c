@@ -24,6 +24,7 @@
 #include <stdio.h>
 
 #include "../../str.h"
+#include "../../ut.h"
 #include "../../mem/shm_mem.h"
 
 #include "prefix_tree.h"
@@ -35,6 +36,7 @@ extern int unode;
 
 #define DR_PREFIX_ARRAY_SIZE 128
 static signed char *dr_char2idx = NULL;
+static char dr_idx2char[DR_PREFIX_ARRAY_SIZE];
 
 /* number of children under a prefix node */
 int ptree_children = 0;
@@ -59,8 +61,10 @@ int init_prefix_tree( char *extra_prefix_chars )
 	memset( dr_char2idx, -1, DR_PREFIX_ARRAY_SIZE * sizeof(char));
 
 	/* init the arrary with the '0'..'9' range */
-	for( i='0' ; i<='9' ; i++)
+	for( i='0' ; i<='9' ; i++) {
+		dr_idx2char[ptree_children] = i;
 		dr_char2idx[i] = ptree_children++;
+	}
 
 	/* and now the extras */
 	if (extra_prefix_chars) {
@@ -71,6 +75,7 @@ int init_prefix_tree( char *extra_prefix_chars )
 					DR_PREFIX_ARRAY_SIZE);
 				continue;
 			}
+			dr_idx2char[ptree_children] = extra_prefix_chars[i];
 			IDX_OF_CHAR( extra_prefix_chars[i] ) = ptree_children++;
 		}
 	}
@@ -202,6 +207,67 @@ err_exit:
 	return NULL;
 }
 
+rt_info_t*
+get_prefix_ptrie(
+	ptrie_t *ptrie,
+	str* prefix,
+	unsigned int rgid,
+	unsigned int *matched_len,
+	int *rgidx
+	)
+{
+	ptrie_node_t *nodes, *n, *kid;
+	rt_info_t *rt;
+	char *p, *end, *label;
+	unsigned int i, k, len, up;
+
+	if(NULL == ptrie || NULL == prefix || prefix->len == 0 || NULL == prefix->s)
+		return NULL;
+
+	nodes = ptrie->nodes;
+	n = nodes;
+	p = prefix->s;
+	end = prefix->s + prefix->len;
+
+	/* go down as long as the prefix string matches; as get_prefix() does,
+	 * fail on an unknown char only if the tree goes on beyond it */
+	while (p < end && n->kids_no) {
+		kid = nodes + n->kids;
+		for (i = n->kids_no; i && kid->first != (unsigned char)*p; i--, kid++);
+		if (i == 0) {
+			if (!IS_VALID_PREFIX_CHAR(*p))
+				return NULL;
+			break;
+		}
+
+		len = kid->depth - n->depth;
+		label = ptrie->labels + kid->label;
+		for (k = 1; k < len && p + k < end && label[k] == p[k]; k++);
+		if (k < len) {
+			if (p + k < end && !IS_VALID_PREFIX_CHAR(p[k]))
+				return NULL;
+			break;
+		}
+
+		p += len;
+		n = kid;
+	}
+
+	/* go up, through the nodes with routing info only */
+	for (up = (n->info != PTRIE_NONE) ? n - nodes : n->up; up != PTRIE_NONE;
+	        up = n->up) {
+		n = nodes + up;
+		rt = internal_check_rt(&ptrie->infos[n->info], rgid, rgidx);
+		if (rt) {
+			if (matched_len) *matched_len = n->depth;
+			return rt;
+		}
+	}
+
+	if (matched_len) *matched_len = 0;
+	return NULL;
+}
+
 pgw_t*
 get_gw_by_internal_id(
 		map_t gw_tree,
@@ -341,6 +407,205 @@ exit:
 	return 0;
 }
 
+void
+del_tree_nodes(
+		ptree_t* t,
+		osips_free_f free_f
+		)
+{
+	int i;
+
+	if(NULL == t)
+		return;
+	for(i=0; i< ptree_children; i++)
+		if(t->ptnode[i].next != NULL)
+			del_tree_nodes(t->ptnode[i].next, free_f);
+	func_free(free_f, t);
+}
+
+
+/* compiling the prefix tree into a ptrie */
+
+struct ptrie_build {
+	ptrie_t *t;
+	unsigned int nodes;
+	unsigned int infos;
+	unsigned int labels;
+};
+
+#define PTREE_SLOT_USED(_pt, _i) \
+	((_pt)->ptnode[_i].rg || (_pt)->ptnode[_i].next)
+
+/* follows the chain of single child slots starting with the slot @i of @pt,
+ * up to a slot with routing info or with several children; the chars along
+ * the way are written into @label, if given
+ * returns the length of the chain, with @pt and @i set to its last slot */
+static int ptrie_edge(ptree_t **pt, int *i, char *label)
+{
+	ptree_t *sub;
+	int j, kid, len = 0;
+
+	for (;;) {
+		if (label)
+			label[len] = dr_idx2char[*i];
+		len++;
+
+		sub = (*pt)->ptnode[*i].next;
+		if ((*pt)->ptnode[*i].rg || !sub)
+			return len;
+
+		for (j = 0, kid = -1; j < ptree_children; j++)
+			if (PTREE_SLOT_USED(sub, j)) {
+				if (kid >= 0)
+					return len;
+				kid = j;
+			}
+		if (kid < 0)
+			return len;
+
+		*pt = sub;
+		*i = kid;
+	}
+}
+
+static void ptrie_count(ptree_t *pt, struct ptrie_build *b)
+{
+	ptree_t *last;
+	int i, j;
+
+	for (i = 0; i < ptree_children; i++) {
+		if (!PTREE_SLOT_USED(pt, i))
+			continue;
+
+		last = pt;
+		j = i;
+		b->labels += ptrie_edge(&last, &j, NULL);
+		b->nodes++;
+		if (last->ptnode[j].rg)
+			b->infos++;
+		if (last->ptnode[j].next)
+			ptrie_count(last->ptnode[j].next, b);
+	}
+}
+
+/* adds the children of node @k, as found under @pt */
+static void ptrie_fill(ptree_t *pt, unsigned int k, struct ptrie_build *b)
+{
+	ptrie_node_t *nodes = b->t->nodes, *kid;
+	ptree_t *last;
+	unsigned int first;
+	int i, j;
+
+	first = b->nodes;
+	nodes[k].kids = first;
+	for (i = 0; i < ptree_children; i++)
+		if (PTREE_SLOT_USED(pt, i))
+			nodes[k].kids_no++;
+	b->nodes += nodes[k].kids_no;
+
+	/* the children are laid out together, then each one gets its own */
+	for (i = 0, kid = nodes + first; i < ptree_children; i++) {
+		if (!PTREE_SLOT_USED(pt, i))
+			continue;
+
+		last = pt;
+		j = i;
+		kid->label = b->labels;
+		kid->depth = nodes[k].depth +
+			ptrie_edge(&last, &j, b->t->labels + b->labels);
+		b->labels += kid->depth - nodes[k].depth;
+		kid->first = (unsigned char)b->t->labels[kid->label];
+		kid->up = (nodes[k].info != PTRIE_NONE) ? k : nodes[k].up;
+		if (last->ptnode[j].rg) {
+			kid->info = b->infos++;
+			b->t->infos[kid->info] = last->ptnode[j];
+			b->t->infos[kid->info].next = NULL;
+		} else {
+			kid->info = PTRIE_NONE;
+		}
+
+		if (last->ptnode[j].next)
+			ptrie_fill(last->ptnode[j].next, kid - nodes, b);
+		else
+			kid->kids = kid - nodes;
+		kid++;
+	}
+}
+
+ptrie_t*
+compile_prefix_tree(
+		ptree_t *ptree,
+		osips_malloc_f malloc_f
+		)
+{
+	struct ptrie_build b;
+	struct timeval start;
+	unsigned long size;
+	ptrie_t *t;
+
+	gettimeofday(&start, NULL);
+
+	/* 1st pass: the sizes */
+	memset(&b, 0, sizeof b);
+	b.nodes = 1;
+	if (ptree)
+		ptrie_count(ptree, &b);
+
+	size = sizeof *t + b.infos * sizeof(ptree_node_t) +
+		b.nodes * sizeof(ptrie_node_t) + b.labels;
+	t = func_malloc(malloc_f, size);
+	if (!t) {
+		LM_ERR("no more memory for a %lu bytes prefix trie\n", size);
+		return NULL;
+	}
+	memset(t, 0, size);
+
+	t->infos = (ptree_node_t *)(t + 1);
+	t->nodes = (ptrie_node_t *)(t->infos + b.infos);
+	t->labels = (char *)(t->nodes + b.nodes);
+	t->nodes_no = b.nodes;
+	t->infos_no = b.infos;
+	t->size = size;
+
+	/* 2nd pass: the root and, recursively, all its descendants */
+	memset(&b, 0, sizeof b);
+	b.t = t;
+	b.nodes = 1;
+	t->nodes[0].info = t->nodes[0].up = PTRIE_NONE;
+	if (ptree)
+		ptrie_fill(ptree, 0, &b);
+
+	t->build_us = get_time_diff(&start);
+
+	LM_DBG("compiled %u prefixes into %u nodes, %lu bytes, in %lu us\n",
+		t->infos_no, t->nodes_no, t->size, t->build_us);
+
+	return t;
+}
+
+void
+del_ptrie(
+		ptrie_t *t,
+		osips_free_f free_f
+		)
+{
+	ptree_node_t *info;
+	unsigned int i;
+	int j;
+
+	if(NULL == t)
+		return;
+
+	for (i = 0; i < t->infos_no; i++) {
+		info = &t->infos[i];
+		for(j=0;j<info->rg_pos;j++)
+			if(info->rg[j].rtlw !=NULL)
+				del_rt_list(info->rg[j].rtlw, free_f);
+		func_free(free_f, info->rg);
+	}
+	func_free(free_f, t);
+}
+
 void
 del_rt_list(
 		rt_info_wrp_t *rwl,
@@ -167,6 +167,40 @@ typedef struct ptree_ {
 	ptree_node_t *ptnode;
 } ptree_t;
 
+/* compiled, read-only form of a prefix tree: a path compressed trie held
+ * in a single memory block, where the children of a node are adjacent and
+ * each node links the closest ancestor holding routing info */
+#define PTRIE_NONE ((unsigned int)-1)
+
+typedef struct ptrie_node_ {
+	/* offset of the edge chars within the labels */
+	unsigned int label;
+	/* index of the first child */
+	unsigned int kids;
+	/* index of the routing info ending here, or PTRIE_NONE */
+	unsigned int info;
+	/* closest ancestor with routing info, or PTRIE_NONE */
+	unsigned int up;
+	/* length of the prefix ending here */
+	unsigned short depth;
+	/* first char of the edge */
+	unsigned char first;
+	unsigned char kids_no;
+} ptrie_node_t;
+
+typedef struct ptrie_ {
+	ptrie_node_t *nodes;
+	/* the routing groups of the prefixes (only rg & rg_pos are used) */
+	ptree_node_t *infos;
+	char *labels;
+	unsigned int nodes_no;
+	unsigned int infos_no;
+	/* whole size of the block, in bytes */
+	unsigned long size;
+	/* time spent compiling it, in microseconds */
+	unsigned long build_us;
+} ptrie_t;
+
 
 
 int
@@ -207,6 +241,52 @@ get_prefix(
 	int *rgidx
 	);
 
+/* builds the trie out of a fully loaded tree; the routing groups are then
+ * owned by the trie, so the tree is to be freed with del_tree_nodes() */
+ptrie_t*
+compile_prefix_tree(
+	ptree_t *ptree,
+	osips_malloc_f
+	);
+
+/* same as get_prefix(), over the compiled trie */
+rt_info_t*
+get_prefix_ptrie(
+	ptrie_t *ptrie,
+	str* prefix,
+	unsigned int rgid,
+	unsigned int *matched_len,
+	int *rgidx
+	);
+
+void
+del_tree_nodes(
+	ptree_t *,
+	osips_free_f
+	);
+
+void
+del_ptrie(
+	ptrie_t *,
+	osips_free_f
+	);
+
+static inline rt_info_t*
+dr_get_prefix(
+	ptree_t *ptree,
+	ptrie_t *ptrie,
+	str* prefix,
+	unsigned int rgid,
+	unsigned int *matched_len,
+	int *rgidx
+	)
+{
+	if (ptrie)
+		return get_prefix_ptrie(ptrie, prefix, rgid, matched_len, rgidx);
+
+	return get_prefix(ptree, prefix, rgid, matched_len, rgidx);
+}
+
 int
 add_rt_info(
 	ptree_node_t*,
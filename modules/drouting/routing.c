@@ -805,6 +805,8 @@ free_rt_data(
 		/* del prefix tree */
 		del_tree(rt_data->pt, free_f);
 		rt_data->pt = 0 ;
+		del_ptrie(rt_data->ptrie, free_f);
+		rt_data->ptrie = 0 ;
 		/* del prefixless rules */
 		if(NULL!=rt_data->noprefix.rg) {
 			for(j=0;j<rt_data->noprefix.rg_pos;j++) {
@@ -55,8 +55,10 @@ typedef struct rt_data_ {
 
 	/* default routing list for prefixless rules */
 	ptree_node_t noprefix;
-	/* tree with routing prefixes */
+	/* tree with routing prefixes, while loading */
 	ptree_t *pt;
+	/* compiled form of the tree, used for the lookups once loaded */
+	ptrie_t *ptrie;
 }rt_data_t;
 
 typedef struct _dr_group {
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <tap.h>
+
+#include "../../../dprint.h"
+#include "../../../mem/shm_mem.h"
+#include "../../../test/ut.h"
+
+#include "../prefix_tree.h"
+
+#define PT_PREFIXES   100000
+#define PT_GROUPS     3
+#define PT_LOOKUPS    200000
+#define PT_BENCH_LOOPS 5
+
+static char pt_numbers[PT_LOOKUPS][20];
+
+
+static ptree_t *build_tree(int prefixes, int *rules)
+{
+	ptree_t *pt = NULL;
+	rt_info_t *r;
+	char buf[16];
+	str prefix;
+	int i, j;
+
+	INIT_PTREE_NODE(shm_malloc_func, NULL, pt);
+
+	for (i = 0; i < prefixes; i++) {
+		/* national-like prefixes, denser on the short lengths */
+		prefix.len = 1 + rand() % (1 + rand() % 12);
+		for (j = 0; j < prefix.len; j++)
+			buf[j] = '0' + rand() % 10;
+		prefix.s = buf;
+
+		r = shm_malloc(sizeof *r);
+		if (!r)
+			goto err_exit;
+		memset(r, 0, sizeof *r);
+		r->id = i;
+		r->priority = rand() % 4;
+
+		if (add_prefix(pt, &prefix, r, 1 + rand() % PT_GROUPS,
+		        shm_malloc_func, shm_free_func) < 0) {
+			shm_free(r);
+			goto err_exit;
+		}
+		(*rules)++;
+	}
+
+	return pt;
+err_exit:
+	return pt;
+}
+
+
+static unsigned long tree_mem(ptree_t *pt)
+{
+	unsigned long size = sizeof *pt + ptree_children * sizeof *pt->ptnode;
+	int i;
+
+	for (i = 0; i < ptree_children; i++)
+		if (pt->ptnode[i].next)
+			size += tree_mem(pt->ptnode[i].next);
+
+	return size;
+}
+
+
+static void test_ptrie_lookups(ptree_t *pt, ptrie_t *trie)
+{
+	rt_info_t *r1, *r2;
+	unsigned int l1, l2, grp;
+	int i, n, idx1, idx2, bad = 0, found = 0;
+	str number;
+
+	for (i = 0; i < PT_LOOKUPS; i++) {
+		number.s = pt_numbers[i];
+		number.len = strlen(number.s);
+		grp = 1 + i % (PT_GROUPS + 1);
+
+		/* all the rules, on all the matching prefixes, in the same order */
+		idx1 = idx2 = 0;
+		for (n = 0; n < 64; n++) {
+			l1 = l2 = 12345;
+			r1 = get_prefix(pt, &number, grp, &l1, &idx1);
+			r2 = get_prefix_ptrie(trie, &number, grp, &l2, &idx2);
+			if (r1 != r2 || idx1 != idx2 || (r1 && l1 != l2)) {
+				bad++;
+				break;
+			}
+			if (!r1)
+				break;
+			found++;
+			if (idx1 == 0) {
+				/* the next shorter prefix */
+				if (--l1 == 0)
+					break;
+				number.len = l1;
+			}
+		}
+	}
+
+	ok(bad == 0, "ptrie-lookups (%d matches)", found);
+}
+
+
+static void test_ptrie_edges(void)
+{
+	ptree_t *pt = NULL;
+	ptrie_t *trie;
+	rt_info_t r[3];
+	str p1 = str_init("1234"), p2 = str_init("12"), p3 = str_init("1299");
+	str n;
+	unsigned int len;
+	int idx;
+
+	memset(r, 0, sizeof r);
+	INIT_PTREE_NODE(shm_malloc_func, NULL, pt);
+	add_prefix(pt, &p1, &r[0], 1, shm_malloc_func, shm_free_func);
+	add_prefix(pt, &p2, &r[1], 1, shm_malloc_func, shm_free_func);
+	add_prefix(pt, &p3, &r[2], 2, shm_malloc_func, shm_free_func);
+
+	trie = compile_prefix_tree(pt, shm_malloc_func);
+	if (!ok(trie != NULL, "ptrie-compile"))
+		goto err_exit;
+
+	/* 3 prefixes, 2 + 1 nodes for the edges, as "12" splits */
+	ok(trie->infos_no == 3 && trie->nodes_no == 4, "ptrie-nodes");
+
+	idx = 0; n.s = "123456"; n.len = 6;
+	ok(get_prefix_ptrie(trie, &n, 1, &len, &idx) == &r[0] && len == 4,
+		"ptrie-longest");
+	idx = 0; n.len = 3;
+	ok(get_prefix_ptrie(trie, &n, 1, &len, &idx) == &r[1] && len == 2,
+		"ptrie-mid-edge");
+	idx = 0; n.s = "1299"; n.len = 4;
+	ok(get_prefix_ptrie(trie, &n, 1, &len, &idx) == &r[1] && len == 2,
+		"ptrie-other-group");
+	/* unknown chars fail the lookup only while still in the tree */
+	idx = 0; n.s = "12a"; n.len = 3;
+	ok(get_prefix_ptrie(trie, &n, 1, &len, &idx) == NULL &&
+		get_prefix(pt, &n, 1, &len, &idx) == NULL, "ptrie-bad-char");
+	idx = 0; n.s = "1234a"; n.len = 5;
+	ok(get_prefix_ptrie(trie, &n, 1, &len, &idx) == &r[0] &&
+		get_prefix(pt, &n, 1, &len, &idx) == &r[0], "ptrie-bad-char-leaf");
+	idx = 0; n.s = "9"; n.len = 1;
+	ok(get_prefix_ptrie(trie, &n, 1, &len, &idx) == NULL && len == 0,
+		"ptrie-no-match");
+
+	/* the rules are static here */
+	shm_free(trie);
+	del_tree_nodes(pt, shm_free_func);
+err_exit:
+	return;
+}
+
+
+static long time_lookups(ptree_t *pt, ptrie_t *trie)
+{
+	unsigned int len;
+	int i, j, idx;
+	long begin;
+	str number;
+
+	begin = ut_now_ns();
+	for (j = 0; j < PT_BENCH_LOOPS; j++)
+		for (i = 0; i < PT_LOOKUPS; i++) {
+			number.s = pt_numbers[i];
+			number.len = 11;
+			idx = 0;
+			if (trie)
+				get_prefix_ptrie(trie, &number, 1, &len, &idx);
+			else
+				get_prefix(pt, &number, 1, &len, &idx);
+		}
+
+	return (ut_now_ns() - begin) / (PT_BENCH_LOOPS * PT_LOOKUPS);
+}
+
+
+static void test_ptrie(int bench)
+{
+	ptree_t *pt;
+	ptrie_t *trie;
+	int i, j, rules = 0;
+
+	srand(1);
+	for (i = 0; i < PT_LOOKUPS; i++) {
+		for (j = 0; j < 11; j++)
+			pt_numbers[i][j] = '0' + rand() % 10;
+		pt_numbers[i][j] = 0;
+	}
+
+	pt = build_tree(bench ? PT_PREFIXES : PT_PREFIXES / 100, &rules);
+	if (!ok(pt != NULL, "ptrie-build-tree"))
+		return;
+
+	trie = compile_prefix_tree(pt, shm_malloc_func);
+	if (!ok(trie != NULL, "ptrie-compile-tree"))
+		return;
+
+	test_ptrie_lookups(pt, trie);
+
+	if (bench)
+		diag("%d rules, %u prefixes: tree %lu bytes, %ld ns/lookup; "
+			"trie %lu bytes (%u nodes, built in %lu us), %ld ns/lookup",
+			rules, trie->infos_no, tree_mem(pt), time_lookups(pt, NULL),
+			trie->size, trie->nodes_no, trie->build_us,
+			time_lookups(pt, trie));
+
+	/* the routing info now belongs to the trie */
+	del_tree_nodes(pt, shm_free_func);
+	del_ptrie(trie, shm_free_func);
+}
+
+
+void mod_tests(void)
+{
+	test_ptrie_edges();
+	test_ptrie(0);
+	/* memory and lookup time, tree vs. trie, on PT_PREFIXES prefixes */
+	//test_ptrie(1);
+}
@@ -63,6 +63,8 @@
 #include "../../data_lump_rpl.h"
 #include "../../forward.h"
 #include "../../timer.h"
+#include "../../statistics.h"
+#include "../../net/net_udp.h"
 #include "../../msg_translator.h"
 #include "../../socket_info.h"
 #include "../../mod_fix.h"
@@ -122,7 +124,7 @@ static int fix_nated_register_f(struct sip_msg *, char *, char *);
 static int add_rcv_param_f(struct sip_msg* msg, int *flag);
 static int get_oldip_fields_value(modparam_t type, void* val);
 
-static void nh_timer(unsigned int, void *);
+static void nh_timer(utime_t, void *);
 static void ping_checker_timer(unsigned int ticks, void *timer_idx);
 int fix_ignore_rpl_codes(void);
 static int mod_init(void);
@@ -135,7 +137,6 @@ static mi_response_t *mi_enable_natping_1(const mi_params_t *params,
 								struct mi_handler *async_hdl);
 //static
 usrloc_api_t ul;
-static int cblen = 0;
 static str nortpproxy_str = str_init("a=nortpproxy:yes");
 static int natping_interval = 0;
 const struct socket_info* force_socket = 0;
@@ -204,6 +205,8 @@ static char *rm_on_to_flag_str = 0;
 static char *sipping_latency_flag_str = 0;
 static int natping_tcp = 0;
 static int natping_partitions = 1;
+static int natping_rate = 0;
+static int natping_send_batch = 64;
 static str ignore_rpl_codes_str;
 unsigned short *ignore_rpl_codes;
 
@@ -220,6 +223,33 @@ int skip_oldip=0;
 /*0-> disabled, 1 ->enabled*/
 unsigned int *natping_state=0;
 
+/* the pinging timer runs this many times per second; each run pings the
+ * next part of the contacts, if due (see nh_cycle_parts()) */
+#define NH_TICKS_PER_SEC  10
+
+/*
+ * State of a pinging partition, in shm: its timer job may be run by any of
+ * the timer processes (but never by two at once - TIMER_FLAG_DELAY_ON_DELAY)
+ */
+struct nh_pinger {
+	char *buf;               /* contacts of the domain & part being pinged */
+	int buf_len;
+	char *cp;                /* next contact to ping, NULL if none */
+	udomain_t *d;            /* domain being pinged, NULL between parts */
+	unsigned int part;       /* cursor: part of the cycle being pinged */
+	unsigned int tick;       /* ticks since the start of the cycle */
+	unsigned int tokens;     /* token bucket, NH_TICKS_PER_SEC per ping */
+	unsigned int sent;       /* pings of the current cycle */
+	unsigned int last_sent;  /* pings of the previous cycle ... */
+	unsigned int last_rate;  /* ... and their rate (per second) */
+};
+
+static struct nh_pinger *nh_pingers;
+
+static stat_var *natping_sent_stat;
+static stat_var *natping_overruns_stat;
+static unsigned long get_natping_rate(void *foo);
+
 static const cmd_export_t cmds[] = {
 	{"fix_nated_contact",  (cmd_function)fix_nated_contact_f, {
 		{CMD_PARAM_STR|CMD_PARAM_OPT,0,0}, {0,0,0}},
@@ -254,6 +284,8 @@ static const param_export_t params[] = {
 	{"remove_on_timeout_bflag",  STR_PARAM, &rm_on_to_flag_str     },
 	{"natping_tcp",              INT_PARAM, &natping_tcp           },
 	{"natping_partitions",       INT_PARAM, &natping_partitions    },
+	{"natping_rate",             INT_PARAM, &natping_rate          },
+	{"natping_send_batch",       INT_PARAM, &natping_send_batch    },
 	{"natping_socket",           STR_PARAM, &natping_socket        },
 	{"oldip_skip",			     STR_PARAM|USE_FUNC_PARAM,
 								   (void*)get_oldip_fields_value   },
@@ -264,6 +296,13 @@ static const param_export_t params[] = {
 	{0, 0, 0}
 };
 
+static const stat_export_t mod_stats[] = {
+	{"natping_sent",      0,            &natping_sent_stat               },
+	{"natping_rate",      STAT_IS_FUNC, (stat_var**)get_natping_rate     },
+	{"natping_overruns",  0,            &natping_overruns_stat           },
+	{0, 0, 0}
+};
+
 static const mi_export_t mi_cmds[] = {
 	{MI_SET_NATPING_STATE, 0, 0, 0, {
 		{mi_enable_natping, {0}},
@@ -301,7 +340,7 @@ struct module_exports exports = {
 	cmds,
 	NULL,
 	params,
-	0,           /* exported statistics */
+	mod_stats,   /* exported statistics */
 	mi_cmds,     /* exported MI functions */
 	0,           /* exported pseudo-variables */
 	0,			 /* exported transformations */
@@ -576,9 +615,24 @@ mod_init(void)
 			}
 		}
 
+		if (natping_partitions<1)
+			natping_partitions = 1;
+		if (natping_rate<0)
+			natping_rate = 0;
+
+		nh_pingers = shm_malloc(natping_partitions * sizeof *nh_pingers);
+		if (!nh_pingers) {
+			LM_ERR("no shmem left\n");
+			return -1;
+		}
+		memset(nh_pingers, 0, natping_partitions * sizeof *nh_pingers);
+
+		/* the partitions are pinged in parallel, by different timer
+		 * processes, if enough are available (see "timer_workers") */
 		for( i=0 ; i<natping_partitions ; i++ ) {
-			if (register_timer( "nh-timer", nh_timer,
-			(void*)(unsigned long)i, 1, TIMER_FLAG_DELAY_ON_DELAY)<0) {
+			if (register_utimer( "nh-timer", nh_timer,
+			(void*)(unsigned long)i, 1000000/NH_TICKS_PER_SEC,
+			TIMER_FLAG_DELAY_ON_DELAY)<0) {
 				LM_ERR("failed to register timer routine\n");
 				return -1;
 			}
@@ -601,10 +655,19 @@ mod_init(void)
 
 static void mod_destroy(void)
 {
+	int i;
+
 	/*free the shared memory*/
 	if (natping_state)
 		shm_free(natping_state);
 
+	if (nh_pingers) {
+		for (i = 0; i < natping_partitions; i++)
+			if (nh_pingers[i].buf)
+				shm_free(nh_pingers[i].buf);
+		shm_free(nh_pingers);
+	}
+
 	if (get_htable())
 		free_hash_table();
 }
@@ -1294,16 +1357,57 @@ static int send_raw(const char *buf, int buf_len, union sockaddr_union *to,
 	udp->uh_ulen = htons((unsigned short) sizeof(struct udphdr) + buf_len);
 	udp->uh_sum = 0;
 
+	if (udp_batch_active())
+		return udp_batch_add(raw_sock, (char *)packet, len, to);
+
 	return sendto(raw_sock, packet, len, 0, (struct sockaddr *) to, sizeof(struct sockaddr_in));
 }
 
 
-static void
-nh_timer(unsigned int ticks, void *timer_idx)
+/* fetches the contacts of the current domain & part of the partition */
+static int nh_fetch_contacts(struct nh_pinger *p, unsigned int part_idx,
+												unsigned int part_max)
 {
+	char *buf;
 	int rval;
-	void *buf = NULL;
-	void *cp;
+
+	p->cp = NULL;
+
+	rval = ul.get_domain_ucontacts(p->d, p->buf, p->buf_len,
+		(ping_nated_only?ul.nat_flag:0), part_idx, part_max,
+		STORE_BRANCH_CTID?1:0);
+	if (rval<0) {
+		LM_ERR("failed to fetch contacts\n");
+		return -1;
+	}
+	if (rval > 0) {
+		buf = shm_malloc(p->buf_len + rval + 128 /*some extra*/);
+		if (buf == NULL) {
+			LM_ERR("out of shm memory\n");
+			return -1;
+		}
+		if (p->buf)
+			shm_free(p->buf);
+		p->buf = buf;
+		p->buf_len += rval + 128;
+
+		rval = ul.get_domain_ucontacts(p->d, p->buf, p->buf_len,
+			(ping_nated_only?ul.nat_flag:0), part_idx, part_max,
+			STORE_BRANCH_CTID?1:0);
+		if (rval != 0)
+			return -1;
+	}
+
+	p->cp = p->buf;
+	return 0;
+}
+
+
+/* pings the fetched contacts, as long as the token bucket allows it
+ * returns 1 if contacts are left to be pinged, 0 otherwise */
+static int nh_ping_contacts(struct nh_pinger *p, unsigned int rate,
+																int *sent)
+{
 	str c;
 	str opt;
 	str path;
@@ -1314,135 +1418,244 @@ nh_timer(unsigned int ticks, void *timer_idx)
 	unsigned int flags;
 	struct proxy_l next_hop;
 	ucontact_coords ct_coords = 0;
+	char *cp;
 
-	udomain_t *d;
+	while ((cp = p->cp)) {
+		memcpy(&(c.len), cp, sizeof(c.len));
+		if (c.len == 0) {
+			p->cp = NULL;
+			break;
+		}
 
-	if ( (*natping_state) == 0 || !nh_cluster_shtag_is_active() )
-		goto done;
+		if (rate && p->tokens < NH_TICKS_PER_SEC)
+			return 1;
 
-	if (cblen > 0) {
-		buf = pkg_malloc(cblen);
-		if (buf == NULL) {
-			LM_ERR("out of pkg memory\n");
-			goto done;
+		c.s = cp + sizeof(c.len);
+		cp = cp + sizeof(c.len) + c.len;
+
+		memcpy(&received.len, cp, sizeof(received.len));
+		received.s = received.len ? (cp + sizeof(received.len)) : NULL;
+		cp = cp + sizeof(received.len) + received.len;
+
+		memcpy(&path.len, cp, sizeof(path.len));
+		path.s = path.len ? (cp + sizeof(path.len)) : NULL;
+		cp = cp + sizeof(path.len) + path.len;
+
+		memcpy(&send_sock, cp, sizeof(send_sock));
+		cp = cp + sizeof(send_sock);
+		memcpy(&flags, cp, sizeof(flags));
+		cp = cp + sizeof(flags);
+		memcpy(&next_hop, cp, sizeof(next_hop));
+		cp = cp + sizeof(next_hop);
+
+		if (STORE_BRANCH_CTID) {
+			memcpy(&ct_coords, cp, sizeof ct_coords);
+			cp = cp + sizeof ct_coords;
 		}
-	}
 
-	for ( d=ul.get_next_udomain(NULL); d; d=ul.get_next_udomain(d)) {
-		rval = ul.get_domain_ucontacts(d, buf, cblen, (ping_nated_only?ul.nat_flag:0),
-			((unsigned int)(unsigned long)timer_idx)*natping_interval+
-			(ticks%natping_interval), natping_partitions*natping_interval,
-			STORE_BRANCH_CTID?1:0);
+		p->cp = cp;
+
+		if (next_hop.proto != PROTO_NONE && next_hop.proto != PROTO_UDP &&
+			(natping_tcp == 0 || (next_hop.proto != PROTO_TCP &&
+								  next_hop.proto != PROTO_TLS &&
+								  next_hop.proto != PROTO_WSS &&
+								  next_hop.proto != PROTO_WS)))
+			continue;
 
-		if (rval<0) {
-			LM_ERR("failed to fetch contacts\n");
-			goto done;
+		LM_DBG("resolving next hop: '%.*s'\n",
+		        next_hop.name.len, next_hop.name.s);
+		he = sip_resolvehost(&next_hop.name, &next_hop.port,
+		                     &next_hop.proto, 0, NULL);
+		if (!he) {
+			LM_ERR("failed to resolve next hop: '%.*s'\n",
+			        next_hop.name.len, next_hop.name.s);
+			continue;
 		}
-		if (rval > 0) {
-			if (buf != NULL)
-				pkg_free(buf);
-			cblen += rval + 128 /*some extra*/;
-			buf = pkg_malloc(cblen);
-			if (buf == NULL) {
-				LM_ERR("out of pkg memory\n");
-				goto done;
+
+		hostent2su(&to, he, 0, next_hop.port);
+
+		if (!send_sock) {
+			send_sock = force_socket ? force_socket :
+			                           get_send_socket(0, &to, next_hop.proto);
+			if (!send_sock) {
+				LM_ERR("can't get sending socket\n");
+				continue;
 			}
+		}
 
-			rval = ul.get_domain_ucontacts(d, buf, cblen, (ping_nated_only?ul.nat_flag:0),
-				((unsigned int)(unsigned long)timer_idx)*natping_interval+
-				(ticks%natping_interval), natping_partitions*natping_interval,
-				STORE_BRANCH_CTID?1:0);
-			if (rval != 0) {
-				goto done;
+		if (rate)
+			p->tokens -= NH_TICKS_PER_SEC;
+		p->sent++;
+		(*sent)++;
+
+		if ((flags & sipping_flag) &&
+		    (opt.s = build_sipping(p->d, &c, send_sock, &path, &opt.len,
+		                         ct_coords, flags))) {
+			if (msg_send(send_sock, next_hop.proto, &to, 0, opt.s, opt.len, NULL) < 0) {
+				LM_ERR("sip msg_send failed\n");
+			}
+		} else if (raw_ip && next_hop.proto == PROTO_UDP) {
+			if (send_raw((char*)sbuf, sizeof(sbuf), &to, raw_ip, raw_port)<0) {
+				LM_ERR("send_raw failed\n");
+			}
+		} else {
+			if (msg_send(send_sock, next_hop.proto, &to, 0,
+			             (char *)sbuf, sizeof(sbuf), NULL) < 0) {
+				LM_ERR("sip msg_send failed!\n");
 			}
 		}
+	}
 
-		if (buf == NULL)
-			goto done;
+	return 0;
+}
 
-		tcp_no_new_conn = 1;
 
-		cp = buf;
-		while (1) {
-			memcpy(&(c.len), cp, sizeof(c.len));
-			if (c.len == 0)
-				break;
+/* pings/sec allowed for the partition, 0 if unlimited */
+static inline unsigned int nh_ping_rate(struct nh_pinger *p)
+{
+	unsigned int rate;
 
-			c.s = (char*)cp + sizeof(c.len);
-			cp = (char*)cp + sizeof(c.len) + c.len;
+	if (!p->last_sent)
+		return natping_rate;
 
-			memcpy(&received.len, cp, sizeof(received.len));
-			received.s = received.len ? ((char*)cp + sizeof(received.len)) : NULL;
-			cp = (char*)cp + sizeof(received.len) + received.len;
+	/* spread the pings evenly over the interval, as many as in the previous
+	 * cycle plus some headroom for the new registrations */
+	rate = p->last_sent / natping_interval;
+	rate += rate / 4 + NH_TICKS_PER_SEC;
 
-			memcpy(&path.len, cp, sizeof(path.len));
-			path.s = path.len ? ((char*)cp + sizeof(path.len)) : NULL;
-			cp = (char*)cp + sizeof(path.len) + path.len;
+	return (natping_rate && natping_rate < rate) ? natping_rate : rate;
+}
 
-			memcpy(&send_sock, cp, sizeof(send_sock));
-			cp = (char*)cp + sizeof(send_sock);
-			memcpy(&flags, cp, sizeof(flags));
-			cp = (char*)cp + sizeof(flags);
-			memcpy(&next_hop, cp, sizeof(next_hop));
-			cp = (char*)cp + sizeof(next_hop);
 
-			if (STORE_BRANCH_CTID) {
-				memcpy(&ct_coords, cp, sizeof ct_coords);
-				cp = (char*)cp + sizeof ct_coords;
-			}
+/*
+ * The parts of a ping cycle (natping_interval), for each partition: one per
+ * timer tick, but no more than the usrloc hash slots, as a part is made of
+ * whole slots. If the contacts are not kept in memory, each fetch is a
+ * query, so the parts are fetched once per second only.
+ */
+static unsigned int nh_cycle_parts(udomain_t *d)
+{
+	unsigned int parts;
 
-			if (next_hop.proto != PROTO_NONE && next_hop.proto != PROTO_UDP &&
-				(natping_tcp == 0 || (next_hop.proto != PROTO_TCP &&
-									  next_hop.proto != PROTO_TLS &&
-									  next_hop.proto != PROTO_WSS &&
-									  next_hop.proto != PROTO_WS)))
-				continue;
+	if (!ul.have_mem_storage())
+		return natping_interval;
 
-			LM_DBG("resolving next hop: '%.*s'\n",
-			        next_hop.name.len, next_hop.name.s);
-			he = sip_resolvehost(&next_hop.name, &next_hop.port,
-			                     &next_hop.proto, 0, NULL);
-			if (!he) {
-				LM_ERR("failed to resolve next hop: '%.*s'\n",
-				        next_hop.name.len, next_hop.name.s);
-				continue;
-			}
+	parts = natping_interval * NH_TICKS_PER_SEC;
+	if (natping_partitions * parts > d->size)
+		parts = d->size / natping_partitions;
 
-			hostent2su(&to, he, 0, next_hop.port);
+	return parts ? parts : 1;
+}
 
-			if (!send_sock) {
-				send_sock = force_socket ? force_socket :
-				                           get_send_socket(0, &to, next_hop.proto);
-				if (!send_sock) {
-					LM_ERR("can't get sending socket\n");
-					continue;
-				}
-			}
 
-			if ((flags & sipping_flag) &&
-			    (opt.s = build_sipping(d, &c, send_sock, &path, &opt.len,
-			                         ct_coords, flags))) {
-				if (msg_send(send_sock, next_hop.proto, &to, 0, opt.s, opt.len, NULL) < 0) {
-					LM_ERR("sip msg_send failed\n");
-				}
-			} else if (raw_ip && next_hop.proto == PROTO_UDP) {
-				if (send_raw((char*)sbuf, sizeof(sbuf), &to, raw_ip, raw_port)<0) {
-					LM_ERR("send_raw failed\n");
-				}
-			} else {
-				if (msg_send(send_sock, next_hop.proto, &to, 0,
-				             (char *)sbuf, sizeof(sbuf), NULL) < 0) {
-					LM_ERR("sip msg_send failed!\n");
-				}
+static void nh_new_cycle(struct nh_pinger *p, unsigned int ticks)
+{
+	/* the achieved rate, over the actual length of the cycle */
+	p->last_rate = (unsigned long)p->sent * NH_TICKS_PER_SEC / p->tick;
+	p->last_sent = p->sent;
+	p->sent = 0;
+	p->part = 0;
+
+	if (p->tick > ticks) {
+		/* late (rate limited), the new cycle starts right away */
+		update_stat(natping_overruns_stat, 1);
+		p->tick = 1;
+	} else {
+		p->tick = 0;
+	}
+}
+
+
+static unsigned long get_natping_rate(void *foo)
+{
+	unsigned long rate = 0;
+	int i;
+
+	if (!nh_pingers)
+		return 0;
+
+	for (i = 0; i < natping_partitions; i++)
+		rate += nh_pingers[i].last_rate;
+
+	return rate;
+}
+
+
+/*
+ * Each run of the timer job of a partition pings the next part of its
+ * contacts (the parts are never fetched ahead of their schedule), but no
+ * more than its token bucket allows - the leftovers are pinged by the next
+ * runs, so the cycle may take longer than the interval if rate limited
+ */
+static void
+nh_timer(utime_t uticks, void *timer_idx)
+{
+	static unsigned int parts;
+	unsigned int idx = (unsigned int)(unsigned long)timer_idx;
+	struct nh_pinger *p = &nh_pingers[idx];
+	unsigned int ticks = natping_interval * NH_TICKS_PER_SEC;
+	unsigned int rate, cap;
+	udomain_t *d;
+	int sent = 0, batch = 0;
+
+	if (!parts) {
+		/* all the domains have the same hash size */
+		if ((d = ul.get_next_udomain(NULL)) == NULL)
+			return;
+		parts = nh_cycle_parts(d);
+	}
+
+	if ( (*natping_state) == 0 || !nh_cluster_shtag_is_active() ) {
+		/* start over, once re-enabled */
+		p->cp = NULL;
+		p->d = NULL;
+		p->part = p->tick = p->sent = p->tokens = 0;
+		return;
+	}
+
+	rate = nh_ping_rate(p);
+	if (rate) {
+		cap = 2 * rate > NH_TICKS_PER_SEC ? 2 * rate : NH_TICKS_PER_SEC;
+		p->tokens = (p->tokens + rate > cap) ? cap : p->tokens + rate;
+	}
+	p->tick++;
+
+	if (natping_send_batch > 0 && udp_batch_start(natping_send_batch) == 0)
+		batch = 1;
+
+	tcp_no_new_conn = 1;
+
+	while (nh_ping_contacts(p, rate, &sent) == 0) {
+		/* done with the domain, on to the next one or to the next part */
+		if (p->d && (p->d = ul.get_next_udomain(p->d)) == NULL)
+			p->part++;
+
+		if (!p->d) {
+			if (p->part >= parts && p->tick >= ticks)
+				nh_new_cycle(p, ticks);
+			/* the parts are due evenly over the ticks of the cycle */
+			if (p->part >= parts ||
+			        (unsigned long)p->part * ticks >=
+			        (unsigned long)p->tick * parts)
+				break;
+
+			if ((p->d = ul.get_next_udomain(NULL)) == NULL) {
+				p->part++;
+				continue;
 			}
 		}
+
+		nh_fetch_contacts(p, idx * parts + p->part,
+			natping_partitions * parts);
 	}
 
 	tcp_no_new_conn = 0;
 
-done:
-	if (buf)
-		pkg_free(buf);
+	if (batch)
+		udp_batch_end();
+
+	if (sent)
+		update_stat(natping_sent_stat, sent);
 }
 
 
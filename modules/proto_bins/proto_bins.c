@@ -529,7 +529,8 @@ err_release:
 static int bins_async_write(struct tcp_connection* con, int fd)
 {
 	int n;
-	struct tcp_async_chunk *chunk;
+	char *buf;
+	int len;
 
 	n = tls_mgm_api.tls_fix_read_conn(con, fd, bins_handshake_tout, t_dst, 0);
 	if (n < 0) {
@@ -542,14 +543,16 @@ static int bins_async_write(struct tcp_connection* con, int fd)
 
 	tls_mgm_api.tls_update_fd(con, fd);
 
-	while ((chunk = tcp_async_get_chunk(con)) != NULL) {
-		LM_DBG("Trying to send %d bytes from chunk %p in conn %p - %d %d \n",
-				chunk->len, chunk, con, chunk->ticks, get_ticks());
+	while (con->async->pending) {
+		/* the small queued chunks go out together, as a single record */
+		buf = tcp_async_coalesce(con, &len);
+		LM_DBG("Trying to send %d bytes (%d chunks pending) in conn %p - %d %d \n",
+				len, con->async->pending, con, con->async->oldest, get_ticks());
 
-		n = tls_mgm_api.tls_write(con, fd, chunk->buf, chunk->len, NULL);
-		if (n==0) {
-			LM_DBG("Can't finish to write chunk %p on conn %p\n",
-					chunk,con);
+		n = tls_mgm_api.tls_write(con, fd, buf, len, NULL);
+		if (n == 0) {
+			LM_DBG("Can't finish to write %d bytes on conn %p\n",
+					len, con);
 			/* report back we have more writting to be done */
 			return 1;
 		} else if (n < 0) {
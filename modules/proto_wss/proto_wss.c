@@ -587,6 +587,22 @@ static int wss_raw_writev(struct tcp_connection *c, int fd,
 #endif
 
 #ifndef TLS_DONT_WRITE_FRAGMENTS
+	static char rec[TCP_ASYNC_COALESCE_SIZE];
+
+	/* a frame header and its (small) payload go out as a single record */
+	for (i = 0, n = 0; i < iovcnt && n <= sizeof rec; i++)
+		n += iov[i].iov_len;
+	if (iovcnt > 1 && n <= sizeof rec) {
+		for (i = 0, n = 0; i < iovcnt; i++) {
+			memcpy(rec + n, iov[i].iov_base, iov[i].iov_len);
+			n += iov[i].iov_len;
+		}
+		lock_get(&c->write_lock);
+		ret = tls_mgm_api.tls_blocking_write(c, fd, rec, n,
+				wss_hs_tls_tout, wss_send_tout, t_dst);
+		goto end;
+	}
+
 	lock_get(&c->write_lock);
 	for (i = 0; i < iovcnt; i++) {
 		n = tls_mgm_api.tls_blocking_write(c, fd, iov[i].iov_base, iov[i].iov_len,
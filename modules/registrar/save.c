@@ -1092,8 +1092,7 @@ int _remove_ip_port(struct sip_msg *msg, str *ip, int *port, void *udomain, str*
 	str aor_user;
 	int ret = 1;
 	int i;
-	map_iterator_t it;
-	void ** dest;
+	rec_iterator_t it;
 	udomain_t *dom = (udomain_t *)udomain;
 
 	if (!udomain || !ip || !port) {
@@ -1133,26 +1132,19 @@ int _remove_ip_port(struct sip_msg *msg, str *ip, int *port, void *udomain, str*
 	for(i=0; i<dom->size; i++) {
 		ul.lock_ulslot( dom, i);
 
-		map_first(dom->table[i].records, &it);
-		while (iterator_is_valid(&it)) {
-			dest = iterator_val(&it);
-			if (!dest) {
-				LM_ERR("Failed to get urecord\n");
-				goto error_unlock;
-			}
-
-			record = (urecord_t *)*dest;
-			iterator_next(&it);
+		for (rt_first(&dom->table[i].records, &it); rt_is_valid(&it);
+		rt_next(&it)) {
+			record = rt_val(&it);
 
 			if (_remove_ip_port_urecord(record,ip,port) != 0) {
 				LM_ERR("Failed to remove contacts \n");
 				/* continue here, might be more */
 			}
 
+			/* the iterator gets past it, even if released */
 			ul.release_urecord(record, 0);
 		}
 
-error_unlock:
 		ul.unlock_ulslot( dom, i);
 	}
 
@@ -76,6 +76,9 @@
 #include "../../mod_fix.h"
 #include "../../dset.h"
 #include "../../route.h"
+#include "../../async.h"
+#include "../../ipc.h"
+#include "../../statistics.h"
 #include "../../lib/cJSON.h"
 #include "../dialog/dlg_load.h"
 #include "../rtp_relay/rtp_relay.h"
@@ -235,6 +238,11 @@ typedef struct rtpe_async_param_ {
         char* cookie;
         pv_spec_t *spvar;
         pv_spec_t *bpvar;
+        /* the multiplexed commands outlive the read lock, so they do not
+         * keep the node, but look it up again by set and URL */
+        unsigned int node_set;
+        str node_url;
+        str reply; /* already received, for the multiplexed commands */
 } rtpe_async_param;
 
 static const char *command_strings[] = {
@@ -365,6 +373,8 @@ static int rtpengine_add_rtpengine_set( char * rtp_proxies, int set_id);
 static int mod_init(void);
 static int mod_preinit(void);
 static int child_init(int);
+static int rtpe_mux_init(int procs_no);
+static struct rtpe_node *rtpe_mux_node(rtpe_async_param *param);
 static void mod_destroy(void);
 
 /* Pseudo-Variables */
@@ -388,6 +398,7 @@ static int rtpengine_retr = 5;
 static int rtpengine_tout = 1;
 static int rtpengine_ping_enabled = 0;
 static int rtpengine_timer_interval = 5;
+static int rtpengine_async_mux = 1;
 static pid_t mypid;
 static int myrand = 0;
 static int myrank = 0;
@@ -752,9 +763,35 @@ static const param_export_t params[] = {
 	{"notification_sock",      STR_PARAM|USE_FUNC_PARAM,
 									(void *)rtpengine_set_notify},
 	{"ping_enabled",           INT_PARAM, &rtpengine_ping_enabled    },
+	{"async_mux",              INT_PARAM, &rtpengine_async_mux       },
 	{0, 0, 0}
 };
 
+static stat_var *rtpe_outstanding;
+static stat_var *rtpe_retransmissions;
+static stat_var *rtpe_timeouts;
+static stat_var *rtpe_latency[RTPE_LAT_BUCKETS];
+
+static const stat_export_t mod_stats[] = {
+	{"async_outstanding",     STAT_NO_RESET|STAT_SHARDED, &rtpe_outstanding},
+	{"async_retransmissions", STAT_SHARDED, &rtpe_retransmissions},
+	{"async_timeouts",        STAT_SHARDED, &rtpe_timeouts},
+	{"latency_1ms",           STAT_SHARDED, &rtpe_latency[0]},
+	{"latency_5ms",           STAT_SHARDED, &rtpe_latency[1]},
+	{"latency_10ms",          STAT_SHARDED, &rtpe_latency[2]},
+	{"latency_50ms",          STAT_SHARDED, &rtpe_latency[3]},
+	{"latency_100ms",         STAT_SHARDED, &rtpe_latency[4]},
+	{"latency_500ms",         STAT_SHARDED, &rtpe_latency[5]},
+	{"latency_over_500ms",    STAT_SHARDED, &rtpe_latency[6]},
+	{0, 0, 0}
+};
+
+/* upper bounds (us) of the latency buckets; the last one is open */
+static const unsigned int rtpe_lat_bounds[RTPE_LAT_BUCKETS - 1] =
+	{1000, 5000, 10000, 50000, 100000, 500000};
+static const char *rtpe_lat_names[RTPE_LAT_BUCKETS] =
+	{"1ms", "5ms", "10ms", "50ms", "100ms", "500ms", "over_500ms"};
+
 static const mi_export_t mi_cmds[] = {
 	{ MI_ENABLE_RTP_ENGINE, 0, 0, 0, {
 		{mi_enable_rtpengine, {"url", "enable", 0}},
@@ -807,7 +844,7 @@ struct module_exports exports = {
 	cmds,
 	acmds,
 	params,
-	0,           /* exported statistics */
+	mod_stats,   /* exported statistics */
 	mi_cmds,     /* exported MI functions */
 	mod_pvs,     /* exported pseudo-variables */
 	0,			 /* exported transformations */
@@ -1328,9 +1365,10 @@ static mi_response_t *mi_show_rtpengines(const mi_params_t *params,
 								struct mi_handler *async_hdl)
 {
 	mi_response_t *resp;
-	mi_item_t *sets_arr, *set_item, *nodes_arr, *node_item;
+	mi_item_t *sets_arr, *set_item, *nodes_arr, *node_item, *lat_item;
 	struct rtpe_set * rtpe_list;
 	struct rtpe_node * crt_rtpe;
+	int i;
 
 	resp = init_mi_result_array(&sets_arr);
 	if (!resp)
@@ -1377,6 +1415,15 @@ static mi_response_t *mi_show_rtpengines(const mi_params_t *params,
 			if (add_mi_number(node_item, MI_RECHECK_TICKS, MI_RECHECK_T_LEN,
 				crt_rtpe->rn_recheck_ticks) < 0)
 				goto error;
+
+			lat_item = add_mi_object(node_item, MI_SSTR("latency"));
+			if (!lat_item)
+				goto error;
+			for (i = 0; i < RTPE_LAT_BUCKETS; i++)
+				if (add_mi_number(lat_item, (char *)rtpe_lat_names[i],
+				strlen(rtpe_lat_names[i]),
+				rtpe_counter_get(crt_rtpe->rn_lat[i])) < 0)
+					goto error;
 		}
 	}
 	RTPE_STOP_READ();
@@ -1773,6 +1820,9 @@ mod_init(void)
     return -1;
   }
 
+	if (rtpengine_async_mux && rtpe_mux_init(count) < 0)
+		return -1;
+
 	return 0;
 }
 
@@ -3407,7 +3457,16 @@ enum async_ret_code resume_async_send_rtpe_command(int fd, struct sip_msg *msg,
 
 	LM_DBG("Need to resume async rtpe call \n");
 
-	if (param->node->rn_umode == 0) {
+	if (!valid_async_fd(fd)) {
+		/* multiplexed command, the reply was already read */
+		if (!param->reply.s) {
+			LM_ERR("no reply received from RTP Engine %s\n",
+				param->node_url.s);
+			goto error;
+		}
+		cp = param->reply.s;
+		len = param->reply.len;
+	} else if (param->node->rn_umode == 0) {
 		do {
 			len = read(fd, buf, sizeof(buf) - 1);
 		} while (len == -1 && errno == EINTR);
@@ -3449,7 +3508,7 @@ enum async_ret_code resume_async_send_rtpe_command(int fd, struct sip_msg *msg,
 	if (param->spvar) {
 		memset(&val, 0, sizeof(pv_value_t));
 		val.flags = PV_VAL_STR;
-		val.rs = param->node->rn_url;
+		val.rs = param->node ? param->node->rn_url : param->node_url;
 		if(pv_set_value(msg, param->spvar, (int)EQ_T, &val)<0)
 			LM_ERR("setting rtpengine pvar failed\n");
 	}
@@ -3534,10 +3593,24 @@ error:
 enum async_ret_code timeout_async_send_rtpe_command(int fd, struct sip_msg *msg, void *_param)
 {
 	rtpe_async_param *param = (rtpe_async_param *)_param;
-	LM_ERR("can't read reply from a RTP proxy - TIMEOUT on %s\n",param->node->rn_url.s);
+	struct rtpe_node *node;
 
-	param->node->rn_disabled = 1;
-	param->node->rn_recheck_ticks = get_ticks() + rtpengine_disable_tout;
+	if (param->node) {
+		LM_ERR("can't read reply from a RTP proxy - TIMEOUT on %s\n",param->node->rn_url.s);
+
+		param->node->rn_disabled = 1;
+		param->node->rn_recheck_ticks = get_ticks() + rtpengine_disable_tout;
+	} else {
+		LM_ERR("can't read reply from a RTP proxy - TIMEOUT on %s\n",param->node_url.s);
+
+		RTPE_START_READ();
+		node = rtpe_mux_node(param);
+		if (node) {
+			node->rn_disabled = 1;
+			node->rn_recheck_ticks = get_ticks() + rtpengine_disable_tout;
+		}
+		RTPE_STOP_READ();
+	}
 
 	pkg_free(param->cookie);
 	bencode_buffer_free(param->bencbuf);
@@ -3626,7 +3699,7 @@ static int start_async_send_rtpe_command(struct rtpe_node *node, bencode_item_t
 			LM_ERR("can't create socket %d \n",errno);
 			goto badproxy;
 		}
-		if (connect(fd, &(node->ai_addr), node->ai_addrlen) < 0) {
+		if (connect(fd, &node->ai_addr.s, node->ai_addrlen) < 0) {
 			LM_ERR("can't connect to RTP proxy %s (%d:%s)\n",node->rn_url.s,errno,strerror(errno));
 			close(fd);
 			goto badproxy;
@@ -3660,6 +3733,426 @@ error:
 }
 
 
+/*
+ * Multiplexed transport for the async commands: all the UDP commands of a
+ * process go out through a single non-blocking socket (per address family),
+ * permanently watched by the reactor of the process. Each process keeps its
+ * own table of in-flight commands, indexed by cookie - a reply resumes the
+ * script context waiting for it, whatever order the replies come in. The
+ * retransmissions and the timeouts are driven by the timer process, which
+ * signals (via IPC) the processes having commands in flight.
+ */
+
+#define RTPE_MUX_HASH_SIZE       64
+#define RTPE_MUX_TIMER_INTERVAL  100 /* ms */
+
+struct rtpe_mux_req {
+	str cookie;          /* without the trailing separator */
+	str cmd;             /* the whole datagram, for retransmissions */
+	union sockaddr_union addr; /* of the node, which may be gone meanwhile */
+	socklen_t addrlen;
+	async_ctx *ctx;
+	rtpe_async_param *param;
+	utime_t sent;        /* first transmission */
+	utime_t next_retr;
+	utime_t expires;
+	struct rtpe_mux_req *next;
+};
+
+struct rtpe_mux_proc {
+	volatile unsigned int inflight;
+	volatile int tick_pending;
+};
+
+/* per process */
+static struct rtpe_mux_req *rtpe_mux_table[RTPE_MUX_HASH_SIZE];
+static int rtpe_mux_socks[2] = {-1, -1};
+
+/* shared, indexed by process_no */
+static struct rtpe_mux_proc *rtpe_mux_procs;
+static int rtpe_mux_procs_no;
+
+
+static inline utime_t rtpe_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (utime_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void rtpe_pkg_free(void *p)
+{
+	pkg_free(p);
+}
+
+static void rtpe_account_latency(struct rtpe_node *node, utime_t lat)
+{
+	int b;
+
+	for (b = 0; b < RTPE_LAT_BUCKETS - 1; b++)
+		if (lat < rtpe_lat_bounds[b])
+			break;
+
+	update_stat(rtpe_latency[b], 1);
+	rtpe_counter_add(node->rn_lat[b], 1);
+}
+
+static int rtpe_mux_read(int fd, void *param);
+
+/* must be called under the read lock - NULL if the node of the command
+ * was removed by a reload meanwhile */
+static struct rtpe_node *rtpe_mux_node(rtpe_async_param *param)
+{
+	return lookup_rtpe_node(select_rtpe_set(param->node_set),
+		&param->node_url);
+}
+
+static int rtpe_mux_sock(int af)
+{
+	int *sock = &rtpe_mux_socks[af == AF_INET6];
+	int flags;
+
+	if (*sock != -1)
+		return *sock;
+
+	*sock = socket(af, SOCK_DGRAM, 0);
+	if (*sock < 0) {
+		LM_ERR("can't create socket (%d:%s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	flags = fcntl(*sock, F_GETFL);
+	if (flags < 0 || fcntl(*sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+		LM_ERR("failed to set O_NONBLOCK (%d:%s)\n", errno, strerror(errno));
+		goto error;
+	}
+
+	if (register_async_fd(*sock, rtpe_mux_read, NULL) < 0) {
+		LM_ERR("failed to add the rtpengine socket to the reactor\n");
+		goto error;
+	}
+
+	return *sock;
+
+error:
+	close(*sock);
+	*sock = -1;
+	return -1;
+}
+
+static int rtpe_mux_xmit(struct rtpe_mux_req *req)
+{
+	int fd, len;
+
+	fd = rtpe_mux_sock(req->addr.s.sa_family);
+	if (fd < 0)
+		return -1;
+
+	do {
+		len = sendto(fd, req->cmd.s, req->cmd.len, 0,
+			&req->addr.s, req->addrlen);
+	} while (len == -1 && errno == EINTR);
+
+	if (len < 0) {
+		/* the next retransmission will try again */
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+			return 0;
+		LM_ERR("can't send command to RTP proxy %s (%d:%s)\n",
+			req->param->node_url.s, errno, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline void rtpe_mux_link(struct rtpe_mux_req *req)
+{
+	struct rtpe_mux_req **head;
+
+	head = &rtpe_mux_table[core_hash(&req->cookie, NULL, RTPE_MUX_HASH_SIZE)];
+	req->next = *head;
+	*head = req;
+
+	rtpe_mux_procs[process_no].inflight++;
+	update_stat(rtpe_outstanding, 1);
+}
+
+/* the socket is not connected, so a reply is only taken for the request
+ * with its cookie if also coming from the node the request was sent to */
+static struct rtpe_mux_req *rtpe_mux_unlink(str *cookie,
+		union sockaddr_union *from)
+{
+	struct rtpe_mux_req **it, *req;
+	struct ip_addr ip;
+
+	for (it = &rtpe_mux_table[core_hash(cookie, NULL, RTPE_MUX_HASH_SIZE)];
+	(req = *it); it = &req->next) {
+		if (str_match(&req->cookie, cookie)) {
+			if (!su_cmp(&req->addr, from)) {
+				su2ip_addr(&ip, from);
+				LM_WARN("discarding reply %.*s from %s:%hu, not from "
+					"RTP proxy %s\n", cookie->len, cookie->s, ip_addr2a(&ip),
+					su_getport(from), req->param->node_url.s);
+				return NULL;
+			}
+			*it = req->next;
+			rtpe_mux_procs[process_no].inflight--;
+			update_stat(rtpe_outstanding, -1);
+			return req;
+		}
+	}
+
+	return NULL;
+}
+
+static void rtpe_mux_resume(struct rtpe_mux_req *req, int was_timeout)
+{
+	async_ctx *ctx = req->ctx;
+
+	pkg_free(req);
+	async_script_resume_f(ASYNC_FD_NONE, ctx, was_timeout);
+}
+
+static int rtpe_mux_read(int fd, void *param)
+{
+	static char buf[RTPENGINE_BUF_SIZE];
+	struct rtpe_mux_req *req;
+	struct rtpe_node *node;
+	rtpe_async_param *aparam;
+	union sockaddr_union from;
+	socklen_t fromlen;
+	str cookie;
+	char *sep;
+	int len;
+
+	for (;;) {
+		fromlen = sizeof from;
+		len = recvfrom(fd, buf, sizeof(buf) - 1, 0, &from.s, &fromlen);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LM_ERR("can't read reply from a RTP proxy (%d:%s)\n",
+					errno, strerror(errno));
+			break;
+		}
+
+		sep = memchr(buf, ' ', len);
+		if (!sep) {
+			LM_WARN("discarding malformed reply from a RTP proxy\n");
+			continue;
+		}
+		cookie.s = buf;
+		cookie.len = sep - buf;
+
+		req = rtpe_mux_unlink(&cookie, &from);
+		if (!req) {
+			LM_DBG("discarding late/unknown reply %.*s\n", cookie.len, cookie.s);
+			continue;
+		}
+
+		aparam = req->param;
+
+		RTPE_START_READ();
+		node = rtpe_mux_node(aparam);
+		if (node) {
+			rtpe_account_latency(node, rtpe_now_us() - req->sent);
+			node->rn_last_ticks = get_ticks();
+		}
+		RTPE_STOP_READ();
+
+		if (!node) {
+			LM_WARN("RTP proxy %s was removed meanwhile, dropping reply %.*s\n",
+				aparam->node_url.s, cookie.len, cookie.s);
+			rtpe_mux_resume(req, 0);
+			continue;
+		}
+
+		/* the reply must live as long as the decoded dictionary */
+		len -= cookie.len + 1;
+		aparam->reply.s = pkg_malloc(len + 1);
+		if (aparam->reply.s) {
+			memcpy(aparam->reply.s, sep + 1, len);
+			aparam->reply.s[len] = '\0';
+			aparam->reply.len = len;
+			bencode_buffer_destroy_add(aparam->bencbuf, rtpe_pkg_free,
+				aparam->reply.s);
+		} else {
+			LM_ERR("no more pkg memory\n");
+		}
+
+		rtpe_mux_resume(req, 0);
+	}
+
+	async_status = ASYNC_CONTINUE;
+	return 0;
+}
+
+/* retransmits and expires the in-flight commands of the process */
+static void rtpe_mux_tick(int sender, void *param)
+{
+	struct rtpe_mux_req **it, *req, *expired = NULL;
+	utime_t now;
+	int i;
+
+	rtpe_mux_procs[process_no].tick_pending = 0;
+	now = rtpe_now_us();
+
+	for (i = 0; i < RTPE_MUX_HASH_SIZE; i++) {
+		for (it = &rtpe_mux_table[i]; (req = *it); ) {
+			if (now >= req->expires) {
+				*it = req->next;
+				rtpe_mux_procs[process_no].inflight--;
+				update_stat(rtpe_outstanding, -1);
+				req->next = expired;
+				expired = req;
+				continue;
+			}
+			if (now >= req->next_retr) {
+				LM_DBG("retransmitting %.*s to %s\n", req->cookie.len,
+					req->cookie.s, req->param->node_url.s);
+				rtpe_mux_xmit(req);
+				req->next_retr = now + (utime_t)rtpengine_tout * 1000000;
+				update_stat(rtpe_retransmissions, 1);
+			}
+			it = &req->next;
+		}
+	}
+
+	/* resume only after the walk, as the resumed scripts may add new
+	 * commands to the table */
+	while ((req = expired)) {
+		expired = req->next;
+		update_stat(rtpe_timeouts, 1);
+		rtpe_mux_resume(req, 1);
+	}
+}
+
+static void rtpe_mux_timer(utime_t uticks, void *param)
+{
+	int i;
+
+	for (i = 0; i < rtpe_mux_procs_no; i++) {
+		if (!rtpe_mux_procs[i].inflight || rtpe_mux_procs[i].tick_pending)
+			continue;
+
+		rtpe_mux_procs[i].tick_pending = 1;
+		if (ipc_send_rpc(i, rtpe_mux_tick, NULL) < 0) {
+			LM_ERR("failed to signal process %d\n", i);
+			rtpe_mux_procs[i].tick_pending = 0;
+		}
+	}
+}
+
+static int rtpe_mux_init(int procs_no)
+{
+	rtpe_mux_procs = shm_malloc(procs_no * sizeof *rtpe_mux_procs);
+	if (!rtpe_mux_procs) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	memset(rtpe_mux_procs, 0, procs_no * sizeof *rtpe_mux_procs);
+	rtpe_mux_procs_no = procs_no;
+
+	if (register_utimer("rtpengine-mux", rtpe_mux_timer, NULL,
+	RTPE_MUX_TIMER_INTERVAL * 1000, TIMER_FLAG_DELAY_ON_DELAY) < 0) {
+		LM_ERR("could not register the retransmission timer\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the script can only be resumed by us from a transaction's context, and
+ * the reply must not be awaited by a process without a reactor */
+static inline int rtpe_mux_usable(struct rtpe_node *node)
+{
+	struct cell *t;
+
+	if (!rtpengine_async_mux || node->rn_umode == 0 ||
+	route_type != REQUEST_ROUTE || process_no >= rtpe_mux_procs_no ||
+	!tmb.t_gett)
+		return 0;
+
+	t = tmb.t_gett();
+	return t && t != T_UNDEFINED;
+}
+
+static int start_mux_send_rtpe_command(struct rtpe_node *node,
+		bencode_item_t *dict, char *cookie, async_ctx *ctx,
+		rtpe_async_param *param)
+{
+	struct rtpe_mux_req *req;
+	struct iovec *v;
+	int vcnt, i, len, cookie_len;
+	utime_t now;
+	char *p;
+
+	v = bencode_iovec(dict, &vcnt, 1, 0);
+	if (!v) {
+		LM_ERR("error converting bencode to iovec\n");
+		return -1;
+	}
+
+	cookie_len = strlen(cookie);
+	for (i = 1, len = cookie_len; i <= vcnt; i++)
+		len += v[i].iov_len;
+	if (len > RTPENGINE_BUF_SIZE) {
+		LM_ERR("Command too big %d - max %d\n", len, RTPENGINE_BUF_SIZE);
+		return -1;
+	}
+
+	if (node->ai_addrlen == 0 && !rtpengine_connect_node(node)) {
+		LM_ERR("cannot resolve RTP engine %s!\n", node->rn_url.s);
+		goto badproxy;
+	}
+
+	req = pkg_malloc(sizeof *req + len);
+	if (!req) {
+		LM_ERR("no more pkg memory\n");
+		return -1;
+	}
+	memset(req, 0, sizeof *req);
+
+	req->cmd.s = p = (char *)(req + 1);
+	req->cmd.len = len;
+	memcpy(p, cookie, cookie_len);
+	for (i = 1, p += cookie_len; i <= vcnt; p += v[i].iov_len, i++)
+		memcpy(p, v[i].iov_base, v[i].iov_len);
+	req->cookie.s = req->cmd.s;
+	req->cookie.len = cookie_len - 1;
+
+	req->addr = node->ai_addr;
+	req->addrlen = node->ai_addrlen;
+	req->ctx = ctx;
+	req->param = param;
+
+	if (rtpe_mux_xmit(req) < 0) {
+		pkg_free(req);
+		goto badproxy;
+	}
+
+	now = rtpe_now_us();
+	req->sent = now;
+	req->next_retr = now + (utime_t)rtpengine_tout * 1000000;
+	req->expires = now + (utime_t)rtpengine_retr * rtpengine_tout * 1000000;
+	if (ctx->timeout_s && now + (utime_t)ctx->timeout_s * 1000000 < req->expires)
+		req->expires = now + (utime_t)ctx->timeout_s * 1000000;
+
+	rtpe_mux_link(req);
+
+	return 1;
+
+badproxy:
+	LM_ERR("proxy <%s> does not respond, disable it\n", node->rn_url.s);
+	node->rn_disabled = 1;
+	node->rn_recheck_ticks = get_ticks() + rtpengine_disable_tout;
+	raise_rtpengine_status_event(node);
+	return -1;
+}
+
+
 static int rtpe_function_call_async(struct sip_msg *msg, async_ctx *ctx, str *flags_str,
         pv_spec_t *spvar, pv_spec_t *bpvar, str *body, enum rtpe_operation op)
 {
@@ -3706,6 +4199,44 @@ static int rtpe_function_call_async(struct sip_msg *msg, async_ctx *ctx, str *fl
 	}
 
 	cookie = gencookie();
+
+	if (rtpe_mux_usable(node)) {
+		param = pkg_malloc(sizeof(rtpe_async_param) + node->rn_url.len + 1);
+		if (!param) {
+			LM_ERR("no more pkg mem\n");
+			RTPE_STOP_READ();
+			goto error;
+		}
+		memset(param, 0, sizeof(rtpe_async_param));
+
+		param->bencbuf = bencbuf;
+		param->op = op;
+		param->node_set = node->set;
+		param->node_url.s = (char *)(param + 1);
+		param->node_url.len = node->rn_url.len;
+		memcpy(param->node_url.s, node->rn_url.s, node->rn_url.len + 1);
+		param->cookie = pkg_strdup(cookie);
+		param->bpvar = bpvar;
+		param->spvar = spvar;
+
+		ret = start_mux_send_rtpe_command(node, ng_flags.dict, cookie,
+			ctx, param);
+		RTPE_STOP_READ();
+		if (ret < 0) {
+			pkg_free(param->cookie);
+			pkg_free(param);
+			goto error;
+		}
+
+		ctx->resume_f = resume_async_send_rtpe_command;
+		ctx->timeout_f = timeout_async_send_rtpe_command;
+		ctx->resume_param = param;
+
+		/* resumed by the in-flight table, once the reply arrives */
+		async_status = ASYNC_NO_FD;
+		return 1;
+	}
+
 	ret = start_async_send_rtpe_command(node, ng_flags.dict, cookie, &read_fd);
 
 	RTPE_STOP_READ();
@@ -28,12 +28,27 @@
 
 #include "bencode.h"
 #include "../../str.h"
+#include "../../ip_addr.h"
+#include "../../atomic.h"
 
 /* flags for set, node, and socket management */
 #define RTPE_TEARDOWN_NODE    (1<<0)
 #define RTPE_TEARDOWN_SET     (1<<1)
 #define RTPE_TEARDOWN_SOCKETS (1<<2)
 
+/* buckets of the per node latency histogram, see rtpe_lat_bounds[] */
+#define RTPE_LAT_BUCKETS      7
+
+#ifdef NO_ATOMIC_OPS
+typedef unsigned long rtpe_counter_t;
+#define rtpe_counter_add(_c, _v)  ((_c) += (_v))
+#define rtpe_counter_get(_c)      (_c)
+#else
+typedef atomic_t rtpe_counter_t;
+#define rtpe_counter_add(_c, _v)  do { atomic_fetch_add(&(_c), (_v)); } while (0)
+#define rtpe_counter_get(_c)      ((unsigned long)atomic_load(&(_c)))
+#endif
+
 struct rtpe_node {
 	unsigned int		idx;			/* overall index */
 	unsigned int		set;			/* id of the set index */
@@ -46,7 +61,9 @@ struct rtpe_node {
 	unsigned int		rn_last_ticks;
 	int					rn_flags;
 	socklen_t       ai_addrlen;
-	struct sockaddr ai_addr;
+	union sockaddr_union ai_addr;
+	/* replies to the async commands, by latency */
+	rtpe_counter_t		rn_lat[RTPE_LAT_BUCKETS];
 
 	struct rtpe_node	*rn_next;
 };
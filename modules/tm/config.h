@@ -28,11 +28,19 @@
 #include "../../config.h"
 
 
-/* size of TM hash table */
+/* default size of TM hash table (see the "hash_size" modparam) */
 #define TM_TABLE_ENTRIES     (1<<16)
 
-/* always use a power of 2 for hash table size */
-#define tm_hash( s1, s2 )     core_hash( &s1, &s2, TM_TABLE_ENTRIES)
+/* default number of locks shared by the hash entries */
+#define TM_TABLE_LOCKS       (1<<12)
+
+/* the hash entry locks are padded to this size, to avoid false sharing */
+#define TM_CACHE_LINE_SIZE   64
+
+/* actual size of the TM hash table, always a power of 2 */
+extern unsigned int tm_hash_size;
+
+#define tm_hash( s1, s2 )     core_hash( &s1, &s2, tm_hash_size)
 
 /* maximum length of localy generated acknowledgment */
 #define MAX_ACK_LEN   1024
@@ -54,6 +62,9 @@
 #define RETR_T1           500        /* in milliseconds */
 #define RETR_T2           4000       /* in milliseconds */
 
+/* max UDP buffers flushed with a single sendmmsg() call (UIO_MAXIOV) */
+#define TM_MAX_UDP_SEND_BATCH  1024
+
 /* when first reply is sent, this additional space is allocated so that
    one does not have to reallocate share memory when the message is
    replaced by a subsequent, longer message
@@ -64,6 +64,10 @@ static enum kill_reason kr;
    lives */
 static struct s_table*  tm_table;
 
+/* number of hash entries and of locks shared by them (modparams) */
+unsigned int tm_hash_size = TM_TABLE_ENTRIES;
+unsigned int tm_hash_locks = TM_TABLE_LOCKS;
+
 int syn_branch = 1;
 
 
@@ -85,13 +89,13 @@ enum kill_reason get_kr(void) {
 
 void lock_hash(int i)
 {
-	lock(&tm_table->entrys[i].mutex);
+	lock(get_entry_lock(tm_table, i));
 }
 
 
 void unlock_hash(int i)
 {
-	unlock(&tm_table->entrys[i].mutex);
+	unlock(get_entry_lock(tm_table, i));
 }
 
 
@@ -107,7 +111,7 @@ unsigned int transaction_count( void )
 	unsigned int count;
 
 	count=0;
-	for (i=0; i<TM_TABLE_ENTRIES; i++)
+	for (i=0; i<tm_table->size; i++)
 		count+=tm_table->entrys[i].cur_entries;
 	return count;
 }
@@ -356,10 +360,12 @@ void free_hash_table(void)
 
 	if (tm_table)
 	{
+		for( i = 0 ; i<tm_table->locks_no; i++)
+			release_entry_lock( tm_table->locks+i );
+
 		/* remove the data contained by each entry */
-		for( i = 0 ; i<TM_TABLE_ENTRIES; i++)
+		for( i = 0 ; i<tm_table->size; i++)
 		{
-			release_entry_lock( (tm_table->entrys)+i );
 			/* delete all synonyms at hash-collision-slot i */
 			p_cell=tm_table->entrys[i].first_cell;
 			for( ; p_cell; p_cell = tmp_cell )
@@ -378,24 +384,43 @@ void free_hash_table(void)
 struct s_table* init_hash_table( unsigned int timer_sets )
 {
 	int              i;
+	unsigned long    locks_offset;
 
-	/*allocs the table*/
-	tm_table= (struct s_table*)shm_malloc( sizeof( struct s_table ) );
+	if (tm_hash_locks > tm_hash_size)
+		tm_hash_locks = tm_hash_size;
+
+	/* allocs the table, the entries and the locks in one chunk; the
+	 * locks are aligned to a cache line (leave room for this) */
+	locks_offset = sizeof(struct s_table) +
+		tm_hash_size * sizeof(struct entry) + TM_CACHE_LINE_SIZE;
+	tm_table= (struct s_table*)shm_malloc( locks_offset +
+		tm_hash_locks * sizeof(entry_lock_type) );
 	if ( !tm_table) {
-		LM_ERR("no more share memory\n");
+		LM_ERR("no more share memory for %u entries\n", tm_hash_size);
 		goto error;
 	}
 
-	memset( tm_table, 0, sizeof (struct s_table ) );
+	memset( tm_table, 0, locks_offset +
+		tm_hash_locks * sizeof(entry_lock_type) );
 
 	tm_table->timer_sets = timer_sets;
+	tm_table->size = tm_hash_size;
+	tm_table->entrys = (struct entry *)(tm_table + 1);
+	tm_table->locks_no = tm_hash_locks;
+	tm_table->locks = (entry_lock_type *)
+		(((unsigned long)tm_table + locks_offset) &
+		~((unsigned long)TM_CACHE_LINE_SIZE - 1));
+
+	/* inits the locks */
+	for( i=0 ; i<tm_table->locks_no; i++ )
+		init_entry_lock( tm_table, i );
 
 	/* inits the entrys */
-	for(  i=0 ; i<TM_TABLE_ENTRIES; i++ )
-	{
-		init_entry_lock( tm_table, (tm_table->entrys)+i );
+	for(  i=0 ; i<tm_table->size; i++ )
 		tm_table->entrys[i].next_label = rand();
-	}
+
+	LM_DBG("TM hash table with %u entries and %u locks\n",
+		tm_table->size, tm_table->locks_no);
 
 	return  tm_table;
 
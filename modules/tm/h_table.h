@@ -47,6 +47,7 @@
 
 struct s_table;
 struct entry;
+union entry_lock;
 struct cell;
 struct timer;
 struct retr_buf;
@@ -316,24 +317,38 @@ typedef struct entry
 	struct cell*    last_cell;
 	/* currently highest sequence number in a synonym list */
 	unsigned int    next_label;
-	/* sync mutex */
-	ser_lock_t      mutex;
 	unsigned long acc_entries;
 	unsigned long cur_entries;
 }entry_type;
 
 
+/* sync mutex of a stripe of hash entries, alone on its cache line */
+typedef union entry_lock
+{
+	ser_lock_t      mutex;
+	char            pad[TM_CACHE_LINE_SIZE];
+}entry_lock_type;
+
 
 /* transaction table */
 struct s_table
 {
 	/* table of hash entries; each of them is a list of synonyms  */
-	struct entry   entrys[ TM_TABLE_ENTRIES ];
+	struct entry   *entrys;
+	/* number of entries, power of 2 */
+	unsigned int   size;
+	/* locks of the entries - entry "i" uses lock "i & (locks_no-1)" */
+	entry_lock_type *locks;
+	/* number of locks, power of 2, not more than the entries */
+	unsigned int   locks_no;
 	/* we keep it here just as a shortcut, we need it for assigning
 	 * a transaction to a specific timer set */
 	unsigned short timer_sets;
 };
 
+#define get_entry_lock(_t, _i) \
+	(&(_t)->locks[(_i) & ((_t)->locks_no-1)].mutex)
+
 
 #define get_retr_timer_payload(_tl_) \
 	container_of( _tl_, struct retr_buf, retr_timer)
@@ -373,6 +388,8 @@ void reset_kr();
 void set_kr( enum kill_reason kr );
 enum kill_reason get_kr();
 
+extern unsigned int tm_hash_locks;
+
 struct s_table* get_tm_table( void );
 struct s_table* init_hash_table(unsigned int timer_sets);
 void   free_hash_table( void );
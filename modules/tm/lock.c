@@ -235,18 +235,17 @@ int init_cell_lock( struct cell *cell )
 	return 0;
 }
 
-int init_entry_lock( struct s_table* ht, struct entry *entry )
+int init_entry_lock( struct s_table* ht, unsigned int idx )
 {
 #ifdef GEN_LOCK_T_PREFERED
-	lock_init(&entry->mutex);
+	lock_init(&ht->locks[idx].mutex);
 #else
 	/* just advice which of the available semaphores to use;
 	   specifically, all entries are partitioned into as
 	   many partitions as number of available semaphores allows
         */
-	entry->mutex.semaphore_set=entry_semaphore;
-	entry->mutex.semaphore_index = ( ((char *)entry - (char *)(ht->entrys ) )
-               / sizeof(struct entry) ) % sem_nr;
+	ht->locks[idx].mutex.semaphore_set=entry_semaphore;
+	ht->locks[idx].mutex.semaphore_index = idx % sem_nr;
 #endif
 	return 0;
 }
@@ -266,7 +265,7 @@ int release_cell_lock( struct cell *cell )
 
 
 
-int release_entry_lock( struct entry *entry )
+int release_entry_lock( union entry_lock *lock )
 {
 	/* the same as above */
 	return 0;
@@ -76,11 +76,11 @@ void lock_cleanup();
 
 
 int init_cell_lock( struct cell *cell );
-int init_entry_lock( struct s_table* ht, struct entry *entry );
+int init_entry_lock( struct s_table* ht, unsigned int idx );
 
 
 int release_cell_lock( struct cell *cell );
-int release_entry_lock( struct entry *entry );
+int release_entry_lock( union entry_lock *lock );
 int release_timerlist_lock( struct timer *timerlist );
 
 
@@ -631,7 +631,7 @@ mi_response_t *mi_tm_hash(const mi_params_t *params,
 
 	tm_t = get_tm_table();
 
-	for (i=0; i<TM_TABLE_ENTRIES; i++) {
+	for (i=0; i<tm_t->size; i++) {
 		resp_item = add_mi_object(resp_arr, NULL, 0);
 		if (!resp_item)
 			goto error;
@@ -655,6 +655,75 @@ error:
 }
 
 
+/*
+  Syntax of "t_hash_histogram" :
+    no nodes
+  Reports how many hash entries hold 0, 1, 2, ... transactions (the last
+  bucket of the histogram counts all the longer entries)
+*/
+mi_response_t *mi_tm_hash_histogram(const mi_params_t *params,
+								struct mi_handler *async_hdl)
+{
+	unsigned long hist[TM_HASH_HIST_BUCKETS];
+	unsigned long total = 0, max = 0, used = 0, n;
+	char name[INT2STR_MAX_LEN + 1];
+	mi_response_t *resp;
+	mi_item_t *resp_obj, *hist_arr, *hist_item;
+	struct s_table* tm_t;
+	unsigned int i;
+
+	tm_t = get_tm_table();
+
+	memset(hist, 0, sizeof hist);
+	for (i=0; i<tm_t->size; i++) {
+		/* read without locking, the result is just informative */
+		n = tm_t->entrys[i].cur_entries;
+		total += n;
+		if (n) used++;
+		if (n > max) max = n;
+		hist[n < TM_HASH_HIST_BUCKETS ? n : TM_HASH_HIST_BUCKETS-1]++;
+	}
+
+	resp = init_mi_result_object(&resp_obj);
+	if (!resp)
+		return 0;
+
+	if (add_mi_number(resp_obj, MI_SSTR("Size"), tm_t->size) < 0)
+		goto error;
+	if (add_mi_number(resp_obj, MI_SSTR("Locks"), tm_t->locks_no) < 0)
+		goto error;
+	if (add_mi_number(resp_obj, MI_SSTR("Transactions"), total) < 0)
+		goto error;
+	if (add_mi_number(resp_obj, MI_SSTR("Used entries"), used) < 0)
+		goto error;
+	if (add_mi_number(resp_obj, MI_SSTR("Max entry length"), max) < 0)
+		goto error;
+
+	hist_arr = add_mi_array(resp_obj, MI_SSTR("Histogram"));
+	if (!hist_arr)
+		goto error;
+
+	for (i=0; i<TM_HASH_HIST_BUCKETS; i++) {
+		hist_item = add_mi_object(hist_arr, NULL, 0);
+		if (!hist_item)
+			goto error;
+
+		n = snprintf(name, sizeof name, "%u%s", i,
+			i==TM_HASH_HIST_BUCKETS-1 ? "+" : "");
+		if (add_mi_string(hist_item, MI_SSTR("Length"), name, n) < 0)
+			goto error;
+		if (add_mi_number(hist_item, MI_SSTR("Entries"), hist[i]) < 0)
+			goto error;
+	}
+
+	return resp;
+
+error:
+	free_mi_response(resp);
+	return init_mi_error(500, MI_SSTR("Internal error"));
+}
+
+
 /*
   Syntax of "t_reply" :
   code
@@ -33,6 +33,7 @@
 #define MI_TM_UAC      "t_uac_dlg"
 #define MI_TM_CANCEL   "t_uac_cancel"
 #define MI_TM_HASH     "t_hash"
+#define MI_TM_HASH_HIST "t_hash_histogram"
 #define MI_TM_REPLY    "t_reply"
 
 mi_response_t *mi_tm_uac_dlg_1(const mi_params_t *params,
@@ -58,6 +59,12 @@ mi_response_t *mi_tm_cancel(const mi_params_t *params,
 mi_response_t *mi_tm_hash(const mi_params_t *params,
 								struct mi_handler *async_hdl);
 
+/* number of buckets in the t_hash_histogram output */
+#define TM_HASH_HIST_BUCKETS  16
+
+mi_response_t *mi_tm_hash_histogram(const mi_params_t *params,
+								struct mi_handler *async_hdl);
+
 mi_response_t *mi_tm_reply_1(const mi_params_t *params,
 								struct mi_handler *async_hdl);
 mi_response_t *mi_tm_reply_2(const mi_params_t *params,
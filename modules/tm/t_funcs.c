@@ -55,6 +55,13 @@
 #include "config.h"
 #include "t_stats.h"
 #include "../../context.h"
+#include "../../net/net_udp.h"
+
+/* max UDP buffers to be sent with one syscall (0 - no batching) */
+int tm_udp_send_batch = 0;
+
+/* if the current tm batch actually queues datagrams */
+static int tm_batching = 0;
 
 
 /* ----------------------------------------------------- */
@@ -80,6 +87,54 @@ int send_pr_buffer( struct retr_buf *rb, void *buf, int len,
 
 
 
+void tm_send_batch_start(void)
+{
+	if (!tm_udp_send_batch)
+		return;
+
+	if (tm_batching++)
+		return;
+
+	if (udp_batch_start(tm_udp_send_batch)<0)
+		tm_batching = 0;
+}
+
+
+void tm_send_batch_end(void)
+{
+	struct timeval begin;
+	int sent;
+
+	if (!tm_batching || --tm_batching)
+		return;
+
+	gettimeofday(&begin, NULL);
+	sent = udp_batch_end();
+	if (sent<=0)
+		return;
+
+	if_update_stat( tm_enable_stats, tm_udp_batches, 1);
+	if_update_stat( tm_enable_stats, tm_udp_batch_msgs, sent);
+	if_update_stat( tm_enable_stats, tm_udp_batch_usec,
+		get_time_diff(&begin));
+}
+
+
+void tm_send_batch_suspend(void)
+{
+	if (tm_batching)
+		udp_batch_suspend();
+}
+
+
+void tm_send_batch_resume(void)
+{
+	if (tm_batching)
+		udp_batch_resume();
+}
+
+
+
 void tm_shutdown(void)
 {
 
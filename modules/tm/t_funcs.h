@@ -64,6 +64,7 @@ struct retr_buf;
 #include "ut.h"
 
 extern int noisy_ctimer;
+extern int tm_udp_send_batch;
 
 
 /* t_relay_to flags */
@@ -104,6 +105,17 @@ int send_pr_buffer( struct retr_buf *rb, void *buf, int len, void* ctx);
 #define SEND_CONTEXTS_BUFFER( _rb, ctx) \
 	SEND_PR_CONTEXTS_BUFFER( (_rb) , (_rb)->buffer.s, (_rb)->buffer.len, ctx)
 
+/* queue the outgoing UDP buffers (if enabled) until tm_send_batch_end();
+ * a queued send always looks successful, so this is only for the sends
+ * whose result is not acted upon - the retransmissions */
+void tm_send_batch_start(void);
+/* flush all the UDP buffers queued since tm_send_batch_start() */
+void tm_send_batch_end(void);
+/* send the next buffers right away, even inside a batch, until
+ * tm_send_batch_resume() - for the sends whose result must be known */
+void tm_send_batch_suspend(void);
+void tm_send_batch_resume(void);
+
 
 #define UNREF_UNSAFE(_T_cell) do { \
 	((_T_cell)->ref_count--);\
@@ -771,7 +771,7 @@ int t_reply_matching( struct sip_msg *p_msg , int *p_branch )
 
 	/* sanity check */
 	if (reverse_hex2int(hashi, hashl, &hash_index)<0
-		||hash_index>=TM_TABLE_ENTRIES
+		||hash_index>=tm_hash_size
 		|| reverse_hex2int(branchi, branchl, &branch_id)<0
 		||branch_id>=MAX_BRANCHES
 		|| (syn_branch ? reverse_hex2int(syni, synl, &entry_label)<0
@@ -1210,7 +1210,7 @@ int t_lookup_ident(struct cell ** trans, unsigned int hash_index,
 {
 	struct cell* p_cell;
 
-	if(hash_index >= TM_TABLE_ENTRIES){
+	if(hash_index >= tm_hash_size){
 		LM_ERR("invalid hash_index=%u\n",hash_index);
 		return -1;
 	}
@@ -1282,7 +1282,7 @@ int t_lookup_callid(struct cell ** trans, str callid, str cseq) {
 	/* lookup the hash index where the transaction is stored */
 	hash_index=tm_hash(callid, cseq);
 
-	if(hash_index >= TM_TABLE_ENTRIES){
+	if(hash_index >= tm_hash_size){
 		LM_ERR("invalid hash_index=%u\n",hash_index);
 		return -1;
 	}
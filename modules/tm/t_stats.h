@@ -54,6 +54,10 @@ extern stat_var *tm_retran_rpl_T2;
 extern stat_var *tm_timeout_fr;
 extern stat_var *tm_timeout_fr_inv;
 
+extern stat_var *tm_udp_batches;
+extern stat_var *tm_udp_batch_msgs;
+extern stat_var *tm_udp_batch_usec;
+
 extern stat_var *tm_cluster_reply_tx;
 extern stat_var *tm_cluster_request_tx;
 extern stat_var *tm_cluster_cancel_tx;
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <tap.h>
+
+#include "../../../dprint.h"
+#include "../../../ut.h"
+#include "../../../parser/msg_parser.h"
+#include "../../../parser/parse_to.h"
+#include "../../../parser/parse_from.h"
+#include "../../../parser/parse_uri.h"
+#include "../../../parser/parse_cseq.h"
+
+#include "../../../test/ut.h"
+
+#include "../sip_msg.h"
+
+#define CLONE_LOOPS 20000
+
+static char *invites[] = {
+	"INVITE sip:+4930123456@pbx.example.com;user=phone SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 10.0.0.10:5060;branch=z9hG4bK-524287-1---77ba17085d60f141;rport\r\n"
+	"Max-Forwards: 70\r\n"
+	"Contact: <sip:alice@10.0.0.10:5060;transport=udp>\r\n"
+	"To: <sip:+4930123456@pbx.example.com;user=phone>\r\n"
+	"From: \"Alice\"<sip:alice@pbx.example.com>;tag=37b4a51f\r\n"
+	"Call-ID: ZjY0ZTI3OGYxNjM0ODY4YWFhOGE5NGVjYjcxYmU2N2I\r\n"
+	"CSeq: 2 INVITE\r\n"
+	"Allow: INVITE, ACK, CANCEL, BYE, NOTIFY, REFER, MESSAGE, OPTIONS, INFO, SUBSCRIBE\r\n"
+	"Content-Type: application/sdp\r\n"
+	"Supported: replaces, norefersub, extended-refer, timer, X-cisco-serviceuri\r\n"
+	"User-Agent: Z 5.4.12 v2.10.11.5\r\n"
+	"Proxy-Authorization: Digest username=\"alice\",realm=\"pbx.example.com\","
+		"nonce=\"5f9c5c0a0000c1a3e1e9b2a7c6b1f5d8b0f6ad8e\",uri=\"sip:+4930123456@pbx.example.com;user=phone\","
+		"response=\"6c2b5a1f9b0e3c1d2a4f8e7d6c5b4a39\",algorithm=MD5\r\n"
+	"Allow-Events: presence, kpml, talk\r\n"
+	"Content-Length: 239\r\n"
+	"\r\n"
+	"v=0\r\n"
+	"o=Z 0 0 IN IP4 10.0.0.10\r\n"
+	"s=Z\r\n"
+	"c=IN IP4 10.0.0.10\r\n"
+	"t=0 0\r\n"
+	"m=audio 8000 RTP/AVP 8 0 101\r\n"
+	"a=rtpmap:101 telephone-event/8000\r\n"
+	"a=fmtp:101 0-16\r\n"
+	"a=sendrecv\r\n"
+	"a=rtcp-mux\r\n"
+	"m=video 0 RTP/AVP 96\r\n"
+	"a=rtpmap:96 H264/90000\r\n",
+
+	"INVITE sip:bob@biloxi.example.com SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 192.0.2.41:5060;branch=z9hG4bK2d4790.1\r\n"
+	"Via: SIP/2.0/UDP 192.0.2.25:5060;received=192.0.2.25;branch=z9hG4bK65a7.2;rport=5060\r\n"
+	"Via: SIP/2.0/TCP 198.51.100.7:5060;branch=z9hG4bK74bf9;received=198.51.100.7\r\n"
+	"Max-Forwards: 68\r\n"
+	"Record-Route: <sip:192.0.2.41;lr;ftag=9fxced76sl>\r\n"
+	"Record-Route: <sip:192.0.2.25;lr;ftag=9fxced76sl;did=a1b.c2d>\r\n"
+	"From: Alice <sip:alice@atlanta.example.com>;tag=9fxced76sl\r\n"
+	"To: Bob <sip:bob@biloxi.example.com>\r\n"
+	"Call-ID: 3848276298220188511@atlanta.example.com\r\n"
+	"CSeq: 1 INVITE\r\n"
+	"Contact: <sip:alice@client.atlanta.example.com;transport=tcp>\r\n"
+	"P-Asserted-Identity: <sip:alice@atlanta.example.com>\r\n"
+	"Session-Expires: 1800;refresher=uac\r\n"
+	"Min-SE: 90\r\n"
+	"Supported: timer, 100rel\r\n"
+	"Content-Type: application/sdp\r\n"
+	"Content-Length: 151\r\n"
+	"\r\n"
+	"v=0\r\n"
+	"o=alice 2890844526 2890844526 IN IP4 client.atlanta.example.com\r\n"
+	"s=-\r\n"
+	"c=IN IP4 192.0.2.101\r\n"
+	"t=0 0\r\n"
+	"m=audio 49172 RTP/AVP 0\r\n"
+	"a=rtpmap:0 PCMU/8000\r\n",
+
+	"INVITE sip:1002@198.51.100.1:5080;transport=udp SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 203.0.113.9:5060;rport;branch=z9hG4bKPjc8f9a2b7-1c6e\r\n"
+	"Max-Forwards: 70\r\n"
+	"From: \"1001\" <sip:1001@198.51.100.1>;tag=a7dc3ab1-52b1\r\n"
+	"To: <sip:1002@198.51.100.1>\r\n"
+	"Contact: \"1001\" <sip:1001@203.0.113.9:5060;ob>\r\n"
+	"Call-ID: 4c1e7b0d-3a2f-4b41-9a55-0f0d1c7f5e11\r\n"
+	"CSeq: 27718 INVITE\r\n"
+	"Route: <sip:198.51.100.1;lr>\r\n"
+	"Allow: PRACK, INVITE, ACK, BYE, CANCEL, UPDATE, INFO, SUBSCRIBE, NOTIFY, REFER, MESSAGE, OPTIONS\r\n"
+	"Supported: replaces, 100rel, timer, norefersub\r\n"
+	"Session-Expires: 1800\r\n"
+	"Min-SE: 90\r\n"
+	"User-Agent: PJSUA v2.13 Linux-6.1/x86_64/glibc-2.36\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n",
+};
+
+
+static int parse_invite(char *buf, struct sip_msg *msg)
+{
+	memset(msg, 0, sizeof *msg);
+	msg->buf = buf;
+	msg->len = strlen(buf);
+
+	if (parse_msg(msg->buf, msg->len, msg) != 0 ||
+	parse_headers(msg, HDR_EOH_F, 0) < 0 || parse_from_header(msg) < 0 ||
+	parse_sip_msg_uri(msg) < 0)
+		return -1;
+
+	return 0;
+}
+
+
+/* check the clone against the original msg */
+static void test_clone_content(struct sip_msg *msg, int i)
+{
+	struct sip_msg *clone;
+	int len;
+
+	clone = sip_msg_cloner(msg, &len, 2);
+	if (!ok(clone != NULL, "clone-%d", i))
+		return;
+
+	ok(clone->callid && str_match(&clone->callid->body, &msg->callid->body),
+		"clone-%d-callid", i);
+	ok(str_match(&get_from(clone)->tag_value, &get_from(msg)->tag_value),
+		"clone-%d-from-tag", i);
+	ok(clone->via1->branch && str_match(&clone->via1->branch->value,
+		&msg->via1->branch->value), "clone-%d-branch", i);
+	ok(get_cseq(clone)->number.s >= clone->buf &&
+		get_cseq(clone)->number.s < clone->buf + clone->len,
+		"clone-%d-cseq-in-buf", i);
+
+	ok(clone->parsed_uri_ok && str_match(&clone->parsed_uri.host,
+		&msg->parsed_uri.host), "clone-%d-ruri-host", i);
+	ok(clone->parsed_uri.host.s >= clone->buf &&
+		clone->parsed_uri.host.s < clone->buf + clone->len,
+		"clone-%d-ruri-in-buf", i);
+
+	free_cloned_msg(clone);
+}
+
+
+static void bench_clone(struct sip_msg *msg, int i)
+{
+	struct sip_msg *clone;
+	long begin;
+	int n, len = 0;
+
+	begin = ut_now_ns();
+	for (n = 0; n < CLONE_LOOPS; n++) {
+		clone = sip_msg_cloner(msg, &len, 2);
+		if (!clone)
+			break;
+		free_cloned_msg(clone);
+	}
+
+	ok(n == CLONE_LOOPS, "clone-bench-%d", i);
+	diag("INVITE #%d (%d bytes), clone: %ld ns/clone, %d bytes of shm",
+		i, msg->len, (ut_now_ns() - begin) / CLONE_LOOPS, len);
+}
+
+
+static void test_sip_msg_clone(int bench)
+{
+	struct sip_msg msg;
+	int i;
+
+	for (i = 0; i < sizeof invites / sizeof *invites; i++) {
+		if (!ok(parse_invite(invites[i], &msg) == 0, "parse-invite-%d", i))
+			continue;
+
+		if (bench)
+			bench_clone(&msg, i);
+		else
+			test_clone_content(&msg, i);
+
+		free_sip_msg(&msg);
+	}
+}
+
+
+void mod_tests(void)
+{
+	test_sip_msg_clone(0);
+	/* clone time and shm footprint, CLONE_LOOPS clones of each INVITE */
+	//test_sip_msg_clone(1);
+}
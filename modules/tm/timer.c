@@ -112,12 +112,28 @@
 #include "t_reply.h"
 #include "t_cancel.h"
 #include "t_stats.h"
+#include "timer_wheel.h"
 
 
 static struct timer_table *timertable=0;
 static unsigned int timer_sets = 0;
 static struct timer detached_timer; /* just to have a value to compare with*/
 
+/* use the timing wheels instead of the sorted timer lists */
+int tm_timer_wheel = 0;
+
+/* per timer set wheels, one for the ticks based timers and one for the
+ * uticks based (retransmission) timers */
+struct tm_timer_wheels {
+	struct timer_wheel  tk;
+	struct timer_wheel  utk;
+};
+static struct tm_timer_wheels *timerwheels=0;
+
+/* per timer set, the max lag (in ms) seen by the last run of the
+ * ticks (index 0) and uticks (index 1) routines */
+static unsigned long *timer_lags=0;
+
 /* currently processed branch */
 extern int _tm_branch_index;
 
@@ -166,6 +182,11 @@ static unsigned int timer_id2type[NR_OF_TIMER_LISTS] = {
 };
 
 
+#define tw_for_list(_set, _id) \
+	((timer_id2type[_id]==UTIME_TYPE) ? \
+		&timerwheels[_set].utk : &timerwheels[_set].tk)
+
+
 /******************** handlers ***************************/
 
 
@@ -278,6 +299,7 @@ inline static void retransmission_handler( struct timer_link *retr_tl )
 {
 	struct retr_buf* r_buf ;
 	enum lists id;
+	int sent_cbs;
 
 	r_buf = get_retr_timer_payload(retr_tl);
 #ifdef EXTRA_DEBUG
@@ -295,8 +317,13 @@ inline static void retransmission_handler( struct timer_link *retr_tl )
 			LM_DBG("retransmission_handler : request resending"
 				" (t=%p, %.9s ... )\n", r_buf->my_T, r_buf->buffer.s);
 			set_t(r_buf->my_T);
+			/* the SENT_OUT callbacks must only see a message which
+			 * actually left, not one queued in the UDP batch */
+			sent_cbs = has_tran_tmcbs( r_buf->my_T, TMCB_MSG_SENT_OUT);
+			if (sent_cbs)
+				tm_send_batch_suspend();
 			if (SEND_BUFFER( r_buf )==0) {
-				if ( has_tran_tmcbs( r_buf->my_T, TMCB_MSG_SENT_OUT) ) {
+				if ( sent_cbs ) {
 					set_extra_tmcb_params( &r_buf->buffer, &r_buf->dst);
 					run_trans_callbacks( TMCB_MSG_SENT_OUT, r_buf->my_T,
 						r_buf->my_T->uas.request, 0, 0);
@@ -307,6 +334,8 @@ inline static void retransmission_handler( struct timer_link *retr_tl )
 				return;
 			} */
 			}
+			if (sent_cbs)
+				tm_send_batch_resume();
 
 			set_t(T_UNDEFINED);
 			switch(r_buf->retr_list) {
@@ -320,7 +349,12 @@ inline static void retransmission_handler( struct timer_link *retr_tl )
 			LM_DBG("retransmission_handler : reply resending "
 				"(t=%p, %.9s ... )\n", r_buf->my_T, r_buf->buffer.s);
 			set_t(r_buf->my_T);
+			sent_cbs = has_tran_tmcbs( r_buf->my_T, TMCB_MSG_SENT_OUT);
+			if (sent_cbs)
+				tm_send_batch_suspend();
 			t_retransmit_reply(r_buf->my_T);
+			if (sent_cbs)
+				tm_send_batch_resume();
 			set_t(T_UNDEFINED);
 			update_stat( tm_retran_rpl_T2, 1);
 	}
@@ -517,6 +551,13 @@ struct timer_table *get_timertable(void)
 }
 
 
+static void free_deleted_cell(struct timer_link *tl, void *foo)
+{
+	if (tl->timer_list && tl->timer_list->id==DELETE_LIST)
+		free_cell( get_dele_timer_payload(tl) );
+}
+
+
 void unlink_timer_lists(void)
 {
 	struct timer_link  *tl, *end, *tmp;
@@ -526,6 +567,14 @@ void unlink_timer_lists(void)
 	if (timertable==0)
 		return; /* nothing to do */
 
+	if (tm_timer_wheel) {
+		for ( set=0 ; set<timer_sets ; set++) {
+			LM_DBG("emptying DELETE list for set %d\n",set);
+			tw_for_each( &timerwheels[set].tk, free_deleted_cell, NULL);
+		}
+		return;
+	}
+
 	for ( set=0 ; set<timer_sets ; set++) {
 		/* remember the DELETE LIST */
 		tl = timertable[set].timers[DELETE_LIST].first_tl.next_tl;
@@ -632,6 +681,37 @@ struct timer_table *tm_init_timers( unsigned int sets )
 		timertable[set].timers[DELETE_LIST].id       = DELETE_LIST;
 	}
 
+	timer_lags = (unsigned long *)shm_malloc(2 * sets * sizeof(unsigned long));
+	if (!timer_lags) {
+		LM_ERR("no more share memory\n");
+		goto error0;
+	}
+	memset(timer_lags, 0, 2 * sets * sizeof(unsigned long));
+
+	if (tm_timer_wheel) {
+		timerwheels = (struct tm_timer_wheels *)shm_malloc
+			( sets * sizeof(struct tm_timer_wheels));
+		if (!timerwheels) {
+			LM_ERR("no more share memory\n");
+			goto error0;
+		}
+		memset(timerwheels, 0, sets * sizeof(struct tm_timer_wheels));
+
+		if (tw_init_link_locks()<0)
+			goto error0;
+
+		for( set=0 ; set<timer_sets ; set++) {
+			if (tw_init( &timerwheels[set].tk, TM_TIMER_ITV_S,
+			get_ticks())<0 ||
+			tw_init( &timerwheels[set].utk, TM_UTIMER_ITV_US,
+			get_uticks())<0) {
+				LM_CRIT("failed to init the timer wheels\n");
+				goto error0;
+			}
+		}
+		LM_DBG("using timing wheels for %d timer sets\n", timer_sets);
+	}
+
 	return timertable;
 
 error0:
@@ -650,6 +730,16 @@ void free_timer_table(void)
 			lock_destroy( timertable[i].ex_lock );
 		shm_free(timertable);
 	}
+	if (timerwheels) {
+		for ( i=0 ; i<timer_sets ; i++ ) {
+			tw_destroy( &timerwheels[i].tk );
+			tw_destroy( &timerwheels[i].utk );
+		}
+		tw_destroy_link_locks();
+		shm_free(timerwheels);
+	}
+	if (timer_lags)
+		shm_free(timer_lags);
 }
 
 
@@ -942,6 +1032,22 @@ void set_timer( struct timer_link *new_tl, enum lists list_id,
 
 	list= &(timertable[new_tl->set].timers[ list_id ]);
 
+	if (tm_timer_wheel) {
+		tw_lock_link( new_tl );
+		/* same as for the lists, a "detached" timer is not valid anymore */
+		if (tw_remove( tw_for_list(new_tl->set, list_id), new_tl,
+		DETACHED_LIST)<0) {
+			LM_CRIT("set_timer for %d list called on a \"detached\" "
+				"timer -- ignoring: %p\n", list_id, new_tl);
+		} else {
+			tw_insert( tw_for_list(new_tl->set, list_id), new_tl, list,
+				timeout + ((timer_id2type[list_id]==UTIME_TYPE)?
+				get_uticks():get_ticks()));
+		}
+		tw_unlock_link( new_tl );
+		return;
+	}
+
 	lock(list->mutex);
 	/* check first if we are on the "detached" timer_routine list,
 	 * if so do nothing, the timer is not valid anymore
@@ -994,6 +1100,18 @@ int set_1timer( struct timer_link *new_tl, enum lists list_id,
 
 	list= &(timertable[new_tl->set].timers[ list_id ]);
 
+	if (tm_timer_wheel) {
+		tw_lock_link( new_tl );
+		if (!new_tl->time_out) {
+			tw_insert( tw_for_list(new_tl->set, list_id), new_tl, list,
+				timeout + ((timer_id2type[list_id]==UTIME_TYPE)?
+				get_uticks():get_ticks()));
+			ret = 0;
+		}
+		tw_unlock_link( new_tl );
+		return ret;
+	}
+
 	lock(list->mutex);
 	if (!new_tl->time_out) {
 		insert_timer_unsafe( list, new_tl, timeout +
@@ -1007,6 +1125,15 @@ int set_1timer( struct timer_link *new_tl, enum lists list_id,
 
 
 
+static inline void tw_remove_link( struct timer_wheel *tw,
+													struct timer_link *tl )
+{
+	tw_lock_link( tl );
+	tw_remove( tw, tl, DETACHED_LIST );
+	tw_unlock_link( tl );
+}
+
+
 /* should be called only from timer process context,
  * else it's unsafe */
 static void unlink_timers( struct cell *t )
@@ -1043,6 +1170,28 @@ static void unlink_timers( struct cell *t )
 
 	set = t->wait_tl.set;
 
+	if (tm_timer_wheel) {
+		if (remove_retr) {
+			tw_remove_link( &timerwheels[set].utk, &t->uas.response.retr_timer);
+			for (i=0; i<t->nr_of_outgoings; i++) {
+				tw_remove_link( &timerwheels[set].utk,
+					&t->uac[i].request.retr_timer);
+				tw_remove_link( &timerwheels[set].utk,
+					&t->uac[i].local_cancel.retr_timer);
+			}
+		}
+		if (remove_fr) {
+			tw_remove_link( &timerwheels[set].tk, &t->uas.response.fr_timer);
+			for (i=0; i<t->nr_of_outgoings; i++) {
+				tw_remove_link( &timerwheels[set].tk,
+					&t->uac[i].request.fr_timer);
+				tw_remove_link( &timerwheels[set].tk,
+					&t->uac[i].local_cancel.fr_timer);
+			}
+		}
+		return;
+	}
+
 	/* do what we have to do....*/
 	if (remove_retr) {
 		/* RT_T1 lock is shared by all other RT timer
@@ -1081,29 +1230,69 @@ static void unlink_timers( struct cell *t )
 		(_tl)->next_tl = (_tl)->prev_tl = 0;\
 		LM_DBG("timer routine:%d,tl=%p next=%p, timeout=%lld\n",\
 			id,(_tl),tmp_tl,(_tl)->time_out);\
-		if ( !(_tl)->deleted ) \
+		if ( !(_tl)->deleted ) {\
+			if ((_tl)->time_out < now && now - (_tl)->time_out > lag)\
+				lag = now - (_tl)->time_out;\
 			(_handler)( _tl );\
+		}\
 		(_tl) = tmp_tl;\
 	}
 
 
+unsigned long tm_get_timer_lag(unsigned short foo)
+{
+	unsigned long lag = 0;
+	unsigned int set;
+
+	for ( set=0 ; set<timer_sets ; set++ )
+		if (timer_lags[2*set] > lag)
+			lag = timer_lags[2*set];
+
+	return lag;
+}
+
+
+unsigned long tm_get_utimer_lag(unsigned short foo)
+{
+	unsigned long lag = 0;
+	unsigned int set;
+
+	for ( set=0 ; set<timer_sets ; set++ )
+		if (timer_lags[2*set+1] > lag)
+			lag = timer_lags[2*set+1];
+
+	return lag;
+}
+
+
 
 
 void timer_routine(unsigned int ticks , void *set)
 {
 	struct timer_link *tl, *tmp_tl;
+	struct timer_link *expired[NR_OF_TIMER_LISTS];
 	struct timespec begin;
 	int                id;
+	utime_t now = ticks, lag = 0;
 
 	clock_gettime(CLOCK_REALTIME, &begin);
 
 	lock_get( timertable[(long)set].ex_lock );
 
+	if (tm_timer_wheel) {
+		memset( expired, 0, sizeof expired);
+		tw_expire( &timerwheels[(long)set].tk, ticks, DETACHED_LIST, expired);
+	}
+
 	for( id=0 ; id<RT_T1_TO_1 ; id++ )
 	{
 		/* to waste as little time in lock as possible, detach list
 		   with expired items and process them after leaving the lock */
-		tl=check_and_split_time_list( &timertable[(long)set].timers[ id ], ticks);
+		if (tm_timer_wheel)
+			tl = expired[id];
+		else
+			tl=check_and_split_time_list( &timertable[(long)set].timers[ id ],
+				ticks);
 		/* process items now */
 		switch (id)
 		{
@@ -1121,6 +1310,8 @@ void timer_routine(unsigned int ticks , void *set)
 	}
 	lock_release( timertable[(long)set].ex_lock );
 
+	timer_lags[2*(long)set] = lag * TM_TIMER_ITV_S * 1000;
+
 	clock_check_diff((double)TM_TIMER_ITV_S*1e9 * TM_TIMER_LOAD_WARN,
 	    "now at %d%%+ capacity, inuse_transactions: %lu", (int)(TM_TIMER_LOAD_WARN*100),
 	    (unsigned long)get_stat_val(tm_trans_inuse));
@@ -1131,18 +1322,31 @@ void timer_routine(unsigned int ticks , void *set)
 void utimer_routine(utime_t uticks , void *set)
 {
 	struct timer_link *tl, *tmp_tl;
+	struct timer_link *expired[NR_OF_TIMER_LISTS];
 	struct timespec begin;
 	int                id;
+	utime_t now = uticks, lag = 0;
 
 	clock_gettime(CLOCK_REALTIME, &begin);
 
 	lock_get( timertable[(long)set].ex_lock );
 
+	tm_send_batch_start();
+
+	if (tm_timer_wheel) {
+		memset( expired, 0, sizeof expired);
+		tw_expire( &timerwheels[(long)set].utk, uticks, DETACHED_LIST, expired);
+	}
+
 	for( id=RT_T1_TO_1 ; id<NR_OF_TIMER_LISTS ; id++ )
 	{
 		/* to waste as little time in lock as possible, detach list
 		   with expired items and process them after leaving the lock */
-		tl=check_and_split_time_list( &timertable[(long)set].timers[ id ], uticks);
+		if (tm_timer_wheel)
+			tl = expired[id];
+		else
+			tl=check_and_split_time_list( &timertable[(long)set].timers[ id ],
+				uticks);
 		/* process items now */
 		switch (id)
 		{
@@ -1156,6 +1360,11 @@ void utimer_routine(utime_t uticks , void *set)
 	}
 	lock_release( timertable[(long)set].ex_lock );
 
+	timer_lags[2*(long)set+1] = lag / 1000;
+
+	/* out of the lock, push all the retransmissions of this tick */
+	tm_send_batch_end();
+
 	clock_check_diff((double)TM_UTIMER_ITV_US*1000 * TM_TIMER_LOAD_WARN,
 	    "now at %d%%+ capacity, inuse_transactions: %lu", (int)(TM_TIMER_LOAD_WARN*100),
 	    (unsigned long)get_stat_val(tm_trans_inuse));
@@ -92,6 +92,7 @@ struct timer_table
 
 
 
+extern int tm_timer_wheel;
 extern int timer_group[NR_OF_TIMER_LISTS];
 extern unsigned int timer_id2timeout[NR_OF_TIMER_LISTS];
 
@@ -120,4 +121,8 @@ void utimer_routine( utime_t, void*);
 
 struct timer_table *get_timertable();
 
+unsigned long tm_get_timer_lag(unsigned short foo);
+
+unsigned long tm_get_utimer_lag(unsigned short foo);
+
 #endif
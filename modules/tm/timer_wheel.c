@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Locking rules:
+ *   - a link is set/removed only while holding its link lock (see
+ *     tw_lock_link()), so at most one process moves a given link;
+ *   - the slot holding a link is found via "ld_tl" and must be locked and
+ *     re-checked (the timer process may cascade the link meanwhile);
+ *   - the link state ("timer_list") is changed only under the slot lock;
+ *   - the timer process cascades by holding the source slot (upper level)
+ *     and then each destination slot (lower level); all the other paths
+ *     hold a single slot lock, so there is no lock inversion.
+ */
+
+#include "../../dprint.h"
+#include "../../mem/shm_mem.h"
+#include "h_table.h"
+#include "timer_wheel.h"
+
+static gen_lock_set_t *tw_link_locks = NULL;
+
+#define tw_units(_tw, _t) \
+	(((_t) + (_tw)->unit - 1) / (_tw)->unit)
+
+#define tw_lvl_shift(_l) \
+	(TW_L0_BITS + ((_l)-1)*TW_LN_BITS)
+
+#define tw_lvl_base(_l) \
+	(TW_L0_SIZE + ((_l)-1)*TW_LN_SIZE)
+
+#define TW_MAX_SPAN (((utime_t)1) << tw_lvl_shift(TW_LEVELS))
+
+#define tw_slot_empty(_h) ((_h)->next_tl==(_h))
+
+
+/* returns the slot for a timer expiring in wheel unit "e" */
+static inline unsigned int tw_slot(utime_t e, utime_t n)
+{
+	utime_t d;
+	int l;
+
+	if (e < n)
+		e = n;
+	d = e - n;
+
+	if (d < TW_L0_SIZE)
+		return e & (TW_L0_SIZE-1);
+
+	if (d >= TW_MAX_SPAN)
+		e = n + TW_MAX_SPAN - 1;
+
+	for (l=1; l<TW_LEVELS-1; l++)
+		if (d < (((utime_t)1) << tw_lvl_shift(l+1)))
+			break;
+
+	return tw_lvl_base(l) + ((e >> tw_lvl_shift(l)) & (TW_LN_SIZE-1));
+}
+
+
+static inline void tw_link(struct timer_link *head, struct timer_link *tl)
+{
+	tl->prev_tl = head->prev_tl;
+	tl->next_tl = head;
+	head->prev_tl->next_tl = tl;
+	head->prev_tl = tl;
+	tl->ld_tl = head;
+}
+
+
+static inline void tw_unlink(struct timer_link *tl)
+{
+	tl->prev_tl->next_tl = tl->next_tl;
+	tl->next_tl->prev_tl = tl->prev_tl;
+	tl->next_tl = tl->prev_tl = NULL;
+}
+
+
+int tw_init(struct timer_wheel *tw, unsigned int unit, utime_t now)
+{
+	int i;
+
+	tw->unit = unit ? unit : 1;
+	tw->next = now / tw->unit;
+
+	for (i=0; i<TW_SLOTS; i++)
+		tw->slots[i].next_tl = tw->slots[i].prev_tl = &tw->slots[i];
+
+	tw->locks = lock_set_alloc(TW_SLOTS);
+	if (tw->locks==NULL) {
+		LM_ERR("failed to alloc the timer wheel locks\n");
+		return -1;
+	}
+	if (lock_set_init(tw->locks)==NULL) {
+		LM_ERR("failed to init the timer wheel locks\n");
+		lock_set_dealloc(tw->locks);
+		tw->locks = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void tw_destroy(struct timer_wheel *tw)
+{
+	if (tw->locks) {
+		lock_set_destroy(tw->locks);
+		lock_set_dealloc(tw->locks);
+		tw->locks = NULL;
+	}
+}
+
+
+int tw_init_link_locks(void)
+{
+	tw_link_locks = lock_set_alloc(TW_LINK_LOCKS);
+	if (tw_link_locks==NULL) {
+		LM_ERR("failed to alloc the timer link locks\n");
+		return -1;
+	}
+	if (lock_set_init(tw_link_locks)==NULL) {
+		LM_ERR("failed to init the timer link locks\n");
+		lock_set_dealloc(tw_link_locks);
+		tw_link_locks = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void tw_destroy_link_locks(void)
+{
+	if (tw_link_locks) {
+		lock_set_destroy(tw_link_locks);
+		lock_set_dealloc(tw_link_locks);
+		tw_link_locks = NULL;
+	}
+}
+
+
+#define tw_link_lock_idx(_tl) \
+	((((unsigned long)(_tl)) >> 4) % TW_LINK_LOCKS)
+
+void tw_lock_link(struct timer_link *tl)
+{
+	lock_set_get(tw_link_locks, tw_link_lock_idx(tl));
+}
+
+
+void tw_unlock_link(struct timer_link *tl)
+{
+	lock_set_release(tw_link_locks, tw_link_lock_idx(tl));
+}
+
+
+void tw_insert(struct timer_wheel *tw, struct timer_link *tl,
+		struct timer *list, utime_t time_out)
+{
+	utime_t e, n;
+	unsigned int idx;
+
+	e = tw_units(tw, time_out);
+
+	/* the slot depends on the current position of the wheel, so make sure
+	 * the timer process did not move it while we were waiting for the
+	 * lock; otherwise the timer may land in an already expired slot */
+	for (;;) {
+		n = tw->next;
+		idx = tw_slot(e, n);
+		lock_set_get(tw->locks, idx);
+		if (n==tw->next)
+			break;
+		lock_set_release(tw->locks, idx);
+	}
+
+	tl->time_out = time_out;
+	tl->timer_list = list;
+	tl->deleted = 0;
+	tw_link(&tw->slots[idx], tl);
+
+	lock_set_release(tw->locks, idx);
+
+	LM_DBG("[%d]: %p (%lld) in slot %u\n", list->id, tl, tl->time_out, idx);
+}
+
+
+/* locks the slot currently holding the link; returns the slot index or
+ * -1 if the link was never inserted into the wheel */
+static inline int tw_lock_slot_of(struct timer_wheel *tw,
+												struct timer_link *tl)
+{
+	struct timer_link *head;
+	int idx;
+
+	for (;;) {
+		head = tl->ld_tl;
+		if (head==NULL)
+			return -1;
+		idx = head - tw->slots;
+		lock_set_get(tw->locks, idx);
+		if (tl->ld_tl==head)
+			return idx;
+		/* cascaded meanwhile, follow it */
+		lock_set_release(tw->locks, idx);
+	}
+}
+
+
+int tw_remove(struct timer_wheel *tw, struct timer_link *tl,
+												struct timer *detached)
+{
+	int idx, ret = 0;
+
+	if ((idx=tw_lock_slot_of(tw, tl))<0)
+		return 0;
+
+	if (tl->timer_list==detached) {
+		ret = -1;
+	} else if (tl->timer_list) {
+		tw_unlink(tl);
+		tl->timer_list = NULL;
+		ret = 1;
+	}
+
+	lock_set_release(tw->locks, idx);
+
+	return ret;
+}
+
+
+/* re-distributes the timers of an upper level slot; only the timer process
+ * calls it, so the position of the wheel is stable */
+static void tw_cascade(struct timer_wheel *tw, int l, unsigned int lidx)
+{
+	struct timer_link *head, *tl, *next;
+	unsigned int src, dst;
+
+	src = tw_lvl_base(l) + lidx;
+	head = &tw->slots[src];
+
+	if (tw_slot_empty(head))
+		return;
+
+	lock_set_get(tw->locks, src);
+
+	tl = head->next_tl;
+	head->prev_tl->next_tl = NULL;
+	head->next_tl = head->prev_tl = head;
+
+	for ( ; tl ; tl=next) {
+		next = tl->next_tl;
+		dst = tw_slot(tw_units(tw, tl->time_out), tw->next);
+		if (dst==src) {
+			/* still too far in the future */
+			tw_link(head, tl);
+			continue;
+		}
+		lock_set_get(tw->locks, dst);
+		tw_link(&tw->slots[dst], tl);
+		lock_set_release(tw->locks, dst);
+	}
+
+	lock_set_release(tw->locks, src);
+}
+
+
+void tw_expire(struct timer_wheel *tw, utime_t now, struct timer *detached,
+										struct timer_link **expired)
+{
+	struct timer_link *tails[NR_OF_TIMER_LISTS];
+	struct timer_link *head, *tl, *next;
+	unsigned int idx, lidx;
+	enum lists id;
+	utime_t n;
+	int l;
+
+	for (id=0; id<NR_OF_TIMER_LISTS; id++)
+		for (tails[id]=expired[id]; tails[id] && tails[id]->next_tl ;
+		tails[id]=tails[id]->next_tl);
+
+	now /= tw->unit;
+
+	while ( (n=tw->next) <= now ) {
+		idx = n & (TW_L0_SIZE-1);
+
+		/* a new round of the first level starts, bring down the timers
+		 * from the upper levels */
+		if (idx==0) {
+			for (l=1; l<TW_LEVELS; l++) {
+				lidx = (n >> tw_lvl_shift(l)) & (TW_LN_SIZE-1);
+				tw_cascade(tw, l, lidx);
+				if (lidx)
+					break;
+			}
+		}
+
+		head = &tw->slots[idx];
+
+		lock_set_get(tw->locks, idx);
+
+		tl = head->next_tl;
+		head->prev_tl->next_tl = NULL;
+		head->next_tl = head->prev_tl = head;
+
+		for ( ; tl && tl!=head ; tl=next) {
+			next = tl->next_tl;
+			id = tl->timer_list->id;
+			tl->timer_list = detached;
+			tl->next_tl = NULL;
+			if (tails[id])
+				tails[id]->next_tl = tl;
+			else
+				expired[id] = tl;
+			tails[id] = tl;
+		}
+
+		/* move the wheel while still holding the slot, so that no insert
+		 * may sneak into the slot after it was expired */
+		tw->next = n + 1;
+
+		lock_set_release(tw->locks, idx);
+	}
+}
+
+
+void tw_for_each(struct timer_wheel *tw,
+		void (*f)(struct timer_link *tl, void *param), void *param)
+{
+	struct timer_link *tl, *next;
+	int i;
+
+	for (i=0; i<TW_SLOTS; i++)
+		for (tl=tw->slots[i].next_tl; tl!=&tw->slots[i]; tl=next) {
+			next = tl->next_tl;
+			f(tl, param);
+		}
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Hierarchical timing wheel backend for the TM timers.
+ *
+ * A wheel has a first level of TW_L0_SIZE slots, each one holding the
+ * timers expiring in one wheel unit, followed by TW_LEVELS-1 coarser levels
+ * of TW_LN_SIZE slots each. Timers far in the future are parked on the
+ * coarse levels and cascaded down as the wheel turns. Every slot has its own
+ * lock, so inserting or removing a timer only contends with the processes
+ * touching the very same slot.
+ *
+ * While a link sits in a wheel slot, its "ld_tl" field (only used by the
+ * sorted lists backend) points to the head of that slot.
+ */
+
+#ifndef _TM_TIMER_WHEEL_H
+#define _TM_TIMER_WHEEL_H
+
+#include "../../locking.h"
+#include "timer.h"
+
+#define TW_L0_BITS  8
+#define TW_LN_BITS  6
+#define TW_LEVELS   4
+#define TW_L0_SIZE  (1<<TW_L0_BITS)
+#define TW_LN_SIZE  (1<<TW_LN_BITS)
+#define TW_SLOTS    (TW_L0_SIZE + (TW_LEVELS-1)*TW_LN_SIZE)
+
+/* locks protecting the set/remove operations on the same timer link */
+#define TW_LINK_LOCKS 256
+
+struct timer_wheel
+{
+	/* next wheel unit to be expired; changed only by the timer process,
+	 * while holding the lock of the slot being expired */
+	volatile utime_t      next;
+	/* length of a wheel unit, in ticks or uticks */
+	unsigned int          unit;
+	gen_lock_set_t        *locks;
+	/* heads of the circular slot lists */
+	struct timer_link     slots[TW_SLOTS];
+};
+
+
+int tw_init(struct timer_wheel *tw, unsigned int unit, utime_t now);
+
+void tw_destroy(struct timer_wheel *tw);
+
+int tw_init_link_locks(void);
+
+void tw_destroy_link_locks(void);
+
+void tw_lock_link(struct timer_link *tl);
+
+void tw_unlock_link(struct timer_link *tl);
+
+/* the caller must hold the link lock; "time_out" is an absolute
+ * value, in ticks or uticks */
+void tw_insert(struct timer_wheel *tw, struct timer_link *tl,
+		struct timer *list, utime_t time_out);
+
+/* the caller must hold the link lock; returns 1 if the link was removed
+ * from the wheel, 0 if it was not linked and -1 if it is part of the
+ * "detached" list (expired, but its handler did not run yet) */
+int tw_remove(struct timer_wheel *tw, struct timer_link *tl,
+		struct timer *detached);
+
+/* moves all the timers expired up to "now" (in ticks or uticks) into per
+ * list chains (indexed by list id and linked by "next_tl"); the expired
+ * links are marked as being part of the "detached" list */
+void tw_expire(struct timer_wheel *tw, utime_t now, struct timer *detached,
+		struct timer_link **expired);
+
+/* walks all the links of the wheel, for shutdown purposes only */
+void tw_for_each(struct timer_wheel *tw,
+		void (*f)(struct timer_link *tl, void *param), void *param);
+
+#endif
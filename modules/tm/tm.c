@@ -194,6 +194,10 @@ stat_var *tm_retran_rpl_T2;
 stat_var *tm_timeout_fr;
 stat_var *tm_timeout_fr_inv;
 
+stat_var *tm_udp_batches;
+stat_var *tm_udp_batch_msgs;
+stat_var *tm_udp_batch_usec;
+
 stat_var *tm_cluster_reply_tx;
 stat_var *tm_cluster_request_tx;
 stat_var *tm_cluster_cancel_tx;
@@ -350,22 +354,30 @@ static const param_export_t params[]={
 		&tm_local_reply_route_s },
 	{ "local_request_route",      STR_PARAM,
 		&tm_local_request_route_s },
+	{ "udp_send_batch",           INT_PARAM,
+		&tm_udp_send_batch },
+	{ "hash_size",                INT_PARAM,
+		&tm_hash_size },
+	{ "hash_locks",               INT_PARAM,
+		&tm_hash_locks },
+	{ "timer_wheel",              INT_PARAM,
+		&tm_timer_wheel },
 	{0,0,0}
 };
 
 
 static const stat_export_t mod_stats[] = {
-	{"received_replies" ,    0,              &tm_rcv_rpls    },
-	{"relayed_replies" ,     0,              &tm_rld_rpls    },
-	{"local_replies" ,       0,              &tm_loc_rpls    },
-	{"UAS_transactions" ,    0,              &tm_uas_trans   },
-	{"UAC_transactions" ,    0,              &tm_uac_trans   },
-	{"2xx_transactions" ,    0,              &tm_trans_2xx   },
-	{"3xx_transactions" ,    0,              &tm_trans_3xx   },
-	{"4xx_transactions" ,    0,              &tm_trans_4xx   },
-	{"5xx_transactions" ,    0,              &tm_trans_5xx   },
-	{"6xx_transactions" ,    0,              &tm_trans_6xx   },
-	{"inuse_transactions" ,  STAT_NO_RESET,  &tm_trans_inuse },
+	{"received_replies" ,    STAT_SHARDED,   &tm_rcv_rpls    },
+	{"relayed_replies" ,     STAT_SHARDED,   &tm_rld_rpls    },
+	{"local_replies" ,       STAT_SHARDED,   &tm_loc_rpls    },
+	{"UAS_transactions" ,    STAT_SHARDED,   &tm_uas_trans   },
+	{"UAC_transactions" ,    STAT_SHARDED,   &tm_uac_trans   },
+	{"2xx_transactions" ,    STAT_SHARDED,   &tm_trans_2xx   },
+	{"3xx_transactions" ,    STAT_SHARDED,   &tm_trans_3xx   },
+	{"4xx_transactions" ,    STAT_SHARDED,   &tm_trans_4xx   },
+	{"5xx_transactions" ,    STAT_SHARDED,   &tm_trans_5xx   },
+	{"6xx_transactions" ,    STAT_SHARDED,   &tm_trans_6xx   },
+	{"inuse_transactions" ,  STAT_NO_RESET|STAT_SHARDED, &tm_trans_inuse },
 	{"cluster_reply_sent" ,  0,              &tm_cluster_reply_tx   },
 	{"cluster_request_sent" ,0,              &tm_cluster_request_tx },
 	{"cluster_cancel_sent" , 0,              &tm_cluster_cancel_tx },
@@ -379,6 +391,13 @@ static const stat_export_t mod_stats[] = {
 	{"retransmission_rpl_T2"     , 0,        &tm_retran_rpl_T2 },
 	{"timeout_finalresponse"     , 0,        &tm_timeout_fr },
 	{"timeout_finalresponse_inv" , 0,        &tm_timeout_fr_inv },
+	{"udp_send_batches"          , 0,        &tm_udp_batches },
+	{"udp_batched_sends"         , 0,        &tm_udp_batch_msgs },
+	{"udp_batch_flush_usec"      , 0,        &tm_udp_batch_usec },
+	{"timer_lag_ms"              , STAT_IS_FUNC,
+		(stat_var**)tm_get_timer_lag },
+	{"utimer_lag_ms"             , STAT_IS_FUNC,
+		(stat_var**)tm_get_utimer_lag },
 	{0,0,0}
 };
 
@@ -432,6 +451,10 @@ static const mi_export_t mi_cmds [] = {
 		{mi_tm_hash, {0}},
 		{EMPTY_MI_RECIPE}}
 	},
+	{ MI_TM_HASH_HIST, 0, 0, 0, {
+		{mi_tm_hash_histogram, {0}},
+		{EMPTY_MI_RECIPE}}
+	},
 	{ MI_TM_REPLY, 0, MI_NAMED_PARAMS_ONLY, 0, {
 		{mi_tm_reply_1, {"code", "reason", "trans_id", "to_tag", 0}},
 		{mi_tm_reply_2, {"code", "reason", "trans_id", "to_tag",
@@ -815,6 +838,27 @@ static int script_init( struct sip_msg *msg, void *bar)
 }
 
 
+/* makes sure a hash related modparam is a power of 2, rounding it down */
+static int fix_hash_param(char *name, unsigned int *val)
+{
+	unsigned int n;
+
+	if (*val==0) {
+		LM_ERR("invalid 0 value for %s\n", name);
+		return -1;
+	}
+
+	for( n=0 ; (*val>>n)>1 ; n++);
+	if (*val!=(1U<<n)) {
+		LM_WARN("%s is not a power of 2 as it should be -> rounding "
+			"from %u to %u\n", name, *val, 1U<<n);
+		*val = 1U<<n;
+	}
+
+	return 0;
+}
+
+
 static int mod_init(void)
 {
 	unsigned int timer_sets,set;
@@ -851,6 +895,14 @@ static int mod_init(void)
 		exports.stats = 0;
 #endif
 
+	if (tm_udp_send_batch < 0) {
+		tm_udp_send_batch = 0;
+	} else if (tm_udp_send_batch > TM_MAX_UDP_SEND_BATCH) {
+		LM_WARN("udp_send_batch %d too large, using %d\n",
+			tm_udp_send_batch, TM_MAX_UDP_SEND_BATCH);
+		tm_udp_send_batch = TM_MAX_UDP_SEND_BATCH;
+	}
+
 	if (init_callid() < 0) {
 		LM_CRIT("Error while initializing Call-ID generator\n");
 		return -1;
@@ -864,6 +916,9 @@ static int mod_init(void)
 		return -1;
 
 	/* building the hash table*/
+	if (fix_hash_param("hash_size", &tm_hash_size)<0 ||
+	fix_hash_param("hash_locks", &tm_hash_locks)<0)
+		return -1;
 	if (!init_hash_table( timer_sets )) {
 		LM_ERR("initializing hash_table failed\n");
 		return -1;
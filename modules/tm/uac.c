@@ -86,7 +86,7 @@ int uac_init(void)
 	str src[3];
 	const struct socket_info *si;
 
-	if (RAND_MAX < TM_TABLE_ENTRIES) {
+	if (RAND_MAX < tm_hash_size) {
 		LM_WARN("uac does not spread across the whole hash table\n");
 	}
 	/* on tcp/tls bind_address is 0 so try to get the first address we listen
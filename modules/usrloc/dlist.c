@@ -677,8 +677,7 @@ get_domain_mem_ucontacts(udomain_t *d,void *buf, int *len, unsigned int flags,
 	urecord_t *r;
 	ucontact_t *c;
 	void *cp;
-	void **dest;
-	map_iterator_t it;
+	rec_iterator_t it;
 	int shortage;
 	int needed;
 	int count;
@@ -699,13 +698,11 @@ get_domain_mem_ucontacts(udomain_t *d,void *buf, int *len, unsigned int flags,
 	//LM_DBG("part/max: %d/%d, idx/nodes: %d/%d\n",
 	//       part_idx, part_max, cur_node_idx, nr_nodes);
 
-	for(i=0; i<d->size; i++) {
-
-		if ( (i % part_max) != part_idx )
-			continue;
+	/* only the slots of the partition */
+	for(i=part_idx; i<d->size; i+=part_max) {
 
 		lock_ulslot( d, i);
-		count = map_size(d->table[i].records);
+		count = rt_size(&d->table[i].records);
 
 		if( count <= 0 )
 		{
@@ -713,16 +710,11 @@ get_domain_mem_ucontacts(udomain_t *d,void *buf, int *len, unsigned int flags,
 			continue;
 		}
 
-		for ( map_first( d->table[i].records, &it);
-			iterator_is_valid(&it);
-			iterator_next(&it) ) {
+		for ( rt_first(&d->table[i].records, &it);
+			rt_is_valid(&it);
+			rt_next(&it) ) {
 
-			dest = iterator_val(&it);
-			if( dest == NULL ) {
-				unlock_ulslot(d, i);
-				return -1;
-			}
-			r =( urecord_t * ) *dest;
+			r = rt_val(&it);
 
 			/* distribute ping workload across cluster nodes */
 			if (pinging_mode == PMD_COOPERATION &&
@@ -1105,7 +1097,6 @@ int find_domain(str* _d, udomain_t** _p)
 ucontact_t* get_ucontact_from_id(udomain_t *d, uint64_t contact_id, urecord_t **_r)
 {
 	int count;
-	void **dest;
 	unsigned int sl;
 	unsigned int rlabel;
 	unsigned short aorhash, clabel;
@@ -1113,30 +1104,24 @@ ucontact_t* get_ucontact_from_id(udomain_t *d, uint64_t contact_id, urecord_t **
 	urecord_t *r;
 	ucontact_t *c;
 
-	map_iterator_t it;
+	rec_iterator_t it;
 
 	unpack_indexes(contact_id, &aorhash, &rlabel, &clabel);
 
 	sl = aorhash&(d->size-1);
 	lock_ulslot(d, sl);
 
-	count = map_size(d->table[sl].records);
+	count = rt_size(&d->table[sl].records);
 	if (count <= 0) {
 		unlock_ulslot(d, sl);
 		return NULL;
 	}
 
-	for (map_first( d->table[sl].records, &it);
-			iterator_is_valid(&it);
-			iterator_next(&it) ) {
-
-		dest = iterator_val(&it);
-		if (dest == NULL) {
-			unlock_ulslot(d, sl);
-			return NULL;
-		}
+	for (rt_first(&d->table[sl].records, &it);
+			rt_is_valid(&it);
+			rt_next(&it) ) {
 
-		r = (urecord_t *)*dest;
+		r = rt_val(&it);
 		if (r->label != rlabel)
 			continue;
 
@@ -104,12 +104,9 @@ void ul_release_idx(int idx)
  */
 int init_slot(struct udomain* _d, hslot_t* _s, int n)
 {
-	_s->records = map_create( AVLMAP_SHARED | AVLMAP_NO_DUPLICATE);
+	rt_init(&_s->records);
 	_s->next_label = 0;
 
-	if( _s->records == NULL )
-		return -1;
-
 	_s->d = _d;
 
 #ifdef GEN_LOCK_T_PREFERED
@@ -121,18 +118,12 @@ int init_slot(struct udomain* _d, hslot_t* _s, int n)
 }
 
 
-void free_value_urecord( void * val )
-{
-	free_urecord( (urecord_t *) val);
-}
-
-
 /*! \brief
  * Deinitialize given slot structure
  */
 void deinit_slot(hslot_t* _s)
 {
-	map_destroy(_s->records , free_value_urecord);
+	rt_destroy(&_s->records, free_urecord);
 	_s->d = 0;
 }
 
@@ -142,20 +133,11 @@ void deinit_slot(hslot_t* _s)
  */
 int slot_add(hslot_t* _s, struct urecord* _r)
 {
-
-	void ** dest;
-
-	dest = map_get( _s->records, _r->aor );
-
-	if( dest == NULL )
-	{
-		LM_ERR("inserting into map\n");
+	if (rt_insert(&_s->records, _r) < 0) {
+		LM_ERR("inserting into the slot\n");
 		return -1;
 	}
 
-
-	*dest = _r;
-
 	_r->slot = _s;
 
 	return 0;
@@ -167,7 +149,6 @@ int slot_add(hslot_t* _s, struct urecord* _r)
  */
 void slot_rem(hslot_t* _s, struct urecord* _r)
 {
-
-	map_remove( _s->records, _r->aor );
+	rt_remove(&_s->records, _r);
 	_r->slot = 0;
 }
@@ -31,8 +31,8 @@
 #define HSLOT_H
 
 #include "../../locking.h"
-#include "../../map.h"
 #include "udomain.h"
+#include "rec_table.h"
 #include "urecord.h"
 
 
@@ -42,7 +42,7 @@ struct urecord;
 
 typedef struct hslot {
 
-	map_t records;
+	rec_table_t records;
 	unsigned int next_label;
 
 	struct udomain* d;      /*!< Domain we belong to */
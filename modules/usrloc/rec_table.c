@@ -0,0 +1,243 @@
+/*
+ * Usrloc record table - open addressing hash of the records of a slot
+ *
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*! \file
+ *  \brief USRLOC - open addressing table of the records of a slot
+ *  \ingroup usrloc
+ */
+
+#include <string.h>
+
+#include "../../mem/shm_mem.h"
+#include "../../dprint.h"
+#include "urecord.h"
+#include "rec_table.h"
+
+/* buckets of a table, on its first insert */
+#define RT_MIN_BITS  3
+/* old buckets processed by each insert, while resizing */
+#define RT_MIG_STEP  4
+
+
+/* all the records of a slot share the low bits of their hash,
+ * so the index is taken out of the high bits of the product */
+static inline unsigned int rt_home(unsigned int hash, unsigned int bits)
+{
+	return (hash * 2654435769U) >> (32 - bits);
+}
+
+
+static inline void rt_put(rec_bucket_t *b, unsigned int bits,
+		unsigned int hash, struct urecord *r)
+{
+	unsigned int mask = (1U << bits) - 1, i;
+
+	for (i = rt_home(hash, bits); b[i].r; i = (i + 1) & mask) ;
+
+	b[i].hash = hash;
+	b[i].r = r;
+}
+
+
+static inline int rt_lookup(rec_bucket_t *b, unsigned int bits,
+		unsigned int hash, const str *aor)
+{
+	unsigned int mask = (1U << bits) - 1, i;
+
+	for (i = rt_home(hash, bits); b[i].r; i = (i + 1) & mask)
+		if (b[i].hash == hash && b[i].r->aor.len == aor->len &&
+		        !memcmp(b[i].r->aor.s, aor->s, aor->len))
+			return i;
+
+	return -1;
+}
+
+
+static inline int rt_index(rec_bucket_t *b, unsigned int bits,
+		struct urecord *r)
+{
+	unsigned int mask = (1U << bits) - 1, i;
+
+	for (i = rt_home(r->aorhash, bits); b[i].r; i = (i + 1) & mask)
+		if (b[i].r == r)
+			return i;
+
+	return -1;
+}
+
+
+/* frees bucket @i, shifting back the following records of its cluster
+ * which may take its place - the free bucket ends up past all of them */
+static void rt_del_at(rec_bucket_t *b, unsigned int bits, unsigned int i)
+{
+	unsigned int mask = (1U << bits) - 1, j, k;
+
+	for (j = (i + 1) & mask; b[j].r; j = (j + 1) & mask) {
+		k = rt_home(b[j].hash, bits);
+
+		/* it may move, unless its home is cyclically within (i, j] */
+		if (((j - k) & mask) >= ((j - i) & mask)) {
+			b[i] = b[j];
+			i = j;
+		}
+	}
+
+	b[i].r = NULL;
+}
+
+
+/* moves the records of the old buckets into the current ones; as the old
+ * buckets are emptied in order, with the records following a freed bucket
+ * only shifting back down to it, all the old buckets below t->mig stay free */
+static void rt_migrate(rec_table_t *t, unsigned int steps)
+{
+	rec_bucket_t *ob;
+
+	while (t->old && steps--) {
+		if (t->old_count == 0) {
+			shm_free(t->old);
+			t->old = NULL;
+			break;
+		}
+
+		ob = &t->old[t->mig];
+		if (!ob->r) {
+			t->mig = (t->mig + 1) & ((1U << t->old_bits) - 1);
+			continue;
+		}
+
+		rt_put(t->b, t->bits, ob->hash, ob->r);
+		t->count++;
+
+		rt_del_at(t->old, t->old_bits, t->mig);
+		t->old_count--;
+	}
+}
+
+
+static int rt_grow(rec_table_t *t)
+{
+	unsigned int bits = t->b ? t->bits + 1 : RT_MIN_BITS;
+	rec_bucket_t *nb;
+
+	/* only one resize at a time */
+	if (t->old)
+		rt_migrate(t, (unsigned int)-1);
+
+	nb = shm_malloc(sizeof *nb << bits);
+	if (!nb)
+		return -1;
+	memset(nb, 0, sizeof *nb << bits);
+
+	if (t->b) {
+		t->old = t->b;
+		t->old_bits = t->bits;
+		t->old_count = t->count;
+		t->mig = 0;
+	}
+
+	t->b = nb;
+	t->bits = bits;
+	t->count = 0;
+
+	return 0;
+}
+
+
+void rt_init(rec_table_t *t)
+{
+	memset(t, 0, sizeof *t);
+}
+
+
+void rt_destroy(rec_table_t *t, rec_destroy_f destroy)
+{
+	unsigned int i;
+
+	if (t->old) {
+		if (destroy)
+			for (i = 0; i < (1U << t->old_bits); i++)
+				if (t->old[i].r)
+					destroy(t->old[i].r);
+		shm_free(t->old);
+	}
+
+	if (t->b) {
+		if (destroy)
+			for (i = 0; i < (1U << t->bits); i++)
+				if (t->b[i].r)
+					destroy(t->b[i].r);
+		shm_free(t->b);
+	}
+
+	rt_init(t);
+}
+
+
+int rt_insert(rec_table_t *t, struct urecord *r)
+{
+	if (t->old)
+		rt_migrate(t, RT_MIG_STEP);
+
+	/* keep it at most 3/4 full */
+	if (!t->b || (rt_size(t) + 1) * 4 > (3U << t->bits)) {
+		if (rt_grow(t) < 0 && (!t->b || t->count + 1 >= (1U << t->bits))) {
+			LM_ERR("no more shm memory\n");
+			return -1;
+		}
+	}
+
+	rt_put(t->b, t->bits, r->aorhash, r);
+	t->count++;
+
+	return 0;
+}
+
+
+struct urecord *rt_find(rec_table_t *t, unsigned int hash, const str *aor)
+{
+	int i;
+
+	if (t->b && (i = rt_lookup(t->b, t->bits, hash, aor)) >= 0)
+		return t->b[i].r;
+
+	if (t->old && (i = rt_lookup(t->old, t->old_bits, hash, aor)) >= 0)
+		return t->old[i].r;
+
+	return NULL;
+}
+
+
+/* the old buckets are not freed here even if emptied, as they may still
+ * be walked by an iterator */
+void rt_remove(rec_table_t *t, struct urecord *r)
+{
+	int i;
+
+	if (t->b && (i = rt_index(t->b, t->bits, r)) >= 0) {
+		rt_del_at(t->b, t->bits, i);
+		t->count--;
+	} else if (t->old && (i = rt_index(t->old, t->old_bits, r)) >= 0) {
+		rt_del_at(t->old, t->old_bits, i);
+		t->old_count--;
+	}
+}
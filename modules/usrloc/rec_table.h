@@ -0,0 +1,176 @@
+/*
+ * Usrloc record table - open addressing hash of the records of a slot
+ *
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*! \file
+ *  \brief USRLOC - open addressing table of the records of a slot
+ *  \ingroup usrloc
+ *
+ * The records are kept in a flat array of (AoR hash, record) buckets,
+ * indexed by the AoR hash computed when the record was created, with
+ * linear probing. A lookup only dereferences the records whose full hash
+ * matches. Removals shift the following buckets back, so there are no
+ * tombstones. A table over 3/4 full doubles: the records get moved to the
+ * new buckets a few at a time, by the following inserts, while lookups
+ * and removals check both arrays.
+ */
+
+#ifndef UL_REC_TABLE_H
+#define UL_REC_TABLE_H
+
+#include "../../str.h"
+
+struct urecord;
+
+typedef struct rec_bucket {
+	unsigned int hash;
+	struct urecord *r;        /*!< NULL if the bucket is free */
+} rec_bucket_t;
+
+typedef struct rec_table {
+	rec_bucket_t *b;          /*!< the buckets inserted into */
+	unsigned int bits;        /*!< 2^bits buckets */
+	unsigned int count;       /*!< records in b */
+
+	rec_bucket_t *old;        /*!< buckets being emptied, on a resize */
+	unsigned int old_bits;
+	unsigned int old_count;
+	unsigned int mig;         /*!< old buckets below this one are free */
+} rec_table_t;
+
+/*! \brief
+ * The iterator gets past the current record even if it was removed in
+ * the meantime; no other record may be added or removed while iterating
+ */
+typedef struct rec_iterator {
+	rec_table_t *t;
+	rec_bucket_t *b;          /*!< the array being walked */
+	unsigned int mask;
+	unsigned int pos;
+	unsigned int left;        /*!< buckets left to check in b */
+	struct urecord *r;        /*!< the current record */
+} rec_iterator_t;
+
+typedef void (*rec_destroy_f)(struct urecord *r);
+
+
+void rt_init(rec_table_t *t);
+
+void rt_destroy(rec_table_t *t, rec_destroy_f destroy);
+
+/*! \brief
+ * Adds a record, which must not be in the table already
+ */
+int rt_insert(rec_table_t *t, struct urecord *r);
+
+struct urecord *rt_find(rec_table_t *t, unsigned int hash, const str *aor);
+
+/*! \brief
+ * Removes a record, if in the table
+ */
+void rt_remove(rec_table_t *t, struct urecord *r);
+
+static inline unsigned int rt_size(rec_table_t *t)
+{
+	return t->count + t->old_count;
+}
+
+/* the walk starts right after a free bucket, so no cluster wraps over its
+ * start: a removal may only shift back records not walked yet */
+static inline void rt_iter_array(rec_iterator_t *it, rec_bucket_t *b,
+		unsigned int bits)
+{
+	unsigned int i;
+
+	it->b = b;
+	it->mask = (1U << bits) - 1;
+
+	for (i = 0; i <= it->mask && b[i].r; i++) ;
+
+	it->pos = (i + 1) & it->mask;
+	it->left = it->mask + 1;
+}
+
+
+/* moves to the first record from the current bucket on - the old
+ * buckets (if resizing) are walked first, then the current ones */
+static inline void rt_settle(rec_iterator_t *it)
+{
+	for (;;) {
+		for (; it->left; it->left--, it->pos = (it->pos + 1) & it->mask)
+			if (it->b[it->pos].r) {
+				it->r = it->b[it->pos].r;
+				return;
+			}
+
+		if (it->b != it->t->old || !it->t->b) {
+			it->r = NULL;
+			return;
+		}
+
+		rt_iter_array(it, it->t->b, it->t->bits);
+	}
+}
+
+
+static inline void rt_first(rec_table_t *t, rec_iterator_t *it)
+{
+	it->t = t;
+	it->r = NULL;
+
+	if (t->old)
+		rt_iter_array(it, t->old, t->old_bits);
+	else if (t->b)
+		rt_iter_array(it, t->b, t->bits);
+	else
+		return;
+
+	rt_settle(it);
+}
+
+
+static inline void rt_next(rec_iterator_t *it)
+{
+	if (!it->r)
+		return;
+
+	/* if the current record was removed, its bucket is either free or
+	 * holds the next record already */
+	if (it->b[it->pos].r == it->r) {
+		it->left--;
+		it->pos = (it->pos + 1) & it->mask;
+	}
+
+	rt_settle(it);
+}
+
+
+static inline int rt_is_valid(rec_iterator_t *it)
+{
+	return it->r != NULL;
+}
+
+static inline struct urecord *rt_val(rec_iterator_t *it)
+{
+	return it->r;
+}
+
+#endif /* UL_REC_TABLE_H */
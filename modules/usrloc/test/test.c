@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tap.h>
+
+#include "../../../str.h"
+#include "../../../map.h"
+#include "../../../hash_func.h"
+#include "../../../test/ut.h"
+
+#include "../urecord.h"
+#include "../rec_table.h"
+
+#define RT_TEST_RECS   20000
+#define RT_BENCH_SLOTS 512
+#ifndef RT_BENCH_RECS
+#define RT_BENCH_RECS  100000
+#endif
+
+static urecord_t *recs;
+static char *aors;
+
+
+/* the records only need an AoR and its hash */
+static int build_recs(int n)
+{
+	int i;
+
+	recs = calloc(n, sizeof *recs);
+	aors = malloc(n * 32);
+	if (!recs || !aors)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		recs[i].aor.s = aors + i * 32;
+		recs[i].aor.len = sprintf(recs[i].aor.s, "sip:%d@example.com", i);
+		recs[i].aorhash = core_hash(&recs[i].aor, NULL, 0);
+	}
+
+	return 0;
+}
+
+
+static void free_recs(void)
+{
+	free(recs);
+	free(aors);
+}
+
+
+/* inserts, lookups and removals against the in_table[] reference,
+ * with the table being resized all along */
+static void test_rt_ops(void)
+{
+	rec_table_t t;
+	char *in_table;
+	int i, k, n, bad = 0;
+
+	in_table = calloc(RT_TEST_RECS, 1);
+	rt_init(&t);
+	srand(7);
+
+	for (i = 0, n = 0; i < 8 * RT_TEST_RECS; i++) {
+		k = rand() % RT_TEST_RECS;
+
+		if (rand() % 3) {
+			if (rt_find(&t, recs[k].aorhash, &recs[k].aor) !=
+			        (in_table[k] ? &recs[k] : NULL))
+				bad++;
+			if (!in_table[k]) {
+				if (rt_insert(&t, &recs[k]) < 0)
+					bad++;
+				in_table[k] = 1;
+				n++;
+			}
+		} else if (in_table[k]) {
+			rt_remove(&t, &recs[k]);
+			in_table[k] = 0;
+			n--;
+		}
+
+		if (rt_size(&t) != n)
+			bad++;
+	}
+
+	for (k = 0; k < RT_TEST_RECS; k++)
+		if (rt_find(&t, recs[k].aorhash, &recs[k].aor) !=
+		        (in_table[k] ? &recs[k] : NULL))
+			bad++;
+
+	ok(bad == 0, "rec-table-ops (%d records left)", n);
+
+	rt_destroy(&t, NULL);
+	free(in_table);
+}
+
+
+/* a walk must get to each record exactly once, even if removing the
+ * records as it goes - as the timer does - and while resizing */
+static void test_rt_iterate(void)
+{
+	rec_iterator_t it;
+	rec_table_t t;
+	char *seen;
+	int i, n, bad = 0, resizing = 0, round;
+
+	seen = calloc(RT_TEST_RECS, 1);
+	rt_init(&t);
+
+	for (n = 1; n <= RT_TEST_RECS; n += n / 3 + 1) {
+		rt_destroy(&t, NULL);
+		for (i = 0; i < n; i++)
+			rt_insert(&t, &recs[i]);
+		resizing += (t.old != NULL);
+
+		for (round = 0; round < 2; round++) {
+			memset(seen, 0, n);
+
+			for (rt_first(&t, &it); rt_is_valid(&it); rt_next(&it)) {
+				i = rt_val(&it) - recs;
+				if (seen[i]++)
+					bad++;
+				/* on the 2nd round, drop every other record */
+				if (round && i % 2)
+					rt_remove(&t, rt_val(&it));
+			}
+
+			for (i = 0; i < n; i++)
+				if (!seen[i])
+					bad++;
+		}
+
+		if (rt_size(&t) != (n + 1) / 2)
+			bad++;
+		for (i = 0; i < n; i++)
+			if (rt_find(&t, recs[i].aorhash, &recs[i].aor) !=
+			        (i % 2 ? NULL : &recs[i]))
+				bad++;
+	}
+
+	ok(bad == 0, "rec-table-iterate (%d walks while resizing)", resizing);
+
+	rt_destroy(&t, NULL);
+	free(seen);
+}
+
+
+/* the records of a domain, spread over its slots: the per-slot AVL
+ * maps versus the per-slot open addressing tables */
+static void bench_rt(void)
+{
+	map_t maps[RT_BENCH_SLOTS];
+	rec_table_t tables[RT_BENCH_SLOTS];
+	unsigned int h;
+	long avl_ins, avl_get, rt_ins, rt_get;
+	void **val;
+	int i, j, k, *order, misses = 0;
+
+	/* the lookups come in no particular order */
+	order = malloc(RT_BENCH_RECS * sizeof *order);
+	for (i = 0; i < RT_BENCH_RECS; i++)
+		order[i] = i;
+	for (i = RT_BENCH_RECS - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		k = order[i];
+		order[i] = order[j];
+		order[j] = k;
+	}
+
+	for (i = 0; i < RT_BENCH_SLOTS; i++) {
+		maps[i] = map_create(AVLMAP_SHARED | AVLMAP_NO_DUPLICATE);
+		rt_init(&tables[i]);
+	}
+
+	/* the inserts use the hash computed at record creation, the lookups
+	 * hash the AoR, as usrloc does */
+	avl_ins = ut_now_ns();
+	for (i = 0; i < RT_BENCH_RECS; i++) {
+		val = map_get(maps[recs[i].aorhash & (RT_BENCH_SLOTS - 1)],
+			recs[i].aor);
+		if (val)
+			*val = &recs[i];
+	}
+	avl_ins = ut_now_ns() - avl_ins;
+
+	avl_get = ut_now_ns();
+	for (i = 0; i < RT_BENCH_RECS; i++) {
+		k = order[i];
+		h = core_hash(&recs[k].aor, NULL, 0);
+		val = map_find(maps[h & (RT_BENCH_SLOTS - 1)], recs[k].aor);
+		if (!val || *val != &recs[k])
+			misses++;
+	}
+	avl_get = ut_now_ns() - avl_get;
+
+	rt_ins = ut_now_ns();
+	for (i = 0; i < RT_BENCH_RECS; i++)
+		rt_insert(&tables[recs[i].aorhash & (RT_BENCH_SLOTS - 1)], &recs[i]);
+	rt_ins = ut_now_ns() - rt_ins;
+
+	rt_get = ut_now_ns();
+	for (i = 0; i < RT_BENCH_RECS; i++) {
+		k = order[i];
+		h = core_hash(&recs[k].aor, NULL, 0);
+		if (rt_find(&tables[h & (RT_BENCH_SLOTS - 1)], h, &recs[k].aor) !=
+		        &recs[k])
+			misses++;
+	}
+	rt_get = ut_now_ns() - rt_get;
+
+	ok(misses == 0, "rec-table-bench (%d AoRs, %d slots)",
+		RT_BENCH_RECS, RT_BENCH_SLOTS);
+	diag("AVL map:    %ld ns/insert, %ld ns/lookup",
+		avl_ins / RT_BENCH_RECS, avl_get / RT_BENCH_RECS);
+	diag("rec table:  %ld ns/insert, %ld ns/lookup",
+		rt_ins / RT_BENCH_RECS, rt_get / RT_BENCH_RECS);
+
+	for (i = 0; i < RT_BENCH_SLOTS; i++) {
+		map_destroy(maps[i], NULL);
+		rt_destroy(&tables[i], NULL);
+	}
+	free(order);
+}
+
+
+static void test_rec_table(int bench)
+{
+	if (!ok(build_recs(bench ? RT_BENCH_RECS : RT_TEST_RECS) == 0,
+	        "rec-table-setup"))
+		return;
+
+	if (bench) {
+		bench_rt();
+	} else {
+		test_rt_ops();
+		test_rt_iterate();
+	}
+
+	free_recs();
+}
+
+
+void mod_tests(void)
+{
+	test_rec_table(0);
+	/* AVL maps vs. tables, RT_BENCH_RECS AoRs over RT_BENCH_SLOTS slots */
+	//test_rec_table(1);
+}
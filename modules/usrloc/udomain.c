@@ -420,7 +420,80 @@ static inline ucontact_info_t* dbrow2info(db_val_t *vals, str *contact)
 }
 
 
-int preload_udomain(db_con_t* _c, udomain_t* _d)
+/* how often the progress of a load is logged */
+#define UL_PRELOAD_REPORT_MS 5000
+
+static inline unsigned long preload_ms(struct timeval *_from,
+		struct timeval *_to)
+{
+	return (_to->tv_sec - _from->tv_sec) * 1000 +
+		(_to->tv_usec - _from->tv_usec) / 1000;
+}
+
+
+void preload_report(struct ul_preload* _pl, int _done)
+{
+	struct timeval now;
+	unsigned long ms;
+
+	gettimeofday(&now, NULL);
+	ms = preload_ms(&_pl->start, &now);
+
+	if (!_done) {
+		LM_INFO("loading contacts from DB: %lu rows so far, %lu rows/s\n",
+			_pl->rows, ms ? _pl->rows * 1000 / ms : _pl->rows);
+		return;
+	}
+
+	LM_INFO("loaded %lu contacts from DB in %lu.%03lus, %lu rows/s\n",
+		_pl->rows, ms / 1000, ms % 1000,
+		ms ? _pl->rows * 1000 / ms : _pl->rows);
+
+	if ( _pl->suggest_regen ) {
+		LM_NOTICE("At least 1 contact(s) from the database has invalid contact_id!\n"
+				"Possible causes for this can be:\n"
+				"\t* you are migrating your location table from a version older than 2.2\n"
+				"\t* you have changed 'hash_size' module parameter from "
+				"when current contact_id's were generated;\n"
+				"If you want to regenerate new contact_id's for the broken entries"
+				" enable 'regen_broken_contactid' module parameter.\n");
+	}
+}
+
+
+static void preload_account(struct ul_preload* _pl, int _rows)
+{
+	struct timeval now;
+
+	lock_get(&_pl->lock);
+
+	_pl->rows += _rows;
+
+	gettimeofday(&now, NULL);
+	if (preload_ms(&_pl->last_report, &now) >= UL_PRELOAD_REPORT_MS) {
+		_pl->last_report = now;
+		preload_report(_pl, 0);
+	}
+
+	lock_release(&_pl->lock);
+}
+
+
+void preload_udomain_finish(udomain_t* _d)
+{
+	int sl;
+
+	/* for each not populated slot with record label
+	 * populate it*/
+	for (sl=0; sl < _d->size; sl++) {
+		if (_d->table[sl].next_label == 0)
+			_d->table[sl].next_label = rand();
+	}
+}
+
+
+static int preload_udomain_rows(db_con_t* _c, udomain_t* _d, db_key_t* _k,
+		db_op_t* _o, db_val_t* _v, int _n, struct ul_preload* _pl)
 {
 	/* no use to try prepared statements here as this query is performed
 	   once at startup -bogdan */
@@ -440,8 +513,6 @@ int preload_udomain(db_con_t* _c, udomain_t* _d)
 	unsigned int   rlabel;
 	UNUSED(n);
 
-	char suggest_regen=0;
-
 	urecord_t* r;
 	ucontact_t* c;
 
@@ -476,7 +547,7 @@ int preload_udomain(db_con_t* _c, udomain_t* _d)
 #endif
 
 	if (DB_CAPABILITY(ul_dbf, DB_CAP_FETCH)) {
-		if (ul_dbf.query(_c, 0, 0, 0, columns, 0,
+		if (ul_dbf.query(_c, _k, _o, _v, columns, _n,
 		                 use_domain ? UL_COLS : UL_COLS - 1, 0, 0) < 0) {
 			LM_ERR("db_query (1) failed\n");
 			return -1;
@@ -489,7 +560,7 @@ int preload_udomain(db_con_t* _c, udomain_t* _d)
 			return -1;
 		}
 	} else {
-		if (ul_dbf.query(_c, 0, 0, 0, columns, 0,
+		if (ul_dbf.query(_c, _k, _o, _v, columns, _n,
 		                 use_domain ? UL_COLS : UL_COLS - 1, 0, &res) < 0) {
 			LM_ERR("db_query failed\n");
 			return -1;
@@ -575,7 +646,7 @@ int preload_udomain(db_con_t* _c, udomain_t* _d)
 				 * if regeneration not set we throw error else we will try generate
 				 * new indexes for record and contact labels */
 				if ( !cid_regen ) {
-					suggest_regen=1;
+					_pl->suggest_regen=1;
 					LM_ERR("failed to match aorhashes for user %.*s,"
 							"db aorhash [%u] new aorhash [%u],"
 							"db contactid [%" PRIu64 "]\n",
@@ -685,6 +756,8 @@ int preload_udomain(db_con_t* _c, udomain_t* _d)
 			unlock_udomain(_d, &user);
 		}
 
+		preload_account(_pl, RES_ROW_N(res));
+
 		if (DB_CAPABILITY(ul_dbf, DB_CAP_FETCH)) {
 			if(ul_dbf.fetch_result(_c, &res, no_rows)<0) {
 				LM_ERR("fetching rows (1) failed\n");
@@ -698,23 +771,6 @@ int preload_udomain(db_con_t* _c, udomain_t* _d)
 
 	ul_dbf.free_result(_c, res);
 
-	if ( suggest_regen ) {
-		LM_NOTICE("At least 1 contact(s) from the database has invalid contact_id!\n"
-				"Possible causes for this can be:\n"
-				"\t* you are migrating your location table from a version older than 2.2\n"
-				"\t* you have changed 'hash_size' module parameter from "
-				"when current contact_id's were generated;\n"
-				"If you want to regenerate new contact_id's for the broken entries"
-				" enable 'regen_broken_contactid' module parameter.\n");
-	}
-
-	/* for each not populated slot with record label
-	 * populate it*/
-	for (sl=0; sl < _d->size; sl++) {
-		if (_d->table[sl].next_label == 0)
-			_d->table[sl].next_label = rand();
-	}
-
 #ifdef EXTRA_DEBUG
 	LM_NOTICE("load end time [%d]\n", (int)time(NULL));
 #endif
@@ -726,6 +782,68 @@ error:
 }
 
 
+int preload_udomain(db_con_t* _c, udomain_t* _d)
+{
+	struct ul_preload pl;
+	int ret;
+
+	memset(&pl, 0, sizeof pl);
+	if (!lock_init(&pl.lock)) {
+		LM_ERR("failed to init the load lock\n");
+		return -1;
+	}
+	gettimeofday(&pl.start, NULL);
+	pl.last_report = pl.start;
+
+	ret = preload_udomain_rows(_c, _d, 0, 0, 0, 0, &pl);
+	if (ret == 0) {
+		preload_udomain_finish(_d);
+		preload_report(&pl, 1);
+	}
+
+	lock_destroy(&pl.lock);
+	return ret;
+}
+
+
+int preload_udomain_part(db_con_t* _c, udomain_t* _d, int _part, int _parts,
+		struct ul_preload* _pl)
+{
+	db_key_t keys[2] = {&contactid_col, &contactid_col};
+	db_op_t ops[2] = {OP_GEQ, OP_LT};
+	db_val_t vals[2];
+	unsigned int lo, hi, base;
+
+	/* the slots of this partition */
+	lo = _part * _d->size / _parts;
+	hi = (_part + 1) * _d->size / _parts;
+	if (lo == hi)
+		return 0;
+
+	memset(vals, 0, sizeof vals);
+	VAL_TYPE(vals) = VAL_TYPE(vals + 1) = DB_BIGINT;
+
+	/* the contact_id starts with the AoR hash, whose low bits give the
+	 * slot - so the slots map to one contact_id range for each possible
+	 * value of the higher bits of the AoR hash */
+	for (base = 0; base < (1 << 16); base += _d->size) {
+		VAL_BIGINT(vals) = pack_indexes(base + lo, 0, 0);
+
+		if (base + hi < (1 << 16)) {
+			VAL_BIGINT(vals + 1) = pack_indexes(base + hi, 0, 0);
+			if (preload_udomain_rows(_c, _d, keys, ops, vals, 2, _pl) < 0)
+				return -1;
+		} else {
+			/* the last range also gets any out of range contact_id */
+			if (preload_udomain_rows(_c, _d, keys, ops, vals, 1, _pl) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+
 /*! \brief
  * loads from DB all contacts for an AOR
  */
@@ -1140,30 +1258,19 @@ void mem_delete_urecord(udomain_t* _d, struct urecord* _r)
 int mem_timer_udomain(udomain_t* _d)
 {
 	struct urecord* ptr;
-	void ** dest;
 	int i,ret=0,flush=0;
-	map_iterator_t it,prev;
+	rec_iterator_t it;
 
 	cid_len = 0;
 	for(i=0; i<_d->size; i++)
 	{
 		lock_ulslot(_d, i);
 
-		map_first(_d->table[i].records,&it);
+		rt_first(&_d->table[i].records, &it);
 
-		while(iterator_is_valid(&it))
+		while(rt_is_valid(&it))
 		{
-
-			dest = iterator_val(&it);
-			if( dest == NULL ) {
-				unlock_ulslot(_d, i);
-				return -1;
-			}
-
-			ptr = (struct urecord *)*dest;
-
-			prev = it;
-			iterator_next(&it);
+			ptr = rt_val(&it);
 
 			if ((ret =timer_urecord(ptr,&_d->ins_list)) < 0) {
 				LM_ERR("timer_urecord failed\n");
@@ -1187,9 +1294,11 @@ int mem_timer_udomain(udomain_t* _d)
 						       ptr->aor.len, ptr->aor.s);
 				}
 
-				iterator_delete(&prev);
 				mem_delete_urecord(_d, ptr);
 			}
+
+			/* gets past the record, even if just deleted */
+			rt_next(&it);
 		}
 
 		unlock_ulslot(_d, i);
@@ -1389,13 +1498,11 @@ int insert_urecord(udomain_t* _d, str* _aor, struct urecord** _r,
 static inline urecord_t *find_mem_urecord(udomain_t *_d, const str *_aor)
 {
 	unsigned int sl, aorhash;
-	urecord_t **r;
 
 	aorhash = core_hash(_aor, NULL, 0);
 	sl = aorhash & (_d->size - 1);
 
-	r = (urecord_t **)map_find(_d->table[sl].records, *_aor);
-	return r ? *r : NULL;
+	return rt_find(&_d->table[sl].records, aorhash, _aor);
 }
 
 /*! \brief
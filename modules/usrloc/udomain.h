@@ -36,6 +36,7 @@
 
 
 #include <stdio.h>
+#include <sys/time.h>
 #include "../../statistics.h"
 #include "../../locking.h"
 #include "../../str.h"
@@ -82,12 +83,47 @@ int new_udomain(str* _n, int _s, udomain_t** _d);
 void free_udomain(udomain_t* _d);
 
 
+/*! \brief
+ * Progress of a domains load from the database, shared by all the
+ * partitions of a parallel load
+ */
+struct ul_preload {
+	gen_lock_t lock;
+	int pending;              /*!< partitions not done yet */
+	unsigned long rows;       /*!< rows loaded so far */
+	struct timeval start;
+	struct timeval last_report;
+	char suggest_regen;
+};
+
+
 /*! \brief
  * Load data from a database
  */
 int preload_udomain(db_con_t* _c, udomain_t* _d);
 
 
+/*! \brief
+ * Load from the database only the records hashed into the slots of
+ * partition _part (out of _parts); the partitions cover disjoint slot
+ * ranges, so they may be loaded in parallel, by different processes
+ */
+int preload_udomain_part(db_con_t* _c, udomain_t* _d, int _part, int _parts,
+		struct ul_preload* _pl);
+
+
+/*! \brief
+ * Completes a domain after all its partitions were loaded
+ */
+void preload_udomain_finish(udomain_t* _d);
+
+
+/*! \brief
+ * Reports the totals of a (partitioned) load
+ */
+void preload_report(struct ul_preload* _pl, int _done);
+
+
 /*! \brief
  * Check the DB validity of a domain
  */
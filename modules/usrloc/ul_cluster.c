@@ -985,24 +985,20 @@ static int receive_sync_request(int node_id)
 	bin_packet_t *sync_packet;
 	dlist_t *dl;
 	udomain_t *dom;
-	map_iterator_t it;
+	rec_iterator_t it;
 	struct urecord *r;
 	ucontact_t* c;
-	void **p;
 	int i;
 
 	for (dl = root; dl; dl = dl->next) {
 		dom = dl->d;
 		for(i = 0; i < dom->size; i++) {
 			lock_ulslot(dom, i);
-			for (map_first(dom->table[i].records, &it);
-				iterator_is_valid(&it);
-				iterator_next(&it)) {
+			for (rt_first(&dom->table[i].records, &it);
+				rt_is_valid(&it);
+				rt_next(&it)) {
 
-				p = iterator_val(&it);
-				if (p == NULL)
-					goto error_unlock;
-				r = (urecord_t *)*p;
+				r = rt_val(&it);
 
 				sync_packet = clusterer_api.sync_chunk_start(&contact_repl_cap,
 									location_cluster, node_id, UL_BIN_VERSION);
@@ -120,7 +120,7 @@ static inline void print_udomain(udomain_t* _d)
 {
 	int i;
 	int max=0, slot=0, n=0,count;
-	map_iterator_t it;
+	rec_iterator_t it;
 	LM_GEN1(L_DBG, "---Domain---\n");
 	LM_GEN1(L_DBG, "name : '%.*s'\n", _d->name->len, ZSW(_d->name->s));
 	LM_GEN1(L_DBG, "size : %d\n", _d->size);
@@ -129,17 +129,17 @@ static inline void print_udomain(udomain_t* _d)
 	LM_GEN1(L_DBG, "\n");
 	for(i=0; i<_d->size; i++)
 	{
-		count = map_size( _d->table[i].records);
+		count = rt_size(&_d->table[i].records);
 		n += count;
 		if(max<count){
 			max= count;
 			slot = i;
 		}
 
-		for ( map_first( _d->table[i].records, &it);
-			iterator_is_valid(&it);
-			iterator_next(&it) )
-			print_urecord((struct urecord *)*iterator_val(&it));
+		for ( rt_first(&_d->table[i].records, &it);
+			rt_is_valid(&it);
+			rt_next(&it) )
+			print_urecord(rt_val(&it));
 	}
 
 	LM_GEN1(L_DBG, "\nMax slot: %d (%d/%d)\n", max, slot, n);
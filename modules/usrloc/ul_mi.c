@@ -338,8 +338,7 @@ mi_response_t *mi_usrloc_dump(const mi_params_t *params, int short_dump)
 	udomain_t* dom;
 	time_t t;
 	int i;
-	map_iterator_t it;
-	void ** dest;
+	rec_iterator_t it;
 	mi_response_t *resp;
 	mi_item_t *resp_obj;
 	mi_item_t *domains_arr, *domain_item, *aors_arr, *aor_item;
@@ -389,16 +388,11 @@ mi_response_t *mi_usrloc_dump(const mi_params_t *params, int short_dump)
 		for(i=0; i<dom->size; i++) {
 			lock_ulslot( dom, i);
 
-			for ( map_first( dom->table[i].records, &it);
-				iterator_is_valid(&it);
-				iterator_next(&it) ) {
+			for ( rt_first(&dom->table[i].records, &it);
+				rt_is_valid(&it);
+				rt_next(&it) ) {
 
-				dest = iterator_val(&it);
-				if( dest == NULL ) {
-					LM_ERR("Failed to get urecord\n");
-					goto error_unlock;
-				}
-				r =( urecord_t * ) *dest;
+				r = rt_val(&it);
 
 				aor_item = add_mi_object(aors_arr, NULL, 0);
 				if (!aor_item) {
@@ -643,6 +637,7 @@ static mi_response_t *mi_sync_domain(udomain_t *dom)
 {
 	int i;
 	static db_ps_t my_ps = NULL;
+	rec_iterator_t it;
 
 	/* delete whole table */
 	if (ul_dbf.use_table(ul_dbh, dom->name) < 0) {
@@ -659,9 +654,12 @@ static mi_response_t *mi_sync_domain(udomain_t *dom)
 	for(i=0; i < dom->size; i++) {
 		lock_ulslot(dom, i);
 
-		if (map_for_each(dom->table[i].records, mi_process_sync, 0)) {
-			LM_ERR("cannot process sync\n");
-			goto error;
+		for (rt_first(&dom->table[i].records, &it); rt_is_valid(&it);
+		rt_next(&it)) {
+			if (mi_process_sync(0, rt_val(&it)->aor, rt_val(&it))) {
+				LM_ERR("cannot process sync\n");
+				goto error;
+			}
 		}
 
 		unlock_ulslot(dom, i);
@@ -159,6 +159,11 @@ int desc_time_order = 0;   /*!< By default do not enable timestamp ordering */
 
 int ul_hash_size = 9;
 
+/* number of partitions (and thus of SIP workers) the contacts
+ * are loaded from DB in parallel with, at startup */
+int ul_preload_workers = 1;
+static struct ul_preload *ul_preload;
+
 /* flag */
 unsigned int nat_bflag = (unsigned int)-1;
 static char *nat_bflag_str = 0;
@@ -261,6 +266,7 @@ static const param_export_t params[] = {
 	{"matching_mode",      INT_PARAM, &matching_mode     },
 	{"cseq_delay",         INT_PARAM, &cseq_delay        },
 	{"hash_size",          INT_PARAM, &ul_hash_size      },
+	{"preload_workers",    INT_PARAM, &ul_preload_workers},
 	{"nat_bflag",          STR_PARAM, &nat_bflag_str     },
 	{"contact_refresh_timer",  INT_PARAM, &ct_refresh_timer },
 
@@ -447,6 +453,51 @@ static void ul_rpc_data_load(int sender_id, void *_)
 	}
 }
 
+static void ul_rpc_data_load_part(int sender_id, void *part)
+{
+	dlist_t* ptr;
+	int done;
+
+	for( ptr=root ; ptr ; ptr=ptr->next) {
+		if (preload_udomain_part(ul_dbh, ptr->d, (int)(long)part,
+		ul_preload_workers, ul_preload) < 0) {
+			LM_ERR("failed to preload partition %d of domain '%.*s'\n",
+				(int)(long)part, ptr->name.len, ZSW(ptr->name.s));
+			/* continue with the other ul domains */;
+		}
+	}
+
+	lock_get(&ul_preload->lock);
+	done = (--ul_preload->pending == 0);
+	lock_release(&ul_preload->lock);
+
+	/* the last partition to complete wraps up the load */
+	if (!done)
+		return;
+
+	for( ptr=root ; ptr ; ptr=ptr->next)
+		preload_udomain_finish(ptr->d);
+	preload_report(ul_preload, 1);
+}
+
+
+static int ul_dispatch_data_load(void)
+{
+	long part;
+
+	gettimeofday(&ul_preload->start, NULL);
+	ul_preload->last_report = ul_preload->start;
+
+	/* any idle SIP worker picks up the next partition */
+	for (part = 0; part < ul_preload_workers; part++)
+		if (ipc_dispatch_rpc(ul_rpc_data_load_part, (void *)part) < 0) {
+			LM_ERR("failed to dispatch the load of partition %ld\n", part);
+			return -1;
+		}
+
+	return 0;
+}
+
 int init_cachedb(void)
 {
 	if (!cdbf.init) {
@@ -486,7 +537,10 @@ static int child_init(int _rank)
 	/* _rank==1 is used even when fork is disabled */
 	if (_rank==1 && rr_persist == RRP_LOAD_FROM_SQL) {
 		/* if cache is used, populate domains from DB */
-		if (ipc_send_rpc( process_no, ul_rpc_data_load, NULL)<0) {
+		if (ul_preload) {
+			if (ul_dispatch_data_load() < 0)
+				return -1;
+		} else if (ipc_send_rpc( process_no, ul_rpc_data_load, NULL)<0) {
 			LM_ERR("failed to fire RPC for data load\n");
 			return -1;
 		}
@@ -969,6 +1023,21 @@ int ul_check_db(void)
 				cid_keys[i] = &contactid_col;
 			}
 		}
+
+		if (rr_persist == RRP_LOAD_FROM_SQL && ul_preload_workers > 1) {
+			ul_preload = shm_malloc(sizeof *ul_preload);
+			if (!ul_preload) {
+				LM_ERR("oom\n");
+				return -1;
+			}
+			memset(ul_preload, 0, sizeof *ul_preload);
+
+			if (!lock_init(&ul_preload->lock)) {
+				LM_ERR("cannot init the preload lock\n");
+				return -1;
+			}
+			ul_preload->pending = ul_preload_workers;
+		}
 	}
 
 	return 0;
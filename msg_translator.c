@@ -128,6 +128,14 @@
 
 int disable_503_translation = 0;
 
+/* lay out the headers of the built messages into a scatter list, sized and
+ * written from a single walk of their lumps, instead of the lumps_len() +
+ * process_lumps() pair */
+int msg_scatter_build = 0;
+
+/* the scatter list of the message being built, reused by all the builds */
+static struct lump_iov msg_iov;
+
 #define append_str(_dest,_src,_len) \
 	do{\
 		memcpy( (_dest) , (_src) , (_len) );\
@@ -1241,6 +1249,345 @@ skip_after:
 }
 
 
+/* the strings used by the SUBST lumps, as resolved by process_lumps() */
+struct lump_subst_addrs {
+	const str *snd_address, *snd_port;
+	const str *rcv_address, *rcv_port;
+};
+
+static str_const lump_protos[] = {
+	[PROTO_NONE] = str_const_init("udp"),
+	[PROTO_UDP]  = str_const_init("udp"),
+	[PROTO_TCP]  = str_const_init("tcp"),
+	[PROTO_TLS]  = str_const_init("tls"),
+	[PROTO_SCTP] = str_const_init("sctp"),
+	[PROTO_WS]   = str_const_init("ws"),
+	[PROTO_WSS]  = str_const_init("wss"),
+};
+
+static str_const lump_transports[] = {
+	[PROTO_NONE] = STR_NULL_const,
+	[PROTO_UDP]  = STR_NULL_const, /* udp is the default */
+	[PROTO_TCP]  = str_const_init(TRANSPORT_PARAM "tcp"),
+	[PROTO_TLS]  = str_const_init(TRANSPORT_PARAM "tls"),
+	[PROTO_SCTP] = str_const_init(TRANSPORT_PARAM "sctp"),
+	[PROTO_WS]   = str_const_init(TRANSPORT_PARAM "ws"),
+	[PROTO_WSS]  = str_const_init(TRANSPORT_PARAM "wss"),
+};
+
+#define lump_known_proto(_p) \
+	((_p) >= 0 && (_p) < sizeof lump_protos / sizeof *lump_protos && \
+		lump_protos[_p].s)
+
+
+int lump_iov_grow(struct lump_iov *v)
+{
+	struct iovec *iov;
+	int size;
+
+	size = v->size ? 2 * v->size : LUMP_IOV_INIT_SIZE;
+	iov = pkg_realloc(v->iov, size * sizeof *iov);
+	if (!iov) {
+		LM_ERR("oom while growing the scatter list to %d\n", size);
+		return -1;
+	}
+	v->iov = iov;
+	v->size = size;
+
+	return 0;
+}
+
+
+static inline void init_lump_subst_addrs(struct sip_msg *msg,
+		const struct socket_info *send_sock, struct lump_subst_addrs *a)
+{
+	if(send_sock && send_sock->adv_name_str.len)
+		a->snd_address=&(send_sock->adv_name_str);
+	else if (msg->set_global_address.len)
+		a->snd_address=&(msg->set_global_address);
+	else if (default_global_address->s)
+		a->snd_address=default_global_address;
+	else
+		a->snd_address=send_sock ? &(send_sock->address_str) : NULL;
+	if(send_sock && send_sock->adv_port_str.len)
+		a->snd_port=&(send_sock->adv_port_str);
+	else if (msg->set_global_port.len)
+		a->snd_port=&(msg->set_global_port);
+	else if (default_global_port->s)
+		a->snd_port=default_global_port;
+	else
+		a->snd_port=send_sock ? &(send_sock->port_no_str) : NULL;
+
+	a->rcv_address = a->rcv_port = NULL;
+	if(msg->rcv.bind_address) {
+		if(msg->rcv.bind_address->adv_name_str.len)
+			a->rcv_address=&(msg->rcv.bind_address->adv_name_str);
+		else if (default_global_address->s)
+			a->rcv_address=default_global_address;
+		else
+			a->rcv_address=&(msg->rcv.bind_address->address_str);
+		if(msg->rcv.bind_address->adv_port_str.len)
+			a->rcv_port=&(msg->rcv.bind_address->adv_port_str);
+		else if (default_global_port->s)
+			a->rcv_port=default_global_port;
+		else
+			a->rcv_port=&(msg->rcv.bind_address->port_no_str);
+	}
+}
+
+
+/* the "address[:port][;transport=proto]" of a SUBST_*_ALL lump */
+static inline int lump_iov_hostport(struct lump_iov *v,
+		const str *address, const str *port, const str *def_port,
+		unsigned short port_no, int proto)
+{
+	if (lump_iov_add(v, address->s, address->len) < 0)
+		return -1;
+
+	if (port_no != SIP_PORT || port != def_port) {
+		if (lump_iov_add(v, ":", 1) < 0 ||
+		        lump_iov_add(v, port->s, port->len) < 0)
+			return -1;
+	}
+
+	if (!lump_known_proto(proto)) {
+		LM_CRIT("unknown proto %d\n", proto);
+		return 0;
+	}
+
+	return lump_iov_add(v, lump_transports[proto].s,
+		lump_transports[proto].len);
+}
+
+
+static int lump_iov_subst(struct lump_iov *v, struct sip_msg *msg,
+		struct lump *l, const struct socket_info *send_sock,
+		const struct lump_subst_addrs *a)
+{
+	const struct socket_info *si = msg->rcv.bind_address;
+
+	switch (l->u.subst) {
+		case SUBST_RCV_IP:
+		case SUBST_RCV_PORT:
+		case SUBST_RCV_PROTO:
+		case SUBST_RCV_ALL:
+			if (!si) {
+				LM_CRIT("null bind_address\n");
+				return 0;
+			}
+			break;
+		case SUBST_SND_IP:
+		case SUBST_SND_PORT:
+		case SUBST_SND_PROTO:
+		case SUBST_SND_ALL:
+			if (!send_sock) {
+				LM_CRIT("called with null send_sock\n");
+				return 0;
+			}
+			break;
+		default:
+			break;
+	}
+
+	switch (l->u.subst) {
+		case SUBST_RCV_IP:
+			return lump_iov_add(v, a->rcv_address->s, a->rcv_address->len);
+		case SUBST_RCV_PORT:
+			return lump_iov_add(v, a->rcv_port->s, a->rcv_port->len);
+		case SUBST_RCV_ALL:
+			return lump_iov_hostport(v, a->rcv_address, a->rcv_port,
+				&si->port_no_str, si->port_no, si->proto);
+		case SUBST_SND_IP:
+			return lump_iov_add(v, a->snd_address->s, a->snd_address->len);
+		case SUBST_SND_PORT:
+			return lump_iov_add(v, a->snd_port->s, a->snd_port->len);
+		case SUBST_SND_ALL:
+			return lump_iov_hostport(v, a->snd_address, a->snd_port,
+				&send_sock->port_no_str, send_sock->port_no, send_sock->proto);
+		case SUBST_RCV_PROTO:
+		case SUBST_SND_PROTO:
+			si = (l->u.subst == SUBST_RCV_PROTO) ? si : send_sock;
+			if (!lump_known_proto(si->proto)) {
+				LM_CRIT("unknown proto %d\n", si->proto);
+				return 0;
+			}
+			return lump_iov_add(v, lump_protos[si->proto].s,
+				lump_protos[si->proto].len);
+		case SUBST_NOP:
+			return 0;
+		default:
+			LM_CRIT("unknown subst type %d\n", l->u.subst);
+	}
+
+	return 0;
+}
+
+
+/* the before (or after) chain of a lump, starting with @r */
+static int lump_iov_chain(struct lump_iov *v, struct sip_msg *msg,
+		struct lump *r, int after, const struct socket_info *send_sock,
+		const struct lump_subst_addrs *a)
+{
+#define lump_next(_l) (after ? (_l)->after : (_l)->before)
+
+	for (; r; r = lump_next(r)) {
+		switch (r->op) {
+			case LUMP_ADD:
+				if (lump_iov_add(v, r->u.value, r->len) < 0)
+					return -1;
+				break;
+			case LUMP_ADD_SUBST:
+				if (lump_iov_subst(v, msg, r, send_sock, a) < 0)
+					return -1;
+				break;
+			case LUMP_ADD_OPT:
+				/* skip if this is an OPT lump and the condition is
+				 * not satisfied */
+				if (!lump_check_opt(r, msg, send_sock))
+					return 0;
+				break;
+			case LUMP_SKIP:
+				/* if a SKIP lump, go to the last in the list*/
+				if (!lump_next(r) || !lump_next(lump_next(r)))
+					continue;
+				for (; lump_next(lump_next(r)); r = lump_next(r))
+					;
+				break;
+			default:
+				/* only ADD allowed for before/after */
+				LM_BUG("invalid op (%x)", r->op);
+		}
+	}
+
+	return 0;
+#undef lump_next
+}
+
+
+/* same walk as process_lumps(), but the output is only described (in @v),
+ * so it is sized and written without evaluating the lumps twice */
+int lumps_to_iov(struct sip_msg *msg, struct lump *lumps, struct lump_iov *v,
+		unsigned int *orig_offs, const struct socket_info *send_sock,
+		int max_offset)
+{
+	struct lump_subst_addrs a;
+	struct lump *t;
+	unsigned int size, s_offset, last_del;
+
+	init_lump_subst_addrs(msg, send_sock, &a);
+
+	s_offset = *orig_offs;
+	last_del = 0;
+
+	for (t = lumps; t && t->u.offset<(unsigned int)max_offset ; t = t->next) {
+		/* skip this lump if the "offset" is still in a "deleted" area */
+		if (t->u.offset < s_offset && t->u.offset != last_del) {
+			LM_DBG("skip a %d, buffer offset=%d, lump offset=%d, last_del=%d\n",
+				t->op,s_offset, t->u.offset,last_del);
+			continue;
+		}
+
+		switch (t->op) {
+			case LUMP_NOP:
+			case LUMP_DEL:
+				/* the original buffer, till offset (if any) */
+				if (s_offset < t->u.offset) {
+					size = t->u.offset - s_offset;
+					if (lump_iov_add(v, msg->buf + s_offset, size) < 0)
+						return -1;
+					s_offset += size;
+				}
+
+				if (t->op == LUMP_DEL)
+					last_del = t->u.offset;
+
+				if (lump_iov_chain(v, msg, t->before, 0, send_sock, &a) < 0)
+					return -1;
+
+				/* skip at most len bytes from orig msg and properly handle
+				 * the DEL lumps at the same offset */
+				if (t->op == LUMP_DEL && t->u.offset + t->len > s_offset)
+					s_offset += t->len - (s_offset - t->u.offset);
+
+				if (lump_iov_chain(v, msg, t->after, 1, send_sock, &a) < 0)
+					return -1;
+				break;
+			case LUMP_ADD:
+			case LUMP_ADD_SUBST:
+			case LUMP_ADD_OPT:
+				/* sized and written by the same walk, so unlike with
+				 * lumps_len(), an ADD along the main chain is fine here */
+				if ((t->op==LUMP_ADD_OPT) &&
+						(!lump_check_opt(t, msg, send_sock)))
+					continue;
+
+				if (lump_iov_chain(v, msg, t->before, 0, send_sock, &a) < 0)
+					return -1;
+
+				if (t->op == LUMP_ADD) {
+					if (lump_iov_add(v, t->u.value, t->len) < 0)
+						return -1;
+				} else if (t->op == LUMP_ADD_SUBST) {
+					if (lump_iov_subst(v, msg, t, send_sock, &a) < 0)
+						return -1;
+				}
+
+				if (lump_iov_chain(v, msg, t->after, 1, send_sock, &a) < 0)
+					return -1;
+				break;
+			case LUMP_SKIP:
+				LM_BUG("LUMP_SKIP");
+				/* if a SKIP lump, go to the last in the list*/
+				if (!t->next || !t->next->next)
+					continue;
+				for (; t->next->next; t = t->next)
+					;
+				break;
+			default:
+				LM_BUG("invalid op 6 (%x)", t->op);
+		}
+	}
+
+	*orig_offs = s_offset;
+	return 0;
+}
+
+
+char *lump_iov_copy(struct lump_iov *v, char *buf)
+{
+	const char *s;
+	size_t len;
+	int i;
+
+	for (i = 0; i < v->n; i++) {
+		s = v->iov[i].iov_base;
+		len = v->iov[i].iov_len;
+
+		/* most of the pieces are a few bytes long (separators, ports,
+		 * params), so spare them the memcpy() call; the fixed size
+		 * copies may overlap, as the pieces are written in order */
+		if (len >= 8 && len <= 16) {
+			memcpy(buf, s, 8);
+			memcpy(buf + len - 8, s + len - 8, 8);
+		} else if (len >= 4 && len < 8) {
+			memcpy(buf, s, 4);
+			memcpy(buf + len - 4, s + len - 4, 4);
+		} else if (len < 4) {
+			buf[0] = s[0];
+			if (len > 1) {
+				buf[1] = s[1];
+				buf[len - 1] = s[len - 1];
+			}
+		} else {
+			memcpy(buf, s, len);
+		}
+		buf += len;
+	}
+
+	return buf;
+}
+
+
 /* Prepares a body to be re-assembled. This consists of the following ops:
  *   - run the functions to build the parts (if the case)
  *   - add SIP header lumps to change CT header 
@@ -1813,6 +2160,7 @@ void reassemble_body_parts( struct sip_msg* msg, char* new_buf,
 				if (part->dump_f) {
 					memcpy(new_buf+offset, part->dump.s, part->dump.len );
 					offset += part->dump.len;
+					pkg_free(part->dump.s);
 					part->dump.s = NULL;
 					part->dump.len = 0;
 				} else {
@@ -1892,27 +2240,29 @@ static inline int calculate_body_diff(struct sip_msg *msg,
 }
 
 
-/* Writes down the new SIP message buffer (SIP headers and body) after
- *   after applying all the changes (over SIP hdrs and SIP body) !
+/* Writes down the new SIP body, after the already written headers, after
+ *   applying all the changes over it !
  * This is a wrapper to hide the differences between 
  *   lump-based changes and body_part-based changes.
  */
-static inline void apply_msg_changes(struct sip_msg *msg,
+static inline void apply_body_changes(struct sip_msg *msg,
 							char *new_buf, unsigned int *new_offs,
 							unsigned int *orig_offs, const struct socket_info *sock,
 							unsigned int max_offset)
 {
 	unsigned int size;
 
-	/* apply changes over the SIP headers */
-	process_lumps(msg, msg->add_rm, new_buf, new_offs, orig_offs, sock, -1);
 	if (msg->body==NULL) {
-		/* no body parsed, no advanced ops done, just dummy lumps over body */
+		/* no body parsed, no advanced ops done, just dummy lumps over body;
+		 * the ones anchored right at its end were counted by lumps_len()
+		 * too, so they are kept */
 		process_lumps(msg, msg->body_lumps, new_buf, new_offs,
-			orig_offs, sock, max_offset);
+			orig_offs, sock, max_offset + 1);
 		/* copy the rest of the message */
-		memcpy(new_buf+*new_offs, msg->buf+*orig_offs, max_offset-*orig_offs);
-		*new_offs += max_offset-*orig_offs;
+		if (*orig_offs < max_offset) {
+			memcpy(new_buf+*new_offs, msg->buf+*orig_offs, max_offset-*orig_offs);
+			*new_offs += max_offset-*orig_offs;
+		}
 	} else {
 		/* copy whatever is left in the original buffer (up to the body) */
 		size = msg->body->body.s ?
@@ -2299,16 +2649,42 @@ build_msg:
 	if (get_body(msg, &body) == 0 && body.len)
 		len -= (msg->buf + msg->len - body.s - body.len);
 
-	/* compute new msg len and fix overlapping zones*/
-	new_len=len+body_delta+lumps_len(msg, msg->add_rm, send_sock,-1);
+	if (msg_scatter_build) {
+		/* lay out the first line and the headers, sizing them at the
+		 * same time */
+		msg_iov.n = 0;
+		msg_iov.len = 0;
+		s_offset = 0;
+		if (msg->new_uri.s){
+			/* message up to uri, then our uri, skipping the original one */
+			size=msg->first_line.u.request.uri.s-buf;
+			if (lump_iov_add(&msg_iov, buf, size) < 0 ||
+			        lump_iov_add(&msg_iov, msg->new_uri.s, msg->new_uri.len) < 0)
+				goto error00;
+			s_offset = size + msg->first_line.u.request.uri.len;
+		}
+		if (lumps_to_iov(msg, msg->add_rm, &msg_iov, &s_offset, send_sock,
+		        -1) < 0)
+			goto error00;
+
+		new_len = msg_iov.len + (len - s_offset) + body_delta;
+#ifdef XL_DEBUG
+		LM_DBG("new_len(%d)=hdrs(%d)+rest(%d)+body_delta(%d)\n", new_len,
+			msg_iov.len, len - s_offset, body_delta);
+#endif
+	} else {
+		/* compute new msg len and fix overlapping zones*/
+		new_len=len+body_delta+lumps_len(msg, msg->add_rm, send_sock,-1);
 #ifdef XL_DEBUG
-	LM_DBG("new_len(%d)=len(%d)+lumps_len\n", new_len, len);
+		LM_DBG("new_len(%d)=len(%d)+lumps_len\n", new_len, len);
 #endif
 
-	if (msg->new_uri.s){
-		uri_len=msg->new_uri.len;
-		new_len=new_len-msg->first_line.u.request.uri.len+uri_len;
+		if (msg->new_uri.s){
+			uri_len=msg->new_uri.len;
+			new_len=new_len-msg->first_line.u.request.uri.len+uri_len;
+		}
 	}
+
 	if (flags&MSG_TRANS_SHM_FLAG)
 		new_buf=(char*)shm_malloc(new_len+1);
 	else
@@ -2319,21 +2695,29 @@ build_msg:
 		goto error00;
 	}
 
-	offset=s_offset=0;
-	if (msg->new_uri.s){
-		/* copy message up to uri */
-		size=msg->first_line.u.request.uri.s-buf;
-		memcpy(new_buf, buf, size);
-		offset+=size;
-		s_offset+=size;
-		/* add our uri */
-		memcpy(new_buf+offset, msg->new_uri.s, uri_len);
-		offset+=uri_len;
-		s_offset+=msg->first_line.u.request.uri.len; /* skip original uri */
+	if (msg_scatter_build) {
+		offset = lump_iov_copy(&msg_iov, new_buf) - new_buf;
+	} else {
+		offset=s_offset=0;
+		if (msg->new_uri.s){
+			/* copy message up to uri */
+			size=msg->first_line.u.request.uri.s-buf;
+			memcpy(new_buf, buf, size);
+			offset+=size;
+			s_offset+=size;
+			/* add our uri */
+			memcpy(new_buf+offset, msg->new_uri.s, uri_len);
+			offset+=uri_len;
+			s_offset+=msg->first_line.u.request.uri.len; /* skip original uri */
+		}
+
+		/* apply changes over the SIP hdrs */
+		process_lumps(msg, msg->add_rm, new_buf, &offset, &s_offset,
+			send_sock, -1);
 	}
 
-	/* apply changes over SIP hdrs and body */
-	apply_msg_changes( msg, new_buf, &offset, &s_offset, send_sock, len);
+	/* apply changes over the SIP body */
+	apply_body_changes( msg, new_buf, &offset, &s_offset, send_sock, len);
 	if (offset!=new_len) {
 		LM_BUG("len mismatch : calculated %d, written %d\n", new_len, offset);
 		abort();
@@ -2404,7 +2788,16 @@ char * build_res_buf_from_sip_res( struct sip_msg* msg,
 	/* adjust len to the useful part of the message */
 	if (get_body(msg, &body) == 0 && body.len)
 		len -= (msg->buf + msg->len - body.s - body.len);
-	new_len=len+body_delta+lumps_len(msg, msg->add_rm, sock, -1);
+	if (msg_scatter_build) {
+		msg_iov.n = 0;
+		msg_iov.len = 0;
+		s_offset = 0;
+		if (lumps_to_iov(msg, msg->add_rm, &msg_iov, &s_offset, sock, -1) < 0)
+			goto error;
+		new_len = msg_iov.len + (len - s_offset) + body_delta;
+	} else {
+		new_len=len+body_delta+lumps_len(msg, msg->add_rm, sock, -1);
+	}
 
 	LM_DBG(" old size: %d, new size: %d\n", len, new_len);
 	new_buf=(char*)pkg_malloc(new_len+1); /* +1 is for debugging
@@ -2413,10 +2806,16 @@ char * build_res_buf_from_sip_res( struct sip_msg* msg,
 		LM_ERR("out of pkg mem\n");
 		goto error;
 	}
-	offset=s_offset=0;
+	if (msg_scatter_build) {
+		offset = lump_iov_copy(&msg_iov, new_buf) - new_buf;
+	} else {
+		offset=s_offset=0;
+		/* apply changes over the SIP hdrs */
+		process_lumps(msg, msg->add_rm, new_buf, &offset, &s_offset, sock, -1);
+	}
 
-	/* apply changes over SIP hdrs and body */
-	apply_msg_changes( msg, new_buf, &offset, &s_offset, sock, len);
+	/* apply changes over the SIP body */
+	apply_body_changes( msg, new_buf, &offset, &s_offset, sock, len);
 	if (offset!=new_len) {
 		LM_BUG("len mismatch : calculated %d, written %d\n", new_len, offset);
 		abort();
@@ -50,6 +50,8 @@
 
 //#define MAX_CONTENT_LEN_BUF INT2STR_MAX_LEN /* see ut.h/int2str() */
 
+#include <sys/uio.h>
+
 #include "parser/msg_parser.h"
 #include "ip_addr.h"
 #include "socket_info.h"
@@ -173,6 +175,44 @@ void process_lumps( struct sip_msg* msg, struct lump* lumps, char* new_buf,
 		unsigned int* new_buf_offs, unsigned int* orig_offs,
 		const struct socket_info* send_sock, int max_offset);
 
+/* scatter list of a rebuilt message: pieces of the original buffer, lump
+ * values and SUBST strings, in output order */
+#define LUMP_IOV_INIT_SIZE  64
+
+struct lump_iov {
+	struct iovec *iov;
+	int n;
+	int size;
+	unsigned int len;   /* total length of the pieces */
+};
+
+int lump_iov_grow(struct lump_iov *v);
+
+static inline int lump_iov_add(struct lump_iov *v, const char *s,
+		unsigned int len)
+{
+	if (len == 0)
+		return 0;
+
+	if (v->n == v->size && lump_iov_grow(v) < 0)
+		return -1;
+
+	v->iov[v->n].iov_base = (void *)s;
+	v->iov[v->n++].iov_len = len;
+	v->len += len;
+
+	return 0;
+}
+
+/* describes the changes of a lump list in @v, consuming the original
+ * buffer from @orig_offs on; same output as process_lumps() */
+int lumps_to_iov(struct sip_msg *msg, struct lump *lumps, struct lump_iov *v,
+		unsigned int *orig_offs, const struct socket_info *send_sock,
+		int max_offset);
+
+/* writes all the pieces of @v at @buf; returns the end of the output */
+char *lump_iov_copy(struct lump_iov *v, char *buf);
+
 int is_del_via1_lump(struct sip_msg* msg);
 
 char* received_builder(struct sip_msg *msg, unsigned int *received_len);
@@ -135,6 +135,10 @@ int tcp_max_msg_time = TCP_CHILD_MAX_MSG_TIME;
 /* If the data reading may be performed across different workers (still
  * serial) or by a single worker (the TCP conns sticks to one worker) */
 int tcp_parallel_read_on_workers = 0;
+/* If the TCP workers accept the new connections themselves, each on its
+ * own SO_REUSEPORT socket, and keep them for their whole life (versus TCP
+ * main accepting them and passing them to the least loaded worker) */
+int tcp_accept_on_workers = 0;
 
 #ifdef HAVE_SO_KEEPALIVE
     int tcp_keepalive = 1;
@@ -167,6 +171,21 @@ unsigned int last_outgoing_tcp_id = 0;
 
 static struct scaling_profile *s_profile = NULL;
 
+/* the per-worker sockets of a listener, in "tcp_accept_on_workers" mode;
+ * they are all created and bound (into the same SO_REUSEPORT group) at
+ * startup, before dropping the privileges, but only the sockets of the
+ * occupied worker slots are listening - so only these get connections */
+struct tcp_worker_listener {
+	struct socket_info *si;
+	int *socks;		/*!< one per TCP worker slot */
+	struct tcp_worker_listener *next;
+};
+
+static struct tcp_worker_listener *tcp_worker_listeners = NULL;
+
+/* the TCP worker slot of the current process, if listening */
+static int tcp_worker_slot = -1;
+
 /****************************** helper functions *****************************/
 extern void handle_sigs(void);
 
@@ -323,40 +342,27 @@ static int send2worker(struct tcp_connection* tcpconn,int rw)
 
 /********************** TCP conn management functions ************************/
 
-/* initializes an already defined TCP listener */
-int tcp_init_listener(struct socket_info *si)
+/* creates and binds a socket for the address of a TCP listener
+ * (with "su" already set); returns the socket or -1 on error */
+static int tcp_open_listener_sock(struct socket_info *si, int reuseport)
 {
 	union sockaddr_union* addr;
 	int optval;
+	int s;
 #ifdef DISABLE_NAGLE
 	int flag;
-	struct protoent* pe;
-
-	if (tcp_proto_no==-1){ /* if not already set */
-		pe=getprotobyname("tcp");
-		if (pe==0){
-			LM_ERR("could not get TCP protocol number\n");
-			tcp_proto_no=-1;
-		}else{
-			tcp_proto_no=pe->p_proto;
-		}
-	}
 #endif
 
 	addr = &si->su;
-	if (init_su(addr, &si->address, si->port_no)<0){
-		LM_ERR("could no init sockaddr_union\n");
-		goto error;
-	}
-	si->socket = socket(AF2PF(addr->s.sa_family), SOCK_STREAM, 0);
-	if (si->socket==-1){
+	s = socket(AF2PF(addr->s.sa_family), SOCK_STREAM, 0);
+	if (s==-1){
 		LM_ERR("socket failed with [%s]\n", strerror(errno));
-		goto error;
+		return -1;
 	}
 #ifdef DISABLE_NAGLE
 	flag=1;
 	if ( (tcp_proto_no!=-1) &&
-		 (setsockopt(si->socket, tcp_proto_no , TCP_NODELAY,
+		 (setsockopt(s, tcp_proto_no , TCP_NODELAY,
 					 &flag, sizeof(flag))<0) ){
 		LM_ERR("could not disable Nagle: %s\n",strerror(errno));
 	}
@@ -370,7 +376,7 @@ int tcp_init_listener(struct socket_info *si)
 	 * to allow the server to be restarted in this situation
 	 */
 	optval=1;
-	if (setsockopt(si->socket, SOL_SOCKET, SO_REUSEADDR,
+	if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR,
 	(void*)&optval, sizeof(optval))==-1) {
 		LM_ERR("setsockopt failed with [%s]\n", strerror(errno));
 		goto error;
@@ -379,35 +385,121 @@ int tcp_init_listener(struct socket_info *si)
 	/* tos */
 	optval = (si->tos > 0) ? si->tos : tos;
 	if (optval > 0) {
-		if (setsockopt(si->socket, IPPROTO_IP, IP_TOS, (void*)&optval,
+		if (setsockopt(s, IPPROTO_IP, IP_TOS, (void*)&optval,
 		sizeof(optval)) ==-1){
 			LM_WARN("setsockopt tos: %s\n", strerror(errno));
 			/* continue since this is not critical */
 		}
 	}
 
-	if (probe_max_sock_buff(si->socket,1,MAX_SEND_BUFFER_SIZE,
+	if (probe_max_sock_buff(s,1,MAX_SEND_BUFFER_SIZE,
 	BUFFER_INCREMENT)) {
 		LM_WARN("setsockopt tcp snd buff: %s\n",strerror(errno));
 		/* continue since this is not critical */
 	}
 
-	init_sock_keepalive(si->socket, &tcp_con_df_profile);
-	if (si->flags & SI_REUSEPORT)
-		set_sock_reuseport(si->socket);
-	if (bind(si->socket, &addr->s, sockaddru_len(*addr))==-1){
+	init_sock_keepalive(s, &tcp_con_df_profile);
+	if (reuseport || (si->flags & SI_REUSEPORT))
+		set_sock_reuseport(s);
+	if (bind(s, &addr->s, sockaddru_len(*addr))==-1){
 		LM_ERR("bind(%x, %p, %d) on %s:%d : %s\n",
-				si->socket, &addr->s,
+				s, &addr->s,
 				(unsigned)sockaddru_len(*addr),
 				si->address_str.s,
 				si->port_no,
 				strerror(errno));
 		goto error;
 	}
+
+	return s;
+error:
+	close(s);
+	return -1;
+}
+
+
+/* creates the sockets of a listener for all the TCP worker slots; they
+ * are non-blocking, as a worker shares its reactor with other fds */
+static int tcp_init_worker_listener(struct socket_info *si)
+{
+	struct tcp_worker_listener *wl;
+	int flags;
+	int r;
+
+	wl = pkg_malloc(sizeof *wl + tcp_workers_max_no * sizeof(int));
+	if (wl==NULL) {
+		LM_ERR("no more pkg memory\n");
+		return -1;
+	}
+	wl->si = si;
+	wl->socks = (int *)(wl + 1);
+
+	for (r=0; r<tcp_workers_max_no; r++) {
+		wl->socks[r] = tcp_open_listener_sock(si, 1);
+		if (wl->socks[r]==-1)
+			goto error;
+		flags = fcntl(wl->socks[r], F_GETFL);
+		if (flags==-1 ||
+		fcntl(wl->socks[r], F_SETFL, flags|O_NONBLOCK)==-1) {
+			LM_ERR("set non-blocking failed: (%d) %s\n",
+				errno, strerror(errno));
+			r++;
+			goto error;
+		}
+	}
+
+	wl->next = tcp_worker_listeners;
+	tcp_worker_listeners = wl;
+
+	LM_DBG("%d worker sockets for %.*s\n", tcp_workers_max_no,
+		si->sock_str.len, si->sock_str.s);
+	return 0;
+error:
+	while (--r>=0)
+		if (wl->socks[r]!=-1)
+			close(wl->socks[r]);
+	pkg_free(wl);
+	return -1;
+}
+
+
+/* initializes an already defined TCP listener */
+int tcp_init_listener(struct socket_info *si)
+{
+#ifdef DISABLE_NAGLE
+	struct protoent* pe;
+
+	if (tcp_proto_no==-1){ /* if not already set */
+		pe=getprotobyname("tcp");
+		if (pe==0){
+			LM_ERR("could not get TCP protocol number\n");
+			tcp_proto_no=-1;
+		}else{
+			tcp_proto_no=pe->p_proto;
+		}
+	}
+#endif
+
+	if (init_su(&si->su, &si->address, si->port_no)<0){
+		LM_ERR("could no init sockaddr_union\n");
+		goto error;
+	}
+	si->socket = tcp_open_listener_sock(si, tcp_accept_on_workers);
+	if (si->socket==-1)
+		goto error;
+
+	if (tcp_accept_on_workers) {
+		/* the listener stays bound only, each TCP worker listens and
+		 * accepts on its own socket */
+		if (tcp_init_worker_listener(si)<0)
+			goto error;
+		return 0;
+	}
+
 	if (listen(si->socket, tcp_socket_backlog)==-1){
 		LM_ERR("listen(%x, %p, %d) on %s: %s\n",
-				si->socket, &addr->s,
-				(unsigned)sockaddru_len(*addr),
+				si->socket, &si->su.s,
+				(unsigned)sockaddru_len(si->su),
 				si->address_str.s,
 				strerror(errno));
 		goto error;
@@ -423,6 +515,57 @@ error:
 }
 
 
+/* starts listening on the sockets of a TCP worker slot and watching them
+ * in the reactor of the current process (the worker in that slot) */
+int tcp_worker_listen(int slot)
+{
+	struct tcp_worker_listener *wl;
+
+	if (!tcp_accept_on_workers)
+		return 0;
+
+	for (wl=tcp_worker_listeners; wl; wl=wl->next) {
+		if (listen(wl->socks[slot], tcp_socket_backlog)==-1) {
+			LM_ERR("listen() on %.*s for TCP worker %d: %s\n",
+				wl->si->sock_str.len, wl->si->sock_str.s, slot,
+				strerror(errno));
+			return -1;
+		}
+		if (reactor_add_reader(wl->socks[slot], F_TCP_LISTENER,
+		RCT_PRIO_NET, wl->si)<0) {
+			LM_ERR("failed to add listen socket to reactor\n");
+			return -1;
+		}
+	}
+
+	tcp_worker_slot = slot;
+	return 0;
+}
+
+
+/* stops listening on the sockets of the current TCP worker; a shutdown()
+ * takes a socket out of the SO_REUSEPORT group (the connections still in
+ * its queue are reset), but keeps it bound, so the next worker forked in
+ * the same slot may listen on it again */
+void tcp_worker_unlisten(void)
+{
+	struct tcp_worker_listener *wl;
+
+	if (tcp_worker_slot<0)
+		return;
+
+	for (wl=tcp_worker_listeners; wl; wl=wl->next) {
+		reactor_del_reader(wl->socks[tcp_worker_slot], -1, 0);
+		if (shutdown(wl->socks[tcp_worker_slot], SHUT_RDWR)<0)
+			LM_WARN("shutdown() on %.*s for TCP worker %d: %s\n",
+				wl->si->sock_str.len, wl->si->sock_str.s, tcp_worker_slot,
+				strerror(errno));
+	}
+
+	tcp_worker_slot = -1;
+}
+
+
 /*! \brief finds a connection, if id=0 return NULL
  * \note WARNING: unprotected (locks) use tcpconn_get unless you really
  * know what you are doing */
@@ -754,6 +897,8 @@ static void __tcpconn_rm(struct tcp_connection* c, int no_event)
 	lock_destroy(&c->write_lock);
 
 	if (c->async) {
+		if (c->wstats)
+			__sync_fetch_and_sub(&c->wstats->queued, c->async->pending);
 		for (r = 0; r<c->async->pending; r++)
 			shm_free(c->async->chunks[r]);
 		shm_free(c->async);
@@ -951,6 +1096,7 @@ static struct tcp_connection* tcpconn_new(int sock, const union sockaddr_union*
 			c->async->allocated = protos[si->proto].net.stream.async_chunks;
 			c->async->oldest = 0;
 			c->async->pending = 0;
+			c->wstats = tcp_get_prof_wstats(prof->id);
 		} else {
 			LM_ERR("could not allocate async data for con!\n");
 			goto error;
@@ -1159,6 +1305,93 @@ static inline int handle_new_connect(const struct socket_info* si)
 }
 
 
+/*! \brief
+ * accepts a new connection on a listener socket of a TCP worker, in the
+ * "tcp_accept_on_workers" mode. The connection is hashed right away (so the
+ * worker may reply over it), after being registered with TCP main, over the
+ * worker's own socket - TCP main only keeps its fd (needed by the sends of
+ * other processes) and does the lifetime bookkeeping.
+ * \param si        - the listener of the socket
+ * \param fd        - the worker's socket for the listener
+ * \param unix_sock - the worker's socket to TCP main
+ * \param c         - set to the new connection (with the worker's ref)
+ * \return  handle_* return convention, as handle_new_connect()
+ */
+int tcp_worker_accept(const struct socket_info* si, int fd, int unix_sock,
+											struct tcp_connection** c)
+{
+	union sockaddr_union su;
+	struct tcp_connection* tcpconn;
+	struct tcp_conn_profile prof;
+	socklen_t su_len = sizeof(su);
+	long response[2];
+	int new_sock;
+
+	*c = NULL;
+
+	/* coverity[overrun-buffer-arg: FALSE] - union has 28 bytes, CID #200070 */
+	new_sock=accept(fd, &(su.s), &su_len);
+	if (new_sock==-1){
+		if ((errno==EAGAIN)||(errno==EWOULDBLOCK))
+			return 0;
+		LM_ERR("failed to accept connection(%d): %s\n", errno, strerror(errno));
+		return -1;
+	}
+
+	tcp_con_get_profile(&su, &si->su, si->proto, &prof);
+	if (tcp_init_sock_opt(new_sock, &prof, si->flags, si->tos)<0){
+		LM_ERR("tcp_init_sock_opt failed\n");
+		close(new_sock);
+		return 1; /* success, because the accept was successful */
+	}
+
+	tcpconn=tcpconn_new(new_sock, &su, si, &prof, S_CONN_OK,
+		F_CONN_ACCEPTED|F_CONN_OWNED);
+	if (tcpconn==NULL){
+		LM_ERR("tcpconn_new failed, closing socket\n");
+		close(new_sock);
+		return 1;
+	}
+	/* the worker keeps it, so no other worker may read from it */
+	tcpconn->profile.parallel_read = 0;
+
+	if (protos[tcpconn->type].net.stream.conn.init &&
+			protos[tcpconn->type].net.stream.conn.init(tcpconn) < 0) {
+		LM_ERR("failed to do proto %d specific init for conn %p\n",
+				tcpconn->type, tcpconn);
+		goto error;
+	}
+	tcpconn->flags |= F_CONN_INIT;
+
+	tcpconn->refcnt++; /* safe, not yet available to the outside world */
+	sh_log(tcpconn->hist, TCP_REF, "worker accept, (%d)", tcpconn->refcnt);
+	/* no fd in TCP main until it gets the registration (and a CONN_GET_FD
+	 * may not be served before that, see tcpconn_flush_accepted()) */
+	tcpconn->s=-1;
+	tcpconn->fd=new_sock;
+
+	response[0]=(long)tcpconn;
+	response[1]=CONN_ACCEPTED;
+	if (send_fd(unix_sock, response, sizeof(response), new_sock)<=0){
+		LM_ERR("failed to register conn with TCP main: %s (%d)\n",
+			strerror(errno), errno);
+		goto error;
+	}
+
+	tcpconn_add(tcpconn);
+	LM_DBG("new connection: %p %d flags: %04x\n",
+			tcpconn, new_sock, tcpconn->flags);
+
+	*c = tcpconn;
+	return 1; /* accept() was successful */
+error:
+	/* no close to report, the conn was not reported as OPEN yet */
+	_tcpconn_rm(tcpconn,1);
+	close(new_sock);
+	return 1;
+}
+
+
 /*! \brief
  * handles an io event on one of the watched tcp connections
  *
@@ -1288,6 +1521,7 @@ inline static int handle_tcp_worker(struct tcp_worker* tcp_c, int fd_i)
 	long response[2];
 	int cmd;
 	int bytes;
+	int fd;
 
 	if (tcp_c->unix_sock<=0){
 		/* (we can't have a fd==0, 0 is never closed )*/
@@ -1295,9 +1529,10 @@ inline static int handle_tcp_worker(struct tcp_worker* tcp_c, int fd_i)
 				(int)(tcp_c-&tcp_workers[0]), tcp_c->pid);
 		goto error;
 	}
-	/* read until sizeof(response)
+	/* get all bytes and the fd (if transmitted, for CONN_ACCEPTED)
 	 * (this is a SOCK_STREAM so read is not atomic) */
-	bytes=recv_all(tcp_c->unix_sock, response, sizeof(response), MSG_DONTWAIT);
+	bytes=receive_fd(tcp_c->unix_sock, response, sizeof(response), &fd,
+						MSG_DONTWAIT);
 	if (bytes<(int)sizeof(response)){
 		if (bytes==0){
 			/* EOF -> bad, worker has died */
@@ -1388,6 +1623,29 @@ inline static int handle_tcp_worker(struct tcp_worker* tcp_c, int fd_i)
 			sh_log(tcpconn->hist, TCP_UNREF, "tcpworker destroy, (%d)", tcpconn->refcnt);
 			tcpconn_destroy(tcpconn); /* closes also the fd */
 			break;
+		case CONN_ACCEPTED:
+			/* accepted (and already hashed) by the worker, which keeps
+			 * reading it - we only need our fd for it */
+			if (fd==-1){
+				LM_CRIT(" cmd CONN_ACCEPTED: no fd received\n");
+				break;
+			}
+			tcpconn->s=fd;
+			tcp_connections_no++;
+			if (tcp_connections_no>tcp_max_connections){
+				LM_ERR("maximum number of connections exceeded: %d/%d\n",
+					tcp_connections_no, tcp_max_connections);
+				/* the worker accepted it already: close it to the peer
+				 * right away (the worker gets an EOF on its fd) and let
+				 * the worker release it, at the latest on its next
+				 * timeout check */
+				shutdown(fd, SHUT_RDWR);
+				TCPCONN_LOCK(tcpconn->id);
+				tcpconn->state=S_CONN_BAD;
+				tcpconn->lifetime=0;
+				TCPCONN_UNLOCK(tcpconn->id);
+			}
+			break;
 		default:
 			LM_CRIT("unknown cmd %d from tcp worker %d (%d)\n",
 				cmd, tcp_c->pid, (int)(tcp_c-&tcp_workers[0]));
@@ -1399,6 +1657,24 @@ error:
 }
 
 
+/*! \brief handles the messages already queued by the TCP workers, until
+ * the registration of the given connection (accepted by one of them) is
+ * found; as the registration is sent before the conn gets hashed, a
+ * process may find the conn before it, but never before it is queued
+ */
+static void tcpconn_flush_accepted(struct tcp_connection* c)
+{
+	int n;
+
+	for (n=0; n<tcp_workers_max_no && c->s==-1; n++)
+		if (tcp_workers[n].unix_sock>0)
+			while (c->s==-1 && handle_tcp_worker(&tcp_workers[n], -1)>0);
+
+	if (c->s==-1)
+		LM_BUG("no registration found for accepted conn %p\n", c);
+}
+
+
 /*! \brief handles io from a "generic" ser process (get fd or new_fd from a tcp_send)
  *
  * \param p     - pointer in the ser processes array (pt[]), to the entry for
@@ -1487,6 +1763,9 @@ inline static int handle_worker(struct process_table* p, int fd_i)
 			tcpconn_destroy(tcpconn); /* will close also the fd */
 			break;
 		case CONN_GET_FD:
+			/* the conn may have been just accepted by a TCP worker */
+			if (tcpconn->s==-1 && (tcpconn->flags&F_CONN_OWNED))
+				tcpconn_flush_accepted(tcpconn);
 			/* send the requested FD  */
 			/* WARNING: take care of setting refcnt properly to
 			 * avoid race condition */
@@ -1684,8 +1963,9 @@ static void tcp_main_server(void)
 
 	/* now start watching all the fds */
 
-	/* add all the sockets we listens on for connections */
-	for( n=PROTO_FIRST ; n<PROTO_LAST ; n++ )
+	/* add all the sockets we listens on for connections (unless the
+	 * workers accept them on their own sockets) */
+	for( n=PROTO_FIRST ; n<PROTO_LAST && !tcp_accept_on_workers ; n++ )
 		if ( is_tcp_based_proto(n) )
 			for( sif=protos[n].listeners ; sif ; sif=sif->next ) {
 				struct socket_info* si = &sif->socket_info;
@@ -1778,6 +2058,9 @@ int tcp_init(void)
 	if (tcp_disabled)
 		return 0;
 
+	if (tcp_init_prof_wstats() < 0)
+		goto error;
+
 #ifdef DBG_TCPCON
 	con_hist = shl_init("TCP con", 10000, 0);
 	if (!con_hist) {
@@ -1991,7 +2274,7 @@ static int fork_dynamic_tcp_process(void *foo)
 		tcp_workers[r].pid = getpid();
 
 		if (tcp_worker_proc_reactor_init(tcp_workers[r].main_unix_sock)<0||
-		init_child(20000) < 0) {
+		init_child(20000) < 0 || tcp_worker_listen(r) < 0) {
 			goto error;
 		}
 
@@ -2118,7 +2401,7 @@ int tcp_start_processes(int *chd_rank, int *startup_done)
 			set_proc_attrs("TCP receiver");
 			tcp_workers[r].pid = getpid();
 			if (tcp_worker_proc_reactor_init(tcp_workers[r].main_unix_sock)<0||
-					init_child(*chd_rank) < 0) {
+					init_child(*chd_rank) < 0 || tcp_worker_listen(r) < 0) {
 				LM_ERR("init_children failed\n");
 				report_failure_status();
 				if (startup_done)
@@ -2294,3 +2577,100 @@ error:
 	free_mi_response(resp);
 	return 0;
 }
+
+
+mi_response_t *mi_tcp_write_stats(const mi_params_t *params,
+						struct mi_handler *async_hdl)
+{
+	mi_response_t *resp;
+	mi_item_t *resp_obj;
+	mi_item_t *profs_arr, *prof_item;
+	struct tcp_prof_wstats *ws;
+	unsigned long writes;
+
+	if (tcp_disabled)
+		return init_mi_result_null();
+
+	resp = init_mi_result_object(&resp_obj);
+	if (!resp)
+		return 0;
+
+	profs_arr = add_mi_array(resp_obj, MI_SSTR("Profiles"));
+	if (!profs_arr)
+		goto error;
+
+	for (ws = tcp_prof_wstats_list(); ws; ws = ws->next) {
+		prof_item = add_mi_object(profs_arr, 0, 0);
+		if (!prof_item)
+			goto error;
+
+		writes = ws->writes;
+		if (add_mi_number(prof_item, MI_SSTR("ID"), ws->id) < 0 ||
+		        add_mi_number(prof_item, MI_SSTR("Writes"), writes) < 0 ||
+		        add_mi_number(prof_item, MI_SSTR("Bytes"), ws->bytes) < 0 ||
+		        add_mi_number(prof_item, MI_SSTR("Chunks"), ws->chunks) < 0 ||
+		        add_mi_number(prof_item, MI_SSTR("Bytes per write"),
+		            writes ? ws->bytes / writes : 0) < 0 ||
+		        add_mi_number(prof_item, MI_SSTR("Queued chunks"),
+		            ws->queued) < 0 ||
+		        add_mi_number(prof_item, MI_SSTR("Max queue depth"),
+		            ws->max_depth) < 0)
+			goto error;
+	}
+
+	return resp;
+
+error:
+	LM_ERR("failed to add MI item\n");
+	free_mi_response(resp);
+	return 0;
+}
+
+
+#ifdef UNIT_TESTS
+/* TCP main, driven from within the current process by the unit tests (see
+ * net/test/test_tcp_accept.c): the tables are set up as for a TCP listener,
+ * with the sockets to the TCP workers, but nothing gets forked */
+int tcp_test_init(void)
+{
+	int r, socks[2];
+
+	tcp_disabled = 0;
+	if (tcp_init()<0)
+		return -1;
+
+	for (r=0; r<tcp_workers_max_no; r++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks)<0) {
+			LM_ERR("socketpair failed: %s\n", strerror(errno));
+			return -1;
+		}
+		tcp_workers[r].unix_sock = socks[0];
+		tcp_workers[r].main_unix_sock = socks[1];
+	}
+
+	return 0;
+}
+
+/* the socket of the given TCP worker to TCP main */
+int tcp_test_worker_sock(int r)
+{
+	return tcp_workers[r].main_unix_sock;
+}
+
+/* TCP main handling a message from the given TCP worker */
+int tcp_test_handle_tcp_worker(int r)
+{
+	return handle_tcp_worker(&tcp_workers[r], -1);
+}
+
+/* TCP main handling a message from a (non TCP) process */
+int tcp_test_handle_worker(struct process_table *p)
+{
+	return handle_worker(p, -1);
+}
+
+int tcp_test_connections_no(void)
+{
+	return tcp_connections_no;
+}
+#endif
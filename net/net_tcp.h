@@ -72,6 +72,10 @@ void tcp_reset_worker_slot(void);
 mi_response_t *mi_tcp_list_conns(const mi_params_t *params,
 							struct mi_handler *async_hdl);
 
+/* MI function to dump the async write counters of each TCP profile */
+mi_response_t *mi_tcp_write_stats(const mi_params_t *params,
+							struct mi_handler *async_hdl);
+
 
 /************************* TCP net helper functions **************************/
 
@@ -81,6 +85,11 @@ int tcp_init_listener(struct socket_info *si);
 /* helper function to set all TCP related options to a socket */
 int tcp_init_sock_opt(int s, const struct tcp_conn_profile *prof, enum si_flags socketflags, int sock_tos);
 
+/* "tcp_accept_on_workers" mode: starts/stops listening on the sockets
+ * of the given TCP worker slot, within the worker's process */
+int tcp_worker_listen(int slot);
+void tcp_worker_unlisten(void);
+
 /********************** TCP conn management functions ************************/
 
 /* returns the connection identified by either the id or the destination to */
@@ -97,6 +106,10 @@ struct tcp_connection* tcp_conn_create(int sock, const union sockaddr_union* su,
 /* sends a connected connection to the master */
 int tcp_conn_send(struct tcp_connection *con);
 
+/* accepts a new connection on a socket of a TCP worker (which keeps it) */
+int tcp_worker_accept(const struct socket_info* si, int fd, int unix_sock,
+		struct tcp_connection** c);
+
 /* release a connection acquired via tcp_conn_get() or tcp_conn_create() */
 void tcp_conn_release(struct tcp_connection* c, int pending_data);
 
@@ -113,4 +126,14 @@ int tcp_done_reading(struct tcp_connection* c);
 
 extern unsigned int last_outgoing_tcp_id;
 
+#ifdef UNIT_TESTS
+struct process_table;
+
+int tcp_test_init(void);
+int tcp_test_worker_sock(int r);
+int tcp_test_handle_tcp_worker(int r);
+int tcp_test_handle_worker(struct process_table *p);
+int tcp_test_connections_no(void);
+#endif
+
 #endif /* _NET_TCP_H_ */
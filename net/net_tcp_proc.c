@@ -33,6 +33,7 @@
 
 #include "tcp_conn.h"
 #include "tcp_passfd.h"
+#include "net_tcp.h"
 #include "net_tcp_report.h"
 #include "trans.h"
 #include "net_tcp_dbg.h"
@@ -146,6 +147,14 @@ static void tcp_receive_timeout(void)
 			tcpconn_release_error(con, 0, "Unknown reason");
 			continue;
 		}
+		/* a conn accepted by this worker stays here for as long as its
+		 * lifetime keeps being refreshed (by traffic from any process) */
+		if (con->timeout<=ticks && (con->flags&F_CONN_OWNED) &&
+		!_termination_in_progress && !con->msg_attempts &&
+		con->lifetime>ticks) {
+			con->timeout = con->lifetime;
+			continue;
+		}
 		/* pass back to Main connections that are inactive (expired) or
 		 * if we are in termination mode (this worker is doing graceful 
 		 * shutdown) and there is no pending data on the conn. */
@@ -328,6 +337,30 @@ again:
 				close(s);
 			}
 			break;
+		case F_TCP_LISTENER:
+			ret = tcp_worker_accept((const struct socket_info*)fm->data,
+				fm->fd, tcpmain_sock, &con);
+			if (con==NULL)
+				break;
+
+			/* same as for a conn received from TCP main, for reading */
+			con->msg_attempts = 0;
+			tcpconn_check_add(con);
+			tcpconn_listadd(tcp_conn_lst, con, c_next, c_prev);
+			con->timeout = con->lifetime;
+			if (reactor_add_reader( con->fd, F_TCPCONN, RCT_PRIO_NET, con )<0) {
+				LM_CRIT("failed to add new socket to the fd list\n");
+				tcpconn_check_del(con);
+				tcpconn_listrm(tcp_conn_lst, con, c_next, c_prev);
+				close(con->fd);
+				con->fd = -1;
+				goto con_error;
+			}
+
+			sh_log(con->hist, TCP_ADD_READER, "add accepted fd %d, ref: %d",
+			       con->fd, con->refcnt);
+			con->proc_id = process_no;
+			break;
 		case F_TCPCONN:
 			if (event_type & IO_WATCH_READ) {
 				con=(struct tcp_connection*)fm->data;
@@ -472,6 +505,9 @@ void tcp_terminate_worker(void)
 	/*remove unix sock to TCP main */
 	reactor_del_reader( _my_fd_to_tcp_main, -1, 0);
 
+	/* stop accepting new conns on our own listeners */
+	tcp_worker_unlisten();
+
 	_termination_in_progress = 1;
 
 	/* let's drain the private IPC */
@@ -489,3 +525,32 @@ void tcp_terminate_worker(void)
 	LM_INFO("reactor not empty, waiting for pending async/conns\n");
 }
 
+
+#ifdef UNIT_TESTS
+/* a TCP worker, driven from within the current process by the unit tests
+ * (see net/test/test_tcp_accept.c): only its reactor and its socket to TCP
+ * main are set up, the events are fed by hand */
+int tcp_test_worker_init(int unix_sock)
+{
+	tcpmain_sock = unix_sock;
+	_my_fd_to_tcp_main = tcpmain_sock;
+
+	return init_worker_reactor("TCP_worker", RCT_PRIO_MAX);
+}
+
+int tcp_test_worker_io(struct fd_map *fm)
+{
+	return handle_io(fm, -1, IO_WATCH_READ);
+}
+
+void tcp_test_worker_timeout(void)
+{
+	tcp_receive_timeout();
+}
+
+void tcp_test_worker_destroy(void)
+{
+	destroy_worker_reactor();
+	tcpmain_sock = _my_fd_to_tcp_main = -1;
+}
+#endif
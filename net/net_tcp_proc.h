@@ -37,4 +37,13 @@ void tcp_terminate_worker(void);
 /*! \brief  releases expired connections and cleans up bad ones (state<0) */
 void tcp_receive_timeout(void);
 
+#ifdef UNIT_TESTS
+struct fd_map;
+
+int tcp_test_worker_init(int unix_sock);
+int tcp_test_worker_io(struct fd_map *fm);
+void tcp_test_worker_timeout(void);
+void tcp_test_worker_destroy(void);
+#endif
+
 #endif
@@ -25,6 +25,9 @@
  */
 
 
+#ifdef HAVE_MMSG
+#define _GNU_SOURCE /* sendmmsg() */
+#endif
 #include <unistd.h>
 
 #include "../ipc.h"
@@ -133,40 +136,36 @@ static int setup_mcast_rcvr(int sock, union sockaddr_union* addr)
 
 
 /**
- * Initialize a UDP socket, supports multicast, IPv4 and IPv6.
- * \param si socket that should be bind
- * \return zero on success, -1 otherwise
- *
- * @status_flags - extra status flags to be set for the socket fd
+ * Creates and binds a UDP socket for the address of a listener
+ * \param si listener to open the socket for (with "su" already set)
+ * \param status_flags extra status flags to be set for the socket fd
+ * \return the socket fd on success, -1 otherwise
  */
-int udp_init_listener(struct socket_info *si, int status_flags)
+static int udp_open_socket(struct socket_info *si, int status_flags)
 {
 	union sockaddr_union* addr;
 	int optval;
+	int s;
 #ifdef USE_MCAST
 	unsigned char m_optval;
 #endif
 
 	addr=&si->su;
-	if (init_su(addr, &si->address, si->port_no)<0){
-		LM_ERR("could not init sockaddr_union\n");
-		goto error;
-	}
 
-	si->socket = socket(AF2PF(addr->s.sa_family), SOCK_DGRAM, 0);
-	if (si->socket==-1){
+	s = socket(AF2PF(addr->s.sa_family), SOCK_DGRAM, 0);
+	if (s==-1){
 		LM_ERR("socket: %s\n", strerror(errno));
-		goto error;
+		return -1;
 	}
 
 	/* make socket non-blocking */
 	if (status_flags) {
-		optval=fcntl(si->socket, F_GETFL);
+		optval=fcntl(s, F_GETFL);
 		if (optval==-1){
 			LM_ERR("fcntl failed: (%d) %s\n", errno, strerror(errno));
 			goto error;
 		}
-		if (fcntl(si->socket,F_SETFL,optval|status_flags)==-1){
+		if (fcntl(s,F_SETFL,optval|status_flags)==-1){
 			LM_ERR("set non-blocking failed: (%d) %s\n",
 				errno, strerror(errno));
 			goto error;
@@ -175,21 +174,35 @@ int udp_init_listener(struct socket_info *si, int status_flags)
 
 	/* set sock opts? */
 	optval=1;
-	if (setsockopt(si->socket, SOL_SOCKET, SO_REUSEADDR ,
+	if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR ,
 					(void*)&optval, sizeof(optval)) ==-1){
 		LM_ERR("setsockopt: %s\n", strerror(errno));
 		goto error;
 	}
 
+	/* sharded listener, each worker will bind its own socket */
+	if (si->flags & SI_REUSEPORT) {
+#ifdef SO_REUSEPORT
+		if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT,
+						(void*)&optval, sizeof(optval)) ==-1){
+			LM_ERR("setsockopt(SO_REUSEPORT): %s\n", strerror(errno));
+			goto error;
+		}
+#else
+		LM_ERR("SO_REUSEPORT is not supported by your system\n");
+		goto error;
+#endif
+	}
+
 	if (si->flags & SI_FRAG) {
 		/* no DF */
 #if defined(IP_MTU_DISCOVER)
 		optval = IP_PMTUDISC_DONT;
-		setsockopt(si->socket, IPPROTO_IP, IP_MTU_DISCOVER, (void*)&optval, sizeof(optval));
+		setsockopt(s, IPPROTO_IP, IP_MTU_DISCOVER, (void*)&optval, sizeof(optval));
 #else
 #if defined(IP_DONTFRAG)
 		optval = 1;
-		setsockopt(si->socket, IPPROTO_IP, IP_DONTFRAG, (void*)&optval, sizeof(optval));
+		setsockopt(s, IPPROTO_IP, IP_DONTFRAG, (void*)&optval, sizeof(optval));
 #else
 		LM_ERR("DF flag is not supported by your system\n");
 		goto error;
@@ -201,12 +214,12 @@ int udp_init_listener(struct socket_info *si, int status_flags)
 	optval = (si->tos > 0) ? si->tos : tos;
 	if (optval > 0) {
 		if (addr->s.sa_family==AF_INET6){
-			if (setsockopt(si->socket,  IPPROTO_IPV6, IPV6_TCLASS, (void*)&optval, sizeof(optval)) ==-1){
+			if (setsockopt(s,  IPPROTO_IPV6, IPV6_TCLASS, (void*)&optval, sizeof(optval)) ==-1){
 				LM_WARN("setsockopt tos for IPV6: %s\n", strerror(errno));
 				/* continue since this is not critical */
 			}
 		} else {
-			if (setsockopt(si->socket, IPPROTO_IP, IP_TOS, (void*)&optval, sizeof(optval)) ==-1){
+			if (setsockopt(s, IPPROTO_IP, IP_TOS, (void*)&optval, sizeof(optval)) ==-1){
 				LM_WARN("setsockopt tos: %s\n", strerror(errno));
 				/* continue since this is not critical */
 			}
@@ -215,7 +228,7 @@ int udp_init_listener(struct socket_info *si, int status_flags)
 #if defined (__linux__) && defined(UDP_ERRORS)
 	optval=1;
 	/* enable error receiving on unconnected sockets */
-	if(setsockopt(si->socket, SOL_IP, IP_RECVERR,
+	if(setsockopt(s, SOL_IP, IP_RECVERR,
 					(void*)&optval, sizeof(optval)) ==-1){
 		LM_ERR("setsockopt: %s\n", strerror(errno));
 		goto error;
@@ -224,13 +237,13 @@ int udp_init_listener(struct socket_info *si, int status_flags)
 
 #ifdef USE_MCAST
 	if ((si->flags & SI_IS_MCAST)
-	    && (setup_mcast_rcvr(si->socket, addr)<0)){
+	    && (setup_mcast_rcvr(s, addr)<0)){
 			goto error;
 	}
 	/* set the multicast options */
 	if (addr->s.sa_family==AF_INET){
 		m_optval = mcast_loopback;
-		if (setsockopt(si->socket, IPPROTO_IP, IP_MULTICAST_LOOP,
+		if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_LOOP,
 						&m_optval, sizeof(m_optval))==-1){
 			LM_WARN("setsockopt(IP_MULTICAST_LOOP): %s\n", strerror(errno));
 			/* it's only a warning because we might get this error if the
@@ -238,21 +251,21 @@ int udp_init_listener(struct socket_info *si, int status_flags)
 		}
 		if (mcast_ttl>=0){
 			m_optval = mcast_ttl;
-			if (setsockopt(si->socket, IPPROTO_IP, IP_MULTICAST_TTL,
+			if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL,
 						&m_optval, sizeof(m_optval))==-1){
 				LM_ERR("setsockopt (IP_MULTICAST_TTL): %s\n", strerror(errno));
 				goto error;
 			}
 		}
 	} else if (addr->s.sa_family==AF_INET6){
-		if (setsockopt(si->socket, IPPROTO_IPV6, IPV6_MULTICAST_LOOP,
+		if (setsockopt(s, IPPROTO_IPV6, IPV6_MULTICAST_LOOP,
 						&mcast_loopback, sizeof(mcast_loopback))==-1){
 			LM_WARN("setsockopt (IPV6_MULTICAST_LOOP): %s\n", strerror(errno));
 			/* it's only a warning because we might get this error if the
 			  network interface doesn't support multicasting */
 		}
 		if (mcast_ttl>=0){
-			if (setsockopt(si->socket, IPPROTO_IP, IPV6_MULTICAST_HOPS,
+			if (setsockopt(s, IPPROTO_IP, IPV6_MULTICAST_HOPS,
 						&mcast_ttl, sizeof(mcast_ttl))==-1){
 				LM_ERR("setssckopt (IPV6_MULTICAST_HOPS): %s\n",
 						strerror(errno));
@@ -265,11 +278,11 @@ int udp_init_listener(struct socket_info *si, int status_flags)
 	}
 #endif /* USE_MCAST */
 
-	if (probe_max_sock_buff(si->socket,0,MAX_RECV_BUFFER_SIZE,
+	if (probe_max_sock_buff(s,0,MAX_RECV_BUFFER_SIZE,
 				BUFFER_INCREMENT)==-1) goto error;
 
-	if (bind(si->socket,  &addr->s, sockaddru_len(*addr))==-1){
-		LM_ERR("bind(%x, %p, %d) on %s: %s\n", si->socket, &addr->s,
+	if (bind(s,  &addr->s, sockaddru_len(*addr))==-1){
+		LM_ERR("bind(%x, %p, %d) on %s: %s\n", s, &addr->s,
 				(unsigned)sockaddru_len(*addr),	si->address_str.s,
 				strerror(errno));
 		if (addr->s.sa_family==AF_INET6)
@@ -277,13 +290,300 @@ int udp_init_listener(struct socket_info *si, int status_flags)
 					" local address, try site local or global\n");
 		goto error;
 	}
-	return 0;
+	return s;
 
 error:
+	close(s);
 	return -1;
 }
 
 
+/**
+ * Initialize a UDP socket, supports multicast, IPv4 and IPv6.
+ * \param si socket that should be bind
+ * \return zero on success, -1 otherwise
+ *
+ * @status_flags - extra status flags to be set for the socket fd
+ */
+int udp_init_listener(struct socket_info *si, int status_flags)
+{
+	if (init_su(&si->su, &si->address, si->port_no)<0){
+		LM_ERR("could not init sockaddr_union\n");
+		return -1;
+	}
+
+	si->socket = udp_open_socket(si, status_flags);
+	if (si->socket==-1)
+		return -1;
+
+	return 0;
+}
+
+
+/* the listener socket inherited from main, if this process reads from
+ * its own SO_REUSEPORT shard instead (-1 otherwise) */
+static int udp_primary_socket = -1;
+
+/**
+ * For "reuse_port" listeners, opens a new socket in the SO_REUSEPORT
+ * group of the listener and makes it the socket of the current process.
+ * The kernel will spread the incoming traffic across all the sockets
+ * of the group, so each UDP worker gets its own receive queue.
+ * \param si the listener the process is bound to
+ * \return zero on success (or if no sharding is needed), -1 otherwise
+ */
+static int udp_open_shard(struct socket_info *si)
+{
+	int s, flags;
+
+	if (!(si->flags & SI_REUSEPORT))
+		return 0;
+
+	/* inherit the status flags (non-blocking) of the primary socket */
+	flags = fcntl(si->socket, F_GETFL);
+	if (flags==-1) {
+		LM_ERR("fcntl failed: (%d) %s\n", errno, strerror(errno));
+		return -1;
+	}
+
+	s = udp_open_socket(si, flags & O_NONBLOCK);
+	if (s<0) {
+		LM_ERR("failed to open UDP shard for %.*s\n",
+			si->sock_str.len, si->sock_str.s);
+		return -1;
+	}
+
+	LM_DBG("process %d got UDP shard %d (primary %d) for %.*s\n",
+		process_no, s, si->socket, si->sock_str.len, si->sock_str.s);
+
+	udp_primary_socket = si->socket;
+	si->socket = s;
+	return 0;
+}
+
+
+/* the per-process queue of outgoing datagrams (see udp_batch_start()) */
+struct udp_batch_dgram {
+	int fd;
+	union sockaddr_union to;
+	unsigned int len;
+	char *buf;
+};
+
+static struct udp_batch_dgram *ub_queue;
+static int ub_size;     /* capacity of the queue */
+static int ub_max;      /* flush threshold of the current batch */
+static int ub_count;    /* queued datagrams */
+static int ub_nesting;  /* nested udp_batch_start() calls */
+static int ub_suspended; /* nested udp_batch_suspend() calls */
+
+
+int udp_batch_start(int size)
+{
+	struct udp_batch_dgram *q;
+
+	if (ub_nesting++)
+		return 0;
+
+	if (size<=0)
+		size = 1;
+
+	if (size > ub_size) {
+		q = pkg_realloc(ub_queue, size * sizeof *q);
+		if (!q) {
+			LM_ERR("oom for a batch of %d UDP datagrams\n", size);
+			ub_nesting--;
+			return -1;
+		}
+		ub_queue = q;
+		ub_size = size;
+	}
+
+	ub_max = size;
+	return 0;
+}
+
+
+int udp_batch_active(void)
+{
+	return ub_nesting > 0 && !ub_suspended;
+}
+
+
+void udp_batch_suspend(void)
+{
+	ub_suspended++;
+}
+
+
+void udp_batch_resume(void)
+{
+	if (ub_suspended)
+		ub_suspended--;
+}
+
+
+#ifdef HAVE_MMSG
+/* sends all the queued datagrams of a socket, starting at "first" */
+static int udp_batch_flush_fd(int first, char *done)
+{
+	struct mmsghdr msgs[ub_count];
+	struct iovec iovs[ub_count];
+	int idx[ub_count];
+	int fd = ub_queue[first].fd;
+	int i, n, k, sent = 0;
+	struct ip_addr ip;
+
+	for (i = first, n = 0; i < ub_count; i++) {
+		if (done[i] || ub_queue[i].fd != fd)
+			continue;
+		done[i] = 1;
+
+		iovs[n].iov_base = ub_queue[i].buf;
+		iovs[n].iov_len = ub_queue[i].len;
+		memset(&msgs[n], 0, sizeof msgs[n]);
+		msgs[n].msg_hdr.msg_iov = &iovs[n];
+		msgs[n].msg_hdr.msg_iovlen = 1;
+		msgs[n].msg_hdr.msg_name = &ub_queue[i].to.s;
+		msgs[n].msg_hdr.msg_namelen = sockaddru_len(ub_queue[i].to);
+		idx[n++] = i;
+	}
+
+	for (i = 0; i < n; ) {
+		k = sendmmsg(fd, msgs + i, n - i, 0);
+		if (k==-1) {
+			if (errno==EINTR)
+				continue;
+			su2ip_addr(&ip, &ub_queue[idx[i]].to);
+			if (errno==EAGAIN || errno==EWOULDBLOCK) {
+				/* the socket buffer is full, do not spin on it */
+				LM_ERR("sendmmsg(%d) would block, dropping %d dgrams, the "
+					"first one for %s:%hu\n", fd, n - i, ip_addr2a(&ip),
+					su_getport(&ub_queue[idx[i]].to));
+				break;
+			}
+			/* the error is for the first datagram, skip it */
+			LM_ERR("sendmmsg(%d, %d dgrams) failed for %s:%hu: %s(%d)\n",
+				fd, n - i, ip_addr2a(&ip), su_getport(&ub_queue[idx[i]].to),
+				strerror(errno), errno);
+			i++;
+			continue;
+		}
+		sent += k;
+		i += k;
+	}
+
+	return sent;
+}
+#endif
+
+
+/* sends out all the queued datagrams */
+static int udp_batch_flush(void)
+{
+	int i, sent = 0;
+#ifdef HAVE_MMSG
+	char done[ub_count];
+#else
+	struct ip_addr ip;
+#endif
+
+#ifdef HAVE_MMSG
+
+	memset(done, 0, ub_count);
+	for (i = 0; i < ub_count; i++)
+		if (!done[i])
+			sent += udp_batch_flush_fd(i, done);
+#else
+	for (i = 0; i < ub_count; i++) {
+again:
+		if (sendto(ub_queue[i].fd, ub_queue[i].buf, ub_queue[i].len, 0,
+		&ub_queue[i].to.s, sockaddru_len(ub_queue[i].to))==-1) {
+			if (errno==EINTR) goto again;
+			/* EAGAIN too: drop it, do not spin on a full buffer */
+			su2ip_addr(&ip, &ub_queue[i].to);
+			LM_ERR("sendto(%d, %u bytes) failed for %s:%hu: %s(%d)\n",
+				ub_queue[i].fd, ub_queue[i].len, ip_addr2a(&ip),
+				su_getport(&ub_queue[i].to), strerror(errno), errno);
+			continue;
+		}
+		sent++;
+	}
+#endif
+
+	for (i = 0; i < ub_count; i++)
+		pkg_free(ub_queue[i].buf);
+	ub_count = 0;
+
+	return sent;
+}
+
+
+int udp_batch_add(int fd, char *buf, unsigned int len,
+		const union sockaddr_union *to)
+{
+	struct udp_batch_dgram *d;
+
+	if (ub_count == ub_max)
+		udp_batch_flush();
+
+	d = &ub_queue[ub_count];
+	d->buf = pkg_malloc(len);
+	if (!d->buf) {
+		LM_ERR("oom for a %u bytes UDP datagram\n", len);
+		return -1;
+	}
+	memcpy(d->buf, buf, len);
+	d->len = len;
+	d->fd = fd;
+	d->to = *to;
+
+	ub_count++;
+	return len;
+}
+
+
+int udp_batch_end(void)
+{
+	if (ub_nesting<=0) {
+		LM_BUG("UDP batch ended without being started\n");
+		return 0;
+	}
+
+	if (--ub_nesting)
+		return 0;
+
+	return udp_batch_flush();
+}
+
+
+/* max number of pending datagrams to handle while closing a shard */
+#define UDP_SHARD_DRAIN_MAX  1024
+
+/**
+ * Closes the SO_REUSEPORT shard of the current process (if any), first
+ * handling the datagrams already queued on it, and switches the
+ * listener back to the primary socket (to be used for sending).
+ */
+static void udp_close_shard(struct socket_info *si)
+{
+	char c;
+	int i, r;
+
+	if (udp_primary_socket<0)
+		return;
+
+	for (i = 0; i < UDP_SHARD_DRAIN_MAX &&
+	recv(si->socket, &c, 1, MSG_PEEK|MSG_DONTWAIT)>=0; i++)
+		if (protos[si->proto].net.dgram.read(si, &r) < -1)
+			break;
+
+	close(si->socket);
+	si->socket = udp_primary_socket;
+	udp_primary_socket = -1;
+}
+
+
 inline static int handle_io(struct fd_map* fm, int idx,int event_type)
 {
 	int n = 0;
@@ -394,9 +694,11 @@ static int fork_dynamic_udp_process(void *si_filter)
 			si->sock_str.len, si->sock_str.s);
 		pt[process_no].pg_filter = si;
 		bind_address=si; /* shortcut */
+		if (udp_workers_cpu_affinity && set_proc_cpu_affinity()<0)
+			LM_WARN("failed to pin UDP worker to a CPU, continuing\n");
 		/* we first need to init the reactor to be able to add fd
 		 * into it in child_init routines */
-		if (udp_proc_reactor_init(si) < 0 ||
+		if (udp_open_shard(si) < 0 || udp_proc_reactor_init(si) < 0 ||
 		init_child(10000/*FIXME*/) < 0) {
 			goto error;
 		}
@@ -438,6 +740,9 @@ static void udp_process_graceful_terminate(int sender, void *param)
 	/*remove network interface */
 	reactor_del_reader( bind_address->socket, -1, 0);
 
+	/* drop our SO_REUSEPORT shard, so the kernel stops feeding it */
+	udp_close_shard( (struct socket_info *)bind_address );
+
 	/*remove private IPC pipe */
 	reactor_del_reader( IPC_FD_READ_SELF, -1, 0);
 
@@ -496,6 +801,17 @@ int udp_start_processes(int *chd_rank, int *startup_done)
 						si->sock_str.len, si->sock_str.s);
 					pt[process_no].pg_filter = si;
 					bind_address=si; /* shortcut */
+					if (udp_workers_cpu_affinity && set_proc_cpu_affinity()<0)
+						LM_WARN("failed to pin UDP worker to a CPU, "
+							"continuing\n");
+					/* the first worker keeps reading from the primary
+					 * socket, which is also part of the SO_REUSEPORT group */
+					if (i>0 && udp_open_shard(si) < 0) {
+						report_failure_status();
+						if (*chd_rank == 1 && startup_done)
+							*startup_done = -1;
+						exit(-1);
+					}
 					/* we first need to init the reactor to be able to add fd
 					 * into it in child_init routines */
 					if (udp_proc_reactor_init(si) < 0 ||
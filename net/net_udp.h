@@ -50,4 +50,27 @@ struct socket_info* udp_find_listener(union sockaddr_union* to, int proto);
 /* initializes an already defined TCP listener */
 int udp_init_listener(struct socket_info *si, int status_flags);
 
+/****************************** Batched sending ******************************/
+
+/* starts queuing (instead of sending) the outgoing UDP datagrams of the
+ * current process, up to "size" datagrams per flush; calls may be nested */
+int udp_batch_start(int size);
+
+/* tells if UDP datagrams are currently queued instead of being sent */
+int udp_batch_active(void);
+
+/* sends the next datagrams right away, even inside a batch, until the
+ * matching udp_batch_resume(); calls may be nested */
+void udp_batch_suspend(void);
+void udp_batch_resume(void);
+
+/* queues a copy of the datagram; flushes the queue if it gets full */
+int udp_batch_add(int fd, char *buf, unsigned int len,
+		const union sockaddr_union *to);
+
+/* ends a batch started with udp_batch_start(); the outermost call sends
+ * out all the queued datagrams (via sendmmsg(), if available) and returns
+ * how many were sent */
+int udp_batch_end(void);
+
 #endif /* _NET_UDP_H_ */
@@ -24,6 +24,10 @@
  *  2015-02-11  first version (bogdan)
  */
 
+#ifdef HAVE_MMSG
+#define _GNU_SOURCE /* recvmmsg() */
+#endif
+
 #include <errno.h>
 #include <unistd.h>
 #include <netinet/tcp.h>
@@ -34,6 +38,7 @@
 #include "../../timer.h"
 #include "../../socket_info.h"
 #include "../../receive.h"
+#include "../../core_stats.h"
 #include "../api_proto.h"
 #include "../api_proto_net.h"
 #include "../net_udp.h"
@@ -49,10 +54,16 @@ static int proto_udp_send(const struct socket_info* send_sock,
 
 static int udp_read_req(const struct socket_info *src, int* bytes_read);
 
+/* upper limit for the number of datagrams fetched by a single read */
+#define UDP_MAX_RECV_BATCH  64
+
 static callback_list* cb_list = NULL;
 
 static int udp_port = SIP_PORT;
 
+/* how many datagrams to fetch per read (1 - no batching) */
+static int udp_recv_batch = 1;
+
 
 static const cmd_export_t cmds[] = {
 	{"proto_init", (cmd_function)proto_udp_init, {{0,0,0}}, 0},
@@ -62,6 +73,7 @@ static const cmd_export_t cmds[] = {
 
 static const param_export_t params[] = {
 	{ "udp_port",    INT_PARAM,   &udp_port   },
+	{ "recv_batch_size", INT_PARAM, &udp_recv_batch },
 	{0, 0, 0}
 };
 
@@ -93,6 +105,24 @@ struct module_exports proto_udp_exports = {
 static int mod_init(void)
 {
 	LM_INFO("initializing UDP-plain protocol\n");
+
+	if (udp_recv_batch < 1) {
+		LM_WARN("invalid recv_batch_size %d, disabling batching\n",
+			udp_recv_batch);
+		udp_recv_batch = 1;
+	} else if (udp_recv_batch > UDP_MAX_RECV_BATCH) {
+		LM_WARN("recv_batch_size %d too large, using %d\n",
+			udp_recv_batch, UDP_MAX_RECV_BATCH);
+		udp_recv_batch = UDP_MAX_RECV_BATCH;
+	}
+#ifndef HAVE_MMSG
+	if (udp_recv_batch > 1) {
+		LM_WARN("recvmmsg() not supported on this system, "
+			"disabling batching\n");
+		udp_recv_batch = 1;
+	}
+#endif
+
 	return 0;
 }
 
@@ -121,36 +151,25 @@ static int proto_udp_init_listener(struct socket_info *si)
 }
 
 
-static int udp_read_req(const struct socket_info *si, int* bytes_read)
+/* handles one received datagram; "buf" must have room for the
+ * 0-terminator right after the "len" bytes of data */
+static void udp_handle_dgram(const struct socket_info *si, char *buf, int len,
+		union sockaddr_union *from)
 {
 	struct receive_info ri;
-	int len;
-	static char buf [BUF_SIZE+1];
 	char *tmp;
-	unsigned int fromlen;
 	callback_list* p;
 	str msg;
 
-	fromlen=sockaddru_len(si->su);
-	/* coverity[overrun-buffer-arg: FALSE] - union has 28 bytes, CID #200029 */
-	len=recvfrom(bind_address->socket, buf, BUF_SIZE,0,&ri.src_su.s,&fromlen);
-	if (len==-1){
-		if (errno==EAGAIN)
-			return 0;
-		if ((errno==EINTR)||(errno==EWOULDBLOCK)|| (errno==ECONNREFUSED))
-			return -1;
-		LM_ERR("recvfrom:[%d] %s\n", errno, strerror(errno));
-		return -2;
-	}
-
 	if (len<MIN_UDP_PACKET) {
 		LM_DBG("probing packet received len = %d\n", len);
-		return 0;
+		return;
 	}
 
 	/* we must 0-term the messages, receive_msg expects it */
 	buf[len]=0; /* no need to save the previous char */
 
+	ri.src_su = *from;
 	ri.bind_address = si;
 	ri.dst_port = si->port_no;
 	ri.dst_ip = si->address;
@@ -173,17 +192,122 @@ static int udp_read_req(const struct socket_info *si, int* bytes_read)
 				}
 			}
 		}
-		if (p) return 0;
+		if (p) return;
 	}
 
 	if (ri.src_port==0){
 		tmp=ip_addr2a(&ri.src_ip);
 		LM_INFO("dropping 0 port packet from %s\n", tmp);
-		return 0;
+		return;
 	}
 
 	/* receive_msg must free buf too!*/
 	receive_msg( msg.s, msg.len, &ri, NULL, 0);
+}
+
+
+#ifdef HAVE_MMSG
+/* per-process buffers for the batched reads, allocated on first use */
+static struct mmsghdr *rcv_msgs;
+static struct iovec *rcv_iovs;
+static union sockaddr_union *rcv_froms;
+static char *rcv_bufs;
+
+static int udp_init_batch_bufs(void)
+{
+	int i;
+
+	rcv_msgs = pkg_malloc(udp_recv_batch * (sizeof *rcv_msgs +
+		sizeof *rcv_iovs + sizeof *rcv_froms));
+	if (!rcv_msgs) {
+		LM_ERR("oom for UDP batch headers\n");
+		return -1;
+	}
+	rcv_bufs = pkg_malloc(udp_recv_batch * (BUF_SIZE+1));
+	if (!rcv_bufs) {
+		LM_ERR("oom for %d UDP batch buffers\n", udp_recv_batch);
+		pkg_free(rcv_msgs);
+		rcv_msgs = NULL;
+		return -1;
+	}
+
+	rcv_iovs = (struct iovec *)(rcv_msgs + udp_recv_batch);
+	rcv_froms = (union sockaddr_union *)(rcv_iovs + udp_recv_batch);
+
+	memset(rcv_msgs, 0, udp_recv_batch * sizeof *rcv_msgs);
+	for (i = 0; i < udp_recv_batch; i++) {
+		rcv_iovs[i].iov_base = rcv_bufs + i * (BUF_SIZE+1);
+		rcv_iovs[i].iov_len = BUF_SIZE;
+		rcv_msgs[i].msg_hdr.msg_iov = &rcv_iovs[i];
+		rcv_msgs[i].msg_hdr.msg_iovlen = 1;
+		rcv_msgs[i].msg_hdr.msg_name = &rcv_froms[i].s;
+	}
+
+	return 0;
+}
+
+
+/* drains up to "udp_recv_batch" datagrams with a single syscall */
+static int udp_read_req_batch(const struct socket_info *si, int* bytes_read)
+{
+	int i, n;
+
+	if (!rcv_msgs && udp_init_batch_bufs() < 0)
+		return -2;
+
+	for (i = 0; i < udp_recv_batch; i++)
+		rcv_msgs[i].msg_hdr.msg_namelen = sockaddru_len(si->su);
+
+	n = recvmmsg(bind_address->socket, rcv_msgs, udp_recv_batch,
+		MSG_DONTWAIT, NULL);
+	if (n==-1){
+		if (errno==EAGAIN)
+			return 0;
+		if ((errno==EINTR)||(errno==EWOULDBLOCK)|| (errno==ECONNREFUSED))
+			return -1;
+		LM_ERR("recvmmsg:[%d] %s\n", errno, strerror(errno));
+		return -2;
+	}
+
+	update_stat(udp_rcv_batches, 1);
+	update_stat(udp_rcv_batch_dgrams, n);
+	if (n==udp_recv_batch)
+		update_stat(udp_rcv_batch_full, 1);
+
+	for (i = 0; i < n; i++)
+		udp_handle_dgram(si, rcv_iovs[i].iov_base, rcv_msgs[i].msg_len,
+			&rcv_froms[i]);
+
+	return 0;
+}
+#endif /* HAVE_MMSG */
+
+
+static int udp_read_req(const struct socket_info *si, int* bytes_read)
+{
+	union sockaddr_union from;
+	int len;
+	static char buf [BUF_SIZE+1];
+	unsigned int fromlen;
+
+#ifdef HAVE_MMSG
+	if (udp_recv_batch > 1)
+		return udp_read_req_batch(si, bytes_read);
+#endif
+
+	fromlen=sockaddru_len(si->su);
+	/* coverity[overrun-buffer-arg: FALSE] - union has 28 bytes, CID #200029 */
+	len=recvfrom(bind_address->socket, buf, BUF_SIZE,0,&from.s,&fromlen);
+	if (len==-1){
+		if (errno==EAGAIN)
+			return 0;
+		if ((errno==EINTR)||(errno==EWOULDBLOCK)|| (errno==ECONNREFUSED))
+			return -1;
+		LM_ERR("recvfrom:[%d] %s\n", errno, strerror(errno));
+		return -2;
+	}
+
+	udp_handle_dgram(si, buf, len, &from);
 
 	return 0;
 }
@@ -204,6 +328,10 @@ static int proto_udp_send(const struct socket_info* source,
 {
 	int n, tolen;
 
+	/* a batch is being built, the datagram will be sent when flushed */
+	if (udp_batch_active())
+		return udp_batch_add(source->socket, buf, len, to);
+
 	tolen=sockaddru_len(*to);
 again:
 	n=sendto(source->socket, buf, len, 0, &to->s, tolen);
@@ -369,13 +369,20 @@ error:
 
 int tcp_async_write(struct tcp_connection* con,int fd)
 {
-	int n;
-	struct tcp_async_chunk *chunk;
-
-	while ((chunk = tcp_async_get_chunk(con)) != NULL) {
-		LM_DBG("Trying to send %d bytes from chunk %p in conn %p - %d %d \n",
-				chunk->len, chunk, con, chunk->ticks, get_ticks());
-		n=send(fd, chunk->buf, chunk->len,
+	struct iovec iov[TCP_ASYNC_IOV_MAX];
+	struct msghdr msg;
+	int n, cnt;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = iov;
+
+	while (con->async->pending) {
+		/* all the queued chunks (as many as fit) go out in a single call */
+		cnt = tcp_async_get_iov(con, iov, TCP_ASYNC_IOV_MAX);
+		msg.msg_iovlen = cnt;
+		LM_DBG("Trying to send %d chunks (%d pending) in conn %p - %d %d\n",
+				cnt, con->async->pending, con, con->async->oldest, get_ticks());
+		n=sendmsg(fd, &msg,
 #ifdef HAVE_MSG_NOSIGNAL
 				MSG_NOSIGNAL
 #else
@@ -387,12 +394,12 @@ int tcp_async_write(struct tcp_connection* con,int fd)
 			if (errno==EINTR)
 				continue;
 			else if (errno==EAGAIN || errno==EWOULDBLOCK) {
-				LM_DBG("Can't finish to write chunk %p on conn %p\n",
-						chunk,con);
+				LM_DBG("Can't finish to write %d chunks on conn %p\n",
+						cnt, con);
 				/* report back we have more writting to be done */
 				return 1;
 			} else {
-				LM_ERR("Error occurred while sending async chunk %d (%s)\n",
+				LM_ERR("Error occurred while sending async chunks %d (%s)\n",
 						errno,strerror(errno));
 				/* report the conn as broken */
 				return -1;
@@ -501,6 +508,7 @@ int tcp_async_add_chunk(struct tcp_connection *con, char *buf,
 		int len, int lock)
 {
 	struct tcp_async_chunk *c;
+	int depth, prev;
 
 	c = shm_malloc(sizeof(struct tcp_async_chunk) + len);
 	if (!c) {
@@ -529,6 +537,19 @@ int tcp_async_add_chunk(struct tcp_connection *con, char *buf,
 	if (con->async->pending == 1)
 		con->async->oldest = c->ticks;
 
+	if (con->wstats) {
+		__sync_fetch_and_add(&con->wstats->queued, 1);
+		/* the stats are shared by all the conns of the profile */
+		depth = con->wstats->max_depth;
+		while (con->async->pending > depth) {
+			prev = __sync_val_compare_and_swap(&con->wstats->max_depth,
+				depth, con->async->pending);
+			if (prev == depth)
+				break;
+			depth = prev;
+		}
+	}
+
 	if (lock)
 		lock_release(&con->write_lock);
 
@@ -543,24 +564,76 @@ struct tcp_async_chunk *tcp_async_get_chunk(struct tcp_connection *con)
 	return con->async->chunks[0];
 }
 
+int tcp_async_get_iov(struct tcp_connection *con, struct iovec *iov, int max)
+{
+	int i;
+
+	for (i = 0; i < con->async->pending && i < max; i++) {
+		iov[i].iov_base = con->async->chunks[i]->buf;
+		iov[i].iov_len = con->async->chunks[i]->len;
+	}
+
+	return i;
+}
+
+char *tcp_async_coalesce(struct tcp_connection *con, int *len)
+{
+	static char buf[TCP_ASYNC_COALESCE_SIZE];
+	struct tcp_async_chunk *chunk;
+	int i;
+
+	chunk = con->async->chunks[0];
+	if (con->async->pending == 1 ||
+	        chunk->len + con->async->chunks[1]->len > TCP_ASYNC_COALESCE_SIZE) {
+		*len = chunk->len;
+		return chunk->buf;
+	}
+
+	/* only whole chunks, so a retry (with more chunks queued meanwhile)
+	 * starts with the same bytes and is never shorter */
+	for (i = 0, *len = 0; i < con->async->pending; i++) {
+		chunk = con->async->chunks[i];
+		if (*len + chunk->len > TCP_ASYNC_COALESCE_SIZE)
+			break;
+		memcpy(buf + *len, chunk->buf, chunk->len);
+		*len += chunk->len;
+	}
+
+	return buf;
+}
+
 void tcp_async_update_write(struct tcp_connection *con, int len)
 {
 	int i = 0, c;
 	struct tcp_async_chunk *chunk;
 
+	if (con->wstats) {
+		__sync_fetch_and_add(&con->wstats->writes, 1);
+		__sync_fetch_and_add(&con->wstats->bytes, len);
+	}
+
 	while (len > 0) {
 		chunk = con->async->chunks[i];
 		if (len < chunk->len) {
 			/* partial write */
 			chunk->len -= len;
 			memmove(chunk->buf, chunk->buf + len, chunk->len);
-			return;
+			break;
 		} else {
 			/* written the entire chunk */
 			i++;
 			len -= chunk->len;
 		}
 	}
+
+	if (i == 0)
+		return;
+
+	if (con->wstats) {
+		__sync_fetch_and_add(&con->wstats->chunks, i);
+		__sync_fetch_and_sub(&con->wstats->queued, i);
+	}
+
 	con->async->pending -= i;
 	for (c = 0; c < i; c++)
 		shm_free(con->async->chunks[c]);
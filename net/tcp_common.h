@@ -21,6 +21,8 @@
 #ifndef _NET_TCP_COMMON_H_
 #define _NET_TCP_COMMON_H_
 
+#include <sys/uio.h>
+
 /* blocking connect on a non-blocking socket */
 int tcp_connect_blocking(int s, const struct sockaddr *servaddr,
 		socklen_t addrlen);
@@ -63,6 +65,22 @@ int tcp_async_add_chunk(struct tcp_connection *con, char *buf,
 /* returns the first chunk to be written */
 struct tcp_async_chunk *tcp_async_get_chunk(struct tcp_connection *con);
 
+/* the most chunks flushed by a single tcp_async_write() syscall */
+#define TCP_ASYNC_IOV_MAX  64
+/* the max plaintext of a TLS record */
+#define TCP_ASYNC_COALESCE_SIZE  16384
+
+/* fills @iov with (at most @max of) the pending chunks, returns their count */
+int tcp_async_get_iov(struct tcp_connection *con, struct iovec *iov, int max);
+
+/* for the writers which cannot use writev() (e.g. TLS, one record per
+ * write): gathers the oldest pending chunks in a per-process buffer, up to
+ * TCP_ASYNC_COALESCE_SIZE bytes; a single chunk is returned in place.
+ * The con must have pending chunks. A write of it which has to be retried
+ * may be retried over a new result, as that starts with the same bytes */
+char *tcp_async_coalesce(struct tcp_connection *con, int *len);
+
+/* consumes @len written bytes out of the pending chunks */
 void tcp_async_update_write(struct tcp_connection *con, int len);
 
 int tcp_read(struct tcp_connection *c,struct tcp_req *r);
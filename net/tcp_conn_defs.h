@@ -84,6 +84,7 @@
 /*!< no longer in "main" reactor for read or write */
 #define F_CONN_REMOVED			(F_CONN_REMOVED_READ|F_CONN_REMOVED_WRITE)
 #define F_CONN_INIT				(1<<5) /*!< the connection was initialized */
+#define F_CONN_OWNED			(1<<6) /*!< accepted by a TCP worker, which keeps it */
 
 enum tcp_conn_states { S_CONN_ERROR=-2, S_CONN_BAD=-1, S_CONN_OK=0,
 		S_CONN_CONNECTING, S_CONN_EOF };
@@ -180,6 +181,8 @@ struct tcp_connection{
 	unsigned short proto_flags;
 	struct struct_hist *hist;
 	struct tcp_async_data *async;
+	/* write queue counters of the profile, if async */
+	struct tcp_prof_wstats *wstats;
 	/* protocol specific data attached to this connection */
 	void *proto_data;
 };
@@ -21,11 +21,19 @@
 #include "tcp_conn_profile.h"
 #include "../str.h"
 #include "../ut.h"
+#include "../locking.h"
+#include "../mem/shm_mem.h"
 
 /* a collection of default TCP connection settings which can be overridden
  * by defining specific settings (per TCP path) using the "tcp_mgm" module */
 struct tcp_conn_profile tcp_con_df_profile;
 
+struct tcp_prof_wstats_head {
+	gen_lock_t lock;
+	struct tcp_prof_wstats *first;
+};
+static struct tcp_prof_wstats_head *tcp_wstats;
+
 static int tcp_con_get_df_profile(const union sockaddr_union *_,
         const union sockaddr_union *__, enum sip_protos ___,
         struct tcp_conn_profile *out_profile)
@@ -80,3 +88,60 @@ void tcp_init_con_profiles(void)
 
 	tcp_init_attrs(tcp_con_df_profile.attrs);
 }
+
+
+int tcp_init_prof_wstats(void)
+{
+	tcp_wstats = shm_malloc(sizeof *tcp_wstats);
+	if (!tcp_wstats) {
+		LM_ERR("oom for the TCP profile stats\n");
+		return -1;
+	}
+	memset(tcp_wstats, 0, sizeof *tcp_wstats);
+
+	if (!lock_init(&tcp_wstats->lock)) {
+		LM_ERR("failed to init the TCP profile stats lock\n");
+		shm_free(tcp_wstats);
+		tcp_wstats = NULL;
+		return -1;
+	}
+
+	/* the default profile is always listed */
+	return tcp_get_prof_wstats(0) ? 0 : -1;
+}
+
+
+struct tcp_prof_wstats *tcp_get_prof_wstats(unsigned int id)
+{
+	struct tcp_prof_wstats *ws;
+
+	if (!tcp_wstats)
+		return NULL;
+
+	lock_get(&tcp_wstats->lock);
+
+	for (ws = tcp_wstats->first; ws; ws = ws->next)
+		if (ws->id == id)
+			goto out;
+
+	ws = shm_malloc(sizeof *ws);
+	if (!ws) {
+		LM_ERR("oom for the stats of TCP profile %u\n", id);
+		goto out;
+	}
+	memset(ws, 0, sizeof *ws);
+	ws->id = id;
+
+	ws->next = tcp_wstats->first;
+	tcp_wstats->first = ws;
+
+out:
+	lock_release(&tcp_wstats->lock);
+	return ws;
+}
+
+
+struct tcp_prof_wstats *tcp_prof_wstats_list(void)
+{
+	return tcp_wstats ? tcp_wstats->first : NULL;
+}
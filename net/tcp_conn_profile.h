@@ -64,4 +64,24 @@ extern struct tcp_conn_attr_key tcp_con_attr[];
 
 int tcp_con_attr_lookup(const str *attr, enum tcp_conn_attr *out_val);
 
+/* counters of the async write queues, shared by all the connections of a
+ * TCP profile (looked up by profile ID, never freed) */
+struct tcp_prof_wstats {
+	unsigned int id;
+	volatile unsigned long writes;  /* syscalls (or TLS writes) of queued data */
+	volatile unsigned long bytes;   /* bytes flushed by these writes */
+	volatile unsigned long chunks;  /* chunks fully flushed by these writes */
+	volatile long queued;           /* chunks currently queued, all conns */
+	volatile int max_depth;         /* the deepest queue of a single conn */
+	struct tcp_prof_wstats *next;
+};
+
+int tcp_init_prof_wstats(void);
+
+/* returns the counters of profile @id, creating them if needed */
+struct tcp_prof_wstats *tcp_get_prof_wstats(unsigned int id);
+
+/* the head of the list, for the MI dump (new entries only get prepended) */
+struct tcp_prof_wstats *tcp_prof_wstats_list(void);
+
 #endif /* TCP_CONN_PROFILE_H */
@@ -0,0 +1,687 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * The "tcp_accept_on_workers" mode, driven from within the test process,
+ * which plays both TCP main and the TCP worker of slot 0: the accept by the
+ * worker, the registration with TCP main (also when another process asks
+ * for the conn before it), the max connections limit, the timeout of the
+ * owned conns and the listening of a worker slot across worker restarts.
+ *
+ * Plus, on demand only (see bench_tcp_accept()), an accept rate benchmark
+ * of the two TCP dispatching modes, over loopback:
+ *  - "main": a single process accepts, picks the least loaded worker (a
+ *    scan over all the workers) and passes it the fd over a unix socket;
+ *  - "workers" (tcp_accept_on_workers): each worker accepts on its own
+ *    socket, out of a SO_REUSEPORT group bound before forking.
+ * Each connection gets a one byte greeting from its worker, so a client
+ * completes it only once the connection got all the way to a worker.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <tap.h>
+
+#include "../../pt.h"
+#include "../../timer.h"
+#include "../../globals.h"
+#include "../../reactor_defs.h"
+#include "../../socket_info.h"
+#include "../tcp_conn.h"
+#include "../tcp_passfd.h"
+#include "../net_tcp.h"
+#include "../net_tcp_proc.h"
+
+#include "../../test/ut.h"
+
+#include "test_tcp_accept.h"
+
+#define ACC_WORKERS   4
+#define ACC_CLIENTS   4
+#define ACC_CONNS     (ACC_CLIENTS * 2000)
+#define ACC_BACKLOG   1024
+
+/* per-worker counters, shared with the forked processes */
+struct acc_shared {
+	volatile unsigned int load[ACC_WORKERS];
+	volatile unsigned int served[ACC_WORKERS];
+	volatile unsigned int failed;
+};
+
+static struct acc_shared *acc;
+
+
+static int acc_socket(unsigned short port)
+{
+	struct sockaddr_in sin;
+	int s, yes = 1;
+
+	s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s < 0)
+		return -1;
+
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+	setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof yes);
+
+	memset(&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = htons(port);
+	if (bind(s, (struct sockaddr *)&sin, sizeof sin) < 0) {
+		close(s);
+		return -1;
+	}
+
+	return s;
+}
+
+
+static unsigned short acc_port(int s)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof sin;
+
+	if (getsockname(s, (struct sockaddr *)&sin, &len) < 0)
+		return 0;
+	return ntohs(sin.sin_port);
+}
+
+
+static void acc_serve(int w, int fd)
+{
+	acc->load[w]++;
+	if (write(fd, "x", 1) != 1)
+		__sync_fetch_and_add(&acc->failed, 1);
+	close(fd);
+	acc->load[w]--;
+	acc->served[w]++;
+}
+
+
+/* "main" mode: the worker gets its connections from the acceptor */
+static void acc_fd_worker(int w, int usock)
+{
+	long conn;
+	int fd;
+
+	for (;;) {
+		if (receive_fd(usock, &conn, sizeof conn, &fd, MSG_WAITALL) <= 0)
+			_exit(0);
+		if (fd >= 0)
+			acc_serve(w, fd);
+	}
+}
+
+
+static void acc_main_acceptor(int s, int *usocks)
+{
+	unsigned int min_load;
+	long conn = 0;
+	int fd, i, idx;
+
+	for (;;) {
+		fd = accept(s, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		/* same selection as send2worker() */
+		for (i = 0, idx = 0, min_load = 100; i < ACC_WORKERS; i++)
+			if (min_load > acc->load[i]) {
+				min_load = acc->load[i];
+				idx = i;
+			}
+
+		if (send_fd(usocks[idx], &conn, sizeof conn, fd) <= 0)
+			__sync_fetch_and_add(&acc->failed, 1);
+		close(fd);
+	}
+}
+
+
+/* "workers" mode: the worker accepts on its own SO_REUSEPORT socket */
+static void acc_reuseport_worker(int w, int s)
+{
+	int fd;
+
+	if (listen(s, ACC_BACKLOG) < 0)
+		_exit(1);
+
+	for (;;) {
+		fd = accept(s, NULL, NULL);
+		if (fd >= 0)
+			acc_serve(w, fd);
+	}
+}
+
+
+static void acc_client(unsigned short port, int conns)
+{
+	struct sockaddr_in sin;
+	struct timeval tv = {2, 0};
+	char c;
+	int s;
+
+	memset(&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = htons(port);
+
+	while (conns--) {
+		s = socket(AF_INET, SOCK_STREAM, 0);
+		if (s < 0) {
+			__sync_fetch_and_add(&acc->failed, 1);
+			continue;
+		}
+		setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+		if (connect(s, (struct sockaddr *)&sin, sizeof sin) < 0 ||
+		        read(s, &c, 1) != 1)
+			__sync_fetch_and_add(&acc->failed, 1);
+		close(s);
+	}
+
+	_exit(0);
+}
+
+
+/* runs the clients against the already started servers, returns the
+ * number of connections per second */
+static long acc_run_clients(unsigned short port, pid_t *servers, int n)
+{
+	pid_t clients[ACC_CLIENTS];
+	long ns;
+	int i;
+
+	ns = ut_now_ns();
+
+	for (i = 0; i < ACC_CLIENTS; i++)
+		if ((clients[i] = fork()) == 0)
+			acc_client(port, ACC_CONNS / ACC_CLIENTS);
+	for (i = 0; i < ACC_CLIENTS; i++)
+		if (clients[i] > 0)
+			waitpid(clients[i], NULL, 0);
+
+	ns = ut_now_ns() - ns;
+
+	for (i = 0; i < n; i++)
+		if (servers[i] > 0) {
+			kill(servers[i], SIGKILL);
+			waitpid(servers[i], NULL, 0);
+		}
+
+	return ns ? ACC_CONNS * 1000000000L / ns : 0;
+}
+
+
+static unsigned int acc_served(void)
+{
+	unsigned int n = 0;
+	int i;
+
+	for (i = 0; i < ACC_WORKERS; i++)
+		n += acc->served[i];
+	return n;
+}
+
+
+static void acc_reset(void)
+{
+	memset((void *)acc, 0, sizeof *acc);
+}
+
+
+static long bench_main_accept(void)
+{
+	pid_t procs[ACC_WORKERS + 1];
+	int usocks[ACC_WORKERS][2], main_socks[ACC_WORKERS];
+	long rate;
+	int s, i;
+
+	s = acc_socket(0);
+	if (s < 0 || listen(s, ACC_BACKLOG) < 0)
+		return -1;
+
+	for (i = 0; i < ACC_WORKERS; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, usocks[i]) < 0)
+			return -1;
+		if ((procs[i] = fork()) == 0) {
+			close(s);
+			acc_fd_worker(i, usocks[i][1]);
+		}
+		close(usocks[i][1]);
+		main_socks[i] = usocks[i][0];
+	}
+
+	if ((procs[ACC_WORKERS] = fork()) == 0)
+		acc_main_acceptor(s, main_socks);
+
+	for (i = 0; i < ACC_WORKERS; i++)
+		close(main_socks[i]);
+
+	rate = acc_run_clients(acc_port(s), procs, ACC_WORKERS + 1);
+	close(s);
+
+	return rate;
+}
+
+
+static long bench_workers_accept(void)
+{
+	pid_t procs[ACC_WORKERS];
+	int socks[ACC_WORKERS];
+	unsigned short port;
+	long rate;
+	int i;
+
+	/* as the listeners are set up: all bound upfront, listen() in workers */
+	socks[0] = acc_socket(0);
+	if (socks[0] < 0)
+		return -1;
+	port = acc_port(socks[0]);
+	for (i = 1; i < ACC_WORKERS; i++)
+		if ((socks[i] = acc_socket(port)) < 0)
+			return -1;
+
+	for (i = 0; i < ACC_WORKERS; i++)
+		if ((procs[i] = fork()) == 0)
+			acc_reuseport_worker(i, socks[i]);
+
+	rate = acc_run_clients(port, procs, ACC_WORKERS);
+
+	for (i = 0; i < ACC_WORKERS; i++)
+		close(socks[i]);
+
+	return rate;
+}
+
+
+/* the listener of the functional tests, with the socket of worker slot 0
+ * watched in the reactor of the test process */
+static struct socket_info acc_si;
+
+static int acc_listener(void)
+{
+	unsigned short port;
+	int s;
+
+	s = acc_socket(0);
+	if (s < 0)
+		return -1;
+	port = acc_port(s);
+	close(s);
+
+	memset(&acc_si, 0, sizeof acc_si);
+	acc_si.proto = PROTO_TCP;
+	acc_si.address.af = AF_INET;
+	acc_si.address.len = 4;
+	acc_si.address.u.addr32[0] = htonl(INADDR_LOOPBACK);
+	acc_si.port_no = port;
+	acc_si.address_str = str_init("127.0.0.1");
+	acc_si.sock_str = str_init("tcp:127.0.0.1");
+
+	return tcp_init_listener(&acc_si);
+}
+
+
+static struct fd_map *acc_find_fd(int type, void *data)
+{
+	struct fd_map *fm;
+	int fd;
+
+	for (fd = 0; fd < _worker_io.max_fd_no; fd++) {
+		fm = get_fd_map(&_worker_io, fd);
+		if (fm->fd > 0 && fm->type == type && (!data || fm->data == data))
+			return fm;
+	}
+
+	return NULL;
+}
+
+
+/* the conn watched by the worker for the given client port */
+static struct tcp_connection *acc_find_conn(unsigned short port)
+{
+	struct tcp_connection *c;
+	struct fd_map *fm;
+	int fd;
+
+	for (fd = 0; fd < _worker_io.max_fd_no; fd++) {
+		fm = get_fd_map(&_worker_io, fd);
+		if (fm->fd <= 0 || fm->type != F_TCPCONN)
+			continue;
+		c = (struct tcp_connection *)fm->data;
+		if (c->fd == fm->fd && c->rcv.src_port == port)
+			return c;
+	}
+
+	return NULL;
+}
+
+
+/* connects a client to the listener; returns the socket, or -1 (with
+ * errno set) if the connection was refused */
+static int acc_connect(unsigned short *lport)
+{
+	struct sockaddr_in sin;
+	struct timeval tv = {1, 0};
+	int s, err;
+
+	s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s < 0)
+		return -1;
+
+	memset(&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = htons(acc_si.port_no);
+	if (connect(s, (struct sockaddr *)&sin, sizeof sin) < 0) {
+		err = errno;
+		close(s);
+		errno = err;
+		return -1;
+	}
+
+	/* never block the test on a read */
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+	*lport = acc_port(s);
+	return s;
+}
+
+
+/* a client connected to the listener, accepted by the worker */
+static struct tcp_connection *acc_worker_accept(int *cs)
+{
+	struct fd_map *fm;
+	unsigned short lport;
+
+	*cs = acc_connect(&lport);
+	fm = acc_find_fd(F_TCP_LISTENER, &acc_si);
+	if (*cs < 0 || !fm || tcp_test_worker_io(fm) <= 0)
+		return NULL;
+
+	return acc_find_conn(lport);
+}
+
+
+/* 1 if the byte written on "fd" reaches the client */
+static int acc_reaches(int fd, int cs)
+{
+	char b;
+
+	return write(fd, "x", 1) == 1 && read(cs, &b, 1) == 1 && b == 'x';
+}
+
+
+static void test_worker_accept(void)
+{
+	struct tcp_connection *c;
+	struct fd_map *fm;
+	unsigned long long cid;
+	int cs, n;
+
+	c = acc_worker_accept(&cs);
+	ok(c && (c->flags & F_CONN_OWNED) && c->s == -1 && c->refcnt == 1 &&
+		c->proc_id == process_no && !tcp_get_correlation_id(c->id, &cid),
+		"tcp-accept: accepted and hashed by the worker");
+	fm = acc_find_fd(F_TCP_LISTENER, &acc_si);
+	ok(fm && tcp_test_worker_io(fm) == 0, "tcp-accept: nothing more to "
+		"accept");
+	if (!c)
+		goto end;
+
+	n = tcp_test_connections_no();
+	ok(tcp_test_handle_tcp_worker(0) > 0 && c->s >= 0 && c->s != c->fd &&
+		c->state == S_CONN_OK && tcp_test_connections_no() == n + 1,
+		"tcp-accept: registered with TCP main");
+	ok(acc_reaches(c->s, cs), "tcp-accept: TCP main writes on its fd");
+	ok(acc_reaches(c->fd, cs), "tcp-accept: the worker writes on its fd");
+
+end:
+	if (cs >= 0)
+		close(cs);
+}
+
+
+/* a process looks the conn up (it is hashed) and asks TCP main for its fd
+ * before TCP main handled the registration - of that conn, or of another
+ * one accepted before it */
+static void test_registration_race(void)
+{
+	struct tcp_connection *c2, *c3, *rc = NULL;
+	struct process_table p;
+	long req[2];
+	int cs2, cs3, socks[2] = {-1, -1}, fd = -1;
+
+	c2 = acc_worker_accept(&cs2);
+	c3 = acc_worker_accept(&cs3);
+	if (!c2 || !c3 || c2->s != -1 || c3->s != -1 ||
+	        socketpair(AF_UNIX, SOCK_STREAM, 0, socks) < 0) {
+		ok(0, "tcp-accept-race: setup");
+		goto end;
+	}
+
+	memset(&p, 0, sizeof p);
+	p.unix_sock = socks[0];
+	req[0] = (long)c3;
+	req[1] = CONN_GET_FD;
+	ok(write(socks[1], req, sizeof req) == sizeof req &&
+		tcp_test_handle_worker(&p) > 0 &&
+		receive_fd(socks[1], &rc, sizeof rc, &fd, MSG_DONTWAIT) ==
+		sizeof rc && rc == c3 && fd >= 0, "tcp-accept-race: CONN_GET_FD served");
+	ok(c2->s >= 0 && c3->s >= 0, "tcp-accept-race: both registrations "
+		"handled first");
+	ok(fd >= 0 && acc_reaches(fd, cs3), "tcp-accept-race: the fd passed "
+		"to the process writes to the right client");
+	ok(tcp_test_handle_tcp_worker(0) == 0, "tcp-accept-race: nothing left "
+		"from the worker");
+
+end:
+	if (fd >= 0)
+		close(fd);
+	if (socks[0] >= 0) {
+		close(socks[0]);
+		close(socks[1]);
+	}
+	if (cs2 >= 0)
+		close(cs2);
+	if (cs3 >= 0)
+		close(cs3);
+}
+
+
+/* TCP main refuses a conn over the limit, the worker drops it */
+static void test_max_connections(void)
+{
+	struct tcp_connection *c;
+	int max = tcp_max_connections, n, cs;
+	char b;
+
+	tcp_max_connections = tcp_test_connections_no();
+
+	c = acc_worker_accept(&cs);
+	if (!c) {
+		ok(0, "tcp-accept-max: setup");
+		goto end;
+	}
+	n = tcp_test_connections_no();
+
+	ok(tcp_test_handle_tcp_worker(0) > 0 && c->state == S_CONN_BAD &&
+		c->lifetime == 0, "tcp-accept-max: over the limit, marked as bad");
+	ok(read(cs, &b, 1) == 0, "tcp-accept-max: closed to the client by "
+		"TCP main");
+
+	tcp_test_worker_timeout();
+	ok(c->fd == -1 && c->proc_id == -1, "tcp-accept-max: dropped by the "
+		"worker");
+
+	/* the conn is gone after this one */
+	ok(tcp_test_handle_tcp_worker(0) > 0 && tcp_test_connections_no() == n,
+		"tcp-accept-max: destroyed by TCP main");
+
+end:
+	tcp_max_connections = max;
+	if (cs >= 0)
+		close(cs);
+}
+
+
+/* the worker keeps its conns for as long as their lifetime is refreshed */
+static void test_owned_timeout(void)
+{
+	struct tcp_connection *c, *d;
+	struct fd_map *fm;
+	int cs, ds = -1;
+	char b;
+
+	c = acc_worker_accept(&cs);
+	if (!c || tcp_test_handle_tcp_worker(0) <= 0) {
+		ok(0, "tcp-accept-timeout: setup");
+		goto end;
+	}
+
+	c->timeout = get_ticks();
+	c->lifetime = c->timeout + 10;
+	tcp_test_worker_timeout();
+	ok(c->fd != -1 && c->proc_id == process_no && c->timeout == c->lifetime,
+		"tcp-accept-timeout: kept while its lifetime is refreshed");
+
+	c->timeout = c->lifetime = get_ticks();
+	tcp_test_worker_timeout();
+	ok(c->fd == -1 && c->proc_id == -1, "tcp-accept-timeout: released once "
+		"expired");
+
+	fm = get_fd_map(&_worker_io, c->s);
+	ok(tcp_test_handle_tcp_worker(0) > 0 && c->refcnt == 0 &&
+		fm->fd == c->s && fm->type == F_TCPCONN && fm->data == c,
+		"tcp-accept-timeout: watched by TCP main after the release");
+
+	/* a partially read message never keeps the conn */
+	d = acc_worker_accept(&ds);
+	if (!d || tcp_test_handle_tcp_worker(0) <= 0) {
+		ok(0, "tcp-accept-timeout: setup");
+		goto end;
+	}
+	d->msg_attempts = 1;
+	d->timeout = get_ticks();
+	d->lifetime = d->timeout + 10;
+	tcp_test_worker_timeout();
+	ok(d->fd == -1 && d->proc_id == -1, "tcp-accept-timeout: released "
+		"with a partial message");
+	ok(tcp_test_handle_tcp_worker(0) > 0 && read(ds, &b, 1) == 0,
+		"tcp-accept-timeout: destroyed by TCP main");
+
+end:
+	if (cs >= 0)
+		close(cs);
+	if (ds >= 0)
+		close(ds);
+}
+
+
+/* a worker going away leaves the SO_REUSEPORT group, while the next one
+ * forked in its slot listens on the same socket again */
+static void test_unlisten_relisten(void)
+{
+	struct tcp_connection *c;
+	unsigned short lport;
+	int cs;
+
+	tcp_worker_unlisten();
+	cs = acc_connect(&lport);
+	ok(!acc_find_fd(F_TCP_LISTENER, &acc_si) && cs < 0 &&
+		errno == ECONNREFUSED, "tcp-accept-unlisten: not listening");
+	if (cs >= 0)
+		close(cs);
+
+	ok(tcp_worker_listen(0) == 0 && acc_find_fd(F_TCP_LISTENER, &acc_si),
+		"tcp-accept-relisten: listening again");
+	c = acc_worker_accept(&cs);
+	ok(c && tcp_test_handle_tcp_worker(0) > 0 && c->s >= 0,
+		"tcp-accept-relisten: accepting again");
+	if (cs >= 0)
+		close(cs);
+}
+
+
+void bench_tcp_accept(void)
+{
+	long rate;
+	int i, spread;
+
+	acc = mmap(NULL, sizeof *acc, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (acc == MAP_FAILED) {
+		ok(0, "tcp-accept: mmap");
+		return;
+	}
+
+	acc_reset();
+	rate = bench_main_accept();
+	ok(rate > 0 && acc_served() == ACC_CONNS && !acc->failed,
+		"tcp-accept-main (%u/%d served)", acc_served(), ACC_CONNS);
+	diag("accept in TCP main + fd passing: %ld conns/s (%d workers)",
+		rate, ACC_WORKERS);
+
+	acc_reset();
+	rate = bench_workers_accept();
+	for (i = 0, spread = 0; i < ACC_WORKERS; i++)
+		spread += (acc->served[i] > 0);
+	ok(rate > 0 && acc_served() == ACC_CONNS && !acc->failed,
+		"tcp-accept-workers (%u/%d served)", acc_served(), ACC_CONNS);
+	ok(spread == ACC_WORKERS, "tcp-accept-workers-spread (%d workers)",
+		spread);
+	diag("accept in the TCP workers (SO_REUSEPORT): %ld conns/s",
+		rate);
+
+	munmap((void *)acc, sizeof *acc);
+}
+
+
+void test_tcp_accept(void)
+{
+	tcp_accept_on_workers = 1;
+
+	if (tcp_test_init() < 0 || acc_listener() < 0 ||
+	        tcp_test_worker_init(tcp_test_worker_sock(0)) < 0 ||
+	        tcp_worker_listen(0) < 0) {
+		ok(0, "tcp-accept: init");
+		tcp_accept_on_workers = 0;
+		return;
+	}
+
+	test_worker_accept();
+	test_registration_race();
+	test_max_connections();
+	test_owned_timeout();
+	test_unlisten_relisten();
+
+	tcp_worker_unlisten();
+	tcp_test_worker_destroy();
+	tcp_accept_on_workers = 0;
+}
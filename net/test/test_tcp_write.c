@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * The async write queue of a stream connection: the accounting of partial
+ * writes spanning several chunks, the coalescing for TLS and a benchmark
+ * of flushing a deep queue of small messages (a trunk) one chunk per
+ * syscall versus gathered in a single sendmsg() (tcp_async_write()).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <tap.h>
+
+#include "../../mem/shm_mem.h"
+#include "../tcp_conn_defs.h"
+#include "../tcp_conn_profile.h"
+#include "../tcp_common.h"
+
+#include "../../test/ut.h"
+
+#include "test_tcp_write.h"
+
+#define TW_CHUNKS     512
+#define TW_QUEUE_MAX  2048
+#define TW_MSG_LEN    400
+#define TW_ROUNDS     40
+
+static struct tcp_connection tw_con;
+static struct tcp_prof_wstats tw_stats;
+
+
+static int tw_init(void)
+{
+	memset(&tw_con, 0, sizeof tw_con);
+	memset(&tw_stats, 0, sizeof tw_stats);
+
+	tw_con.async = shm_malloc(sizeof *tw_con.async +
+		TW_QUEUE_MAX * sizeof(struct tcp_async_chunk *));
+	if (!tw_con.async)
+		return -1;
+
+	tw_con.async->allocated = TW_QUEUE_MAX;
+	tw_con.async->pending = 0;
+	tw_con.async->oldest = 0;
+	tw_con.wstats = &tw_stats;
+	return 0;
+}
+
+
+static void tw_flush_all(void)
+{
+	int i, len = 0;
+
+	for (i = 0; i < tw_con.async->pending; i++)
+		len += tw_con.async->chunks[i]->len;
+	if (len)
+		tcp_async_update_write(&tw_con, len);
+}
+
+
+static void test_update_write(void)
+{
+	char buf[16];
+	int len;
+	char *p;
+
+	tcp_async_add_chunk(&tw_con, "aaa", 3, 0);
+	tcp_async_add_chunk(&tw_con, "bbbb", 4, 0);
+	tcp_async_add_chunk(&tw_con, "ccccc", 5, 0);
+	ok(tw_stats.queued == 3 && tw_stats.max_depth == 3, "tcp-write-queued");
+
+	p = tcp_async_coalesce(&tw_con, &len);
+	ok(len == 12 && !memcmp(p, "aaabbbbccccc", 12), "tcp-write-coalesce");
+
+	/* the first two chunks and a part of the third one */
+	tcp_async_update_write(&tw_con, 9);
+	ok(tw_con.async->pending == 1 && tw_con.async->chunks[0]->len == 3 &&
+		!memcmp(tw_con.async->chunks[0]->buf, "ccc", 3),
+		"tcp-write-partial-multi");
+	ok(tw_stats.queued == 1 && tw_stats.chunks == 2 && tw_stats.bytes == 9 &&
+		tw_stats.writes == 1, "tcp-write-stats");
+
+	/* a single chunk, or one too large to be gathered, is not copied */
+	p = tcp_async_coalesce(&tw_con, &len);
+	ok(len == 3 && p == tw_con.async->chunks[0]->buf,
+		"tcp-write-coalesce-single");
+	memset(buf, 'x', sizeof buf);
+	tcp_async_add_chunk(&tw_con, buf, sizeof buf, 0);
+	for (len = 0; len < TCP_ASYNC_COALESCE_SIZE / sizeof buf; len++)
+		tcp_async_add_chunk(&tw_con, buf, sizeof buf, 0);
+	p = tcp_async_coalesce(&tw_con, &len);
+	ok(len <= TCP_ASYNC_COALESCE_SIZE && len > TCP_ASYNC_COALESCE_SIZE - 16 &&
+		(len - 3) % sizeof buf == 0, "tcp-write-coalesce-limit");
+
+	tw_flush_all();
+	ok(tw_con.async->pending == 0 && tw_stats.queued == 0,
+		"tcp-write-flushed");
+}
+
+
+static void tw_drain(int fd)
+{
+	char buf[65536];
+
+	while (read(fd, buf, sizeof buf) > 0) ;
+	_exit(0);
+}
+
+
+static void tw_fill(void)
+{
+	char msg[TW_MSG_LEN];
+	int i;
+
+	memset(msg, 'S', sizeof msg);
+	for (i = 0; i < TW_CHUNKS; i++)
+		tcp_async_add_chunk(&tw_con, msg, sizeof msg, 0);
+}
+
+
+/* the former tcp_async_write(): one send() per queued chunk */
+static int tw_write_per_chunk(int fd)
+{
+	struct tcp_async_chunk *chunk;
+	int n;
+
+	while ((chunk = tcp_async_get_chunk(&tw_con)) != NULL) {
+		n = send(fd, chunk->buf, chunk->len, MSG_NOSIGNAL);
+		if (n < 0)
+			return -1;
+		tcp_async_update_write(&tw_con, n);
+	}
+
+	return 0;
+}
+
+
+static long tw_bench(int fd, int gather, unsigned long *writes)
+{
+	long begin, ns = 0;
+	int r, rc = 0;
+
+	tw_stats.writes = 0;
+
+	for (r = 0; r < TW_ROUNDS && rc == 0; r++) {
+		tw_fill();
+
+		begin = ut_now_ns();
+		rc = gather ? tcp_async_write(&tw_con, fd) : tw_write_per_chunk(fd);
+		ns += ut_now_ns() - begin;
+		tw_flush_all();
+	}
+
+	*writes = tw_stats.writes;
+	return rc == 0 ? ns / (TW_ROUNDS * TW_CHUNKS) : -1;
+}
+
+
+void test_tcp_write(void)
+{
+	unsigned long w1, w2;
+	long ns1, ns2;
+	int sv[2];
+	pid_t pid;
+
+	if (tw_init() < 0) {
+		ok(0, "tcp-write: oom");
+		return;
+	}
+
+	test_update_write();
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		ok(0, "tcp-write: socketpair");
+		goto out;
+	}
+
+	if ((pid = fork()) == 0) {
+		close(sv[0]);
+		tw_drain(sv[1]);
+	}
+	close(sv[1]);
+
+	ns1 = tw_bench(sv[0], 0, &w1);
+	ns2 = tw_bench(sv[0], 1, &w2);
+
+	close(sv[0]);
+	if (pid > 0) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+	}
+
+	ok(ns1 >= 0 && ns2 >= 0 && w2 < w1, "tcp-write-gather (%lu vs %lu writes)",
+		w2, w1);
+	diag("async queue flush, %d x %d bytes: one send() per chunk: %ld ns/msg, "
+		"%lu bytes/syscall", TW_CHUNKS, TW_MSG_LEN, ns1,
+		w1 ? (unsigned long)TW_ROUNDS * TW_CHUNKS * TW_MSG_LEN / w1 : 0);
+	diag("async queue flush, gathered: %ld ns/msg, %lu bytes/syscall",
+		ns2, w2 ? (unsigned long)TW_ROUNDS * TW_CHUNKS * TW_MSG_LEN / w2 : 0);
+
+out:
+	shm_free(tw_con.async);
+	tw_con.async = NULL;
+}
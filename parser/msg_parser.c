@@ -135,7 +135,7 @@ char* get_hdr_field_aux(char* buf, char* end, struct hdr_field* hdr,int sip_well
 				/* find end of header */
 				/* find lf */
 				do{
-					match=q_memchr(tmp, '\n', end-tmp);
+					match=find_lf(tmp, end);
 					if (match){
 						match++;
 					}else {
@@ -180,7 +180,7 @@ char* get_hdr_field_aux(char* buf, char* end, struct hdr_field* hdr,int sip_well
 				/* find end of header */
 				/* find lf */
 				do{
-					match=q_memchr(tmp, '\n', end-tmp);
+					match=find_lf(tmp, end);
 					if (match){
 						match++;
 					}else {
@@ -225,7 +225,7 @@ char* get_hdr_field_aux(char* buf, char* end, struct hdr_field* hdr,int sip_well
 				/* find end of header */
 				/* find lf */
 				do{
-					match=q_memchr(tmp, '\n', end-tmp);
+					match=find_lf(tmp, end);
 					if (match){
 						match++;
 					}else {
@@ -260,7 +260,7 @@ char* get_hdr_field_aux(char* buf, char* end, struct hdr_field* hdr,int sip_well
 				/* find end of header */
 				/* find lf */
 				do{
-					match=q_memchr(tmp, '\n', end-tmp);
+					match=find_lf(tmp, end);
 					if (match){
 						match++;
 					}else {
@@ -331,7 +331,7 @@ char* get_hdr_field_aux(char* buf, char* end, struct hdr_field* hdr,int sip_well
 			/* find end of header */
 			/* find lf */
 			do{
-				match=q_memchr(tmp, '\n', end-tmp);
+				match=find_lf(tmp, end);
 				if (match){
 					match++;
 				}else {
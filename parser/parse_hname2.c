@@ -28,6 +28,10 @@
  */
 
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "parse_hname2.h"
 #include "keys.h"
 #include "../ut.h"  /* q_memchr */
@@ -47,6 +51,42 @@ static inline char* skip_ws(char* p, char *end)
 	return p;
 }
 
+#ifdef FUZZ_BUILD
+int hname_scalar_scan;
+#define HNAME_SIMD_SCAN (!hname_scalar_scan)
+#else
+#define HNAME_SIMD_SCAN 1
+#endif
+
+/*
+ * Return the position of the first ':', ' ' or '\t' (i.e. the end of an
+ * unknown header name), or @end if there is none. With SSE2, 16 bytes are
+ * checked at once, as long as they are all before @end
+ */
+static inline char* find_hname_end(char* p, char *end)
+{
+#ifdef __SSE2__
+	const __m128i colon = _mm_set1_epi8(':');
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	__m128i v;
+	unsigned int mask;
+
+	for(; HNAME_SIMD_SCAN && end - p >= 16; p += 16) {
+		v = _mm_loadu_si128((const __m128i *)p);
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, colon),
+			_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab))));
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+
+	for(; p < end; p++) {
+		if ((*p == ':') || (*p == ' ') || (*p == '\t')) return p;
+	}
+	return p;
+}
+
 /*
  * Parser macros
  */
@@ -272,22 +312,18 @@ char* parse_hname2(char* begin, char* end, struct hdr_field* hdr)
  other:
 	/* Unknown header type */
 	hdr->type = HDR_OTHER_T;
-	/* if overflow during the "switch-case" parsing, the "while" will
-	 * exit and we will fall in the "error" section */
-	while ( p < end ) {
-		switch (*p) {
-			case ':' :
-				hdr->name.len = p - hdr->name.s;
-				return (p + 1);
-			case ' ' :
-			case '\t':
-				hdr->name.len = p - hdr->name.s;
-				p = skip_ws(p+1, end);
-				if (p >= end || *p != ':')
-					goto error;
-				return (p+1);
-		}
-		p++;
+	/* if overflow during the "switch-case" parsing, no delimiter is
+	 * found and we will fall in the "error" section */
+	p = find_hname_end(p, end);
+	if (p < end) {
+		hdr->name.len = p - hdr->name.s;
+		if (*p == ':')
+			return (p + 1);
+
+		p = skip_ws(p+1, end);
+		if (p >= end || *p != ':')
+			goto error;
+		return (p+1);
 	}
 
  error:
@@ -32,4 +32,10 @@
  */
 char* parse_hname2(char* begin, char* end, struct hdr_field* hdr);
 
+#ifdef FUZZ_BUILD
+/* if set, the unknown header names are scanned byte by byte only, so the
+ * fuzzers may check the vectorized scan against the scalar one */
+extern int hname_scalar_scan;
+#endif
+
 #endif /* PARSE_HNAME2_H */
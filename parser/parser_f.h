@@ -27,6 +27,8 @@
 #ifndef parser_f_h
 #define parser_f_h
 
+#include <string.h>
+
 #include "../str.h"
 
 char* eat_line(char* buffer, unsigned int len);
@@ -38,6 +40,14 @@ inline static char* eat_space_end(const char* p, const char* pend)
 	for(;(p<pend)&&(*p==' ' || *p=='\t') ;p++);
 	return (char *)p;
 }
+
+/* the line ends are searched with the libc memchr(), which is vectorized
+ * (and dispatched at runtime to the best of SSE2/AVX2/EVEX on x86_64) */
+inline static char* find_lf(const char* p, const char* pend)
+{
+	return p < pend ? memchr(p, '\n', pend - p) : NULL;
+}
+
 #define SP(_c) ((_c)=='\t' || (_c)==' ')
 inline static char* eat_lws_end(const char* p, const char* pend)
 {
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <tap.h>
+
+#include "../../str.h"
+#include "../../ut.h"
+#include "../../test/ut.h"
+
+#include "../msg_parser.h"
+#include "../parse_hname2.h"
+
+#include "test_parse_hname.h"
+
+#define HNAME_BENCH_LOOPS 200000
+
+#define HN(_s) (char *)(_s), (char *)(_s) + strlen(_s)
+
+/* names not known by the parser, as found in the IMS traffic */
+static const char *unknown_hnames[] = {
+	"P-Charging-Vector", "P-Access-Network-Info", "P-Visited-Network-ID",
+	"P-Called-Party-ID", "Accept-Contact", "Request-Disposition",
+	"X-Custom-Header", "Alert-Info", "Allow-Events", "Content-Encoding",
+};
+
+
+/* the unknown names end on the first ':', ' ' or '\t', wherever it is */
+static void test_hname_other(void)
+{
+	struct hdr_field hdr;
+	char buf[128], *r;
+	int i, len, pos, bad = 0, n = 0;
+	const char delim[] = ": \t";
+
+	srand(1);
+
+	for (len = 4; len < 80; len++)
+		for (pos = 1; pos < len; pos++) {
+			/* no known name starts with 'Q' */
+			for (i = 0; i < sizeof buf; i++)
+				buf[i] = (i == 0) ? 'Q' : "abz-_.Z0"[rand() % 8];
+			buf[pos] = delim[rand() % 3];
+			if (buf[pos] != ':' && pos + 1 < len)
+				buf[pos + 1] = ':';
+
+			memset(&hdr, 0, sizeof hdr);
+			r = parse_hname2(buf, buf + len, &hdr);
+			n++;
+
+			if (buf[pos] != ':' && pos + 1 >= len) {
+				if (hdr.type != HDR_ERROR_T || r)
+					bad++;
+			} else if (hdr.type != HDR_OTHER_T || hdr.name.s != buf ||
+			        hdr.name.len != pos ||
+			        r != buf + pos + (buf[pos] == ':' ? 1 : 2)) {
+				bad++;
+			}
+		}
+
+	ok(bad == 0, "hname-other (%d names)", n);
+
+	/* no delimiter at all - only the @end bytes may be checked */
+	memset(buf, 'x', sizeof buf);
+	buf[40] = ':';
+	parse_hname2(buf, buf + 40, &hdr);
+	ok(hdr.type == HDR_ERROR_T, "hname-other-end");
+}
+
+
+static void test_hdr_lf(void)
+{
+	struct hdr_field hdr;
+	char buf[512];
+	int len;
+
+	/* a long body, folded */
+	len = sprintf(buf, "X-Long: %0200d\r\n\t%0100d\r\nTo: <sip:b@x>\r\n", 1, 2);
+
+	memset(&hdr, 0, sizeof hdr);
+	get_hdr_field(buf, buf + len, &hdr);
+	ok(hdr.type == HDR_OTHER_T && hdr.body.len == 200 + 2 + 1 + 100 &&
+		hdr.len == 8 + hdr.body.len + 2, "hdr-lf-1");
+
+	/* no LF at all */
+	len = sprintf(buf, "Subject: %0300d", 1);
+	memset(&hdr, 0, sizeof hdr);
+	get_hdr_field(buf, buf + len, &hdr);
+	ok(hdr.type == HDR_ERROR_T, "hdr-lf-2");
+}
+
+
+void bench_parse_hname(void)
+{
+	struct hdr_field hdr;
+	long begin;
+	char buf[1024], *bend;
+	int i, n, off[sizeof unknown_hnames / sizeof *unknown_hnames];
+
+	/* the names are parsed in place, within the headers of a message */
+	for (i = 0, n = 0; i < sizeof unknown_hnames / sizeof *unknown_hnames; i++) {
+		off[i] = n;
+		n += sprintf(buf + n, "%s: some header body\r\n", unknown_hnames[i]);
+	}
+	bend = buf + n;
+
+	begin = ut_now_ns();
+	for (n = 0; n < HNAME_BENCH_LOOPS; n++)
+		for (i = 0; i < sizeof unknown_hnames / sizeof *unknown_hnames; i++)
+			parse_hname2(buf + off[i], bend, &hdr);
+
+	diag("unknown header names: %ld ns/hdr", (ut_now_ns() - begin) /
+		(HNAME_BENCH_LOOPS * (long)(sizeof unknown_hnames / sizeof *unknown_hnames)));
+}
+
+
+void test_parse_hname(void)
+{
+	struct hdr_field hdr;
+	char *p;
+
+	p = parse_hname2(HN("Content-Length: 0\r\n"), &hdr);
+	ok(hdr.type == HDR_CONTENTLENGTH_T && hdr.name.len == 14, "hname-1");
+	p = parse_hname2(HN("P-Charging-Vector:x\r\n"), &hdr);
+	ok(hdr.type == HDR_OTHER_T && hdr.name.len == 17 && *p == 'x', "hname-2");
+	p = parse_hname2(HN("P-Access-Network-Info \t :x\r\n"), &hdr);
+	ok(hdr.type == HDR_OTHER_T && hdr.name.len == 21 && *p == 'x', "hname-3");
+	p = parse_hname2(HN("P-Access-Network-Info x:\r\n"), &hdr);
+	ok(hdr.type == HDR_ERROR_T && !p, "hname-4");
+
+	test_hname_other();
+	test_hdr_lf();
+}
@@ -26,6 +26,7 @@
 #include "test_parse_fcaps.h"
 #include "test_parser.h"
 #include "test_parse_authenticate_body.h"
+#include "test_parse_hname.h"
 
 void test_parse_uri(void)
 {
@@ -201,4 +202,5 @@ void test_parser(void)
 	test_parse_qop_val();
 	test_parse_fcaps();
 	test_parse_authenticate_body();
+	test_parse_hname();
 }
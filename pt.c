@@ -19,6 +19,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define _GNU_SOURCE /* sched_setaffinity() */
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -35,6 +36,7 @@
 #include "pt.h"
 #include "bin_interface.h"
 #include "core_stats.h"
+#include "log_ring.h"
 
 
 /* array with children pids, 0= main proc,
@@ -217,6 +219,37 @@ void set_proc_attrs(const char *fmt, ...)
 }
 
 
+/* Pins the current process to a single CPU, picked round-robin by process
+ * number over the online CPUs */
+int set_proc_cpu_affinity(void)
+{
+#ifdef __OS_linux
+	cpu_set_t set;
+	long ncpus;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus<=0) {
+		LM_ERR("failed to get the number of online CPUs\n");
+		return -1;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(process_no % ncpus, &set);
+	if (sched_setaffinity(0, sizeof set, &set)<0) {
+		LM_ERR("failed to pin process %d to CPU %ld: %s\n",
+			process_no, process_no % ncpus, strerror(errno));
+		return -1;
+	}
+
+	LM_DBG("process %d pinned to CPU %ld\n", process_no, process_no % ncpus);
+	return 0;
+#else
+	LM_ERR("CPU pinning not supported on this OS\n");
+	return -1;
+#endif
+}
+
+
 /* Resets all the values in the process table for a given id (a slot) so that
  * it can be reused later 
  * WARNING: this should be called only by main process and when it is 100% 
@@ -469,6 +502,9 @@ int count_child_processes(void)
 	/* attendent */
 	proc_no++;
 
+	/* async log writer */
+	proc_no += log_ring_count_processes();
+
 	/* count the processes requested by modules */
 	proc_no += count_module_procs(0);
 
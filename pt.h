@@ -105,6 +105,7 @@ extern int _termination_in_progress;
 
 int   init_multi_proc_support();
 void  set_proc_attrs(const char *fmt, ...);
+int   set_proc_cpu_affinity(void);
 int   count_init_child_processes(void);
 int   count_child_processes(void);
 
@@ -2368,12 +2368,10 @@ static int pv_get_avp(struct sip_msg *msg,  pv_param_t *param, pv_value_t *res)
 	int avp_name;
 	int_str avp_value;
 	struct usr_avp *avp;
-	int_str avp_value0;
-	struct usr_avp *avp0;
 	int idx;
 	int idxf;
 	char *p;
-	int n=0;
+	int n;
 
 	if(msg==NULL || res==NULL || param==NULL)
 		return -1;
@@ -2470,10 +2468,7 @@ static int pv_get_avp(struct sip_msg *msg,  pv_param_t *param, pv_value_t *res)
 	/* we have a numeric index */
 	if(idx<0)
 	{
-		n = 1;
-		avp0 = avp;
-		while ((avp0=search_first_avp(name_type, avp_name,
-						&avp_value0, avp0))!=0) n++;
+		n = count_avps(name_type, avp_name);
 		idx = -idx;
 		if(idx>n)
 		{
@@ -2481,24 +2476,9 @@ static int pv_get_avp(struct sip_msg *msg,  pv_param_t *param, pv_value_t *res)
 			return pv_get_null(msg, param, res);
 		}
 		idx = n - idx;
-		if(idx==0)
-		{
-			if(avp->flags & AVP_VAL_STR) {
-				res->rs = avp_value.s;
-			} else if(avp->flags & AVP_VAL_NULL) {
-				res->flags |= PV_VAL_NULL;
-			} else {
-				res->rs.s = sint2str(avp_value.n, &res->rs.len);
-				res->ri = avp_value.n;
-				res->flags |= PV_VAL_INT|PV_TYPE_INT;
-			}
-			return 0;
-		}
 	}
-	n=0;
-	while(n<idx
-			&& (avp=search_first_avp(name_type, avp_name, &avp_value, avp))!=0)
-		n++;
+	if(idx>0)
+		avp = search_index_avp(name_type, avp_name, &avp_value, idx);
 
 	if(avp!=0)
 	{
@@ -48,6 +48,7 @@
 
 
 #include <stdlib.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <regex.h>
 #include <netdb.h>
@@ -1222,10 +1223,118 @@ int get_script_route_idx( char* name,struct script_route *sr, int size,int set)
 }
 
 
+#define is_const_elem(_e, _t) \
+	((_e) && (_e)->type==ELEM_T && (_e)->op==VALUE_OP && (_e)->left.type==(_t))
+
+/*! \brief Evaluates, once and for all, the arithmetic over constants (e.g.
+ * "$var(t) = 24 * 3600;"), turning the node into a plain value
+ * \return 1 if folded, 0 if left as it is
+ */
+static int fold_expr(struct expr* e)
+{
+	struct expr *l, *r;
+	long long w;
+	int a, b, n;
+	str s;
+
+	if (e->type!=ELEM_T || e->left.type!=EXPR_O)
+		return 0;
+
+	l = e->left.v.expr;
+	r = (e->right.type==EXPR_ST) ? e->right.v.expr : NULL;
+
+	if (e->op==BNOT_OP) {
+		if (!is_const_elem(l, NUMBERV_O))
+			return 0;
+		n = ~l->left.v.n;
+		goto fold_number;
+	}
+
+	if (is_const_elem(l, NUMBERV_O) && is_const_elem(r, NUMBERV_O)) {
+		a = l->left.v.n;
+		b = r->left.v.n;
+		/* computed on 64 bits: the results which would overflow an int
+		 * (undefined in C) are left for the runtime, as before */
+		switch (e->op) {
+			case PLUS_OP:   w = (long long)a + b; break;
+			case MINUS_OP:  w = (long long)a - b; break;
+			case MULT_OP:   w = (long long)a * b; break;
+			case BAND_OP:   w = a & b; break;
+			case BOR_OP:    w = a | b; break;
+			case BXOR_OP:   w = a ^ b; break;
+			case DIV_OP:
+			case MODULO_OP:
+				/* leave the error to be reported at runtime; INT_MIN / -1
+				 * would raise SIGFPE right here */
+				if (b==0 || (a==INT_MIN && b==-1))
+					return 0;
+				w = (e->op==DIV_OP) ? a / b : a % b;
+				break;
+			case BLSHIFT_OP:
+				/* shifting a negative value or a bit out is undefined */
+				if (b<0 || b>=8*sizeof(int) || a<0 || a>(INT_MAX>>b))
+					return 0;
+				w = a << b;
+				break;
+			case BRSHIFT_OP:
+				if (b<0 || b>=8*sizeof(int))
+					return 0;
+				w = a >> b;
+				break;
+			default:
+				return 0;
+		}
+		if (w<INT_MIN || w>INT_MAX)
+			return 0;
+		n = (int)w;
+		goto fold_number;
+	}
+
+	/* concatenation; an empty result would evaluate as true when built
+	 * at runtime, but as false as a constant */
+	if (e->op==PLUS_OP && is_const_elem(l, STRINGV_O) &&
+	is_const_elem(r, STRINGV_O) && l->left.v.s.len + r->left.v.s.len > 0) {
+		s.len = l->left.v.s.len + r->left.v.s.len;
+		s.s = pkg_malloc(s.len + 1);
+		if (s.s==NULL) {
+			LM_ERR("no more pkg memory\n");
+			return 0;
+		}
+		memcpy(s.s, l->left.v.s.s, l->left.v.s.len);
+		memcpy(s.s + l->left.v.s.len, r->left.v.s.s, r->left.v.s.len);
+		s.s[s.len] = '\0';
+
+		e->left.type = STRINGV_O;
+		e->left.v.s = s;
+		goto folded;
+	}
+
+	return 0;
+
+fold_number:
+	e->left.type = NUMBERV_O;
+	e->left.v.n = n;
+folded:
+	/* the constants hold no other data than their strings */
+	if (l->left.type==STRINGV_O)
+		pkg_free(l->left.v.s.s);
+	pkg_free(l);
+	if (r) {
+		if (r->left.type==STRINGV_O)
+			pkg_free(r->left.v.s.s);
+		pkg_free(r);
+	}
+	e->op = VALUE_OP;
+	e->right.type = 0;
+	e->right.v.data = NULL;
+	return 1;
+}
+
+
 /*! \brief traverses an expression tree and compiles the REs where necessary)
  * \return 0 for ok, <0 if errors
  */
-static int fix_expr(struct expr* exp)
+int fix_expr(struct expr* exp)
 {
 	regex_t* re;
 	int ret;
@@ -1295,6 +1404,8 @@ static int fix_expr(struct expr* exp)
 					return ret;
 				}
 			}
+			/* the operands were already folded, if possible */
+			fold_expr(exp);
 			ret=0;
 	}
 	return ret;
@@ -242,6 +242,8 @@ int fix_rls(void);
 
 int check_rls(void);
 
+int fix_expr(struct expr* exp);
+
 int eval_expr(struct expr* e, struct sip_msg* msg, pv_value_t *val);
 
 
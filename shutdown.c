@@ -41,6 +41,7 @@
 #include "net/net_udp.h"
 #include "net/net_tcp.h"
 #include "shutdown.h"
+#include "log_ring.h"
 
 /**
  * Clean up on exit. This should be called before exiting.
@@ -235,6 +236,9 @@ void shutdown_opensips( int status )
 		 allow an almost gracious shutdown */
 	shm_force_unlock();
 
+	/* write whatever the processes queued before exiting */
+	destroy_log_ring();
+
 	signal(SIGALRM, sig_alarm_abort);
 	alarm(SHUTDOWN_TIMEOUT - i / 100);
 	cleanup(1);
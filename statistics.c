@@ -315,6 +315,12 @@ int init_stats_collector(void)
 		goto error;
 	}
 
+	/* register logging statistics */
+	if (register_module_stats( "log", log_stats)!=0 ) {
+		LM_ERR("failed to register logging statistics\n");
+		goto error;
+	}
+
 	/* create the module for "dynamic" statistics */
 	dy_mod = add_stat_module( DYNAMIC_MODULE_NAME );
 	if (dy_mod==NULL) {
@@ -416,7 +422,8 @@ static int __register_stat(str *module, str *name, stat_var **pvar,
 	stat_var **shash;
 	stat_var *stat;
 	stat_var *it;
-	int hash;
+	int hash, i;
+	unsigned long size;
 
 	if (module==0 || name==0 || pvar==0) {
 		LM_ERR("invalid parameters module=%p, name=%p, pvar=%p \n",
@@ -426,8 +433,12 @@ static int __register_stat(str *module, str *name, stat_var **pvar,
 
 	if(flags&STAT_NOT_ALLOCATED){
 		stat = *pvar;
+		/* the value is provided by the caller, as a single counter */
+		flags &= ~STAT_SHARDED;
 		goto do_register;
 	}
+	if (flags&STAT_IS_FUNC)
+		flags &= ~STAT_SHARDED;
 	stat = unsafe ?
 			(stat_var*)shm_malloc_unsafe(sizeof(stat_var) +
 			(((flags&STAT_SHM_NAME)==0)?name->len:0))
@@ -442,17 +453,21 @@ static int __register_stat(str *module, str *name, stat_var **pvar,
 	memset( stat, 0, sizeof(stat_var) );
 
 	if ( (flags&STAT_IS_FUNC)==0 ) {
+		size = (flags&STAT_SHARDED) ?
+			STAT_SHARDS * STAT_SHARD_SIZE : sizeof(stat_val);
 		stat->u.val = unsafe ?
-			(stat_val*)shm_malloc_unsafe(sizeof(stat_val)) :
-			(stat_val*)shm_malloc(sizeof(stat_val));
+			(stat_val*)shm_malloc_unsafe(size) :
+			(stat_val*)shm_malloc(size);
 		if (stat->u.val==0) {
 			LM_ERR("no more shm memory\n");
 			goto error1;
 		}
+		stat->flags = flags;
+		for (i = 0; i < ((flags&STAT_SHARDED) ? STAT_SHARDS : 1); i++)
 #ifdef NO_ATOMIC_OPS
-		*(stat->u.val) = 0;
+			*stat_shard(stat, i) = 0;
 #else
-		atomic_init(stat->u.val, 0);
+			atomic_init(stat_shard(stat, i), 0);
 #endif
 		*pvar = stat;
 	} else {
@@ -657,6 +672,51 @@ stat_var* get_stat( const str *name )
 	return __get_stat(name, -1);
 }
 
+unsigned long get_sharded_stat_val( stat_var *var )
+{
+	/* summed up in the type of the slots, so the (modulo) sum of a gauge
+	 * going down in some slots and up in others is the one of an unsharded
+	 * stat, before widening */
+#ifdef NO_ATOMIC_OPS
+	stat_val val = 0;
+#else
+	typeof(atomic_load(stat_shard(var, 0)) + 0) val = 0;
+#endif
+	int i;
+
+	for (i = 0; i < STAT_SHARDS; i++)
+#ifdef NO_ATOMIC_OPS
+		val += *stat_shard(var, i);
+#else
+		val += atomic_load(stat_shard(var, i));
+#endif
+
+	return val;
+}
+
+void reset_sharded_stat( stat_var *var )
+{
+	int i;
+
+#ifdef NO_ATOMIC_OPS
+	if ((var->flags&STAT_NO_SYNC)==0)
+		lock_get(stat_lock);
+#endif
+
+	/* not atomic as a whole - updates racing with the reset may survive */
+	for (i = 0; i < STAT_SHARDS; i++)
+#ifdef NO_ATOMIC_OPS
+		*stat_shard(var, i) = 0;
+#else
+		atomic_store(stat_shard(var, i), 0);
+#endif
+
+#ifdef NO_ATOMIC_OPS
+	if ((var->flags&STAT_NO_SYNC)==0)
+		lock_release(stat_lock);
+#endif
+}
+
 int mi_stat_name(str *mod, str *stat, str *out)
 {
 	static str tmp_buf = {0, 0};
@@ -37,6 +37,7 @@
 #include "atomic.h"
 
 #include "hash_func.h"
+#include "globals.h"
 
 #define STATS_HASH_POWER   8
 #define STATS_HASH_SIZE    (1<<(STATS_HASH_POWER))
@@ -51,6 +52,15 @@
 #define STAT_HIDDEN    (1<<5)
 #define STAT_PER_PROC  (1<<6)
 #define STAT_HAS_GROUP (1<<7)
+/* the value is split in per-process slots, summed up on read; to be used
+ * for the counters updated by all the workers, at high rates */
+#define STAT_SHARDED   (1<<8)
+
+/* number of slots of a STAT_SHARDED statistic (power of 2) - processes with
+ * the same index modulo STAT_SHARDS share a slot */
+#define STAT_SHARDS      64
+/* each slot gets its own cache line */
+#define STAT_SHARD_SIZE  64
 
 #ifdef NO_ATOMIC_OPS
 typedef unsigned int stat_val;
@@ -156,6 +166,10 @@ group_stats *find_stat_group(str *name);
 
 unsigned int get_stat_val( stat_var *var );
 
+/* sums up the per-process slots of a STAT_SHARDED statistic */
+unsigned long get_sharded_stat_val( stat_var *var );
+void reset_sharded_stat( stat_var *var );
+
 /*! \brief
  * Returns the statistic associated with 'numerical_code' and 'is_a_reply'.
  * Specifically:
@@ -206,15 +220,22 @@ extern gen_lock_t *stat_lock;
 
 
 #ifdef STATISTICS
+	#define stat_shard(_var, _i) \
+		((stat_val *)((char *)(_var)->u.val + (_i) * STAT_SHARD_SIZE))
+	/* the slot to be updated by the current process */
+	#define stat_slot(_var) \
+		(((_var)->flags&STAT_SHARDED) ? \
+			stat_shard(_var, process_no & (STAT_SHARDS-1)) : (_var)->u.val)
+
 	#ifdef NO_ATOMIC_OPS
 		#define update_stat( _var, _n) \
 			do { \
 				if ( !((_var)->flags&STAT_IS_FUNC) ) {\
 					if ((_var)->flags&STAT_NO_SYNC) {\
-						*((_var)->u.val) += _n;\
+						*stat_slot(_var) += _n;\
 					} else {\
 						lock_get(stat_lock);\
-						*((_var)->u.val) += _n;\
+						*stat_slot(_var) += _n;\
 						lock_release(stat_lock);\
 					}\
 				}\
@@ -222,7 +243,9 @@ extern gen_lock_t *stat_lock;
 		#define reset_stat( _var) \
 			do { \
 				if ( ((_var)->flags&(STAT_NO_RESET|STAT_IS_FUNC))==0 ) {\
-					if ((_var)->flags&STAT_NO_SYNC) {\
+					if ((_var)->flags&STAT_SHARDED) {\
+						reset_sharded_stat(_var);\
+					} else if ((_var)->flags&STAT_NO_SYNC) {\
 						*((_var)->u.val) = 0;\
 					} else {\
 						lock_get(stat_lock);\
@@ -232,22 +255,29 @@ extern gen_lock_t *stat_lock;
 				}\
 			}while(0)
 		#define get_stat_val( _var ) ((unsigned long)\
-			((_var)->flags&STAT_IS_FUNC)?(_var)->u.f((_var)->context):*((_var)->u.val))
+			((_var)->flags&STAT_IS_FUNC)?(_var)->u.f((_var)->context):\
+			((_var)->flags&STAT_SHARDED)?get_sharded_stat_val(_var):\
+			*((_var)->u.val))
 	#else
 		#define update_stat( _var, _n) \
 			do { \
 				if ( !((_var)->flags&STAT_IS_FUNC) ) {\
-					atomic_fetch_add((_var)->u.val, _n); \
+					atomic_fetch_add(stat_slot(_var), _n); \
 				}\
 			}while(0)
 		#define reset_stat( _var) \
 			do { \
 				if ( ((_var)->flags&(STAT_NO_RESET|STAT_IS_FUNC))==0 ) {\
-					atomic_store((_var)->u.val, 0); \
+					if ((_var)->flags&STAT_SHARDED) \
+						reset_sharded_stat(_var); \
+					else \
+						atomic_store((_var)->u.val, 0); \
 				}\
 			}while(0)
 		#define get_stat_val( _var ) ((unsigned long)\
-			((_var)->flags&STAT_IS_FUNC)?(_var)->u.f((_var)->context):atomic_load((_var)->u.val))
+			((_var)->flags&STAT_IS_FUNC)?(_var)->u.f((_var)->context):\
+			((_var)->flags&STAT_SHARDED)?get_sharded_stat_val(_var):\
+			atomic_load((_var)->u.val))
 	#endif /* NO_ATOMIC_OPS */
 
 	#define if_update_stat(_c, _var, _n) \
@@ -9,7 +9,11 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include <stdlib.h>
+#include <string.h>
+
 #include "../parser/sdp/sdp.h"
+#include "../parser/parse_hname2.h"
 
 #include "../cachedb/test/test_cachedb.h"
 #include "../lib/test/test_csv.h"
@@ -25,6 +29,22 @@ limitations under the License.
 
 #include "../test/fuzz/fuzz_standalone.h"
 
+/* the vectorized scan of the header names must give exactly what the
+ * scalar one gives */
+static void check_hname(char *p, char *end) {
+  struct hdr_field vec = {}, scal = {};
+  char *rv, *rs;
+
+  hname_scalar_scan = 0;
+  rv = parse_hname2(p, end, &vec);
+  hname_scalar_scan = 1;
+  rs = parse_hname2(p, end, &scal);
+  hname_scalar_scan = 0;
+
+  if (rv != rs || vec.type != scal.type || vec.name.len != scal.name.len)
+    abort();
+}
+
 int LLVMFuzzerTestOneInput(const char *data, size_t size) {
 
   if (size <= 1) {
@@ -32,10 +52,30 @@ int LLVMFuzzerTestOneInput(const char *data, size_t size) {
   }
 
   struct sip_msg orig_inv = {};
+  struct hdr_field *hf;
+  char *p;
   orig_inv.buf = (char *)data;
   orig_inv.len = size;
 
   parse_msg(orig_inv.buf, orig_inv.len, &orig_inv);
+
+  /* the (vectorized) scanning must stop on the first delimiter only */
+  for (hf = orig_inv.headers; hf; hf = hf->next) {
+    if (hf->type == HDR_OTHER_T &&
+        (memchr(hf->name.s, ':', hf->name.len) ||
+         memchr(hf->name.s, ' ', hf->name.len) ||
+         memchr(hf->name.s, '\t', hf->name.len)))
+      abort();
+  }
+
   free_sip_msg(&orig_inv);
+
+  /* each line of the input, as a header */
+  for (p = (char *)data; p; p = memchr(p, '\n', data + size - p)) {
+    if (*p == '\n' && ++p == data + size)
+      break;
+    check_hname(p, (char *)data + size);
+  }
+
   return 0;
 }
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tap.h>
+
+#include "../str.h"
+#include "../ut.h"
+#include "../dprint.h"
+#include "../ip_addr.h"
+#include "../resolve.h"
+#include "../receive.h"
+#include "../socket_info.h"
+#include "../mem/mem.h"
+#include "../parser/msg_parser.h"
+
+#include "ut.h"
+#include "script_bench.h"
+
+#define SCRIPT_BENCH_SEP  "\n---\n"
+
+char *script_bench_file;
+
+static char *read_bench_file(const char *path, long *len)
+{
+	FILE *f;
+	char *buf;
+
+	f = fopen(path, "r");
+	if (!f) {
+		LM_ERR("failed to open %s\n", path);
+		return NULL;
+	}
+
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	buf = pkg_malloc(*len + 1);
+	if (!buf) {
+		LM_ERR("oom\n");
+		fclose(f);
+		return NULL;
+	}
+
+	if (fread(buf, 1, *len, f) != *len) {
+		LM_ERR("failed to read %s\n", path);
+		pkg_free(buf);
+		buf = NULL;
+	} else {
+		buf[*len] = '\0';
+	}
+
+	fclose(f);
+	return buf;
+}
+
+
+/* copies the message, with CRLF line endings, in a pkg buffer */
+static int load_bench_msg(const char *s, int len, str *msg)
+{
+	int i;
+
+	msg->s = pkg_malloc(2 * len + 1);
+	if (!msg->s) {
+		LM_ERR("oom\n");
+		return -1;
+	}
+
+	for (i = 0, msg->len = 0; i < len; i++) {
+		if (s[i] == '\n' && (i == 0 || s[i - 1] != '\r'))
+			msg->s[msg->len++] = '\r';
+		msg->s[msg->len++] = s[i];
+	}
+	msg->s[msg->len] = '\0';
+
+	return 0;
+}
+
+
+static void bench_msg(str *msg, int idx, int loops, struct receive_info *ri)
+{
+	struct sip_msg pmsg;
+	char *buf;
+	long begin, parse_ns, run_ns;
+	char *eol;
+	int i, rc = 0;
+
+	buf = pkg_malloc(msg->len + 1);
+	if (!buf) {
+		ok(0, "script-bench-%d-oom", idx);
+		return;
+	}
+
+	/* the parsing alone, as a reference */
+	begin = ut_now_ns();
+	for (i = 0; i < loops; i++) {
+		memcpy(buf, msg->s, msg->len + 1);
+		memset(&pmsg, 0, sizeof pmsg);
+		pmsg.buf = buf;
+		pmsg.len = msg->len;
+		if (parse_msg(buf, msg->len, &pmsg) != 0)
+			rc = -1;
+		free_sip_msg(&pmsg);
+	}
+	parse_ns = (ut_now_ns() - begin) / loops;
+
+	if (!ok(rc == 0, "script-bench-%d-parse", idx))
+		goto out;
+
+	/* the buffer is only read by the script (the changes go to lumps), but
+	 * it is rewritten anyway, so the timing compares with the above */
+	begin = ut_now_ns();
+	for (i = 0; i < loops; i++) {
+		memcpy(buf, msg->s, msg->len + 1);
+		if (receive_msg(buf, msg->len, ri, NULL, 0) != 0)
+			rc = -1;
+	}
+	run_ns = (ut_now_ns() - begin) / loops;
+
+	ok(rc == 0, "script-bench-%d-run", idx);
+
+	/* named by the first line */
+	eol = q_memchr(msg->s, '\r', msg->len);
+	diag("msg %d (%.*s): %ld ns/msg, of which %ld ns parsing", idx,
+		(int)(eol ? eol - msg->s : msg->len), msg->s, run_ns, parse_ns);
+
+out:
+	pkg_free(buf);
+}
+
+
+void test_script_bench(void)
+{
+	const struct socket_info *si;
+	struct receive_info ri;
+	struct ip_addr *ip;
+	str src = str_init("127.0.0.1");
+	char *file, *p, *end, *next;
+	long len;
+	int idx, loops = SCRIPT_BENCH_LOOPS;
+	str msg, s;
+
+	/* "<file>[:<loops>]" */
+	p = strrchr(script_bench_file, ':');
+	if (p) {
+		s.s = p + 1;
+		s.len = strlen(s.s);
+		if (str2sint(&s, &loops) == 0 && loops > 0)
+			*p = '\0';
+		else
+			loops = SCRIPT_BENCH_LOOPS;
+	}
+
+	si = get_first_socket();
+	if (!ok(si != NULL, "script-bench-listener"))
+		return;
+
+	memset(&ri, 0, sizeof ri);
+	ri.bind_address = si;
+	ri.proto = si->proto;
+	ri.dst_ip = si->address;
+	ri.dst_port = si->port_no;
+	ip = str2ip(&src);
+	ri.src_ip = *ip;
+	ri.src_port = SIP_PORT;
+	init_su(&ri.src_su, &ri.src_ip, ri.src_port);
+
+	file = read_bench_file(script_bench_file, &len);
+	if (!ok(file != NULL, "script-bench-file"))
+		return;
+
+	diag("replaying %s, %d times per message", script_bench_file, loops);
+
+	for (p = file, end = file + len, idx = 0; p < end; p = next, idx++) {
+		next = strstr(p, SCRIPT_BENCH_SEP);
+		if (next) {
+			len = next + 1 - p;
+			next += sizeof SCRIPT_BENCH_SEP - 1;
+		} else {
+			len = end - p;
+			next = end;
+		}
+
+		if (load_bench_msg(p, len, &msg) < 0)
+			break;
+
+		bench_msg(&msg, idx, loops, &ri);
+		pkg_free(msg.s);
+	}
+
+	pkg_free(file);
+}
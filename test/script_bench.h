@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,USA
+ */
+
+#ifndef SCRIPT_BENCH_H
+#define SCRIPT_BENCH_H
+
+/*
+ * Script benchmark ("-T script:<file>[:<loops>]" cmdline param): the SIP
+ * messages of <file> are replayed through receive_msg(), thus through the
+ * main request (or onreply) route of the -f script, as if received on the
+ * first listener. The time spent per message is reported, next to the time
+ * needed just for parsing it.
+ *
+ * The messages are separated by lines holding only "---"; the LF line
+ * endings are turned into CRLF. Note that the script runs for real, so any
+ * relaying or replying it does will go out through the listeners!
+ */
+
+#define SCRIPT_BENCH_LOOPS  10000
+
+extern char *script_bench_file;
+
+void test_script_bench(void);
+
+#endif
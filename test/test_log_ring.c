@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <tap.h>
+
+#include "../statistics.h"
+#include "../core_stats.h"
+#include "../log_ring.h"
+
+#include "test_log_ring.h"
+
+#define DROPPED(_level) \
+	get_stat_val(log_async_dropped[log_ring_level_idx(_level)])
+
+/* records are accounted until full, then dropped */
+static void test_log_ring_full(void)
+{
+	char line[200];
+	unsigned long dropped;
+	int i, pushed = 0;
+
+	memset(line, 'x', sizeof line);
+
+	if (!ok(init_log_ring() == 0 && log_ring, "test-log-ring-init"))
+		return;
+
+	ok(log_ring_used() == 0, "test-log-ring-empty");
+
+	dropped = DROPPED(L_INFO);
+	for (i = 0; i < 2 * log_ring->size / sizeof line; i++)
+		if (log_ring_push(0, 0, L_INFO, line, sizeof line) == 0)
+			pushed++;
+
+	ok(pushed > 0 && pushed < i, "test-log-ring-full");
+	ok(log_ring_used() <= log_ring->size, "test-log-ring-used");
+	ok(DROPPED(L_INFO) - dropped == i - pushed, "test-log-ring-dropped");
+
+	ok(log_ring_level_idx(L_ALERT) == 0 &&
+		log_ring_level_idx(L_ERR) == 2 && log_ring_level_idx(L_WARN) == 3 &&
+		log_ring_level_idx(L_DBG) == LOG_RING_LEVELS - 1,
+		"test-log-ring-levels");
+
+	/* records with no destination are simply consumed */
+	destroy_log_ring();
+	ok(!log_ring && log_ring_used() == 0, "test-log-ring-destroy");
+}
+
+/* the stderr records go to the file, if set, in order; a record reserved
+ * but never completed holds the ones after it only for a while */
+static void test_log_ring_file(void)
+{
+	char path[] = "/tmp/opensips_log_ring.XXXXXX", buf[64];
+	unsigned long dropped;
+	int fd, len;
+
+	fd = mkstemp(path);
+	if (!ok(fd >= 0, "test-log-ring-file-tmp"))
+		return;
+
+	log_async_file = path;
+	if (!ok(init_log_ring() == 0 && log_ring, "test-log-ring-file-init"))
+		goto out;
+
+	log_ring_push(LOG_RING_STDERR, 0, L_INFO, "one\n", 4);
+	log_ring_push(LOG_RING_STDERR, 0, L_INFO, "two\n", 4);
+	ok(log_ring_drain(0) == 2 && log_ring_used() == 0,
+		"test-log-ring-file-drain");
+
+	/* a producer gone right after its reservation */
+	log_ring->head += 64;
+	log_ring_push(LOG_RING_STDERR, 0, L_INFO, "lost\n", 5);
+	dropped = DROPPED(L_DBG);
+
+	ok(log_ring_drain(0) == 0 && log_ring_used() > 0,
+		"test-log-ring-stuck-wait");
+	usleep((LOG_RING_STUCK_MS + 100) * 1000);
+	ok(log_ring_drain(0) == 1 && log_ring_used() == 0 &&
+		DROPPED(L_DBG) - dropped == 1, "test-log-ring-stuck-skip");
+
+	log_ring_push(LOG_RING_STDERR, 0, L_INFO, "three\n", 6);
+	ok(log_ring_drain(0) == 1, "test-log-ring-stuck-after");
+
+	destroy_log_ring();
+
+	len = read(fd, buf, sizeof buf);
+	ok(len == 14 && !memcmp(buf, "one\ntwo\nthree\n", 14),
+		"test-log-ring-file");
+
+out:
+	log_async_file = NULL;
+	close(fd);
+	unlink(path);
+}
+
+void test_log_ring(void)
+{
+	int buf_size = log_async_buf_size;
+
+	log_async_buf_size = 1;
+
+	test_log_ring_full();
+	test_log_ring_file();
+
+	log_async_buf_size = buf_size;
+}
@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * The rebuild of a SIP message from its lumps, by both builders: the
+ * lumps_len() + process_lumps() pair and the scatter list one
+ * (msg_scatter_build), which must give the same output. The benchmark
+ * compares the two over a header-heavy request.
+ */
+
+#include <string.h>
+#include <tap.h>
+
+#include "../globals.h"
+#include "../data_lump.h"
+#include "../msg_translator.h"
+#include "../parser/msg_parser.h"
+#include "../parser/parse_body.h"
+#include "ut.h"
+
+#include "test_msg_translator.h"
+
+#define MSG_BUILD_BENCH_LOOPS 100000
+
+static char inv[] =
+	"INVITE sip:bob@biloxi.example.com SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 192.0.2.41:5060;branch=z9hG4bK2d4790.1\r\n"
+	"Via: SIP/2.0/UDP 192.0.2.25:5060;branch=z9hG4bK65a7.2;rport=5060\r\n"
+	"Record-Route: <sip:192.0.2.41;lr;ftag=9fxced76sl>\r\n"
+	"From: Alice <sip:alice@atlanta.example.com>;tag=9fxced76sl\r\n"
+	"To: Bob <sip:bob@biloxi.example.com>\r\n"
+	"Call-ID: 3848276298220188511@atlanta.example.com\r\n"
+	"CSeq: 1 INVITE\r\n"
+	"Contact: <sip:alice@client.atlanta.example.com;transport=tcp>\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n";
+
+static char inv_exp[] =
+	"INVITE sip:bob@biloxi.example.com SIP/2.0\r\n"
+	"tcpVia: SIP/2.0/UDP 192.0.2.41:5060;branch=z9hG4bK2d4790.1\r\n"
+	"X-Orig: 1\r\n"
+	"From: Alice <sip:alice@atlanta.example.com>;tag=9fxced76sl\r\n"
+	"To: Bob <sip:bob@biloxi.example.com>\r\n"
+	"Call-ID: 3848276298220188511@atlanta.example.com\r\n"
+	"CSeq: 1 INVITE\r\n"
+	"Contact: <sip:10.0.0.1:5070;transport=tcp>\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n";
+
+static const char *builders[] = {"lumps", "scatter"};
+
+
+static char *test_lump_str(const char *s)
+{
+	int len = strlen(s);
+	char *p = pkg_malloc(len);
+
+	if (p)
+		memcpy(p, s, len);
+	return p;
+}
+
+static void init_test_sock(struct socket_info *si, int proto)
+{
+	memset(si, 0, sizeof *si);
+	si->address_str = str_init("10.0.0.1");
+	si->port_no_str = str_init("5070");
+	si->port_no = 5070;
+	si->proto = proto;
+}
+
+/* parses @inv and changes its headers through nested, deleted, COND and
+ * SUBST lumps */
+static int mk_lumped_req(struct sip_msg *msg, struct socket_info *si)
+{
+	struct hdr_field *h;
+	struct lump *l;
+
+	memset(msg, 0, sizeof *msg);
+	msg->buf = inv;
+	msg->len = sizeof inv - 1;
+	msg->rcv.bind_address = si;
+	msg->rcv.proto = PROTO_UDP;
+
+	if (parse_msg(msg->buf, msg->len, msg) != 0 ||
+	        parse_headers(msg, HDR_EOH_F, 0) != 0)
+		return -1;
+
+	for (h = msg->headers; h; h = h->next) {
+		if ((h->type == HDR_VIA_T && h != msg->h_via1) ||
+		        h->type == HDR_RECORDROUTE_T) {
+			del_lump(msg, h->name.s - msg->buf, h->len, h->type);
+		} else if (h->type == HDR_CONTACT_T) {
+			l = del_lump(msg, h->body.s - msg->buf, h->body.len, h->type);
+			l = insert_new_lump_after(l, test_lump_str("<sip:"), 5, 0);
+			l = insert_subst_lump_after(l, SUBST_SND_ALL, 0);
+			insert_new_lump_after(l, test_lump_str(">"), 1, 0);
+		} else if (h->type == HDR_FROM_T) {
+			l = anchor_lump(msg, h->name.s - msg->buf, 0);
+			insert_new_lump_before(l, test_lump_str("X-Orig: 1\r\n"), 11, 0);
+			l = insert_cond_lump_after(l, COND_IF_DIFF_PROTO, 0);
+			insert_new_lump_after(l, test_lump_str("X-Proto: 1\r\n"), 12, 0);
+		}
+	}
+	/* within the deleted Via */
+	del_lump(msg, msg->h_via1->next->name.s - msg->buf + 4, 6, 0);
+	l = anchor_lump(msg, msg->h_via1->name.s - msg->buf, 0);
+	insert_subst_lump_before(l, SUBST_RCV_PROTO, 0);
+
+	return 0;
+}
+
+/* the rebuild of the headers, over the nested, deleted and SUBST lumps */
+static void test_msg_translator_hdrs(void)
+{
+	struct socket_info si;
+	struct sip_msg msg;
+	struct lump_iov v = {0};
+	char *out;
+	unsigned int orig_offs, len;
+	int b;
+
+	init_test_sock(&si, PROTO_TCP);
+
+	if (!ok(mk_lumped_req(&msg, &si) == 0, "test-msg-build-parse"))
+		return;
+
+	orig_offs = 0;
+	ok(lumps_to_iov(&msg, msg.add_rm, &v, &orig_offs, &si, -1) == 0 &&
+		v.len + msg.len - orig_offs == sizeof inv_exp - 1,
+		"test-msg-build-iov");
+
+	for (b = 0; b < 2; b++) {
+		msg_scatter_build = b;
+		out = build_req_buf_from_sip_req(&msg, &len, &si, PROTO_UDP, NULL,
+			MSG_TRANS_NOVIA_FLAG);
+		ok(out && len == sizeof inv_exp - 1 && !memcmp(out, inv_exp, len),
+			"test-msg-build-req-%s", builders[b]);
+		if (out)
+			pkg_free(out);
+	}
+	msg_scatter_build = 0;
+
+	if (v.iov)
+		pkg_free(v.iov);
+	free_sip_msg(&msg);
+}
+
+static int test_body_part_dump(void *parsed, struct sip_msg *msg, str *buf)
+{
+	buf->s = test_lump_str("dumped\r\n");
+	buf->len = buf->s ? 8 : 0;
+	return buf->s ? 0 : -1;
+}
+
+/* the rebuild of the body, by its lumps and by its parts, along with the
+ * headers, into a single buffer with the right Content-Length */
+static void test_msg_translator_body(void)
+{
+	static char body_inv[] =
+		"INVITE sip:bob@biloxi.example.com SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP 192.0.2.41:5060;branch=z9hG4bK2d4790.1\r\n"
+		"Call-ID: 3848276298220188511@atlanta.example.com\r\n"
+		"CSeq: 1 INVITE\r\n"
+		"Content-Type: application/sdp\r\n"
+		"Content-Length: 29\r\n"
+		"\r\n"
+		"v=0\r\n"
+		"o=- 1 1 IN IP4 1.2.3.4\r\n";
+	static char exp_lumps[] =
+		"INVITE sip:bob@biloxi.example.com SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP 192.0.2.41:5060;branch=z9hG4bK2d4790.1\r\n"
+		"Call-ID: 3848276298220188511@atlanta.example.com\r\n"
+		"CSeq: 1 INVITE\r\n"
+		"Content-Type: application/sdp\r\n"
+		"Content-Length: 35\r\n"
+		"\r\n"
+		"v=0\r\n"
+		"o=- 1 1 IN IP4 10.0.0.1\r\n"
+		"a=x\r\n";
+	static char exp_parts[] =
+		"INVITE sip:bob@biloxi.example.com SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP 192.0.2.41:5060;branch=z9hG4bK2d4790.1\r\n"
+		"Call-ID: 3848276298220188511@atlanta.example.com\r\n"
+		"CSeq: 1 INVITE\r\n"
+		"Content-Type: multipart/mixed;boundary=OSS-unique-boundary-42\r\n"
+		"Content-Length: 194\r\n"
+		"\r\n"
+		"--OSS-unique-boundary-42\r\n"
+		"Content-Type: application/sdp\r\n"
+		"\r\n"
+		"v=0\r\n"
+		"o=- 1 1 IN IP4 10.0.0.1\r\n"
+		"\r\n"
+		"--OSS-unique-boundary-42\r\n"
+		"Content-Type: text/plain\r\n"
+		"X-Part: 2\r\n"
+		"\r\n"
+		"dumped\r\n"
+		"\r\n"
+		"--OSS-unique-boundary-42--\r\n";
+	str mime = str_init("text/plain"), hdrs = str_init("X-Part: 2\r\n");
+	struct socket_info si;
+	struct sip_msg msg;
+	struct body_part *part;
+	struct lump *l;
+	char *out, *ip;
+	unsigned int len;
+	int i, b;
+
+	init_test_sock(&si, PROTO_UDP);
+
+	for (b = 0; b < 2; b++) {
+		msg_scatter_build = b;
+
+		for (i = 0; i < 2; i++) {
+			memset(&msg, 0, sizeof msg);
+			msg.buf = body_inv;
+			msg.len = sizeof body_inv - 1;
+			msg.rcv.bind_address = &si;
+			msg.rcv.proto = PROTO_UDP;
+
+			if (!ok(parse_msg(msg.buf, msg.len, &msg) == 0 &&
+			        parse_headers(&msg, HDR_EOH_F, 0) == 0,
+			        "test-msg-body-parse"))
+				goto out;
+
+			/* the SDP address replaced, a line appended at the very end */
+			ip = l_memmem(msg.buf, "1.2.3.4", msg.len, 7);
+			l = del_lump(&msg, ip - msg.buf, 7, 0);
+			insert_subst_lump_after(l, SUBST_SND_IP, 0);
+			l = anchor_lump(&msg, msg.len, 0);
+			insert_new_lump_before(l, test_lump_str("a=x\r\n"), 5, 0);
+
+			if (i == 0) {
+				out = build_req_buf_from_sip_req(&msg, &len, &si, PROTO_UDP,
+					NULL, MSG_TRANS_NOVIA_FLAG);
+				ok(out && len == sizeof exp_lumps - 1 &&
+					!memcmp(out, exp_lumps, len),
+					"test-msg-body-lumps-%s", builders[b]);
+			} else {
+				/* going multipart: the SDP part keeps its lumps (but for
+				 * the ones past the part), the new part is dumped */
+				part = NULL;
+				if (parse_sip_body(&msg) == 0 && msg.body)
+					part = add_body_part(&msg, &mime, &hdrs, NULL);
+				if (part)
+					part->dump_f = test_body_part_dump;
+				out = part ? build_req_buf_from_sip_req(&msg, &len, &si,
+					PROTO_UDP, NULL, MSG_TRANS_NOVIA_FLAG) : NULL;
+				ok(out && len == sizeof exp_parts - 1 &&
+					!memcmp(out, exp_parts, len),
+					"test-msg-body-parts-%s", builders[b]);
+			}
+
+			if (out)
+				pkg_free(out);
+			free_sip_msg(&msg);
+		}
+	}
+
+out:
+	msg_scatter_build = 0;
+}
+
+void test_msg_translator(void)
+{
+	test_msg_translator_hdrs();
+	test_msg_translator_body();
+}
+
+/* A/B of the two builders, over the same lumps */
+void bench_msg_translator(void)
+{
+	struct socket_info si;
+	struct sip_msg msg;
+	char *out = NULL;
+	unsigned int len;
+	long ns[2];
+	int b, i;
+
+	init_test_sock(&si, PROTO_TCP);
+
+	if (!ok(mk_lumped_req(&msg, &si) == 0, "bench-msg-build-parse"))
+		return;
+
+	for (b = 0; b < 2; b++) {
+		msg_scatter_build = b;
+
+		ns[b] = ut_now_ns();
+		for (i = 0; i < MSG_BUILD_BENCH_LOOPS; i++) {
+			out = build_req_buf_from_sip_req(&msg, &len, &si, PROTO_UDP,
+				NULL, MSG_TRANS_NOVIA_FLAG);
+			if (!out)
+				break;
+			pkg_free(out);
+		}
+		ns[b] = (ut_now_ns() - ns[b]) / MSG_BUILD_BENCH_LOOPS;
+
+		ok(i == MSG_BUILD_BENCH_LOOPS, "bench-msg-build-%s", builders[b]);
+	}
+	msg_scatter_build = 0;
+
+	diag("request rebuild: lumps_len() + process_lumps(): %ld ns/msg, "
+		"scatter list: %ld ns/msg", ns[0], ns[1]);
+
+	free_sip_msg(&msg);
+}
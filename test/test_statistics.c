@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <tap.h>
+
+#include "../str.h"
+#include "../globals.h"
+#include "../statistics.h"
+
+#include "test_statistics.h"
+
+/* sharded counters: updates from several processes add up on read */
+static void test_sharded_stats(void)
+{
+	stat_var *cnt = NULL, *gauge = NULL;
+	int proc_no = process_no;
+
+	if (register_stat("test_statistics", "sharded_counter", &cnt, STAT_SHARDED) != 0 ||
+	        register_stat("test_statistics", "sharded_gauge", &gauge,
+	            STAT_SHARDED|STAT_NO_RESET) != 0) {
+		ok(0, "test-sharded-stats-register");
+		return;
+	}
+
+	for (process_no = 0; process_no < 2 * STAT_SHARDS; process_no++) {
+		update_stat(cnt, 2);
+		update_stat(gauge, process_no % 2 ? -1 : 3);
+	}
+	process_no = proc_no;
+
+	ok(get_stat_val(cnt) == 4 * STAT_SHARDS, "test-sharded-stats-sum");
+	ok(get_stat_val(gauge) == 2 * STAT_SHARDS, "test-sharded-stats-gauge");
+	ok(get_stat_val(get_stat(_str("sharded_counter"))) == 4 * STAT_SHARDS,
+	   "test-sharded-stats-lookup");
+
+	reset_stat(cnt);
+	reset_stat(gauge);
+	ok(get_stat_val(cnt) == 0, "test-sharded-stats-reset");
+	ok(get_stat_val(gauge) == 2 * STAT_SHARDS, "test-sharded-stats-no-reset");
+}
+
+void test_statistics(void)
+{
+	test_sharded_stats();
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2024 OpenSIPS Solutions
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <tap.h>
+
+#include "../str.h"
+#include "../usr_avp.h"
+
+#include "ut.h"
+#include "test_usr_avp.h"
+
+#define AVP_BENCH_LOOPS       2000
+#define AVP_BENCH_DSTS        100
+
+/* the stacking semantics of the AVPs of the message, with their lookup index
+ * on, vs. with the same AVPs in a private (never indexed) list */
+static long bench_avp_lookups(int ids[3])
+{
+	int_str val;
+	int i, j, n = 0;
+	long begin;
+
+	begin = ut_now_ns();
+	for (i = 0; i < AVP_BENCH_LOOPS; i++)
+		for (j = 0; j < AVP_BENCH_DSTS; j += 7)
+			n += search_index_avp(0, ids[j % 3], &val, j) != NULL;
+
+	return n ? (ut_now_ns() - begin) / n : -1;
+}
+
+static void test_avp_index(void)
+{
+	str names[3] = {str_init("ut_ds_dst"), str_init("ut_ds_attrs"),
+		str_init("ut_ds_sock")};
+	struct usr_avp **old, *priv = NULL, *avp;
+	int ids[3], i, bad = 0;
+	long ns_idx, ns_list;
+	int_str val;
+
+	for (i = 0; i < 3; i++)
+		if (parse_avp_spec(&names[i], &ids[i]) < 0) {
+			ok(0, "test-avp-index-ids");
+			return;
+		}
+
+	reset_avps();
+
+	/* like push_ds_2_avps(): all the destinations, in reverse order */
+	for (i = AVP_BENCH_DSTS - 1; i >= 0; i--) {
+		val.n = i;
+		if (add_avp(0, ids[0], val) < 0 || add_avp(0, ids[1], val) < 0 ||
+		        add_avp(0, ids[2], val) < 0)
+			bad++;
+	}
+	ok(bad == 0, "test-avp-index-add");
+
+	/* the first lookup walks the list and builds the index */
+	avp = search_first_avp(0, ids[0], &val, NULL);
+	ok(avp && val.n == 0, "test-avp-index-first");
+
+	for (i = 0, bad = 0; i < AVP_BENCH_DSTS; i++)
+		if (!search_index_avp(0, ids[1], &val, i) || val.n != i)
+			bad++;
+	ok(bad == 0 && !search_index_avp(0, ids[1], &val, AVP_BENCH_DSTS),
+		"test-avp-index-idx");
+	ok(count_avps(0, ids[2]) == AVP_BENCH_DSTS, "test-avp-index-count");
+
+	/* the index follows the changes */
+	val.n = -1;
+	add_avp(0, ids[0], val);
+	val.n = AVP_BENCH_DSTS;
+	add_avp_last(0, ids[0], val);
+	ok(count_avps(0, ids[0]) == AVP_BENCH_DSTS + 2 &&
+		search_index_avp(0, ids[0], &val, 0) && val.n == -1 &&
+		search_index_avp(0, ids[0], &val, AVP_BENCH_DSTS + 1) &&
+		val.n == AVP_BENCH_DSTS, "test-avp-index-stack");
+
+	destroy_index_avp(0, ids[0], 0);
+	val.n = 1000;
+	replace_avp(0, ids[0], val, 5);
+	ok(search_first_avp(0, ids[0], &val, NULL) && val.n == 0 &&
+		search_index_avp(0, ids[0], &val, 5) && val.n == 1000 &&
+		search_index_avp(0, ids[0], &val, 6) && val.n == 6 &&
+		count_avps(0, ids[0]) == AVP_BENCH_DSTS + 1, "test-avp-index-change");
+
+	/* walking the list gives the same, in the same order */
+	for (avp = NULL, i = 0, bad = 0;
+	        (avp = search_first_avp(0, ids[2], &val, avp)); i++)
+		if (val.n != i)
+			bad++;
+	ok(bad == 0 && i == AVP_BENCH_DSTS, "test-avp-index-walk");
+
+	ns_idx = bench_avp_lookups(ids);
+
+	/* the same AVPs, in a list which is never indexed */
+	priv = clone_avp_list(*get_avp_list());
+	old = set_avp_list(&priv);
+	ok(count_avps(0, ids[0]) == AVP_BENCH_DSTS + 1, "test-avp-index-clone");
+	ns_list = bench_avp_lookups(ids);
+	destroy_avp_list(&priv);
+	set_avp_list(old);
+
+	diag("AVP lookup by index, %d AVPs: %ld ns indexed, %ld ns in the list",
+		3 * AVP_BENCH_DSTS + 1, ns_idx, ns_list);
+
+	reset_avps();
+	ok(!search_first_avp(0, ids[0], NULL, NULL) &&
+		count_avps(0, ids[0]) == 0, "test-avp-index-reset");
+}
+
+void test_usr_avp(void)
+{
+	test_avp_index();
+}
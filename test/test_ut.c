@@ -18,14 +18,149 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,USA
  */
 
+#include <string.h>
+#include <limits.h>
 #include <tap.h>
 
 #include "../ut.h"
 #include "../str.h"
 #include "../mod_fix.h"
+#include "../route.h"
+
+static struct expr *test_num(int n)
+{
+	return mk_elem(VALUE_OP, NUMBERV_O, (void *)(long)n, 0, 0);
+}
+
+static struct expr *test_str(const char *s)
+{
+	char *p = pkg_malloc(strlen(s) + 1);
+
+	if (!p)
+		return NULL;
+	strcpy(p, s);
+	return mk_elem(VALUE_OP, STRINGV_O, p, 0, 0);
+}
+
+static struct expr *test_op(int op, struct expr *l, struct expr *r)
+{
+	return mk_elem(op, EXPR_O, l, r ? EXPR_ST : 0, r);
+}
+
+static void test_free_expr(struct expr *e)
+{
+	if (!e)
+		return;
+
+	if (e->left.type == EXPR_O)
+		test_free_expr(e->left.v.expr);
+	else if (e->left.type == STRINGV_O)
+		pkg_free(e->left.v.s.s);
+	if (e->right.type == EXPR_ST)
+		test_free_expr(e->right.v.expr);
+	pkg_free(e);
+}
+
+/* folds the (twice built) @e, checking it against its runtime evaluation */
+static void test_fold(struct expr *e, struct expr *ref, int foldable,
+		const char *name)
+{
+	pv_value_t val;
+	int folded, same = 1;
+
+	if (!e || !ref) {
+		ok(0, "%s-oom", name);
+		goto out;
+	}
+
+	folded = fix_expr(e) == 0 && e->op == VALUE_OP;
+	if (folded && foldable) {
+		eval_expr(ref, NULL, &val);
+		if (e->left.type == NUMBERV_O)
+			same = (val.flags & PV_VAL_INT) && val.ri == e->left.v.n;
+		else
+			same = (val.flags & PV_VAL_STR) &&
+				val.rs.len == e->left.v.s.len &&
+				!memcmp(val.rs.s, e->left.v.s.s, val.rs.len);
+		pv_value_destroy(&val);
+	}
+	ok(folded == foldable && same, "%s", name);
+
+out:
+	test_free_expr(e);
+	test_free_expr(ref);
+}
+
+/* the arithmetic over constants is evaluated at fixup time */
+static void test_expr_folding(void)
+{
+	int i;
+	struct expr *e[2];
+
+#define test_fold_case(_build, _foldable, _name) \
+	do { \
+		for (i = 0; i < 2; i++) \
+			e[i] = _build; \
+		test_fold(e[0], e[1], _foldable, _name); \
+	} while (0)
+
+	test_fold_case(test_op(MINUS_OP, test_op(PLUS_OP,
+		test_op(MULT_OP, test_num(24), test_num(3600)), test_num(1)),
+		test_num(5)), 1, "test-fold-int-arith");
+	test_fold_case(test_op(BAND_OP, test_op(BNOT_OP, test_num(0), NULL),
+		test_num(255)), 1, "test-fold-int-bnot");
+	test_fold_case(test_op(BOR_OP, test_op(BLSHIFT_OP, test_num(1),
+		test_num(4)), test_op(MODULO_OP, test_num(-7), test_num(4))), 1,
+		"test-fold-int-bits");
+	test_fold_case(test_op(PLUS_OP, test_op(PLUS_OP, test_str("sip:"),
+		test_str("alice")), test_str("@atlanta.example.com")), 1,
+		"test-fold-str-concat");
+
+	/* left for the runtime */
+	test_fold_case(test_op(PLUS_OP, test_num(5), test_str("x")), 0,
+		"test-fold-mixed");
+	test_fold_case(test_op(PLUS_OP, test_str("x"), test_num(5)), 0,
+		"test-fold-mixed-str");
+	test_fold_case(test_op(DIV_OP, test_num(7), test_num(0)), 0,
+		"test-fold-div-zero");
+	test_fold_case(test_op(BLSHIFT_OP, test_num(1), test_num(40)), 0,
+		"test-fold-shift-width");
+	test_fold_case(test_op(PLUS_OP, test_str(""), test_str("")), 0,
+		"test-fold-str-empty");
+
+	/* overflowing the int (undefined, or SIGFPE for INT_MIN / -1) */
+	test_fold_case(test_op(PLUS_OP, test_num(INT_MAX), test_num(1)), 0,
+		"test-fold-overflow-add");
+	test_fold_case(test_op(MINUS_OP, test_num(INT_MIN), test_num(1)), 0,
+		"test-fold-overflow-sub");
+	test_fold_case(test_op(MULT_OP, test_num(INT_MAX / 2), test_num(3)), 0,
+		"test-fold-overflow-mult");
+	test_fold_case(test_op(DIV_OP, test_num(INT_MIN), test_num(-1)), 0,
+		"test-fold-overflow-div");
+	test_fold_case(test_op(MODULO_OP, test_num(INT_MIN), test_num(-1)), 0,
+		"test-fold-overflow-mod");
+	test_fold_case(test_op(BLSHIFT_OP, test_num(INT_MAX), test_num(1)), 0,
+		"test-fold-overflow-shift");
+	test_fold_case(test_op(BLSHIFT_OP, test_num(-1), test_num(1)), 0,
+		"test-fold-shift-negative");
+
+	/* right at the limits, still folded */
+	test_fold_case(test_op(PLUS_OP, test_num(INT_MAX - 1), test_num(1)), 1,
+		"test-fold-limit-add");
+	test_fold_case(test_op(MINUS_OP, test_num(INT_MIN + 1), test_num(1)), 1,
+		"test-fold-limit-sub");
+	test_fold_case(test_op(DIV_OP, test_num(INT_MIN + 1), test_num(-1)), 1,
+		"test-fold-limit-div");
+	test_fold_case(test_op(BLSHIFT_OP, test_num(1), test_num(30)), 1,
+		"test-fold-limit-shift");
+
+#undef test_fold_case
+}
 
 void test_ut(void)
 {
+	test_expr_folding();
+
 	ok(is_e164(_str("")) == -1, "test-e164-0");
 	ok(is_e164(_str("+")) == -1, "test-e164-1");
 	ok(is_e164(_str("+1")) == -1, "test-e164-2");
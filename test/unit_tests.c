@@ -27,8 +27,16 @@
 #include "../lib/test/test_csv.h"
 #include "../lib/test/test_digest_auth.h"
 #include "../parser/test/test_parser.h"
+#include "../parser/test/test_parse_hname.h"
 #include "../mem/test/test_malloc.h"
+#include "../net/test/test_tcp_accept.h"
+#include "../net/test/test_tcp_write.h"
 #include "test_ut.h"
+#include "test_msg_translator.h"
+#include "test_log_ring.h"
+#include "test_statistics.h"
+#include "test_usr_avp.h"
+#include "script_bench.h"
 
 #include "../str.h"
 #include "../lib/list.h"
@@ -63,12 +71,30 @@ int run_unit_tests(void)
 		/* remember to update the Makefile.test OpenSIPS command-line with at
 		 * least "-m2048 -M128" before stress-testing any of the allocators! */
 		//test_malloc();
+		test_shm_cache();
 		test_cachedb();
 		test_lib_csv();
 		test_parser();
 		test_ut();
+		test_statistics();
+		test_usr_avp();
+		test_msg_translator();
+		test_log_ring();
 		test_lib_digest_auth();
 		test_db();
+		test_tcp_accept();
+		test_tcp_write();
+		/* forks and connects 8000 times, only for measuring the accept
+		 * rate of the two TCP dispatching modes */
+		//bench_tcp_accept();
+		/* A/B of the two message builders, 100k rebuilds each */
+		//bench_msg_translator();
+		/* 200k parses of each unknown header name */
+		//bench_parse_hname();
+
+	/* script benchmark */
+	} else if (!strcmp(testing_module, "script")) {
+		test_script_bench();
 
 	/* module tests */
 	} else {
@@ -20,6 +20,8 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <time.h>
+
 #include "../dprint.h"
 #include "../parser/msg_parser.h"
 
@@ -67,3 +69,12 @@ int mk_sip_req(const char *method, const char *ruri, struct sip_msg *msg)
 
 	return 0;
 }
+
+
+long ut_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
@@ -38,4 +38,9 @@
  */
 int mk_sip_req(const char *method, const char *ruri, struct sip_msg *msg);
 
+/**
+ * ut_now_ns - the monotonic clock, in nanoseconds, for timing the benchmarks
+ */
+long ut_now_ns(void);
+
 #endif /* __TEST_UT_H__ */
@@ -58,6 +58,44 @@ static int *last_avp_index_shm = 0;
 #define p2int(_p) (int)(unsigned long)(_p)
 #define int2p(_i) (void *)(unsigned long)(_i)
 
+/*
+ * Lookup index of the message's AVPs (the global list, which only this
+ * process works with): for each id, its AVPs, in reverse list order (the
+ * most recently added one last), so the stacking by add_avp() is an append.
+ * It is only built when searching a list longer than AVP_IDX_MIN_WALK,
+ * kept up to date by the add/replace/destroy functions and dropped by any
+ * other change (a new head or generation of the list).
+ * The transaction/dialog lists may be changed by other processes, so they
+ * are always searched linearly.
+ */
+#define AVP_IDX_MIN_WALK  16
+#define AVP_IDX_MIN_SIZE  16
+
+struct avp_idx_ent {
+	int id;                  /* -1 if the slot is free */
+	int n;
+	int size;
+	struct usr_avp **avps;   /* kept allocated across the messages */
+};
+
+static struct avp_idx {
+	struct avp_idx_ent *ents;
+	int size;                /* power of 2 */
+	int used;
+	int valid;
+	struct usr_avp *head;    /* head of the list, as indexed */
+	unsigned int gen;
+} avp_idx;
+
+/* bumped by any change of the AVP lists */
+static unsigned int avp_gen;
+
+#define avp_idx_ok() \
+	(avp_idx.valid && crt_avps==&global_avps && \
+		*crt_avps==avp_idx.head && avp_idx.gen==avp_gen)
+
+#define avp_idx_hash(_id) (((unsigned int)(_id) * 2654435761U))
+
 int init_global_avps(void)
 {
 	/* initialize map for static avps */
@@ -97,6 +135,212 @@ int init_extra_avps(void)
 }
 
 
+
+static struct avp_idx_ent *avp_idx_get(int id, int create)
+{
+	struct avp_idx_ent *e, *old;
+	int i, old_size;
+
+	if (avp_idx.size) {
+		for (i = avp_idx_hash(id) & (avp_idx.size - 1); ;
+		        i = (i + 1) & (avp_idx.size - 1)) {
+			e = &avp_idx.ents[i];
+			if (e->id == id)
+				return e;
+			if (e->id == -1)
+				break;
+		}
+
+		if (!create)
+			return NULL;
+
+		if (2 * (avp_idx.used + 1) <= avp_idx.size) {
+			avp_idx.used++;
+			e->id = id;
+			e->n = 0;
+			return e;
+		}
+	} else if (!create) {
+		return NULL;
+	}
+
+	/* grow, rehashing the ids; the vectors of the free slots go away */
+	old = avp_idx.ents;
+	old_size = avp_idx.size;
+
+	avp_idx.size = old_size ? 2 * old_size : AVP_IDX_MIN_SIZE;
+	avp_idx.ents = pkg_malloc(avp_idx.size * sizeof *avp_idx.ents);
+	if (!avp_idx.ents) {
+		LM_ERR("oom for the AVP index\n");
+		avp_idx.ents = old;
+		avp_idx.size = old_size;
+		return NULL;
+	}
+	memset(avp_idx.ents, 0, avp_idx.size * sizeof *avp_idx.ents);
+	for (i = 0; i < avp_idx.size; i++)
+		avp_idx.ents[i].id = -1;
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i].id == -1) {
+			if (old[i].avps)
+				pkg_free(old[i].avps);
+			continue;
+		}
+		for (e = &avp_idx.ents[avp_idx_hash(old[i].id) & (avp_idx.size-1)];
+		        e->id != -1;
+		        e = (e == &avp_idx.ents[avp_idx.size - 1]) ? avp_idx.ents : e+1)
+			;
+		*e = old[i];
+	}
+	if (old)
+		pkg_free(old);
+
+	return avp_idx_get(id, create);
+}
+
+
+static int avp_idx_append(struct usr_avp *avp)
+{
+	struct avp_idx_ent *e;
+	struct usr_avp **avps;
+	int size;
+
+	e = avp_idx_get(avp->id, 1);
+	if (!e)
+		return -1;
+
+	if (e->n == e->size) {
+		size = e->size ? 2 * e->size : 4;
+		avps = pkg_realloc(e->avps, size * sizeof *avps);
+		if (!avps) {
+			LM_ERR("oom for the AVP index\n");
+			return -1;
+		}
+		e->avps = avps;
+		e->size = size;
+	}
+
+	e->avps[e->n++] = avp;
+	return 0;
+}
+
+
+static void avp_idx_clear(void)
+{
+	int i;
+
+	for (i = 0; i < avp_idx.size; i++) {
+		avp_idx.ents[i].id = -1;
+		avp_idx.ents[i].n = 0;
+	}
+	avp_idx.used = 0;
+	avp_idx.valid = 0;
+}
+
+
+static void avp_idx_build(void)
+{
+	struct usr_avp *avp, **stack = NULL;
+	int n, i;
+
+	avp_idx_clear();
+
+	/* the vectors are in reverse list order */
+	for (n = 0, avp = *crt_avps; avp; avp = avp->next)
+		n++;
+	stack = pkg_malloc(n * sizeof *stack);
+	if (!stack) {
+		LM_ERR("oom for the AVP index\n");
+		return;
+	}
+	for (i = 0, avp = *crt_avps; avp; avp = avp->next)
+		stack[i++] = avp;
+
+	for (i = n - 1; i >= 0; i--)
+		if (avp_idx_append(stack[i]) < 0)
+			goto out;
+
+	avp_idx.head = *crt_avps;
+	avp_idx.gen = avp_gen;
+	avp_idx.valid = 1;
+out:
+	pkg_free(stack);
+}
+
+
+/* whether a search (by @flags) may be answered by the index - which is
+ * built on the way, if the list of the message is long enough */
+static inline int avp_idx_use(unsigned short flags)
+{
+	struct usr_avp *avp;
+	int n;
+
+	if (flags&AVP_SCRIPT_MASK)
+		return 0;
+	if (avp_idx_ok())
+		return 1;
+	if (crt_avps!=&global_avps)
+		return 0;
+
+	for (n = 0, avp = *crt_avps; avp && n <= AVP_IDX_MIN_WALK; avp = avp->next)
+		n++;
+	if (n <= AVP_IDX_MIN_WALK)
+		return 0;
+
+	avp_idx_build();
+	return avp_idx_ok();
+}
+
+
+/* the vector slot of an indexed AVP */
+static struct usr_avp **avp_idx_slot(struct usr_avp *avp,
+		struct avp_idx_ent **ent)
+{
+	struct avp_idx_ent *e;
+	int i;
+
+	e = avp_idx_get(avp->id, 0);
+	if (!e)
+		return NULL;
+
+	/* the recent ones are looked up (and changed) the most */
+	for (i = e->n - 1; i >= 0; i--)
+		if (e->avps[i] == avp) {
+			*ent = e;
+			return &e->avps[i];
+		}
+
+	return NULL;
+}
+
+
+/* to be called after linking a new AVP: updates the index or drops it */
+static inline void avp_idx_added(struct usr_avp *avp, int was_ok, int last)
+{
+	struct avp_idx_ent *e;
+
+	if (!was_ok)
+		return;
+
+	if (last) {
+		/* the oldest one of its id - first in the vector */
+		if (avp_idx_append(avp) < 0)
+			goto drop;
+		e = avp_idx_get(avp->id, 0);
+		memmove(e->avps + 1, e->avps, (e->n - 1) * sizeof *e->avps);
+		e->avps[0] = avp;
+	} else if (avp_idx_append(avp) < 0) {
+		goto drop;
+	}
+
+	avp_idx.head = *crt_avps;
+	avp_idx.gen = avp_gen;
+	return;
+drop:
+	avp_idx.valid = 0;
+}
+
+
 struct usr_avp* new_avp(unsigned short flags, int id, int_str val)
 {
 	struct usr_avp *avp;
@@ -123,6 +367,7 @@ struct usr_avp* new_avp(unsigned short flags, int id, int_str val)
 
 	avp->flags = flags;
 	avp->id = id ;
+	avp_gen++;
 
 	if (flags & AVP_VAL_STR) {
 		/* avp type ID, str value */
@@ -145,6 +390,7 @@ error:
 int add_avp(unsigned short flags, int name, int_str val)
 {
 	struct usr_avp* avp;
+	int idx_ok = avp_idx_ok();
 
 	avp = new_avp(flags, name, val);
 	if(avp == NULL) {
@@ -154,6 +400,7 @@ int add_avp(unsigned short flags, int name, int_str val)
 
 	avp->next = *crt_avps;
 	*crt_avps = avp;
+	avp_idx_added(avp, idx_ok, 0);
 	return 0;
 }
 
@@ -161,6 +408,7 @@ int add_avp_last(unsigned short flags, int name, int_str val)
 {
 	struct usr_avp* avp;
 	struct usr_avp* last_avp;
+	int idx_ok = avp_idx_ok();
 
 	avp = new_avp(flags, name, val);
 	if(avp == NULL) {
@@ -179,6 +427,7 @@ int add_avp_last(unsigned short flags, int name, int_str val)
 		avp->next = NULL;
 		last_avp = avp;
 	}
+	avp_idx_added(avp, idx_ok, 1);
 	return 0;
 }
 
@@ -186,6 +435,17 @@ struct usr_avp *search_index_avp(unsigned short flags,
 					int name, int_str *val, unsigned int index)
 {
 	struct usr_avp *avp = NULL;
+	struct avp_idx_ent *e;
+
+	if (avp_idx_use(flags)) {
+		e = avp_idx_get(name, 0);
+		if (!e || index >= e->n)
+			return 0;
+		avp = e->avps[e->n - 1 - index];
+		if (val)
+			get_avp_val(avp, val);
+		return avp;
+	}
 
 	while ( (avp=search_first_avp( flags, name, val, avp))!=0 ) {
 		if( index == 0 ){
@@ -200,6 +460,9 @@ int replace_avp(unsigned short flags, int name, int_str val, int index)
 {
 	struct usr_avp* avp, *avp_prev;
 	struct usr_avp* avp_new, *avp_del;
+	struct usr_avp **slot;
+	struct avp_idx_ent *e;
+	int idx_ok;
 
 	if(index < 0) {
 		/* convert negative index to 0+ */
@@ -218,6 +481,7 @@ int replace_avp(unsigned short flags, int name, int_str val, int index)
 		return -1;
 	}
 
+	idx_ok = avp_idx_ok();
 	avp_new = new_avp(flags, name, val);
 	if(avp_new == NULL) {
 		LM_ERR("Failed to create new avp structure\n");
@@ -231,6 +495,13 @@ int replace_avp(unsigned short flags, int name, int_str val, int index)
 			else
 				*crt_avps = avp_new;
 			avp_new->next = avp_del->next;
+			avp_gen++;
+			/* same id, same position */
+			if (idx_ok && (slot = avp_idx_slot(avp_del, &e))) {
+				*slot = avp_new;
+				avp_idx.head = *crt_avps;
+				avp_idx.gen = avp_gen;
+			}
 			shm_free(avp_del);
 			return 0;
 		}
@@ -337,6 +608,7 @@ struct usr_avp *search_first_avp( unsigned short flags,
 {
 	struct usr_avp *head;
 	struct usr_avp *avp;
+	struct avp_idx_ent *e;
 
 	if (id < 0) {
 		LM_ERR("invalid avp id %d\n", id);
@@ -350,6 +622,12 @@ struct usr_avp *search_first_avp( unsigned short flags,
 		if (*crt_avps==0)
 			return 0;
 		head = *crt_avps;
+
+		if (avp_idx_use(flags)) {
+			e = avp_idx_get(id, 0);
+			avp = (e && e->n) ? e->avps[e->n - 1] : NULL;
+			goto found;
+		}
 	} else {
 		if(start->next==0)
 			return 0;
@@ -359,6 +637,8 @@ struct usr_avp *search_first_avp( unsigned short flags,
 	/* search for the AVP by ID (&name) */
 	avp = internal_search_ID_avp(head, id, flags&AVP_SCRIPT_MASK);
 
+found:
+
 	/* get the value - if required */
 	if (avp && val)
 		get_avp_val(avp, val);
@@ -390,6 +670,9 @@ void destroy_avp( struct usr_avp *avp_del)
 {
 	struct usr_avp *avp;
 	struct usr_avp *avp_prev;
+	struct usr_avp **slot;
+	struct avp_idx_ent *e;
+	int idx_ok = avp_idx_ok();
 
 	for( avp_prev=0,avp=*crt_avps ; avp ; avp_prev=avp,avp=avp->next ) {
 		if (avp==avp_del) {
@@ -397,6 +680,13 @@ void destroy_avp( struct usr_avp *avp_del)
 				avp_prev->next=avp->next;
 			else
 				*crt_avps = avp->next;
+			avp_gen++;
+			if (idx_ok && (slot = avp_idx_slot(avp_del, &e))) {
+				memmove(slot, slot + 1,
+					(e->avps + --e->n - slot) * sizeof *slot);
+				avp_idx.head = *crt_avps;
+				avp_idx.gen = avp_gen;
+			}
 			shm_free(avp);
 			return;
 		}
@@ -445,8 +735,14 @@ void destroy_index_avp( unsigned short flags, int name, int index)
 int count_avps(unsigned short flags, int name)
 {
 	struct usr_avp *avp = NULL;
+	struct avp_idx_ent *e;
 	int n = 0;
 
+	if (avp_idx_use(flags)) {
+		e = avp_idx_get(name, 0);
+		return e ? e->n : 0;
+	}
+
 	while ((avp=search_first_avp(flags, name, 0, avp)))
 		n++;
 
@@ -464,6 +760,7 @@ void destroy_avp_list_bulk( struct usr_avp **list )
 		shm_free_bulk( foo );
 	}
 	*list = 0;
+	avp_gen++;
 }
 
 
@@ -478,6 +775,7 @@ void destroy_avp_list_unsafe( struct usr_avp **list )
 		shm_free_unsafe( foo );
 	}
 	*list = 0;
+	avp_gen++;
 }
 
 
@@ -493,6 +791,7 @@ inline void destroy_avp_list( struct usr_avp **list )
 		shm_free( foo );
 	}
 	*list = 0;
+	avp_gen++;
 }
 
 
@@ -626,21 +925,25 @@ int get_avp_id(str *name)
 
 struct usr_avp *clone_avp_list(struct usr_avp *old)
 {
-	struct usr_avp *a;
+	struct usr_avp *a, *head = NULL, **last = &head;
 	int_str val;
 
-	if (!old) return NULL;
+	/* iterative, as the branch-heavy lists may be hundreds long */
+	for ( ; old ; old = old->next) {
+		/* create a copy of the old AVP */
+		get_avp_val( old, &val );
+		a = new_avp( old->flags, old->id, val);
+		if (a==NULL) {
+			LM_ERR("cloning failed, trunking the list\n");
+			break;
+		}
 
-	/* create a copy of the old AVP */
-	get_avp_val( old, &val );
-	a = new_avp( old->flags, old->id, val);
-	if (a==NULL) {
-		LM_ERR("cloning failed, trunking the list\n");
-		return NULL;
+		*last = a;
+		last = &a->next;
 	}
 
-	a->next = clone_avp_list(old->next);
-	return a;
+	*last = NULL;
+	return head;
 }
 
 